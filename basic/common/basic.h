@@ -0,0 +1,148 @@
+#ifndef BASIC_COMMON_H
+#define BASIC_COMMON_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <infiniband/verbs.h>
+
+/* Helpers of the single-node tests: Timing, device lookup, buffers, loopback QPs */
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The first device if @dev_name is NULL */
+static inline struct ibv_device *find_device(struct ibv_device **dev_list,
+					     const char *dev_name)
+{
+	int i;
+
+	if (!dev_name)
+		return dev_list[0];
+
+	for (i = 0; dev_list[i] != NULL; i++) {
+		if (strcmp(dev_name, ibv_get_device_name(dev_list[i])) == 0)
+			return dev_list[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * malloc() and ibv_reg_mr() as reg_mr_test does; The buffer is filled with
+ * @fill first, so all pages are touched before the registration. Returns
+ * NULL with errno set on failure.
+ */
+static inline char *alloc_reg_buf(struct ibv_pd *pd, size_t len, int access,
+				  int fill, struct ibv_mr **mr)
+{
+	char *buf;
+
+	buf = malloc(len);
+	if (!buf) {
+		perror("malloc");
+		return NULL;
+	}
+	memset(buf, fill, len);
+
+	*mr = ibv_reg_mr(pd, buf, len, access);
+	if (!*mr) {
+		perror("ibv_reg_mr");
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/* Takes @qp from RESET to RTS, connected to itself */
+static inline int connect_loopback_qp(struct ibv_context *ibctx, struct ibv_qp *qp,
+				      unsigned int ib_port, int gid_index,
+				      int access, uint8_t min_rnr_timer)
+{
+	struct ibv_port_attr port_attr = {};
+	struct ibv_qp_attr attr = {};
+	union ibv_gid gid = {};
+	int ret;
+
+	ret = ibv_query_port(ibctx, ib_port, &port_attr);
+	if (ret) {
+		perror("ibv_query_port");
+		return ret;
+	}
+
+	ret = ibv_query_gid(ibctx, ib_port, gid_index, &gid);
+	if (ret) {
+		perror("ibv_query_gid");
+		return ret;
+	}
+
+	attr.qp_state = IBV_QPS_INIT;
+	attr.pkey_index = 0;
+	attr.port_num = ib_port;
+	attr.qp_access_flags = access;
+	ret = ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX |
+			    IBV_QP_PORT | IBV_QP_ACCESS_FLAGS);
+	if (ret) {
+		perror("ibv_modify_qp(INIT)");
+		return ret;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.qp_state = IBV_QPS_RTR;
+	attr.path_mtu = port_attr.active_mtu;
+	attr.dest_qp_num = qp->qp_num;
+	attr.rq_psn = 0;
+	attr.max_dest_rd_atomic = 1;
+	attr.min_rnr_timer = min_rnr_timer;
+	attr.ah_attr.port_num = ib_port;
+	attr.ah_attr.dlid = port_attr.lid;
+	if (port_attr.link_layer == IBV_LINK_LAYER_ETHERNET) {
+		attr.ah_attr.is_global = 1;
+		attr.ah_attr.grh.dgid = gid;
+		attr.ah_attr.grh.sgid_index = gid_index;
+		attr.ah_attr.grh.hop_limit = 1;
+	}
+	ret = ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
+			    IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+			    IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER);
+	if (ret) {
+		perror("ibv_modify_qp(RTR)");
+		return ret;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.qp_state = IBV_QPS_RTS;
+	attr.timeout = 14;
+	attr.retry_cnt = 7;
+	attr.rnr_retry = 7;
+	attr.sq_psn = 0;
+	attr.max_rd_atomic = 1;
+	ret = ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT |
+			    IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY |
+			    IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC);
+	if (ret) {
+		perror("ibv_modify_qp(RTS)");
+		return ret;
+	}
+
+	return 0;
+}
+
+#endif
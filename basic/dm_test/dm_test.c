@@ -0,0 +1,450 @@
+/*
+ * Device memory test: Allocate on-device memory with ibv_alloc_dm(), register
+ * it with ibv_reg_dm_mr(), then compare it with host memory for:
+ *   - host <-> buffer copy throughput (ibv_memcpy_to/from_dm() vs. memcpy());
+ *   - RDMA WRITE/READ latency of small messages on a loopback RC QP, with the
+ *     buffer as the remote target.
+ * The test is skipped if the device doesn't have device memory.
+ *
+ * gcc -Wall -o dm_test dm_test.c -libverbs
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <infiniband/verbs.h>
+
+#include "../common/basic.h"
+
+#define info(args...) fprintf(stdout, ##args)
+#define err(args...) fprintf(stderr, ##args)
+
+#define dump(args...) fprintf(stdout, ##args)
+
+#define DM_TEST_MIN_SIZE 8
+
+static const char *dev_name;
+static unsigned int iters = 10000;
+static unsigned int max_msg_size = 4096;
+static unsigned int ib_port = 1;
+static int gid_index;
+
+static struct ibv_context *ibctx;
+static struct ibv_pd *pd;
+static struct ibv_cq *cq;
+static struct ibv_qp *qp;
+
+static struct ibv_dm *dm;
+static struct ibv_mr *dm_mr;
+static size_t dm_len;
+
+/* Local buffer, used as the source/destination of all copies and RDMA ops */
+static char *lbuf;
+static struct ibv_mr *lmr;
+
+/* Host memory target, compared with device memory */
+static char *hbuf;
+static struct ibv_mr *hmr;
+
+static void show_usage(char *prog)
+{
+	printf("Usage: %s [OPTION]\n", prog);
+	printf("  [-d, --device] <ib_device>  - IB device (the first one by default)\n");
+	printf("  [-p, --ib-port] <port>      - IB port (1 by default)\n");
+	printf("  [-g, --gid-index] <index>   - GID index, for RoCE (0 by default)\n");
+	printf("  [-n, --iters] <num>         - Iterations for each message size (%d by default)\n", iters);
+	printf("  [-s, --max-size] <bytes>    - Maximum message size (%d by default)\n", max_msg_size);
+	printf("  [-h, --help]                - Show help\n");
+}
+
+static int parse_opt(int argc, char *argv[])
+{
+	static const struct option long_opts[] = {
+		{"help", 0, NULL, 'h'},
+		{"device", 1, NULL, 'd'},
+		{"ib-port", 1, NULL, 'p'},
+		{"gid-index", 1, NULL, 'g'},
+		{"iters", 1, NULL, 'n'},
+		{"max-size", 1, NULL, 's'},
+		{},
+	};
+	int op;
+
+	while ((op = getopt_long(argc, argv, "hd:p:g:n:s:", long_opts, NULL)) != -1) {
+		switch (op) {
+		case 'h':
+			show_usage(argv[0]);
+			exit(0);
+
+		case 'd':
+			dev_name = optarg;
+			break;
+
+		case 'p':
+			ib_port = atoi(optarg);
+			break;
+
+		case 'g':
+			gid_index = atoi(optarg);
+			break;
+
+		case 'n':
+			iters = atoi(optarg);
+			break;
+
+		case 's':
+			max_msg_size = atoi(optarg);
+			break;
+
+		default:
+			err("Unknown option %c\n", op);
+			show_usage(argv[0]);
+			return EINVAL;
+		}
+	}
+
+	if (!iters || max_msg_size < DM_TEST_MIN_SIZE) {
+		err("Invalid iters %d or max-size %d\n", iters, max_msg_size);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static int poll_completion(void)
+{
+	struct ibv_wc wc;
+	int n;
+
+	do {
+		n = ibv_poll_cq(cq, 1, &wc);
+	} while (n == 0);
+
+	if (n < 0) {
+		err("ibv_poll_cq failed %d\n", n);
+		return n;
+	}
+
+	if (wc.status != IBV_WC_SUCCESS) {
+		err("CQE status %d(%s), opcode %d\n", wc.status,
+		    ibv_wc_status_str(wc.status), wc.opcode);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int create_loopback_qp(void)
+{
+	struct ibv_qp_init_attr init_attr = {};
+
+	init_attr.qp_type = IBV_QPT_RC;
+	init_attr.send_cq = cq;
+	init_attr.recv_cq = cq;
+	init_attr.cap.max_send_wr = 32;
+	init_attr.cap.max_recv_wr = 1;
+	init_attr.cap.max_send_sge = 1;
+	init_attr.cap.max_recv_sge = 1;
+
+	qp = ibv_create_qp(pd, &init_attr);
+	if (!qp) {
+		perror("ibv_create_qp");
+		return errno;
+	}
+
+	return connect_loopback_qp(ibctx, qp, ib_port, gid_index,
+				   IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+				   IBV_ACCESS_REMOTE_WRITE, 12);
+}
+
+/* Returns 0 if DM is allocated, ENOTSUP if the device doesn't have DM */
+static int alloc_dm(void)
+{
+	struct ibv_device_attr_ex attr_ex = {};
+	struct ibv_alloc_dm_attr dm_attr = {};
+	int ret;
+
+	ret = ibv_query_device_ex(ibctx, NULL, &attr_ex);
+	if (ret) {
+		err("ibv_query_device_ex failed %d\n", ret);
+		return ret;
+	}
+
+	info("Device max_dm_size %ld\n", attr_ex.max_dm_size);
+	if (!attr_ex.max_dm_size)
+		return ENOTSUP;
+
+	dm_len = max_msg_size;
+	if (dm_len > attr_ex.max_dm_size) {
+		dm_len = attr_ex.max_dm_size;
+		max_msg_size = dm_len;
+		info("Max message size is limited to %d\n", max_msg_size);
+	}
+
+	dm_attr.length = dm_len;
+	dm = ibv_alloc_dm(ibctx, &dm_attr);
+	if (!dm) {
+		perror("ibv_alloc_dm");
+		if (errno == EOPNOTSUPP || errno == ENOSYS)
+			return ENOTSUP;
+		return errno;
+	}
+
+	/* DM MR must be zero-based, so the remote address is the DM offset */
+	dm_mr = ibv_reg_dm_mr(pd, dm, 0, dm_len, IBV_ACCESS_ZERO_BASED |
+			      IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+			      IBV_ACCESS_REMOTE_WRITE);
+	if (!dm_mr) {
+		perror("ibv_reg_dm_mr");
+		return errno;
+	}
+
+	return 0;
+}
+
+static int setup(void)
+{
+	int flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+		IBV_ACCESS_REMOTE_WRITE;
+	struct ibv_device **dev_list;
+	struct ibv_device *ibdev;
+	int ret;
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list) {
+		perror("ibv_get_device_list()");
+		return errno;
+	}
+
+	ibdev = find_device(dev_list, dev_name);
+	if (!ibdev) {
+		err("Device not found %s\n", dev_name ? dev_name : "");
+		ibv_free_device_list(dev_list);
+		return ENODEV;
+	}
+
+	ibctx = ibv_open_device(ibdev);
+	ibv_free_device_list(dev_list);
+	if (!ibctx) {
+		perror("ibv_open_device");
+		return errno;
+	}
+	info("Doing test on ibdev %s\n", ibctx->device->name);
+
+	pd = ibv_alloc_pd(ibctx);
+	if (!pd) {
+		perror("ibv_alloc_pd");
+		return errno;
+	}
+
+	ret = alloc_dm();
+	if (ret)
+		return ret;
+
+	lbuf = alloc_reg_buf(pd, dm_len, flags, 0x5a, &lmr);
+	if (!lbuf)
+		return errno;
+
+	hbuf = alloc_reg_buf(pd, dm_len, flags, 0, &hmr);
+	if (!hbuf)
+		return errno;
+
+	cq = ibv_create_cq(ibctx, 32, NULL, NULL, 0);
+	if (!cq) {
+		perror("ibv_create_cq");
+		return errno;
+	}
+
+	return create_loopback_qp();
+}
+
+static void cleanup(void)
+{
+	if (qp)
+		ibv_destroy_qp(qp);
+	if (cq)
+		ibv_destroy_cq(cq);
+	if (hmr)
+		ibv_dereg_mr(hmr);
+	if (lmr)
+		ibv_dereg_mr(lmr);
+	free(hbuf);
+	free(lbuf);
+	if (dm_mr)
+		ibv_dereg_mr(dm_mr);
+	if (dm)
+		ibv_free_dm(dm);
+	if (pd)
+		ibv_dealloc_pd(pd);
+	if (ibctx)
+		ibv_close_device(ibctx);
+}
+
+/* Returns the throughput in MB/s, or a negative value on failure */
+static double test_copy(int to_dm, int use_dm, unsigned int size)
+{
+	uint64_t t0, tm;
+	int i, ret;
+
+	t0 = get_time_ns();
+	for (i = 0; i < iters; i++) {
+		if (use_dm) {
+			if (to_dm)
+				ret = ibv_memcpy_to_dm(dm, 0, lbuf, size);
+			else
+				ret = ibv_memcpy_from_dm(lbuf, dm, 0, size);
+			if (ret) {
+				err("ibv_memcpy_%s_dm failed %d\n", to_dm ? "to" : "from", ret);
+				return -1;
+			}
+		} else {
+			if (to_dm)
+				memcpy(hbuf, lbuf, size);
+			else
+				memcpy(lbuf, hbuf, size);
+			/* Don't let the compiler drop the copy */
+			__asm__ __volatile__("" : : "r"(hbuf), "r"(lbuf) : "memory");
+		}
+	}
+	tm = get_time_ns() - t0;
+
+	return (double)size * iters * 1000 / (tm ? tm : 1);
+}
+
+/* Fills @samples with the latency of each signaled RDMA op, in ns */
+static int test_rdma_lat(enum ibv_wr_opcode opcode, struct ibv_mr *rmr,
+			 uint64_t raddr, unsigned int size, uint64_t *samples)
+{
+	struct ibv_sge sge = {
+		.addr = (uintptr_t)lbuf,
+		.length = size,
+		.lkey = lmr->lkey,
+	};
+	struct ibv_send_wr wr = {
+		.sg_list = &sge,
+		.num_sge = 1,
+		.opcode = opcode,
+		.send_flags = IBV_SEND_SIGNALED,
+		.wr.rdma.remote_addr = raddr,
+		.wr.rdma.rkey = rmr->rkey,
+	}, *bad_wr;
+	uint64_t t0;
+	int i, ret;
+
+	for (i = 0; i < iters; i++) {
+		t0 = get_time_ns();
+		ret = ibv_post_send(qp, &wr, &bad_wr);
+		if (ret) {
+			perror("ibv_post_send");
+			return ret;
+		}
+
+		ret = poll_completion();
+		if (ret)
+			return ret;
+		samples[i] = get_time_ns() - t0;
+	}
+
+	qsort(samples, iters, sizeof(*samples), cmp_u64);
+	return 0;
+}
+
+static int run_copy_test(void)
+{
+	double dm_to, dm_from, host_to, host_from;
+	unsigned int size;
+
+	dump("\nCopy throughput (MB/s):\n");
+	dump("  %8s %12s %12s %12s %12s\n", "size", "to_dm", "memcpy_to",
+	     "from_dm", "memcpy_from");
+	for (size = DM_TEST_MIN_SIZE; size <= max_msg_size; size *= 2) {
+		dm_to = test_copy(1, 1, size);
+		dm_from = test_copy(0, 1, size);
+		host_to = test_copy(1, 0, size);
+		host_from = test_copy(0, 0, size);
+		if (dm_to < 0 || dm_from < 0)
+			return -1;
+
+		dump("  %8d %12.1f %12.1f %12.1f %12.1f\n", size,
+		     dm_to, host_to, dm_from, host_from);
+	}
+
+	return 0;
+}
+
+static int run_rdma_test(void)
+{
+	struct {
+		const char *name;
+		enum ibv_wr_opcode opcode;
+	} ops[] = {
+		{ "RDMA_WRITE", IBV_WR_RDMA_WRITE },
+		{ "RDMA_READ", IBV_WR_RDMA_READ },
+	};
+	uint64_t *dm_lat, *host_lat;
+	unsigned int size;
+	int i, ret = 0;
+
+	dm_lat = calloc(iters, sizeof(*dm_lat));
+	host_lat = calloc(iters, sizeof(*host_lat));
+	if (!dm_lat || !host_lat) {
+		perror("calloc");
+		ret = errno;
+		goto out;
+	}
+
+	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+		dump("\n%s latency (in micro-seconds), target in device vs. host memory:\n",
+		     ops[i].name);
+		dump("  %8s %10s %10s %10s %10s\n", "size", "dm_p50", "host_p50",
+		     "dm_p99", "host_p99");
+		for (size = DM_TEST_MIN_SIZE; size <= max_msg_size; size *= 2) {
+			ret = test_rdma_lat(ops[i].opcode, dm_mr, 0, size, dm_lat);
+			if (ret)
+				goto out;
+
+			ret = test_rdma_lat(ops[i].opcode, hmr, (uintptr_t)hbuf,
+					    size, host_lat);
+			if (ret)
+				goto out;
+
+			dump("  %8d %10.3f %10.3f %10.3f %10.3f\n", size,
+			     dm_lat[iters / 2] / 1000.0, host_lat[iters / 2] / 1000.0,
+			     dm_lat[(uint64_t)iters * 99 / 100] / 1000.0,
+			     host_lat[(uint64_t)iters * 99 / 100] / 1000.0);
+		}
+	}
+
+out:
+	free(dm_lat);
+	free(host_lat);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	ret = parse_opt(argc, argv);
+	if (ret)
+		return ret;
+
+	ret = setup();
+	if (ret == ENOTSUP) {
+		info("Device memory is not available, test skipped\n");
+		cleanup();
+		return 0;
+	}
+
+	if (!ret)
+		ret = run_copy_test();
+	if (!ret)
+		ret = run_rdma_test();
+
+	cleanup();
+	return ret;
+}
@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause)
+"""
+Parse the "struct/union mlx5_ifc_<name>_bits" layouts in mlx5_ifc.h, where
+each "u8 field[N]" is an N-bit field, and generate C code from them.
+
+  gen_ifc.py fields <mlx5_ifc.h> <name>...
+      Field tables (name, bit offset, bit size) of all non-reserved fields,
+      with nested structs flattened as "outer.inner", used to decode a layout
+      without a per-field DEVX_GET().
+
+  gen_ifc.py accessors <mlx5_ifc.h> <name>...
+      A typed buffer "struct mlx5_ifc_<name>" and static inline
+      mlx5_ifc_<name>_set_<field>()/_get_<field>() with constant dword index,
+      shift and mask for every field up to 64 bits ("outer.inner" becomes
+      "outer__inner"), plus mlx5_ifc_<name>_write(), which builds the whole
+      layout from a "struct mlx5_ifc_<name>_vals" with one store per dword.
+"""
+import re
+import sys
+
+
+class Member:
+    def __init__(self, name, kind, typ=None, dims=None, members=None):
+        self.name = name        # None for an anonymous struct/union
+        self.kind = kind        # 'bits', 'struct', 'union', 'anon_struct', 'anon_union'
+        self.typ = typ          # Layout name for 'struct' and 'union'
+        self.dims = dims or []  # Array dimensions; For 'bits' the last one is the width
+        self.members = members  # For anonymous struct/union
+
+
+class Layout:
+    def __init__(self, name, is_union, members):
+        self.name = name
+        self.is_union = is_union
+        self.members = members
+
+
+RE_START = re.compile(r'^(struct|union)\s+mlx5_ifc_(\w+)_bits\s*\{')
+RE_ANON = re.compile(r'^(struct|union)\s*\{')
+RE_END = re.compile(r'^\}\s*;')
+RE_BITS = re.compile(r'^u8\s+(\w+)((?:\s*\[[^\]]*\])+)\s*;')
+RE_NESTED = re.compile(r'^(struct|union)\s+mlx5_ifc_(\w+)_bits\s+(\w+)((?:\s*\[[^\]]*\])*)\s*;')
+
+
+def parse_dims(s):
+    dims = []
+    for d in re.findall(r'\[([^\]]*)\]', s):
+        dims.append(int(d, 0) if d.strip() else 0)
+    return dims
+
+
+def strip_comments(text):
+    text = re.sub(r'/\*.*?\*/', '', text, flags=re.S)
+    return re.sub(r'//[^\n]*', '', text)
+
+
+def parse(path):
+    lines = [l.strip() for l in strip_comments(open(path).read()).splitlines()]
+    layouts = {}
+    i = 0
+
+    def parse_body(i):
+        members = []
+        while i < len(lines):
+            l = lines[i]
+            i += 1
+            if not l:
+                continue
+            if RE_END.match(l):
+                return members, i
+            m = RE_BITS.match(l)
+            if m:
+                members.append(Member(m.group(1), 'bits', dims=parse_dims(m.group(2))))
+                continue
+            m = RE_NESTED.match(l)
+            if m:
+                members.append(Member(m.group(3), m.group(1), typ=m.group(2),
+                                      dims=parse_dims(m.group(4))))
+                continue
+            m = RE_ANON.match(l)
+            if m:
+                sub, i = parse_body(i)
+                members.append(Member(None, 'anon_' + m.group(1), members=sub))
+                continue
+            raise ValueError('%s:%d: unknown member "%s"' % (path, i, l))
+        raise ValueError('%s: unterminated layout' % path)
+
+    while i < len(lines):
+        m = RE_START.match(lines[i])
+        i += 1
+        if not m:
+            continue
+        members, i = parse_body(i)
+        layouts[m.group(2)] = Layout(m.group(2), m.group(1) == 'union', members)
+
+    return layouts
+
+
+def count(dims):
+    n = 1
+    for d in dims:
+        n *= d
+    return n
+
+
+def member_size(layouts, mem):
+    if mem.kind == 'bits':
+        return count(mem.dims)
+    if mem.kind in ('struct', 'union'):
+        return layout_size(layouts, layouts[mem.typ]) * count(mem.dims)
+    return members_size(layouts, mem.members, mem.kind == 'anon_union')
+
+
+def members_size(layouts, members, is_union):
+    sizes = [member_size(layouts, m) for m in members]
+    if not sizes:
+        return 0
+    return max(sizes) if is_union else sum(sizes)
+
+
+def layout_size(layouts, layout):
+    return members_size(layouts, layout.members, layout.is_union)
+
+
+def is_reserved(name):
+    return name.startswith('reserved')
+
+
+def flatten(layouts, members, is_union, base, prefix, out):
+    """Append (name, bit_off, bit_sz) of all non-reserved leaf fields."""
+    off = base
+    for mem in members:
+        size = member_size(layouts, mem)
+        if mem.kind == 'bits':
+            if not is_reserved(mem.name):
+                width = mem.dims[-1]
+                if len(mem.dims) == 1:
+                    out.append((prefix + mem.name, off, width))
+                else:
+                    for k in range(count(mem.dims[:-1])):
+                        out.append(('%s%s[%d]' % (prefix, mem.name, k),
+                                    off + k * width, width))
+        elif mem.kind in ('struct', 'union'):
+            sub = layouts[mem.typ]
+            sub_size = layout_size(layouts, sub)
+            n = count(mem.dims)
+            for k in range(n):
+                name = mem.name if not mem.dims else '%s[%d]' % (mem.name, k)
+                flatten(layouts, sub.members, sub.is_union, off + k * sub_size,
+                        prefix + name + '.', out)
+        else:
+            flatten(layouts, mem.members, mem.kind == 'anon_union', off, prefix, out)
+        if not is_union:
+            off += size
+    return out
+
+
+def gen_fields(layouts, names):
+    print('/* Generated by gen_ifc.py from mlx5_ifc.h, do not edit */')
+    print('#ifndef MLX5_IFC_FIELDS_H')
+    print('#define MLX5_IFC_FIELDS_H')
+    print('')
+    print('#include <stdint.h>')
+    print('')
+    print('struct mlx5_ifc_field {')
+    print('\tconst char *name;')
+    print('\tuint32_t bit_off;')
+    print('\tuint32_t bit_sz;')
+    print('};')
+    for name in names:
+        layout = layouts[name]
+        fields = flatten(layouts, layout.members, layout.is_union, 0, '', [])
+        print('')
+        print('/* struct mlx5_ifc_%s_bits: %d bits */' % (name, layout_size(layouts, layout)))
+        print('static const struct mlx5_ifc_field mlx5_ifc_%s_fields[] = {' % name)
+        for f in fields:
+            print('\t{ "%s", 0x%x, 0x%x },' % f)
+        print('};')
+    print('')
+    print('#endif /* MLX5_IFC_FIELDS_H */')
+
+
+def c_name(name):
+    return name.replace('.', '__').replace('[', '_').replace(']', '')
+
+
+def dw_parts(off, sz):
+    """Split a field into (dword, shift in dword, value shift, width) parts."""
+    parts = []
+    end = off + sz
+    while off < end:
+        dw = off // 32
+        part_end = min(end, (dw + 1) * 32)
+        width = part_end - off
+        parts.append((dw, (dw + 1) * 32 - part_end, end - part_end, width))
+        off = part_end
+    return parts
+
+
+def mask(width):
+    return '0x%xu' % ((1 << width) - 1) if width < 32 else '0xffffffffu'
+
+
+def part_value(v, vshift, width, shift):
+    """C expression of one part of value @v, placed at @shift in the dword."""
+    e = v if not vshift else '(%s >> %d)' % (v, vshift)
+    if vshift or width < 32:
+        e = '((uint32_t)%s & %s)' % (e, mask(width))
+    else:
+        e = '(uint32_t)%s' % e
+    return e if not shift else '(%s << %d)' % (e, shift)
+
+
+def gen_accessors(layouts, names):
+    print('/* Generated by gen_ifc.py from mlx5_ifc.h, do not edit */')
+    print('#ifndef MLX5_IFC_ACCESSORS_H')
+    print('#define MLX5_IFC_ACCESSORS_H')
+    print('')
+    print('#include <endian.h>')
+    print('#include <stdint.h>')
+    print('')
+    print('#define MLX5_IFC_BUF(typ, p) ((struct mlx5_ifc_##typ *)(p))')
+    for name in names:
+        layout = layouts[name]
+        size = layout_size(layouts, layout)
+        ndw = (size + 31) // 32
+        fields = [f for f in flatten(layouts, layout.members, layout.is_union, 0, '', [])
+                  if f[2] <= 64]
+        typ = 'struct mlx5_ifc_%s' % name
+        print('')
+        print('/* struct mlx5_ifc_%s_bits, big-endian */' % name)
+        print('%s {' % typ)
+        print('\tuint32_t dw[%d];' % ndw)
+        print('};')
+
+        for fname, off, sz in fields:
+            vt = 'uint32_t' if sz <= 32 else 'uint64_t'
+            fn = 'mlx5_ifc_%s_%%s_%s' % (name, c_name(fname))
+            parts = dw_parts(off, sz)
+            print('')
+            print('static inline void %s(%s *p, %s v)' % (fn % 'set', typ, vt))
+            print('{')
+            for dw, shift, vshift, width in parts:
+                if width == 32:
+                    print('\tp->dw[%d] = htobe32(%s);' % (dw, part_value('v', vshift, width, 0)))
+                else:
+                    print('\tp->dw[%d] = htobe32((be32toh(p->dw[%d]) & ~(%s << %d)) | %s);' %
+                          (dw, dw, mask(width), shift, part_value('v', vshift, width, shift)))
+            print('}')
+            print('')
+            print('static inline %s %s(const %s *p)' % (vt, fn % 'get', typ))
+            print('{')
+            exprs = []
+            for dw, shift, vshift, width in parts:
+                e = 'be32toh(p->dw[%d])' % dw
+                if shift:
+                    e = '(%s >> %d)' % (e, shift)
+                if width < 32:
+                    e = '(%s & %s)' % (e, mask(width))
+                if vshift:
+                    e = '((%s)%s << %d)' % (vt, e, vshift)
+                exprs.append(e)
+            print('\treturn %s;' % ' |\n\t       '.join(exprs))
+            print('}')
+
+        # A batched writer makes no sense when fields of a union overlap
+        bits = set()
+        overlap = False
+        for fname, off, sz in fields:
+            if bits.intersection(range(off, off + sz)):
+                overlap = True
+                break
+            bits.update(range(off, off + sz))
+        if overlap:
+            continue
+
+        print('')
+        print('struct mlx5_ifc_%s_vals {' % name)
+        for fname, off, sz in fields:
+            print('\t%s %s;' % ('uint32_t' if sz <= 32 else 'uint64_t', c_name(fname)))
+        print('};')
+        print('')
+        print('/* Write all %d dwords at once, reserved bits and fields wider than 64 bits are cleared */' % ndw)
+        print('static inline void mlx5_ifc_%s_write(%s *p, const struct mlx5_ifc_%s_vals *v)' %
+              (name, typ, name))
+        print('{')
+        per_dw = [[] for _ in range(ndw)]
+        for fname, off, sz in fields:
+            for dw, shift, vshift, width in dw_parts(off, sz):
+                per_dw[dw].append(part_value('v->' + c_name(fname), vshift, width, shift))
+        for dw in range(ndw):
+            if per_dw[dw]:
+                print('\tp->dw[%d] = htobe32(%s);' % (dw, ' |\n\t\t\t    '.join(per_dw[dw])))
+            else:
+                print('\tp->dw[%d] = 0;' % dw)
+        print('}')
+    print('')
+    print('#endif /* MLX5_IFC_ACCESSORS_H */')
+
+
+def main():
+    modes = {'fields': gen_fields, 'accessors': gen_accessors}
+
+    if len(sys.argv) < 4 or sys.argv[1] not in modes:
+        sys.stderr.write('Usage: %s fields|accessors <mlx5_ifc.h> <name>...\n' % sys.argv[0])
+        return 1
+
+    layouts = parse(sys.argv[2])
+    for name in sys.argv[3:]:
+        if name not in layouts:
+            sys.stderr.write('Unknown layout mlx5_ifc_%s_bits\n' % name)
+            return 1
+
+    modes[sys.argv[1]](layouts, sys.argv[3:])
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,465 @@
+/*
+ * HCA capability snapshot: Query every QUERY_HCA_CAP op_mod once through devx,
+ * decode all fields of the capability layouts in mlx5_ifc.h into JSON, and
+ * keep the raw capabilities in a cache file keyed by the FW version, so that
+ * later runs load the cache instead of issuing FW commands.
+ *
+ * A saved cache file can be decoded with "-l <file>" without any device.
+ *
+ * Build: make (mlx5_ifc_fields.h is generated by gen_ifc.py)
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <infiniband/verbs.h>
+#include <infiniband/mlx5dv.h>
+
+#include "mlx5_ifc.h"
+#include "mlx5_ifc_fields.h"
+
+#define err(args...) fprintf(stderr, ##args)
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define HCA_CAPS_MAGIC "MLX5CAPS"
+#define HCA_CAPS_VERSION 1
+#define HCA_CAP_SZ DEVX_UN_SZ_BYTES(hca_cap_union)
+
+struct hca_cap_desc {
+	const char *name;
+	uint16_t op_mod;	/* Without HCA_CAP_OPMOD_GET_MAX/CUR */
+	const struct mlx5_ifc_field *fields;
+	unsigned int num_fields;
+};
+
+#define HCA_CAP_DESC(_name, _op_mod) \
+	{ #_name, _op_mod, mlx5_ifc_##_name##_fields, ARRAY_SIZE(mlx5_ifc_##_name##_fields) }
+
+static const struct hca_cap_desc hca_caps[] = {
+	HCA_CAP_DESC(cmd_hca_cap, MLX5_SET_HCA_CAP_OP_MOD_GENERAL_DEVICE),
+	HCA_CAP_DESC(cmd_hca_cap_2, MLX5_SET_HCA_CAP_OP_MOD_GENERAL_DEVICE_CAP_2),
+	HCA_CAP_DESC(odp_cap, MLX5_CAP_ODP << 1),
+	HCA_CAP_DESC(atomic_caps, MLX5_CAP_ATOMIC << 1),
+	HCA_CAP_DESC(roce_cap, MLX5_SET_HCA_CAP_OP_MOD_ROCE),
+	HCA_CAP_DESC(flow_table_nic_cap, MLX5_SET_HCA_CAP_OP_MOD_NIC_FLOW_TABLE),
+	HCA_CAP_DESC(flow_table_eswitch_cap, MLX5_SET_HCA_CAP_OP_MOD_ESW_FLOW_TABLE),
+	HCA_CAP_DESC(e_switch_cap, MLX5_SET_HCA_CAP_OP_MOD_ESW),
+	HCA_CAP_DESC(qos_cap, MLX5_SET_HCA_CAP_OP_MOD_QOS),
+	HCA_CAP_DESC(device_mem_cap, MLX5_SET_HCA_CAP_OP_MOD_DEVICE_MEMORY),
+	HCA_CAP_DESC(crypto_caps, MLX5_SET_HCA_CAP_OP_MOD_CRYPTO),
+};
+
+#define NUM_HCA_CAPS ARRAY_SIZE(hca_caps)
+
+/*
+ * Cache/dump file: One header followed by NUM_HCA_CAPS entries, in the order
+ * of hca_caps[]; Capabilities are kept as returned by FW (big-endian).
+ */
+struct hca_caps_file_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_caps;
+	uint32_t cap_mode;	/* HCA_CAP_OPMOD_GET_MAX/CUR */
+	uint32_t reserved;
+	char dev_name[64];
+	char fw_ver[64];
+};
+
+struct hca_caps_file_entry {
+	uint16_t op_mod;
+	uint16_t valid;		/* 0 if the query failed, e.g. not supported */
+	uint32_t reserved;
+	uint8_t data[HCA_CAP_SZ];
+};
+
+struct hca_caps_snapshot {
+	struct hca_caps_file_hdr hdr;
+	struct hca_caps_file_entry caps[NUM_HCA_CAPS];
+	const char *source;
+};
+
+static const char *dev_name;
+static const char *cache_file;
+static const char *load_file;
+static const char *out_file;
+static const char *cache_dir = "/tmp";
+static int cap_mode = HCA_CAP_OPMOD_GET_CUR;
+static bool refresh;
+
+static struct hca_caps_snapshot snap;
+
+static void show_usage(char *prog)
+{
+	printf("Usage: %s [OPTION]\n", prog);
+	printf("  [-d, --device] <ib_device>  - IB device (the first one by default)\n");
+	printf("  [-m, --max]                 - Query the maximum instead of the current capabilities\n");
+	printf("  [-C, --cache-dir] <dir>     - Directory of the cache files (%s by default)\n", cache_dir);
+	printf("  [-c, --cache-file] <file>   - Cache file; <cache-dir>/mlx5_caps-<dev>-<fw_ver>-<cur|max>.bin by default\n");
+	printf("  [-r, --refresh]             - Query the device even if the cache is valid\n");
+	printf("  [-l, --load] <file>         - Decode a saved cache file, no device is needed\n");
+	printf("  [-o, --output] <file>       - Write JSON to this file (stdout by default)\n");
+	printf("  [-h, --help]                - Show help\n");
+}
+
+static int parse_opt(int argc, char *argv[])
+{
+	static const struct option long_opts[] = {
+		{"help", 0, NULL, 'h'},
+		{"device", 1, NULL, 'd'},
+		{"max", 0, NULL, 'm'},
+		{"cache-dir", 1, NULL, 'C'},
+		{"cache-file", 1, NULL, 'c'},
+		{"refresh", 0, NULL, 'r'},
+		{"load", 1, NULL, 'l'},
+		{"output", 1, NULL, 'o'},
+		{},
+	};
+	int op;
+
+	while ((op = getopt_long(argc, argv, "hd:mC:c:rl:o:", long_opts, NULL)) != -1) {
+		switch (op) {
+		case 'h':
+			show_usage(argv[0]);
+			exit(0);
+
+		case 'd':
+			dev_name = optarg;
+			break;
+
+		case 'm':
+			cap_mode = HCA_CAP_OPMOD_GET_MAX;
+			break;
+
+		case 'C':
+			cache_dir = optarg;
+			break;
+
+		case 'c':
+			cache_file = optarg;
+			break;
+
+		case 'r':
+			refresh = true;
+			break;
+
+		case 'l':
+			load_file = optarg;
+			break;
+
+		case 'o':
+			out_file = optarg;
+			break;
+
+		default:
+			err("Unknown option %c\n", op);
+			show_usage(argv[0]);
+			return EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int load_snapshot(const char *file, struct hca_caps_snapshot *s)
+{
+	FILE *f;
+	int i, ret = 0;
+
+	f = fopen(file, "rb");
+	if (!f)
+		return errno;
+
+	if (fread(&s->hdr, sizeof(s->hdr), 1, f) != 1 ||
+	    memcmp(s->hdr.magic, HCA_CAPS_MAGIC, sizeof(s->hdr.magic)) ||
+	    s->hdr.version != HCA_CAPS_VERSION ||
+	    s->hdr.num_caps != NUM_HCA_CAPS ||
+	    fread(s->caps, sizeof(s->caps), 1, f) != 1) {
+		err("%s: invalid or incompatible caps file\n", file);
+		ret = EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < NUM_HCA_CAPS; i++) {
+		if (s->caps[i].op_mod != hca_caps[i].op_mod) {
+			err("%s: entry %d op_mod 0x%x, expected 0x%x\n", file, i,
+			    s->caps[i].op_mod, hca_caps[i].op_mod);
+			ret = EINVAL;
+			goto out;
+		}
+	}
+
+	s->hdr.dev_name[sizeof(s->hdr.dev_name) - 1] = '\0';
+	s->hdr.fw_ver[sizeof(s->hdr.fw_ver) - 1] = '\0';
+out:
+	fclose(f);
+	return ret;
+}
+
+/* Write to a temp file then rename, so that a reader never sees a partial file */
+static int save_snapshot(const char *file, const struct hca_caps_snapshot *s)
+{
+	char tmp[4096];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", file, getpid());
+	f = fopen(tmp, "wb");
+	if (!f) {
+		err("Failed to create %s: %s\n", tmp, strerror(errno));
+		return errno;
+	}
+
+	if (fwrite(&s->hdr, sizeof(s->hdr), 1, f) != 1 ||
+	    fwrite(s->caps, sizeof(s->caps), 1, f) != 1) {
+		err("Failed to write %s\n", tmp);
+		fclose(f);
+		unlink(tmp);
+		return EIO;
+	}
+
+	if (fclose(f) || rename(tmp, file)) {
+		err("Failed to save %s: %s\n", file, strerror(errno));
+		unlink(tmp);
+		return errno;
+	}
+
+	return 0;
+}
+
+static int query_hca_cap(struct ibv_context *ibctx, struct hca_caps_file_entry *e)
+{
+	uint32_t in[DEVX_ST_SZ_DW(query_hca_cap_in)] = {};
+	uint32_t out[DEVX_ST_SZ_DW(query_hca_cap_out)] = {};
+	int ret;
+
+	DEVX_SET(query_hca_cap_in, in, opcode, MLX5_CMD_OP_QUERY_HCA_CAP);
+	DEVX_SET(query_hca_cap_in, in, op_mod, e->op_mod | cap_mode);
+
+	ret = mlx5dv_devx_general_cmd(ibctx, in, sizeof(in), out, sizeof(out));
+	if (ret)
+		return ret;
+
+	memcpy(e->data, DEVX_ADDR_OF(query_hca_cap_out, out, capability), HCA_CAP_SZ);
+	e->valid = 1;
+	return 0;
+}
+
+static struct ibv_context *open_device(void)
+{
+	struct mlx5dv_context_attr dv_attr = {
+		.flags = MLX5DV_CONTEXT_FLAGS_DEVX,
+	};
+	struct ibv_device **dev_list;
+	struct ibv_context *ibctx = NULL;
+	struct ibv_device *ibdev = NULL;
+	int i;
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list) {
+		perror("ibv_get_device_list()");
+		return NULL;
+	}
+
+	for (i = 0; dev_list[i] != NULL; i++) {
+		if (!dev_name || !strcmp(dev_name, ibv_get_device_name(dev_list[i]))) {
+			ibdev = dev_list[i];
+			break;
+		}
+	}
+
+	if (!ibdev)
+		err("Device not found %s\n", dev_name ? dev_name : "");
+	else if (!mlx5dv_is_supported(ibdev))
+		err("Device %s doesn't support mlx5dv\n", ibv_get_device_name(ibdev));
+	else {
+		ibctx = mlx5dv_open_device(ibdev, &dv_attr);
+		if (!ibctx)
+			ibctx = ibv_open_device(ibdev);
+		if (!ibctx)
+			perror("ibv_open_device");
+	}
+
+	ibv_free_device_list(dev_list);
+	return ibctx;
+}
+
+static void init_hdr(struct hca_caps_file_hdr *hdr, struct ibv_context *ibctx,
+		     const char *fw_ver)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, HCA_CAPS_MAGIC, sizeof(hdr->magic));
+	hdr->version = HCA_CAPS_VERSION;
+	hdr->num_caps = NUM_HCA_CAPS;
+	hdr->cap_mode = cap_mode;
+	snprintf(hdr->dev_name, sizeof(hdr->dev_name), "%s", ibv_get_device_name(ibctx->device));
+	snprintf(hdr->fw_ver, sizeof(hdr->fw_ver), "%s", fw_ver);
+}
+
+static bool cache_valid(const struct hca_caps_snapshot *s, const struct hca_caps_file_hdr *expected)
+{
+	return !strcmp(s->hdr.dev_name, expected->dev_name) &&
+		!strcmp(s->hdr.fw_ver, expected->fw_ver) &&
+		s->hdr.cap_mode == expected->cap_mode;
+}
+
+static int get_snapshot_from_device(struct hca_caps_snapshot *s)
+{
+	struct ibv_device_attr dev_attr = {};
+	struct hca_caps_file_hdr hdr;
+	struct ibv_context *ibctx;
+	char path[4096];
+	int i, ret, num_valid = 0;
+
+	ibctx = open_device();
+	if (!ibctx)
+		return ENODEV;
+
+	ret = ibv_query_device(ibctx, &dev_attr);
+	if (ret) {
+		err("ibv_query_device failed %d\n", ret);
+		goto out;
+	}
+	init_hdr(&hdr, ibctx, dev_attr.fw_ver);
+
+	if (!cache_file) {
+		snprintf(path, sizeof(path), "%s/mlx5_caps-%s-%s-%s.bin", cache_dir,
+			 hdr.dev_name, hdr.fw_ver,
+			 cap_mode == HCA_CAP_OPMOD_GET_MAX ? "max" : "cur");
+		cache_file = path;
+	}
+
+	if (!refresh && !load_snapshot(cache_file, s) && cache_valid(s, &hdr)) {
+		s->source = "cache";
+		goto out;
+	}
+
+	memset(s, 0, sizeof(*s));
+	s->hdr = hdr;
+	for (i = 0; i < NUM_HCA_CAPS; i++) {
+		s->caps[i].op_mod = hca_caps[i].op_mod;
+		if (query_hca_cap(ibctx, &s->caps[i]))
+			err("QUERY_HCA_CAP %s (op_mod 0x%x) failed, errno %d\n",
+			    hca_caps[i].name, hca_caps[i].op_mod, errno);
+		else
+			num_valid++;
+	}
+
+	if (!num_valid) {
+		err("No capability could be queried from %s\n", hdr.dev_name);
+		ret = EOPNOTSUPP;
+		goto out;
+	}
+
+	s->source = "device";
+	if (save_snapshot(cache_file, s))
+		err("Cache is not saved\n");
+
+out:
+	ibv_close_device(ibctx);
+	return ret;
+}
+
+/* Fields are MSB-first in big-endian dwords, same as DEVX_GET() */
+static uint64_t get_bits(const uint8_t *p, uint32_t bit_off, uint32_t bit_sz)
+{
+	uint64_t v = 0;
+	uint32_t i, b;
+
+	for (i = 0; i < bit_sz; i++) {
+		b = bit_off + i;
+		v = (v << 1) | ((p[b / 8] >> (7 - b % 8)) & 1);
+	}
+
+	return v;
+}
+
+static void dump_field(FILE *f, const uint8_t *data, const struct mlx5_ifc_field *fld)
+{
+	uint32_t i;
+
+	if (fld->bit_sz <= 32) {
+		fprintf(f, "%lu", get_bits(data, fld->bit_off, fld->bit_sz));
+	} else if (fld->bit_sz <= 64) {
+		/* Keep 64-bit values exact for JSON readers using doubles */
+		fprintf(f, "\"0x%lx\"", get_bits(data, fld->bit_off, fld->bit_sz));
+	} else {
+		fprintf(f, "\"0x");
+		for (i = 0; i < fld->bit_sz; i += 8)
+			fprintf(f, "%02lx", get_bits(data, fld->bit_off + i,
+						     fld->bit_sz - i < 8 ? fld->bit_sz - i : 8));
+		fprintf(f, "\"");
+	}
+}
+
+static void dump_json(FILE *f, const struct hca_caps_snapshot *s)
+{
+	const struct hca_cap_desc *desc;
+	int i, j;
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"device\": \"%s\",\n", s->hdr.dev_name);
+	fprintf(f, "  \"fw_ver\": \"%s\",\n", s->hdr.fw_ver);
+	fprintf(f, "  \"mode\": \"%s\",\n",
+		s->hdr.cap_mode == HCA_CAP_OPMOD_GET_MAX ? "max" : "cur");
+	fprintf(f, "  \"source\": \"%s\",\n", s->source);
+	fprintf(f, "  \"caps\": {\n");
+	for (i = 0; i < NUM_HCA_CAPS; i++) {
+		desc = &hca_caps[i];
+		fprintf(f, "    \"%s\": ", desc->name);
+		if (!s->caps[i].valid) {
+			fprintf(f, "null%s\n", i == NUM_HCA_CAPS - 1 ? "" : ",");
+			continue;
+		}
+
+		fprintf(f, "{\n");
+		for (j = 0; j < desc->num_fields; j++) {
+			fprintf(f, "      \"%s\": ", desc->fields[j].name);
+			dump_field(f, s->caps[i].data, &desc->fields[j]);
+			fprintf(f, "%s\n", j == desc->num_fields - 1 ? "" : ",");
+		}
+		fprintf(f, "    }%s\n", i == NUM_HCA_CAPS - 1 ? "" : ",");
+	}
+	fprintf(f, "  }\n");
+	fprintf(f, "}\n");
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *f = stdout;
+	int ret;
+
+	ret = parse_opt(argc, argv);
+	if (ret)
+		return ret;
+
+	if (load_file) {
+		ret = load_snapshot(load_file, &snap);
+		if (ret) {
+			err("Failed to load %s: %s\n", load_file, strerror(ret));
+			return ret;
+		}
+		snap.source = "file";
+	} else {
+		ret = get_snapshot_from_device(&snap);
+		if (ret)
+			return ret;
+	}
+
+	if (out_file) {
+		f = fopen(out_file, "w");
+		if (!f) {
+			err("Failed to open %s: %s\n", out_file, strerror(errno));
+			return errno;
+		}
+	}
+
+	dump_json(f, &snap);
+
+	if (f != stdout)
+		fclose(f);
+	return 0;
+}
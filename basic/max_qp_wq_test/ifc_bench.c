@@ -0,0 +1,326 @@
+/*
+ * Compare DEVX_SET()/DEVX_GET() with the accessors generated by
+ * "gen_ifc.py accessors" when building create_mkey_in and
+ * create_flow_table_in commands in a tight loop. No device is needed.
+ *
+ * Build: make ifc_bench (mlx5_ifc_accessors.h is generated by gen_ifc.py)
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <infiniband/mlx5dv.h>
+
+#include "mlx5_ifc.h"
+#include "mlx5_ifc_accessors.h"
+#include "../common/basic.h"
+
+#define info(args...) printf(args)
+#define err(args...) fprintf(stderr, ##args)
+
+#define barrier() asm volatile("" ::: "memory")
+
+#define MKEY_IN_SZ DEVX_ST_SZ_BYTES(create_mkey_in)
+#define FT_IN_SZ DEVX_ST_SZ_BYTES(create_flow_table_in)
+
+_Static_assert(sizeof(struct mlx5_ifc_create_mkey_in) == MKEY_IN_SZ, "create_mkey_in size");
+_Static_assert(sizeof(struct mlx5_ifc_create_flow_table_in) == FT_IN_SZ, "create_flow_table_in size");
+
+static unsigned long iters = 10000000;
+
+/* Build commands the way a devx user typically does: zero the buffer, then set fields */
+static __attribute__((noinline)) void mkey_devx(void *in, uint32_t i)
+{
+	void *mkc = DEVX_ADDR_OF(create_mkey_in, in, memory_key_mkey_entry);
+
+	memset(in, 0, MKEY_IN_SZ);
+	DEVX_SET(create_mkey_in, in, opcode, MLX5_CMD_OP_CREATE_MKEY);
+	DEVX_SET(create_mkey_in, in, translations_octword_actual_size, 1);
+	DEVX_SET(mkc, mkc, access_mode_1_0, MLX5_MKC_ACCESS_MODE_MTT);
+	DEVX_SET(mkc, mkc, a, 1);
+	DEVX_SET(mkc, mkc, rw, 1);
+	DEVX_SET(mkc, mkc, rr, 1);
+	DEVX_SET(mkc, mkc, lw, 1);
+	DEVX_SET(mkc, mkc, lr, 1);
+	DEVX_SET(mkc, mkc, qpn, 0xffffff);
+	DEVX_SET(mkc, mkc, mkey_7_0, i & 0xff);
+	DEVX_SET(mkc, mkc, pd, i & 0xffffff);
+	DEVX_SET64(mkc, mkc, start_addr, 0x10000ull + (uint64_t)i * 4096);
+	DEVX_SET64(mkc, mkc, len, 4096);
+	DEVX_SET(mkc, mkc, translations_octword_size, 1);
+	DEVX_SET(mkc, mkc, log_page_size, 12);
+}
+
+static __attribute__((noinline)) void mkey_gen(struct mlx5_ifc_create_mkey_in *in, uint32_t i)
+{
+	memset(in, 0, sizeof(*in));
+	mlx5_ifc_create_mkey_in_set_opcode(in, MLX5_CMD_OP_CREATE_MKEY);
+	mlx5_ifc_create_mkey_in_set_translations_octword_actual_size(in, 1);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__access_mode_1_0(in, MLX5_MKC_ACCESS_MODE_MTT);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__a(in, 1);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__rw(in, 1);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__rr(in, 1);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__lw(in, 1);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__lr(in, 1);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__qpn(in, 0xffffff);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__mkey_7_0(in, i & 0xff);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__pd(in, i & 0xffffff);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__start_addr(in, 0x10000ull + (uint64_t)i * 4096);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__len(in, 4096);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__translations_octword_size(in, 1);
+	mlx5_ifc_create_mkey_in_set_memory_key_mkey_entry__log_page_size(in, 12);
+}
+
+static __attribute__((noinline)) void mkey_batch(struct mlx5_ifc_create_mkey_in *in, uint32_t i)
+{
+	struct mlx5_ifc_create_mkey_in_vals v = {
+		.opcode = MLX5_CMD_OP_CREATE_MKEY,
+		.translations_octword_actual_size = 1,
+		.memory_key_mkey_entry__access_mode_1_0 = MLX5_MKC_ACCESS_MODE_MTT,
+		.memory_key_mkey_entry__a = 1,
+		.memory_key_mkey_entry__rw = 1,
+		.memory_key_mkey_entry__rr = 1,
+		.memory_key_mkey_entry__lw = 1,
+		.memory_key_mkey_entry__lr = 1,
+		.memory_key_mkey_entry__qpn = 0xffffff,
+		.memory_key_mkey_entry__mkey_7_0 = i & 0xff,
+		.memory_key_mkey_entry__pd = i & 0xffffff,
+		.memory_key_mkey_entry__start_addr = 0x10000ull + (uint64_t)i * 4096,
+		.memory_key_mkey_entry__len = 4096,
+		.memory_key_mkey_entry__translations_octword_size = 1,
+		.memory_key_mkey_entry__log_page_size = 12,
+	};
+
+	mlx5_ifc_create_mkey_in_write(in, &v);
+}
+
+static __attribute__((noinline)) void ft_devx(void *in, uint32_t i)
+{
+	void *ftc = DEVX_ADDR_OF(create_flow_table_in, in, flow_table_context);
+
+	memset(in, 0, FT_IN_SZ);
+	DEVX_SET(create_flow_table_in, in, opcode, MLX5_CMD_OP_CREATE_FLOW_TABLE);
+	DEVX_SET(create_flow_table_in, in, table_type, FS_FT_NIC_RX);
+	DEVX_SET(create_flow_table_in, in, other_vport, i & 1);
+	DEVX_SET(create_flow_table_in, in, vport_number, i & 0xffff);
+	DEVX_SET(flow_table_context, ftc, table_miss_action, 1);
+	DEVX_SET(flow_table_context, ftc, level, i & 0x3f);
+	DEVX_SET(flow_table_context, ftc, log_size, 10);
+	DEVX_SET(flow_table_context, ftc, table_miss_id, i & 0xffffff);
+}
+
+static __attribute__((noinline)) void ft_gen(struct mlx5_ifc_create_flow_table_in *in, uint32_t i)
+{
+	memset(in, 0, sizeof(*in));
+	mlx5_ifc_create_flow_table_in_set_opcode(in, MLX5_CMD_OP_CREATE_FLOW_TABLE);
+	mlx5_ifc_create_flow_table_in_set_table_type(in, FS_FT_NIC_RX);
+	mlx5_ifc_create_flow_table_in_set_other_vport(in, i & 1);
+	mlx5_ifc_create_flow_table_in_set_vport_number(in, i & 0xffff);
+	mlx5_ifc_create_flow_table_in_set_flow_table_context__table_miss_action(in, 1);
+	mlx5_ifc_create_flow_table_in_set_flow_table_context__level(in, i & 0x3f);
+	mlx5_ifc_create_flow_table_in_set_flow_table_context__log_size(in, 10);
+	mlx5_ifc_create_flow_table_in_set_flow_table_context__table_miss_id(in, i & 0xffffff);
+}
+
+static __attribute__((noinline)) void ft_batch(struct mlx5_ifc_create_flow_table_in *in, uint32_t i)
+{
+	struct mlx5_ifc_create_flow_table_in_vals v = {
+		.opcode = MLX5_CMD_OP_CREATE_FLOW_TABLE,
+		.table_type = FS_FT_NIC_RX,
+		.other_vport = i & 1,
+		.vport_number = i & 0xffff,
+		.flow_table_context__table_miss_action = 1,
+		.flow_table_context__level = i & 0x3f,
+		.flow_table_context__log_size = 10,
+		.flow_table_context__table_miss_id = i & 0xffffff,
+	};
+
+	mlx5_ifc_create_flow_table_in_write(in, &v);
+}
+
+/* Decode the fields a driver would look at */
+static __attribute__((noinline)) uint64_t mkey_get_devx(const void *in)
+{
+	const void *mkc = DEVX_ADDR_OF(create_mkey_in, in, memory_key_mkey_entry);
+
+	return DEVX_GET(create_mkey_in, in, opcode) +
+		DEVX_GET(mkc, mkc, access_mode_1_0) + DEVX_GET(mkc, mkc, rw) +
+		DEVX_GET(mkc, mkc, lr) + DEVX_GET(mkc, mkc, mkey_7_0) +
+		DEVX_GET(mkc, mkc, pd) + DEVX_GET64(mkc, mkc, start_addr) +
+		DEVX_GET64(mkc, mkc, len) + DEVX_GET(mkc, mkc, log_page_size);
+}
+
+static __attribute__((noinline)) uint64_t mkey_get_gen(const struct mlx5_ifc_create_mkey_in *in)
+{
+	return mlx5_ifc_create_mkey_in_get_opcode(in) +
+		mlx5_ifc_create_mkey_in_get_memory_key_mkey_entry__access_mode_1_0(in) +
+		mlx5_ifc_create_mkey_in_get_memory_key_mkey_entry__rw(in) +
+		mlx5_ifc_create_mkey_in_get_memory_key_mkey_entry__lr(in) +
+		mlx5_ifc_create_mkey_in_get_memory_key_mkey_entry__mkey_7_0(in) +
+		mlx5_ifc_create_mkey_in_get_memory_key_mkey_entry__pd(in) +
+		mlx5_ifc_create_mkey_in_get_memory_key_mkey_entry__start_addr(in) +
+		mlx5_ifc_create_mkey_in_get_memory_key_mkey_entry__len(in) +
+		mlx5_ifc_create_mkey_in_get_memory_key_mkey_entry__log_page_size(in);
+}
+
+static __attribute__((noinline)) uint64_t ft_get_devx(const void *in)
+{
+	const void *ftc = DEVX_ADDR_OF(create_flow_table_in, in, flow_table_context);
+
+	return DEVX_GET(create_flow_table_in, in, opcode) +
+		DEVX_GET(create_flow_table_in, in, table_type) +
+		DEVX_GET(create_flow_table_in, in, vport_number) +
+		DEVX_GET(flow_table_context, ftc, level) +
+		DEVX_GET(flow_table_context, ftc, log_size) +
+		DEVX_GET(flow_table_context, ftc, table_miss_id);
+}
+
+static __attribute__((noinline)) uint64_t ft_get_gen(const struct mlx5_ifc_create_flow_table_in *in)
+{
+	return mlx5_ifc_create_flow_table_in_get_opcode(in) +
+		mlx5_ifc_create_flow_table_in_get_table_type(in) +
+		mlx5_ifc_create_flow_table_in_get_vport_number(in) +
+		mlx5_ifc_create_flow_table_in_get_flow_table_context__level(in) +
+		mlx5_ifc_create_flow_table_in_get_flow_table_context__log_size(in) +
+		mlx5_ifc_create_flow_table_in_get_flow_table_context__table_miss_id(in);
+}
+
+static int verify(void)
+{
+	struct mlx5_ifc_create_flow_table_in ft_g, ft_b;
+	struct mlx5_ifc_create_mkey_in mkey_g, mkey_b;
+	uint32_t ft_d[DEVX_ST_SZ_DW(create_flow_table_in)];
+	uint32_t mkey_d[DEVX_ST_SZ_DW(create_mkey_in)];
+	uint32_t i;
+
+	for (i = 0; i < 100000; i += 997) {
+		/* Dirty buffers, the batched writer must clear everything */
+		memset(&mkey_b, 0xa5, sizeof(mkey_b));
+		memset(&ft_b, 0xa5, sizeof(ft_b));
+
+		mkey_devx(mkey_d, i);
+		mkey_gen(&mkey_g, i);
+		mkey_batch(&mkey_b, i);
+		if (memcmp(mkey_d, &mkey_g, MKEY_IN_SZ) ||
+		    memcmp(mkey_d, &mkey_b, MKEY_IN_SZ)) {
+			err("create_mkey_in mismatch, i %u\n", i);
+			return EINVAL;
+		}
+		if (mkey_get_devx(mkey_d) != mkey_get_gen(&mkey_g)) {
+			err("create_mkey_in get mismatch, i %u\n", i);
+			return EINVAL;
+		}
+
+		ft_devx(ft_d, i);
+		ft_gen(&ft_g, i);
+		ft_batch(&ft_b, i);
+		if (memcmp(ft_d, &ft_g, FT_IN_SZ) || memcmp(ft_d, &ft_b, FT_IN_SZ)) {
+			err("create_flow_table_in mismatch, i %u\n", i);
+			return EINVAL;
+		}
+		if (ft_get_devx(ft_d) != ft_get_gen(&ft_g)) {
+			err("create_flow_table_in get mismatch, i %u\n", i);
+			return EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static void report(const char *name, uint64_t tm)
+{
+	info("  %-24s %8.2f ns/cmd %10.2f Mcmds/s\n", name,
+	     (double)tm / iters, iters * 1000.0 / tm);
+}
+
+#define RUN(name, call)							\
+	do {								\
+		uint64_t start = get_time_ns();				\
+		unsigned long n;					\
+									\
+		for (n = 0; n < iters; n++) {				\
+			call;						\
+			barrier();					\
+		}							\
+		report(name, get_time_ns() - start);			\
+	} while (0)
+
+static void run_bench(void)
+{
+	struct mlx5_ifc_create_flow_table_in ft;
+	struct mlx5_ifc_create_mkey_in mkey;
+	volatile uint64_t sum = 0;
+
+	info("create_mkey_in (%zu bytes):\n", MKEY_IN_SZ);
+	RUN("DEVX_SET", mkey_devx(&mkey, n));
+	RUN("generated setters", mkey_gen(&mkey, n));
+	RUN("generated batch write", mkey_batch(&mkey, n));
+	RUN("DEVX_GET", sum += mkey_get_devx(&mkey));
+	RUN("generated getters", sum += mkey_get_gen(&mkey));
+
+	info("create_flow_table_in (%zu bytes):\n", FT_IN_SZ);
+	RUN("DEVX_SET", ft_devx(&ft, n));
+	RUN("generated setters", ft_gen(&ft, n));
+	RUN("generated batch write", ft_batch(&ft, n));
+	RUN("DEVX_GET", sum += ft_get_devx(&ft));
+	RUN("generated getters", sum += ft_get_gen(&ft));
+}
+
+static void show_usage(char *prog)
+{
+	printf("Usage: %s [OPTION]\n", prog);
+	printf("  [-n, --iters] <n>  - Commands built per variant (%lu by default)\n", iters);
+	printf("  [-h, --help]       - Show help\n");
+}
+
+static int parse_opt(int argc, char *argv[])
+{
+	static const struct option long_opts[] = {
+		{"help", 0, NULL, 'h'},
+		{"iters", 1, NULL, 'n'},
+		{},
+	};
+	int op;
+
+	while ((op = getopt_long(argc, argv, "hn:", long_opts, NULL)) != -1) {
+		switch (op) {
+		case 'h':
+			show_usage(argv[0]);
+			exit(0);
+
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			if (!iters) {
+				err("Invalid number of iterations: %s\n", optarg);
+				return EINVAL;
+			}
+			break;
+
+		default:
+			err("Unknown option %c\n", op);
+			show_usage(argv[0]);
+			return EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	ret = parse_opt(argc, argv);
+	if (ret)
+		return ret;
+
+	ret = verify();
+	if (ret)
+		return ret;
+
+	info("All variants produce identical commands, %lu iterations each\n", iters);
+	run_bench();
+	return 0;
+}
@@ -0,0 +1,550 @@
+/*
+ * Work queue depth sweep: Create loopback RC QPs with send/recv queue depth
+ * from 16 up to the device maximum (CAP.log_max_qp_sz on mlx5, or max_qp_wr
+ * from ibv_query_device() on other providers, e.g. rxe), and for each depth
+ * measure message rate, completion latency and memory footprint of the QP/CQ.
+ * Then recommend the smallest depth that reaches the peak message rate.
+ *
+ * gcc -Wall -o qp_depth_test qp_depth_test.c -libverbs -lmlx5
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <infiniband/verbs.h>
+#include <infiniband/mlx5dv.h>
+
+#include "mlx5_ifc.h"
+#include "../common/basic.h"
+
+#define info(args...) fprintf(stdout, ##args)
+#define err(args...) fprintf(stderr, ##args)
+
+#define dump(args...) fprintf(stdout, ##args)
+
+#define DEPTH_MIN 16
+#define POST_BATCH 32
+#define POLL_BATCH 64
+#define MAX_DEPTH_RESULTS 32
+
+#define RECV_WRID_FLAG (1ULL << 63)
+
+static const char *dev_name;
+static unsigned int iters = 200000;
+static unsigned int msg_size = 64;
+static unsigned int max_depth;
+static unsigned int peak_pct = 95;
+static unsigned int ib_port = 1;
+static int gid_index;
+
+static struct ibv_context *ibctx;
+static struct ibv_pd *pd;
+static struct ibv_device_attr dev_attr;
+static int is_mlx5;
+
+static char *buf;
+static struct ibv_mr *mr;
+
+struct depth_result {
+	unsigned int depth;
+	double mpps;
+	double lat_avg, lat_p50, lat_p99;	/* In micro-seconds */
+	long footprint;				/* In bytes, -1 if unknown */
+};
+
+static struct depth_result results[MAX_DEPTH_RESULTS];
+static int num_results;
+
+static void show_usage(char *prog)
+{
+	printf("Usage: %s [OPTION]\n", prog);
+	printf("  [-d, --device] <ib_device>  - IB device (the first one by default)\n");
+	printf("  [-p, --ib-port] <port>      - IB port (1 by default)\n");
+	printf("  [-g, --gid-index] <index>   - GID index, for RoCE (0 by default)\n");
+	printf("  [-n, --iters] <num>         - Messages sent for each depth (%d by default)\n", iters);
+	printf("  [-s, --size] <bytes>        - Message size (%d by default)\n", msg_size);
+	printf("  [-m, --max-depth] <num>     - Stop the sweep at this depth (device maximum by default)\n");
+	printf("  [-P, --peak-pct] <pct>      - Rate regarded as reaching the peak, in %% of the peak (%d by default)\n", peak_pct);
+	printf("  [-h, --help]                - Show help\n");
+}
+
+static int parse_opt(int argc, char *argv[])
+{
+	static const struct option long_opts[] = {
+		{"help", 0, NULL, 'h'},
+		{"device", 1, NULL, 'd'},
+		{"ib-port", 1, NULL, 'p'},
+		{"gid-index", 1, NULL, 'g'},
+		{"iters", 1, NULL, 'n'},
+		{"size", 1, NULL, 's'},
+		{"max-depth", 1, NULL, 'm'},
+		{"peak-pct", 1, NULL, 'P'},
+		{},
+	};
+	int op;
+
+	while ((op = getopt_long(argc, argv, "hd:p:g:n:s:m:P:", long_opts, NULL)) != -1) {
+		switch (op) {
+		case 'h':
+			show_usage(argv[0]);
+			exit(0);
+
+		case 'd':
+			dev_name = optarg;
+			break;
+
+		case 'p':
+			ib_port = atoi(optarg);
+			break;
+
+		case 'g':
+			gid_index = atoi(optarg);
+			break;
+
+		case 'n':
+			iters = atoi(optarg);
+			break;
+
+		case 's':
+			msg_size = atoi(optarg);
+			break;
+
+		case 'm':
+			max_depth = atoi(optarg);
+			break;
+
+		case 'P':
+			peak_pct = atoi(optarg);
+			break;
+
+		default:
+			err("Unknown option %c\n", op);
+			show_usage(argv[0]);
+			return EINVAL;
+		}
+	}
+
+	if (!iters || !msg_size || !peak_pct || peak_pct > 100) {
+		err("Invalid iters %d, size %d or peak-pct %d\n", iters, msg_size, peak_pct);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static long get_rss(void)
+{
+	long size, rss = -1;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return -1;
+
+	if (fscanf(f, "%ld %ld", &size, &rss) != 2)
+		rss = -1;
+	fclose(f);
+
+	return rss < 0 ? -1 : rss * sysconf(_SC_PAGESIZE);
+}
+
+/* Same query as test.c; Returns 0 if devx isn't available */
+static unsigned int query_mlx5_max_qp_wr(void)
+{
+	uint16_t opmod = MLX5_SET_HCA_CAP_OP_MOD_GENERAL_DEVICE | HCA_CAP_OPMOD_GET_CUR;
+	uint32_t in[DEVX_ST_SZ_DW(query_hca_cap_in)] = {};
+	uint32_t out[DEVX_ST_SZ_DW(query_hca_cap_out)] = {};
+	int ret, log_max_qp_wr;
+
+	DEVX_SET(query_hca_cap_in, in, opcode, MLX5_CMD_OP_QUERY_HCA_CAP);
+	DEVX_SET(query_hca_cap_in, in, op_mod, opmod);
+
+	ret = mlx5dv_devx_general_cmd(ibctx, in, sizeof(in), out, sizeof(out));
+	if (ret) {
+		err("mlx5dv_devx_general_cmd(QUERY_HCA_CAP) failed %d, errno %d\n", ret, errno);
+		return 0;
+	}
+
+	log_max_qp_wr = DEVX_GET(query_hca_cap_out, out, capability.cmd_hca_cap.log_max_qp_sz);
+	info("CAP.log_max_qp_sz %d, max qp WQE %d\n", log_max_qp_wr, 1 << log_max_qp_wr);
+	return 1 << log_max_qp_wr;
+}
+
+static unsigned int get_max_qp_wr(void)
+{
+	unsigned int max_wr = 0;
+
+	if (is_mlx5)
+		max_wr = query_mlx5_max_qp_wr();
+
+	if (!max_wr) {
+		max_wr = dev_attr.max_qp_wr;
+		info("ibv_query_device: max_qp_wr %d\n", max_wr);
+	}
+
+	return max_wr;
+}
+
+/* Size of the WQ and CQ buffers; Exact on mlx5, RSS delta on others */
+static long get_footprint(struct ibv_qp *qp, struct ibv_cq *cq, long rss_before)
+{
+	struct mlx5dv_qp dv_qp = {};
+	struct mlx5dv_cq dv_cq = {};
+	struct mlx5dv_obj obj = {};
+	long rss;
+
+	if (is_mlx5) {
+		obj.qp.in = qp;
+		obj.qp.out = &dv_qp;
+		obj.cq.in = cq;
+		obj.cq.out = &dv_cq;
+		if (!mlx5dv_init_obj(&obj, MLX5DV_OBJ_QP | MLX5DV_OBJ_CQ))
+			return (long)dv_qp.sq.wqe_cnt * dv_qp.sq.stride +
+				(long)dv_qp.rq.wqe_cnt * dv_qp.rq.stride +
+				(long)dv_cq.cqe_cnt * dv_cq.cqe_size;
+	}
+
+	rss = get_rss();
+	if (rss < 0 || rss_before < 0)
+		return -1;
+
+	return rss - rss_before;
+}
+
+static int post_recvs(struct ibv_qp *qp, unsigned int num)
+{
+	struct ibv_recv_wr wrs[POST_BATCH], *bad_wr;
+	struct ibv_sge sges[POST_BATCH];
+	unsigned int i, n;
+	int ret;
+
+	while (num) {
+		n = num > POST_BATCH ? POST_BATCH : num;
+		for (i = 0; i < n; i++) {
+			sges[i].addr = (uintptr_t)buf + msg_size;
+			sges[i].length = msg_size;
+			sges[i].lkey = mr->lkey;
+
+			wrs[i].wr_id = RECV_WRID_FLAG;
+			wrs[i].sg_list = &sges[i];
+			wrs[i].num_sge = 1;
+			wrs[i].next = (i == n - 1) ? NULL : &wrs[i + 1];
+		}
+
+		ret = ibv_post_recv(qp, wrs, &bad_wr);
+		if (ret) {
+			err("ibv_post_recv failed %d\n", ret);
+			return ret;
+		}
+		num -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Keep up to @depth SENDs outstanding, post them in chains and poll the CQ
+ * in batches; Receives are re-posted right after the pass that polled
+ * their completions, before more SENDs are posted, so the RQ never has
+ * fewer receives than SENDs in flight and no RNR NAK skews the rates.
+ */
+static int run_traffic(struct ibv_qp *qp, struct ibv_cq *cq, unsigned int depth,
+		       uint64_t *lat, uint64_t *post_ts, struct depth_result *res)
+{
+	struct ibv_send_wr wrs[POST_BATCH], *bad_wr;
+	unsigned int posted = 0, completed = 0, to_repost = 0;
+	unsigned int i, n, outstanding;
+	struct ibv_wc wc[POLL_BATCH];
+	struct ibv_sge sge = {
+		.addr = (uintptr_t)buf,
+		.length = msg_size,
+		.lkey = mr->lkey,
+	};
+	uint64_t t0, now, tm, total = 0;
+	int ne, ret;
+
+	for (i = 0; i < POST_BATCH; i++) {
+		memset(&wrs[i], 0, sizeof(wrs[i]));
+		wrs[i].sg_list = &sge;
+		wrs[i].num_sge = 1;
+		wrs[i].opcode = IBV_WR_SEND;
+		wrs[i].send_flags = IBV_SEND_SIGNALED;
+	}
+
+	ret = post_recvs(qp, depth);
+	if (ret)
+		return ret;
+
+	t0 = get_time_ns();
+	while (completed < iters) {
+		outstanding = posted - completed;
+		n = depth - outstanding;
+		if (n > iters - posted)
+			n = iters - posted;
+		if (n > POST_BATCH)
+			n = POST_BATCH;
+
+		if (n) {
+			now = get_time_ns();
+			for (i = 0; i < n; i++) {
+				wrs[i].wr_id = posted + i;
+				wrs[i].next = (i == n - 1) ? NULL : &wrs[i + 1];
+				post_ts[(posted + i) % depth] = now;
+			}
+
+			ret = ibv_post_send(qp, wrs, &bad_wr);
+			if (ret) {
+				err("ibv_post_send failed %d, depth %d outstanding %d\n",
+				    ret, depth, outstanding);
+				return ret;
+			}
+			posted += n;
+		}
+
+		ne = ibv_poll_cq(cq, POLL_BATCH, wc);
+		if (ne < 0) {
+			err("ibv_poll_cq failed %d\n", ne);
+			return ne;
+		}
+
+		now = get_time_ns();
+		for (i = 0; i < ne; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				err("CQE status %d(%s), opcode %d, wr_id 0x%lx\n",
+				    wc[i].status, ibv_wc_status_str(wc[i].status),
+				    wc[i].opcode, wc[i].wr_id);
+				return -1;
+			}
+
+			if (wc[i].wr_id & RECV_WRID_FLAG) {
+				to_repost++;
+				continue;
+			}
+
+			lat[completed] = now - post_ts[wc[i].wr_id % depth];
+			total += lat[completed];
+			completed++;
+		}
+
+		if (to_repost) {
+			ret = post_recvs(qp, to_repost);
+			if (ret)
+				return ret;
+			to_repost = 0;
+		}
+	}
+	tm = get_time_ns() - t0;
+
+	qsort(lat, iters, sizeof(*lat), cmp_u64);
+	res->mpps = (double)iters * 1000 / (tm ? tm : 1);
+	res->lat_avg = total / iters / 1000.0;
+	res->lat_p50 = lat[iters / 2] / 1000.0;
+	res->lat_p99 = lat[(uint64_t)iters * 99 / 100] / 1000.0;
+	return 0;
+}
+
+static int test_depth(unsigned int depth, uint64_t *lat, struct depth_result *res)
+{
+	struct ibv_qp_init_attr init_attr = {};
+	struct ibv_cq *cq = NULL;
+	struct ibv_qp *qp = NULL;
+	uint64_t *post_ts;
+	long rss;
+	int ret = -1;
+
+	post_ts = calloc(depth, sizeof(*post_ts));
+	if (!post_ts) {
+		perror("calloc");
+		return errno;
+	}
+
+	rss = get_rss();
+	cq = ibv_create_cq(ibctx, depth * 2, NULL, NULL, 0);
+	if (!cq) {
+		err("ibv_create_cq(%d) failed, errno %d\n", depth * 2, errno);
+		goto out;
+	}
+
+	init_attr.qp_type = IBV_QPT_RC;
+	init_attr.send_cq = cq;
+	init_attr.recv_cq = cq;
+	init_attr.cap.max_send_wr = depth;
+	init_attr.cap.max_recv_wr = depth;
+	init_attr.cap.max_send_sge = 1;
+	init_attr.cap.max_recv_sge = 1;
+	qp = ibv_create_qp(pd, &init_attr);
+	if (!qp) {
+		err("ibv_create_qp(depth %d) failed, errno %d\n", depth, errno);
+		goto out;
+	}
+
+	res->depth = depth;
+	res->footprint = get_footprint(qp, cq, rss);
+
+	/* RNR retries just in case, a receive completion polled after its SEND's */
+	ret = connect_loopback_qp(ibctx, qp, ib_port, gid_index, IBV_ACCESS_LOCAL_WRITE, 1);
+	if (ret)
+		goto out;
+
+	ret = run_traffic(qp, cq, depth, lat, post_ts, res);
+
+out:
+	if (qp)
+		ibv_destroy_qp(qp);
+	if (cq)
+		ibv_destroy_cq(cq);
+	free(post_ts);
+	return ret;
+}
+
+static void dump_results(void)
+{
+	struct depth_result *r;
+	double peak = 0;
+	int i, best = -1;
+
+	dump("\n%8s %10s %10s %10s %10s %12s\n", "depth", "Mpps",
+	     "lat_avg", "lat_p50", "lat_p99", "footprint");
+	for (i = 0; i < num_results; i++) {
+		r = &results[i];
+		if (r->footprint >= 0)
+			dump("%8d %10.3f %10.3f %10.3f %10.3f %12ld\n", r->depth,
+			     r->mpps, r->lat_avg, r->lat_p50, r->lat_p99, r->footprint);
+		else
+			dump("%8d %10.3f %10.3f %10.3f %10.3f %12s\n", r->depth,
+			     r->mpps, r->lat_avg, r->lat_p50, r->lat_p99, "n/a");
+		if (r->mpps > peak)
+			peak = r->mpps;
+	}
+	dump("(latency in micro-seconds, footprint in bytes)\n");
+
+	for (i = 0; i < num_results; i++) {
+		if (results[i].mpps * 100 >= peak * peak_pct) {
+			best = i;
+			break;
+		}
+	}
+
+	if (best >= 0)
+		dump("\nPeak rate %.3f Mpps; Recommended depth: %d (%.3f Mpps, %d%% of the peak at least)\n",
+		     peak, results[best].depth, results[best].mpps, peak_pct);
+}
+
+static int run_sweep(void)
+{
+	unsigned int depth, max_wr;
+	uint64_t *lat;
+	int ret = 0;
+
+	max_wr = get_max_qp_wr();
+	if (max_depth && max_depth < max_wr)
+		max_wr = max_depth;
+	/* Sends and receives share one CQ */
+	if (max_wr > dev_attr.max_cqe / 2)
+		max_wr = dev_attr.max_cqe / 2;
+
+	info("Sweeping depth %d..%d, message size %d, %d messages per depth\n",
+	     DEPTH_MIN, max_wr, msg_size, iters);
+
+	lat = calloc(iters, sizeof(*lat));
+	if (!lat) {
+		perror("calloc");
+		return errno;
+	}
+
+	for (depth = DEPTH_MIN; depth <= max_wr && num_results < MAX_DEPTH_RESULTS; depth *= 2) {
+		ret = test_depth(depth, lat, &results[num_results]);
+		if (ret) {
+			err("Test with depth %d failed, sweep stopped\n", depth);
+			break;
+		}
+		info("  depth %d done: %.3f Mpps\n", depth, results[num_results].mpps);
+		num_results++;
+	}
+
+	free(lat);
+	if (num_results)
+		dump_results();
+
+	return num_results ? 0 : ret;
+}
+
+static int setup(void)
+{
+	struct ibv_device **dev_list;
+	struct ibv_device *ibdev;
+	int ret;
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list) {
+		perror("ibv_get_device_list()");
+		return errno;
+	}
+
+	ibdev = find_device(dev_list, dev_name);
+	if (!ibdev) {
+		err("Device not found %s\n", dev_name ? dev_name : "");
+		ibv_free_device_list(dev_list);
+		return ENODEV;
+	}
+
+	is_mlx5 = mlx5dv_is_supported(ibdev);
+	ibctx = ibv_open_device(ibdev);
+	ibv_free_device_list(dev_list);
+	if (!ibctx) {
+		perror("ibv_open_device");
+		return errno;
+	}
+	info("Doing test on ibdev %s (%s)\n", ibctx->device->name,
+	     is_mlx5 ? "mlx5" : "non-mlx5");
+
+	ret = ibv_query_device(ibctx, &dev_attr);
+	if (ret) {
+		err("ibv_query_device failed %d\n", ret);
+		return ret;
+	}
+
+	pd = ibv_alloc_pd(ibctx);
+	if (!pd) {
+		perror("ibv_alloc_pd");
+		return errno;
+	}
+
+	/* One send buffer and one (shared) receive buffer */
+	buf = alloc_reg_buf(pd, msg_size * 2, IBV_ACCESS_LOCAL_WRITE, 0x5a, &mr);
+	if (!buf)
+		return errno;
+
+	return 0;
+}
+
+static void cleanup(void)
+{
+	if (mr)
+		ibv_dereg_mr(mr);
+	free(buf);
+	if (pd)
+		ibv_dealloc_pd(pd);
+	if (ibctx)
+		ibv_close_device(ibctx);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	ret = parse_opt(argc, argv);
+	if (ret)
+		return ret;
+
+	ret = setup();
+	if (!ret)
+		ret = run_sweep();
+
+	cleanup();
+	return ret;
+}
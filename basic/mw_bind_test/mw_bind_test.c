@@ -0,0 +1,503 @@
+/*
+ * Memory window bind-rate test: Grant/revoke remote access to a region of a
+ * large, pre-registered MR by binding and locally invalidating type-2 memory
+ * windows on a loopback RC QP, and compare it with doing ibv_reg_mr() and
+ * ibv_dereg_mr() for every grant.
+ *
+ * gcc -Wall -o mw_bind_test mw_bind_test.c -libverbs
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <infiniband/verbs.h>
+
+#include "../common/basic.h"
+
+#define info(args...) fprintf(stdout, ##args)
+#define err(args...) fprintf(stderr, ##args)
+
+#define dump(args...) fprintf(stdout, ##args)
+
+#define MW_BIND_WRID 0x100
+#define MW_INV_WRID 0x200
+
+static const char *dev_name;
+static unsigned int iters = 100000;
+static unsigned int grant_size = 4096;
+static unsigned long buflen = 64 * 1024 * 1024;
+static unsigned int window = 16;
+static unsigned int ib_port = 1;
+static int gid_index;
+
+static struct ibv_context *ibctx;
+static struct ibv_pd *pd;
+static struct ibv_cq *cq;
+static struct ibv_qp *qp;
+static struct ibv_qp_ex *qpx;
+static char *buf;
+static struct ibv_mr *mr;
+static struct ibv_mw **mws;
+static uint32_t *mw_rkeys;	/* The rkey each MW is bound with, last bind */
+
+struct lat_stat {
+	uint64_t *samples;
+	uint64_t total;
+};
+
+static void show_usage(char *prog)
+{
+	printf("Usage: %s [OPTION]\n", prog);
+	printf("  [-d, --device] <ib_device>  - IB device (the first one by default)\n");
+	printf("  [-p, --ib-port] <port>      - IB port (1 by default)\n");
+	printf("  [-g, --gid-index] <index>   - GID index, for RoCE (0 by default)\n");
+	printf("  [-n, --iters] <num>         - Number of grant/revoke iterations (%d by default)\n", iters);
+	printf("  [-s, --size] <bytes>        - Size of each grant (%d by default)\n", grant_size);
+	printf("  [-b, --buf-size] <bytes>    - Size of the large MR (%ld by default)\n", buflen);
+	printf("  [-w, --window] <num>        - Number of MWs bound in one batch (%d by default)\n", window);
+	printf("  [-h, --help]                - Show help\n");
+}
+
+static int parse_opt(int argc, char *argv[])
+{
+	static const struct option long_opts[] = {
+		{"help", 0, NULL, 'h'},
+		{"device", 1, NULL, 'd'},
+		{"ib-port", 1, NULL, 'p'},
+		{"gid-index", 1, NULL, 'g'},
+		{"iters", 1, NULL, 'n'},
+		{"size", 1, NULL, 's'},
+		{"buf-size", 1, NULL, 'b'},
+		{"window", 1, NULL, 'w'},
+		{},
+	};
+	int op;
+
+	while ((op = getopt_long(argc, argv, "hd:p:g:n:s:b:w:", long_opts, NULL)) != -1) {
+		switch (op) {
+		case 'h':
+			show_usage(argv[0]);
+			exit(0);
+
+		case 'd':
+			dev_name = optarg;
+			break;
+
+		case 'p':
+			ib_port = atoi(optarg);
+			break;
+
+		case 'g':
+			gid_index = atoi(optarg);
+			break;
+
+		case 'n':
+			iters = atoi(optarg);
+			break;
+
+		case 's':
+			grant_size = atoi(optarg);
+			break;
+
+		case 'b':
+			buflen = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'w':
+			window = atoi(optarg);
+			break;
+
+		default:
+			err("Unknown option %c\n", op);
+			show_usage(argv[0]);
+			return EINVAL;
+		}
+	}
+
+	if (!iters || !window || !grant_size || grant_size > buflen) {
+		err("Invalid iters %d, window %d, size %d or buf-size %ld\n",
+		    iters, window, grant_size, buflen);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+/* Busy-poll until @num completions are received */
+static int poll_completions(int num)
+{
+	struct ibv_wc wc[16];
+	int i, n;
+
+	while (num > 0) {
+		n = ibv_poll_cq(cq, num > 16 ? 16 : num, wc);
+		if (n < 0) {
+			err("ibv_poll_cq failed %d\n", n);
+			return n;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				err("CQE status %d(%s), opcode %d, wr_id 0x%lx\n",
+				    wc[i].status, ibv_wc_status_str(wc[i].status),
+				    wc[i].opcode, wc[i].wr_id);
+				return -1;
+			}
+		}
+		num -= n;
+	}
+
+	return 0;
+}
+
+static int create_loopback_qp(void)
+{
+	struct ibv_qp_init_attr_ex init_attr = {};
+
+	init_attr.qp_type = IBV_QPT_RC;
+	init_attr.send_cq = cq;
+	init_attr.recv_cq = cq;
+	/* Each grant in a batch takes two WQEs: bind and local invalidate */
+	init_attr.cap.max_send_wr = window * 2;
+	init_attr.cap.max_recv_wr = 1;
+	init_attr.cap.max_send_sge = 1;
+	init_attr.cap.max_recv_sge = 1;
+	init_attr.pd = pd;
+	init_attr.comp_mask = IBV_QP_INIT_ATTR_PD | IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
+	init_attr.send_ops_flags = IBV_QP_EX_WITH_BIND_MW | IBV_QP_EX_WITH_LOCAL_INV;
+
+	qp = ibv_create_qp_ex(ibctx, &init_attr);
+	if (!qp) {
+		perror("ibv_create_qp_ex");
+		return errno;
+	}
+	qpx = ibv_qp_to_qp_ex(qp);
+
+	return connect_loopback_qp(ibctx, qp, ib_port, gid_index,
+				   IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+				   IBV_ACCESS_REMOTE_WRITE, 12);
+}
+
+static int setup(void)
+{
+	struct ibv_device **dev_list;
+	struct ibv_device *ibdev;
+	int i, ret;
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list) {
+		perror("ibv_get_device_list()");
+		return errno;
+	}
+
+	ibdev = find_device(dev_list, dev_name);
+	if (!ibdev) {
+		err("Device not found %s\n", dev_name ? dev_name : "");
+		ibv_free_device_list(dev_list);
+		return ENODEV;
+	}
+
+	ibctx = ibv_open_device(ibdev);
+	ibv_free_device_list(dev_list);
+	if (!ibctx) {
+		perror("ibv_open_device");
+		return errno;
+	}
+	info("Doing test on ibdev %s\n", ibctx->device->name);
+
+	pd = ibv_alloc_pd(ibctx);
+	if (!pd) {
+		perror("ibv_alloc_pd");
+		return errno;
+	}
+
+	buf = alloc_reg_buf(pd, buflen, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+			    IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_MW_BIND, 0, &mr);
+	if (!buf)
+		return errno;
+
+	cq = ibv_create_cq(ibctx, window * 2, NULL, NULL, 0);
+	if (!cq) {
+		perror("ibv_create_cq");
+		return errno;
+	}
+
+	ret = create_loopback_qp();
+	if (ret)
+		return ret;
+
+	mws = calloc(window, sizeof(*mws));
+	mw_rkeys = calloc(window, sizeof(*mw_rkeys));
+	if (!mws || !mw_rkeys) {
+		perror("calloc");
+		return errno;
+	}
+
+	for (i = 0; i < window; i++) {
+		mws[i] = ibv_alloc_mw(pd, IBV_MW_TYPE_2);
+		if (!mws[i]) {
+			perror("ibv_alloc_mw(TYPE_2)");
+			return errno;
+		}
+		mw_rkeys[i] = mws[i]->rkey;
+	}
+
+	return 0;
+}
+
+static void cleanup(void)
+{
+	int i;
+
+	if (mws) {
+		for (i = 0; i < window; i++)
+			if (mws[i])
+				ibv_dealloc_mw(mws[i]);
+		free(mws);
+	}
+	free(mw_rkeys);
+
+	if (qp)
+		ibv_destroy_qp(qp);
+	if (cq)
+		ibv_destroy_cq(cq);
+	if (mr)
+		ibv_dereg_mr(mr);
+	free(buf);
+	if (pd)
+		ibv_dealloc_pd(pd);
+	if (ibctx)
+		ibv_close_device(ibctx);
+}
+
+static uint64_t grant_offset(unsigned int i)
+{
+	return ((uint64_t)i * grant_size) % (buflen - grant_size + 1);
+}
+
+/*
+ * ibv_wr_bind_mw() doesn't update mw->rkey, so the key of the last bind of
+ * MW @w is kept in mw_rkeys[w]: Each bind takes the next one, and the local
+ * invalidate revokes that one.
+ */
+static void post_bind(unsigned int w, unsigned int i, uint32_t flags)
+{
+	struct ibv_mw_bind_info bind_info = {
+		.mr = mr,
+		.addr = (uint64_t)(uintptr_t)buf + grant_offset(i),
+		.length = grant_size,
+		.mw_access_flags = IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE,
+	};
+
+	qpx->wr_id = MW_BIND_WRID;
+	qpx->wr_flags = flags;
+	mw_rkeys[w] = ibv_inc_rkey(mw_rkeys[w]);
+	ibv_wr_bind_mw(qpx, mws[w], mw_rkeys[w], &bind_info);
+}
+
+static void post_local_inv(unsigned int w, uint32_t flags)
+{
+	qpx->wr_id = MW_INV_WRID;
+	qpx->wr_flags = flags;
+	ibv_wr_local_inv(qpx, mw_rkeys[w]);
+}
+
+/* One signaled bind and one signaled invalidate per iteration */
+static int test_mw_latency(struct lat_stat *grant, struct lat_stat *revoke)
+{
+	uint64_t t0, t1, t2;
+	int i, ret;
+
+	for (i = 0; i < iters; i++) {
+		t0 = get_time_ns();
+		ibv_wr_start(qpx);
+		post_bind(0, i, IBV_SEND_SIGNALED);
+		ret = ibv_wr_complete(qpx);
+		if (ret) {
+			err("ibv_wr_complete(bind) failed %d\n", ret);
+			return ret;
+		}
+		ret = poll_completions(1);
+		if (ret)
+			return ret;
+
+		t1 = get_time_ns();
+		ibv_wr_start(qpx);
+		post_local_inv(0, IBV_SEND_SIGNALED);
+		ret = ibv_wr_complete(qpx);
+		if (ret) {
+			err("ibv_wr_complete(local_inv) failed %d\n", ret);
+			return ret;
+		}
+		ret = poll_completions(1);
+		if (ret)
+			return ret;
+		t2 = get_time_ns();
+
+		grant->samples[i] = t1 - t0;
+		revoke->samples[i] = t2 - t1;
+	}
+
+	return 0;
+}
+
+/*
+ * Bind and invalidate @window MWs in one batch (one doorbell), only the last
+ * WR is signaled. Returns the time used in ns, or 0 on failure.
+ */
+static uint64_t test_mw_rate(void)
+{
+	unsigned int j, n, done = 0;
+	uint64_t t0, tm;
+	int ret;
+
+	t0 = get_time_ns();
+	while (done < iters) {
+		n = (iters - done < window) ? iters - done : window;
+
+		ibv_wr_start(qpx);
+		for (j = 0; j < n; j++)
+			post_bind(j, done + j, 0);
+		for (j = 0; j < n; j++)
+			post_local_inv(j, (j == n - 1) ? IBV_SEND_SIGNALED : 0);
+		ret = ibv_wr_complete(qpx);
+		if (ret) {
+			err("ibv_wr_complete failed %d\n", ret);
+			return 0;
+		}
+
+		ret = poll_completions(1);
+		if (ret)
+			return 0;
+
+		done += n;
+	}
+
+	tm = get_time_ns() - t0;
+	return tm ? tm : 1;
+}
+
+static int test_mr_latency(struct lat_stat *grant, struct lat_stat *revoke)
+{
+	uint64_t t0, t1, t2;
+	struct ibv_mr *gmr;
+	int i, ret;
+
+	for (i = 0; i < iters; i++) {
+		t0 = get_time_ns();
+		gmr = ibv_reg_mr(pd, buf + grant_offset(i), grant_size,
+				 IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+				 IBV_ACCESS_REMOTE_WRITE);
+		if (!gmr) {
+			perror("ibv_reg_mr");
+			return errno;
+		}
+
+		t1 = get_time_ns();
+		ret = ibv_dereg_mr(gmr);
+		if (ret) {
+			perror("ibv_dereg_mr");
+			return ret;
+		}
+		t2 = get_time_ns();
+
+		grant->samples[i] = t1 - t0;
+		revoke->samples[i] = t2 - t1;
+	}
+
+	return 0;
+}
+
+static void dump_lat(const char *name, struct lat_stat *s)
+{
+	uint64_t avg;
+	int i;
+
+	s->total = 0;
+	for (i = 0; i < iters; i++)
+		s->total += s->samples[i];
+	avg = s->total / iters;
+
+	qsort(s->samples, iters, sizeof(*s->samples), cmp_u64);
+	dump("  %-14s %9.3f %9.3f %9.3f %9.3f %9.3f\n", name,
+	     s->samples[0] / 1000.0, avg / 1000.0, s->samples[iters / 2] / 1000.0,
+	     s->samples[(uint64_t)iters * 99 / 100] / 1000.0,
+	     s->samples[iters - 1] / 1000.0);
+}
+
+static int run_test(void)
+{
+	struct lat_stat mw_grant, mw_revoke, mr_grant, mr_revoke;
+	uint64_t mw_tm, mw_lat_total, mr_lat_total;
+	int ret = -1;
+
+	mw_grant.samples = calloc(iters, sizeof(uint64_t));
+	mw_revoke.samples = calloc(iters, sizeof(uint64_t));
+	mr_grant.samples = calloc(iters, sizeof(uint64_t));
+	mr_revoke.samples = calloc(iters, sizeof(uint64_t));
+	if (!mw_grant.samples || !mw_revoke.samples ||
+	    !mr_grant.samples || !mr_revoke.samples) {
+		perror("calloc");
+		goto out;
+	}
+
+	info("Grant size %d, MR size %ld, iterations %d, window %d\n",
+	     grant_size, buflen, iters, window);
+
+	ret = test_mw_latency(&mw_grant, &mw_revoke);
+	if (ret)
+		goto out;
+
+	mw_tm = test_mw_rate();
+	if (!mw_tm) {
+		ret = -1;
+		goto out;
+	}
+
+	ret = test_mr_latency(&mr_grant, &mr_revoke);
+	if (ret)
+		goto out;
+
+	dump("\nLatency (in micro-seconds):\n");
+	dump("  %-14s %9s %9s %9s %9s %9s\n", "", "min", "avg", "p50", "p99", "max");
+	dump_lat("mw_bind", &mw_grant);
+	dump_lat("mw_local_inv", &mw_revoke);
+	dump_lat("reg_mr", &mr_grant);
+	dump_lat("dereg_mr", &mr_revoke);
+
+	mw_lat_total = mw_grant.total + mw_revoke.total;
+	mr_lat_total = mr_grant.total + mr_revoke.total;
+	dump("\nGrant/revoke rate (pairs per second):\n");
+	dump("  mw, one at a time:      %12.0f\n", iters * 1e9 / mw_lat_total);
+	dump("  mw, %4d per batch:     %12.0f\n", window, iters * 1e9 / mw_tm);
+	dump("  reg_mr/dereg_mr:        %12.0f\n", iters * 1e9 / mr_lat_total);
+	dump("\nmw (batched) vs. reg_mr/dereg_mr speedup: %.1fx\n",
+	     (double)mr_lat_total / mw_tm);
+
+out:
+	free(mw_grant.samples);
+	free(mw_revoke.samples);
+	free(mr_grant.samples);
+	free(mr_revoke.samples);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	ret = parse_opt(argc, argv);
+	if (ret)
+		return ret;
+
+	ret = setup();
+	if (!ret)
+		ret = run_test();
+
+	cleanup();
+	return ret;
+}
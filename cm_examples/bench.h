@@ -0,0 +1,47 @@
+#ifndef CM_EXAMPLES_BENCH_H
+#define CM_EXAMPLES_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Timing and latency reports of the benchmarks */
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sorts @lat (ns) and prints its distribution in us */
+static inline void dump_lat(const char *name, uint64_t *lat, unsigned long n)
+{
+	uint64_t total = 0;
+	unsigned long i;
+
+	if (!n) {
+		printf("  %-22s: -\n", name);
+		return;
+	}
+
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+	for (i = 0; i < n; i++)
+		total += lat[i];
+
+	printf("  %-22s: n %6lu, avg %9.1f, p50 %9.1f, p90 %9.1f, p99 %9.1f, p99.9 %9.1f, max %9.1f us\n",
+	       name, n, total / 1000.0 / n, lat[n / 2] / 1000.0,
+	       lat[n * 90 / 100] / 1000.0, lat[n * 99 / 100] / 1000.0,
+	       lat[n * 999 / 1000] / 1000.0, lat[n - 1] / 1000.0);
+}
+
+#endif
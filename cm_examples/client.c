@@ -1,14 +1,33 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 #include <rdma/rdma_cma.h>
 
+#include "bench.h"
+#include "comp.h"
 #include "helper.h"
 #include "params.h"
+#include "proto.h"
+#include "rcache.h"
+
+#define DEF_MSG_SIZE 64
+#define DEF_ITERS 100000
+#define DEF_STREAM_WINDOW 64
+#define MAX_SAMPLES (1 << 20)
+#define WRID_RECV (1ULL << 63)
+#define MAX_BATCH 64
+#define DEF_BULK_CHUNK (1U << 20)
+#define DEF_BULK_LEN (256UL << 20)
 
 static struct rdma_event_channel *ech;
 static struct rdma_cm_id *cm_id;
@@ -16,12 +35,97 @@ static struct rdma_cm_id *cm_id;
 static const char *server = CM_EXAMPLE_SERVER_IP;
 
 static struct ibv_pd *pd;
-static struct ibv_cq *cq;
+static struct comp comp;
 static struct ibv_mr *mr;
 static char buf[BUFSIZE];
 
+/*
+ * Benchmark modes, negotiated with server.c in the connect private data;
+ * Without one, a single string is sent as before
+ */
+static int mode = CM_MODE_PRINT;
+static uint32_t msg_size;
+static uint32_t window;
+static uint64_t iters = DEF_ITERS;
+static char *bench_buf;		/* window receive slots, then the send buffer(s) */
+static uint32_t slot_size;
+static size_t bench_len;
+
+/* Bulk modes, the source moved into the region of server.c */
+static const char *bulk_file;
+static char *bulk_src;
+static size_t bulk_len;
+static struct ibv_mr *bulk_mr;
+static struct cm_region peer;
+
+/* How the messages are posted, see -b, -c, -i and -x */
+struct post_cfg {
+	unsigned int batch;		/* WRs chained per post, one doorbell */
+	unsigned int sig_every;		/* Every n-th send signaled */
+	bool inl;
+	bool wr_api;			/* ibv_wr_*() instead of ibv_post_send() */
+};
+
+struct bench_res {
+	double mpps;
+	double gbps;
+	uint64_t p50, p99;		/* ns */
+};
+
+static struct post_cfg pcfg = { .batch = 1, .sig_every = 1 };
+static bool sweep;
+static struct ibv_qp_ex *qpx;
+static uint32_t max_inline;
+
+/* Completion handling, see -C and -B, and the offered load of -R */
+static int comp_mode = COMP_POLL;
+static uint64_t comp_budget_ns = COMP_DEF_BUDGET_NS;
+static uint64_t rate;
+
+/* Resolutions of the earlier runs, see -r and -T */
+static struct rcache rcache;
+static const char *rcache_file;
+static unsigned int rcache_ttl;
+
+static const char *const mode_str[CM_MODE_NUM] = {
+	[CM_MODE_ECHO] = "ping-pong",
+	[CM_MODE_SINK] = "uni-stream",
+	[CM_MODE_BIDIR] = "bi-stream",
+	[CM_MODE_BULK_WRITE] = "rdma-write",
+	[CM_MODE_BULK_WRITE_IMM] = "rdma-write-imm",
+	[CM_MODE_BULK_READ] = "rdma-read",
+	[CM_MODE_BULK_SEND] = "send-copy",
+};
+
+static bool is_bulk(void)
+{
+	return mode >= CM_MODE_BULK_WRITE && mode <= CM_MODE_BULK_SEND;
+}
+
+static int post_recv_slot(uint32_t slot)
+{
+	struct ibv_sge sg_list = {
+		.addr   = (uintptr_t)bench_buf + (size_t)slot * slot_size,
+		.length = slot_size,
+		.lkey   = mr->lkey,
+	};
+	struct ibv_recv_wr wr = {
+		.wr_id   = WRID_RECV | slot,
+		.sg_list = &sg_list,
+		.num_sge = 1,
+	}, *bad_wr;
+	int err;
+
+	err = ibv_post_recv(cm_id->qp, &wr, &bad_wr);
+	if (err)
+		perror("ibv_post_recv");
+	return err;
+}
+
 static int setup_qp_client(void)
 {
+	uint32_t depth = window > 32 ? window : 32, i;
+	struct ibv_qp_init_attr_ex attr_ex;
 	int ret;
 
 	pd = ibv_alloc_pd(cm_id->verbs);
@@ -30,35 +134,73 @@ static int setup_qp_client(void)
 		return -1;
 	}
 
-	mr = ibv_reg_mr(pd, buf, BUFSIZE, IBV_ACCESS_LOCAL_WRITE);
+	if (bench_buf)
+		mr = ibv_reg_mr(pd, bench_buf, bench_len, IBV_ACCESS_LOCAL_WRITE);
+	else
+		mr = ibv_reg_mr(pd, buf, BUFSIZE, IBV_ACCESS_LOCAL_WRITE);
 	if (!mr) {
 		perror("ibv_reg_mr");
 		return -1;
 	}
 
-	cq = ibv_create_cq(cm_id->verbs, 32, NULL, NULL, 0);
-	if (!cq) {
-		perror("ibv_create_cq");
-		return -1;
+	/* Only read, locally or by the server */
+	if (bulk_src && mode != CM_MODE_BULK_SEND) {
+		bulk_mr = ibv_reg_mr(pd, bulk_src, bulk_len, IBV_ACCESS_REMOTE_READ);
+		if (!bulk_mr) {
+			perror("ibv_reg_mr");
+			return -1;
+		}
 	}
 
+	/* Sends may complete after the echoes they caused */
+	if (comp_init(&comp, cm_id->verbs, depth * 4, NULL, comp_mode,
+		      COMP_DEF_BATCH, comp_budget_ns) || comp_wait_init(&comp))
+		return -1;
+
 	struct ibv_qp_init_attr init_attr = {
 		.cap = {
-			.max_send_wr = 32,
-			.max_recv_wr = 32,
+			.max_send_wr = depth * 2,
+			.max_recv_wr = depth,
 			.max_send_sge = 1,
 			.max_recv_sge = 1,
 			.max_inline_data = 64,
 		},
 		.qp_type = IBV_QPT_RC,
-		.send_cq = cq,
-		.recv_cq = cq,
+		.send_cq = comp.cq,
+		.recv_cq = comp.cq,
 	};
 
-	ret = rdma_create_qp(cm_id, pd, &init_attr);
-	if (ret) {
-		perror("rdma_create_qp");
-		return -1;
+	if (pcfg.wr_api || sweep) {
+		memset(&attr_ex, 0, sizeof(attr_ex));
+		attr_ex.cap = init_attr.cap;
+		attr_ex.qp_type = init_attr.qp_type;
+		attr_ex.send_cq = comp.cq;
+		attr_ex.recv_cq = comp.cq;
+		attr_ex.comp_mask = IBV_QP_INIT_ATTR_PD | IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
+		attr_ex.pd = pd;
+		attr_ex.send_ops_flags = IBV_QP_EX_WITH_SEND;
+
+		ret = rdma_create_qp_ex(cm_id, &attr_ex);
+		if (ret) {
+			perror("rdma_create_qp_ex");
+			return -1;
+		}
+		qpx = ibv_qp_to_qp_ex(cm_id->qp);
+		max_inline = attr_ex.cap.max_inline_data;
+	} else {
+		ret = rdma_create_qp(cm_id, pd, &init_attr);
+		if (ret) {
+			perror("rdma_create_qp");
+			return -1;
+		}
+		max_inline = init_attr.cap.max_inline_data;
+	}
+
+	/* Before connecting, a bi-stream starts right away */
+	for (i = 0; bench_buf && i < window; i++) {
+		ret = post_recv_slot(i);
+		if (ret)
+			return ret;
 	}
 
 	return 0;
@@ -67,8 +209,19 @@ static int setup_qp_client(void)
 static int start_cm_client(void)
 {
 	struct rdma_conn_param param = {};
+	struct cm_hello hello = {
+		.magic = htobe32(CM_HELLO_MAGIC),
+		.mode = mode,
+		.msg_size = htobe32(msg_size),
+		.window = htobe32(window),
+		.iters = htobe64(iters),
+	};
+	char key[RCACHE_KEY_LEN];
 	struct sockaddr_in sin = {};
         struct rdma_cm_event *e;
+	struct rcache_entry ce;
+	uint64_t start;
+	bool hit;
 	int err;
 
 	INFO("Server IP %s port %d..", server, CM_EXAMPLE_SERVER_PORT);
@@ -92,16 +245,24 @@ static int start_cm_client(void)
 		return err;
 	}
 
-	err = rdma_resolve_addr(cm_id, NULL, (struct sockaddr *)&sin, 1000 /* ms */);
+	rcache_key_addr(key, (struct sockaddr *)&sin);
+	hit = !rcache_lookup(&rcache, key, &ce);
+	start = get_time_ns();
+	if (hit)
+		err = rcache_resolve_addr(cm_id, &ce, 1000 /* ms */);
+	else
+		err = rdma_resolve_addr(cm_id, NULL, (struct sockaddr *)&sin, 1000 /* ms */);
 	if (err) {
 		perror("rdma_resolve_addr");
 		return err;
 	}
 
+	/* A stale entry fails here, resolved from scratch the next time */
 	err = rdma_get_cm_event(ech, &e);
 	if (err || (e->event != RDMA_CM_EVENT_ADDR_RESOLVED)) {
 		ERR("Expects RDMA_CM_EVENT_ESTABLISHED get %d(%s): %d",
 		    e->event, rdma_event_str(e->event), err);
+		rcache_invalidate(&rcache, key);
 		return -1;
 	}
 	err = rdma_ack_cm_event(e);
@@ -111,7 +272,7 @@ static int start_cm_client(void)
 	}
 	INFO("rdma_resolve_addr done");
 
-	err = rdma_resolve_route(cm_id, 5000);
+	err = rcache_resolve_route(cm_id, hit ? &ce : NULL, 5000);
 	if (err) {
 		perror("rdma_resolve_route");
 		return err;
@@ -121,6 +282,7 @@ static int start_cm_client(void)
 	if (err || (e->event != RDMA_CM_EVENT_ROUTE_RESOLVED)) {
 		ERR("Expects RDMA_CM_EVENT_ESTABLISHED get %d(%s): %d",
 		    e->event, rdma_event_str(e->event), err);
+		rcache_invalidate(&rcache, key);
 		return -1;
 	}
 	err = rdma_ack_cm_event(e);
@@ -130,11 +292,31 @@ static int start_cm_client(void)
 	}
 	INFO("rdma_resolve_route done");
 
+	if (!hit)
+		rcache_store(&rcache, key, cm_id);
+	if (rcache_file)
+		dump("%s resolved in %.1f us, %s\n", key, (get_time_ns() - start) / 1000.0,
+		     hit ? "cached" : "from scratch");
+
 	err = setup_qp_client();
 	if (err)
 		return err;
 	INFO("setup qp done");
 
+	if (mode != CM_MODE_PRINT) {
+		param.private_data = &hello;
+		param.private_data_len = sizeof(hello);
+		param.rnr_retry_count = 7;
+	}
+	if (is_bulk()) {
+		hello.len = htobe64(bulk_len);
+		if (bulk_mr) {
+			hello.addr = htobe64((uintptr_t)bulk_src);
+			hello.rkey = htobe32(bulk_mr->rkey);
+		}
+		param.initiator_depth = RDMA_MAX_INIT_DEPTH;
+		param.responder_resources = RDMA_MAX_RESP_RES;
+	}
 	err = rdma_connect(cm_id, &param);
 	if (err) {
 		perror("rdma_connect");
@@ -147,6 +329,9 @@ static int start_cm_client(void)
 		    e->event, rdma_event_str(e->event), err);
 		return -1;
 	}
+	/* The private data is gone once acked */
+	if (is_bulk() && e->param.conn.private_data_len >= sizeof(peer))
+		memcpy(&peer, e->param.conn.private_data, sizeof(peer));
 	err = rdma_ack_cm_event(e);
 	if (err) {
 		perror("rdma_ack_cm_event");
@@ -154,6 +339,16 @@ static int start_cm_client(void)
 	}
 	INFO("Connection established");
 
+	if (is_bulk()) {
+		if (be32toh(peer.magic) != CM_HELLO_MAGIC || !peer.len) {
+			ERR("No region from the server, an older one?");
+			return -1;
+		}
+		peer.rkey = be32toh(peer.rkey);
+		peer.addr = be64toh(peer.addr);
+		peer.len = be64toh(peer.len);
+	}
+
 	return 0;
 }
 
@@ -173,7 +368,7 @@ static void send_data(void)
 		.send_flags = IBV_SEND_SIGNALED, /* XXX */
 	}, *bad_wr;
 	int err, size, msgid = 0, num_comp;
-	struct ibv_wc wc;
+	struct ibv_wc wc[COMP_MAX_BATCH];
 
 	do {
 		INFO("Sleep 2 seconds to wait server to prepare..");
@@ -191,37 +386,613 @@ static void send_data(void)
 		INFO("Sent(size %d): `%s'", size, buf);
 
 		do {
-			num_comp = ibv_poll_cq(cq, 1, &wc);
+			num_comp = comp_wait(&comp, wc, COMP_FOREVER);
 		} while (num_comp == 0);
 
 		if (num_comp < 0) {
-			perror("ibv_poll_cq");
+			perror("comp_wait");
 			return;
 		}
 
-		if (wc.status != IBV_WC_SUCCESS) {
+		if (wc[0].status != IBV_WC_SUCCESS) {
 			INFO("Failed status %s(%x) for wr_id %d\n",
-			    ibv_wc_status_str(wc.status), wc.status, (int)wc.wr_id);
+			    ibv_wc_status_str(wc[0].status), wc[0].status, (int)wc[0].wr_id);
 			return;
 		}
 	} while (0);
 }
 
+/* The last send is always signaled, to know the run is done */
+static bool is_signaled(const struct post_cfg *cfg, uint64_t seq)
+{
+	return !((seq + 1) % cfg->sig_every) || seq + 1 == iters;
+}
+
+/* Posts messages seq to seq + n - 1 with one doorbell */
+static int post_sends(const struct post_cfg *cfg, uint64_t seq, unsigned int n)
+{
+	char *p = bench_buf + (size_t)window * slot_size;
+	struct ibv_sge sg_list = {
+		.addr   = (uintptr_t)p,
+		.length = msg_size,
+		.lkey   = mr->lkey,
+	};
+	struct ibv_send_wr wr[MAX_BATCH], *bad_wr;
+	unsigned int i;
+	int err;
+
+	if (cfg->wr_api) {
+		ibv_wr_start(qpx);
+		for (i = 0; i < n; i++) {
+			qpx->wr_id = seq + i;
+			qpx->wr_flags = is_signaled(cfg, seq + i) ? IBV_SEND_SIGNALED : 0;
+			ibv_wr_send(qpx);
+			if (cfg->inl)
+				ibv_wr_set_inline_data(qpx, p, msg_size);
+			else
+				ibv_wr_set_sge(qpx, mr->lkey, (uintptr_t)p, msg_size);
+		}
+		err = ibv_wr_complete(qpx);
+		if (err) {
+			errno = err;
+			perror("ibv_wr_complete");
+		}
+		return err;
+	}
+
+	for (i = 0; i < n; i++) {
+		memset(&wr[i], 0, sizeof(wr[i]));
+		wr[i].wr_id = seq + i;
+		wr[i].next = i + 1 < n ? &wr[i + 1] : NULL;
+		wr[i].sg_list = &sg_list;
+		wr[i].num_sge = 1;
+		wr[i].opcode = IBV_WR_SEND;
+		wr[i].send_flags = (is_signaled(cfg, seq + i) ? IBV_SEND_SIGNALED : 0) |
+				   (cfg->inl ? IBV_SEND_INLINE : 0);
+	}
+
+	err = ibv_post_send(cm_id->qp, wr, &bad_wr);
+	if (err)
+		perror("ibv_post_send");
+	return err;
+}
+
+/*
+ * Ping-pong keeps window messages waiting for their echo, the streams
+ * window sends in flight; Sends and echoes complete in order, so the
+ * n-th completion is timed against the n-th send, and a signaled send
+ * completes all before it.
+ */
+static uint64_t cpu_time_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+	       (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+static int run_bench(const struct post_cfg *cfg, struct bench_res *res)
+{
+	uint64_t rx_total = mode == CM_MODE_SINK ? 0 : iters;
+	uint64_t sent = 0, tx_done = 0, rx_done = 0, nsamples = 0, inflight;
+	uint64_t *ts, *samples, start, wall, now, msgs, n, k, cpu, deadline;
+	uint64_t gap = rate ? 1000000000ULL / rate : 0, next_send;
+	uint64_t polls = comp.polls, empty = comp.empty_polls, events = comp.events;
+	struct ibv_wc wc[COMP_MAX_BATCH];
+	int ret = -1, ne, i;
+
+	ts = calloc(window, sizeof(*ts));
+	samples = calloc(iters < MAX_SAMPLES ? iters : MAX_SAMPLES, sizeof(*samples));
+	if (!ts || !samples) {
+		ERR("Failed to allocate latency samples");
+		goto out;
+	}
+
+	cpu = cpu_time_ns();
+	start = get_time_ns();
+	next_send = start;
+	while (tx_done < iters || rx_done < rx_total) {
+		/* Whole batches only, unless it's the tail */
+		inflight = sent - (mode == CM_MODE_ECHO ? rx_done : tx_done);
+		n = iters - sent < cfg->batch ? iters - sent : cfg->batch;
+		now = get_time_ns();
+		while (n && window - inflight >= n && now >= next_send) {
+			for (k = 0; k < n; k++)
+				ts[(sent + k) % window] = now;
+			if (post_sends(cfg, sent, n))
+				goto out;
+			sent += n;
+			inflight += n;
+			next_send += n * gap;
+			n = iters - sent < cfg->batch ? iters - sent : cfg->batch;
+			now = get_time_ns();
+		}
+
+		/* Paced, wake up for the next send if the window allows it */
+		deadline = COMP_FOREVER;
+		if (gap && n && window - inflight >= n)
+			deadline = next_send;
+
+		ne = comp_wait(&comp, wc, deadline);
+		if (ne < 0)
+			goto out;
+
+		for (i = 0; i < ne; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				ERR("Failed status %s(%x) for wr_id 0x%lx",
+				    ibv_wc_status_str(wc[i].status), wc[i].status, wc[i].wr_id);
+				goto out;
+			}
+
+			now = get_time_ns();
+			if (wc[i].wr_id & WRID_RECV) {
+				if (mode == CM_MODE_ECHO)
+					samples[nsamples++ % MAX_SAMPLES] = now - ts[rx_done % window];
+				rx_done++;
+				if (post_recv_slot(wc[i].wr_id & ~WRID_RECV))
+					goto out;
+			} else {
+				if (mode != CM_MODE_ECHO)
+					samples[nsamples++ % MAX_SAMPLES] = now - ts[wc[i].wr_id % window];
+				tx_done = wc[i].wr_id + 1;
+			}
+		}
+	}
+	wall = get_time_ns() - start;
+	cpu = cpu_time_ns() - cpu;
+
+	/* A round trip is one message for the ping-pong */
+	msgs = mode == CM_MODE_BIDIR ? tx_done + rx_done : tx_done;
+	if (nsamples > MAX_SAMPLES)
+		nsamples = MAX_SAMPLES;
+	res->mpps = msgs * 1e3 / wall;
+	res->gbps = msgs * msg_size * 8.0 / wall;
+	if (sweep) {
+		qsort(samples, nsamples, sizeof(*samples), cmp_u64);
+		res->p50 = samples[nsamples / 2];
+		res->p99 = samples[nsamples * 99 / 100];
+		ret = 0;
+		goto out;
+	}
+
+	dump("%s: %" PRIu64 " messages of %u bytes, window %u, in %.3f s\n",
+	     mode_str[mode], msgs, msg_size, window, wall / 1e9);
+	dump("  batch %u, signaled every %u, %s, %s\n", cfg->batch, cfg->sig_every,
+	     cfg->inl ? "inline" : "sge", cfg->wr_api ? "ibv_wr_*()" : "ibv_post_send()");
+	dump("  %.3f Mpps, %.3f Gb/s, offered %s\n", res->mpps, res->gbps,
+	     rate ? "paced" : "as fast as the window allows");
+	dump("  %s completions: cpu %.1f%%, %.3f us per message, %" PRIu64 " polls (%.1f%% empty), %" PRIu64 " events\n",
+	     comp_mode_str(comp_mode), cpu * 100.0 / wall, msgs ? cpu / 1000.0 / msgs : 0,
+	     comp.polls - polls, comp.polls - polls ?
+	     (comp.empty_polls - empty) * 100.0 / (comp.polls - polls) : 0,
+	     comp.events - events);
+	dump_lat(mode == CM_MODE_ECHO ? "round trip" : "send completion", samples, nsamples);
+	ret = 0;
+
+out:
+	free(samples);
+	free(ts);
+	return ret;
+}
+
+/* Message rate of every posting strategy on the same connection */
+static int run_sweep(void)
+{
+	static const unsigned int batches[] = { 1, 4, 16, 64 };
+	static const unsigned int sigs[] = { 1, 8, 64 };
+	struct post_cfg cfg, best_cfg = {};
+	struct bench_res res, best = {};
+	unsigned int b, c, inl, api;
+	int ret;
+
+	dump("uni-stream, %" PRIu64 " messages of %u bytes per run, window %u, max inline %u\n",
+	     iters, msg_size, window, max_inline);
+	dump("%6s %6s %7s %14s %9s %9s %9s %9s\n",
+	     "batch", "signal", "inline", "api", "Mpps", "Gb/s", "p50 us", "p99 us");
+
+	for (api = 0; api < 2; api++)
+	for (inl = 0; inl < 2; inl++)
+	for (b = 0; b < sizeof(batches) / sizeof(batches[0]); b++)
+	for (c = 0; c < sizeof(sigs) / sizeof(sigs[0]); c++) {
+		cfg.batch = batches[b];
+		cfg.sig_every = sigs[c];
+		cfg.inl = inl;
+		cfg.wr_api = api;
+		if (cfg.batch > window || cfg.sig_every > window ||
+		    (cfg.inl && msg_size > max_inline))
+			continue;
+
+		ret = run_bench(&cfg, &res);
+		if (ret)
+			return ret;
+		dump("%6u %6u %7s %14s %9.3f %9.3f %9.2f %9.2f\n",
+		     cfg.batch, cfg.sig_every, cfg.inl ? "yes" : "no",
+		     cfg.wr_api ? "ibv_wr_*()" : "ibv_post_send", res.mpps, res.gbps,
+		     res.p50 / 1000.0, res.p99 / 1000.0);
+		if (res.mpps > best.mpps) {
+			best = res;
+			best_cfg = cfg;
+		}
+	}
+
+	dump("Best: batch %u, signaled every %u, %s, %s: %.3f Mpps\n",
+	     best_cfg.batch, best_cfg.sig_every, best_cfg.inl ? "inline" : "sge",
+	     best_cfg.wr_api ? "ibv_wr_*()" : "ibv_post_send()", best.mpps);
+	return 0;
+}
+
+/* The next chunk from @off, which can't cross the end of the server's region */
+static int post_chunk(uint64_t off, uint64_t seq, uint32_t *len)
+{
+	uint64_t roff = off % peer.len;
+	struct ibv_sge sg_list;
+	struct ibv_send_wr wr = {
+		.sg_list    = &sg_list,
+		.num_sge    = 1,
+		.send_flags = IBV_SEND_SIGNALED,
+	}, *bad_wr;
+	char *slot;
+	int err;
+
+	*len = msg_size;
+	if (*len > bulk_len - off)
+		*len = bulk_len - off;
+	if (*len > peer.len - roff)
+		*len = peer.len - roff;
+
+	sg_list.length = *len;
+	if (mode == CM_MODE_BULK_SEND) {
+		/* The copy of the SEND path, into a slot of the send ring */
+		slot = bench_buf + (size_t)(window + seq % window) * slot_size;
+		memcpy(slot, bulk_src + off, *len);
+		sg_list.addr = (uintptr_t)slot;
+		sg_list.lkey = mr->lkey;
+		wr.opcode = IBV_WR_SEND;
+	} else {
+		sg_list.addr = (uintptr_t)bulk_src + off;
+		sg_list.lkey = bulk_mr->lkey;
+		wr.opcode = mode == CM_MODE_BULK_WRITE ? IBV_WR_RDMA_WRITE : IBV_WR_RDMA_WRITE_WITH_IMM;
+		wr.imm_data = htobe32(*len);
+		wr.wr.rdma.remote_addr = peer.addr + roff;
+		wr.wr.rdma.rkey = peer.rkey;
+	}
+	wr.wr_id = *len;
+
+	err = ibv_post_send(cm_id->qp, &wr, &bad_wr);
+	if (err)
+		perror("ibv_post_send");
+	return err;
+}
+
+/*
+ * Moves the source into the server's region, window chunks in flight: With
+ * RDMA WRITEs and a zero-length SEND after them, as RC places them in
+ * order; With WRITE_WITH_IMMs, each consuming a receive; Or copied into
+ * SENDs, for comparison. For rdma-read the server pulls and SENDs when
+ * done.
+ */
+static int run_bulk(void)
+{
+	uint64_t total = mode == CM_MODE_BULK_READ ? 0 : bulk_len;
+	uint64_t off = 0, done = 0, posted = 0, completed = 0, start, wall, cpu;
+	bool fin = mode == CM_MODE_BULK_WRITE, pulled = mode != CM_MODE_BULK_READ;
+	struct ibv_send_wr wr = {
+		.opcode     = IBV_WR_SEND,
+		.send_flags = IBV_SEND_SIGNALED,
+	}, *bad_wr;
+	struct ibv_wc wc[COMP_MAX_BATCH];
+	uint32_t len;
+	int ne, i;
+
+	cpu = cpu_time_ns();
+	start = get_time_ns();
+	while (off < total || completed < posted || fin || !pulled) {
+		while (off < total && posted - completed < window) {
+			if (post_chunk(off, posted, &len))
+				return -1;
+			off += len;
+			posted++;
+		}
+
+		if (fin && off == total) {
+			if (ibv_post_send(cm_id->qp, &wr, &bad_wr)) {
+				perror("ibv_post_send");
+				return -1;
+			}
+			posted++;
+			fin = false;
+		}
+
+		ne = comp_wait(&comp, wc, COMP_FOREVER);
+		if (ne < 0)
+			return -1;
+
+		for (i = 0; i < ne; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				ERR("Failed status %s(%x) for wr_id 0x%lx",
+				    ibv_wc_status_str(wc[i].status), wc[i].status, wc[i].wr_id);
+				return -1;
+			}
+
+			if (wc[i].wr_id & WRID_RECV) {
+				pulled = true;
+				if (post_recv_slot(wc[i].wr_id & ~WRID_RECV))
+					return -1;
+			} else {
+				done += wc[i].wr_id;
+				completed++;
+			}
+		}
+	}
+	wall = get_time_ns() - start;
+	cpu = cpu_time_ns() - cpu;
+
+	/* The server timed its READs, here it's until its SEND */
+	if (mode == CM_MODE_BULK_READ)
+		done = bulk_len;
+
+	dump("%s: %" PRIu64 " bytes from %s in %u byte chunks, window %u, in %.3f s\n",
+	     mode_str[mode], done, bulk_file ? bulk_file : "memory", msg_size, window,
+	     wall / 1e9);
+	dump("  %.3f GB/s, region of %" PRIu64 " MiB, %s completions\n",
+	     (double)done / wall, peer.len >> 20, comp_mode_str(comp_mode));
+	dump("  cpu %.1f%%, %.3f cpu s per GB\n", cpu * 100.0 / wall,
+	     done ? cpu / (double)done : 0);
+	return 0;
+}
+
+/* The file of -f, or anonymous memory written once so it's all there */
+static int map_bulk_src(void)
+{
+	struct stat st;
+	int fd;
+
+	if (!bulk_file) {
+		if (!bulk_len)
+			bulk_len = DEF_BULK_LEN;
+		bulk_src = mmap(NULL, bulk_len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (bulk_src == MAP_FAILED) {
+			perror("mmap");
+			bulk_src = NULL;
+			return -1;
+		}
+		memset(bulk_src, 0xa5, bulk_len);
+		return 0;
+	}
+
+	fd = open(bulk_file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(bulk_file);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if (!bulk_len || bulk_len > (size_t)st.st_size)
+		bulk_len = st.st_size;
+	if (!bulk_len) {
+		ERR("%s is empty", bulk_file);
+		close(fd);
+		return -1;
+	}
+
+	bulk_src = mmap(NULL, bulk_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (bulk_src == MAP_FAILED) {
+		perror("mmap");
+		bulk_src = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	dump("Usage: %s [-a <server ip>] [-m pingpong|uni|bi] [-s <size>] [-w <window>] [-n <iters>]\n", prog);
+	dump("              [-b <batch>] [-c <signal every>] [-i] [-x] [-S]\n");
+	dump("              [-C poll|event|hybrid] [-B <budget us>] [-R <rate>]\n");
+	dump("              [-r <resolution cache> [-T <ttl>]]\n");
+	dump("       %s -m write|writeimm|read|sendcopy [-f <file>] [-l <bytes>] [-s <chunk>] [-w <window>]\n", prog);
+	dump("  -m: Benchmark against server.c, by default one string is sent\n");
+	dump("  -s: Message size, up to %d (default %d); Bulk chunk (default %u KiB, up to %d for sendcopy)\n",
+	     BUFSIZE, DEF_MSG_SIZE, DEF_BULK_CHUNK >> 10, BUFSIZE);
+	dump("  -w: Messages in flight (default 1 for ping-pong, %d for streams)\n",
+	     DEF_STREAM_WINDOW);
+	dump("  -n: Messages sent (default %d)\n", DEF_ITERS);
+	dump("  -b: Sends chained per post (default 1, up to %d)\n", MAX_BATCH);
+	dump("  -c: Every n-th send signaled (default 1)\n");
+	dump("  -i: Sent inline, if the message fits\n");
+	dump("  -x: Posted with ibv_wr_*()\n");
+	dump("  -S: Sweep the above with a uni-stream and report the message rates\n");
+	dump("  -C: Completions: poll (default), event or hybrid, busy-polling for -B <us> (default %llu)\n",
+	     COMP_DEF_BUDGET_NS / 1000);
+	dump("  -R: Messages per second offered, e.g. to compare the completion modes under load\n");
+	dump("  -r: Cache of the address and route resolutions, kept in the file for -T <s> (default %d)\n",
+	     RCACHE_DEF_TTL_S);
+	dump("  -f/-l: Bulk source, the file mapped or anonymous, of -l bytes (default the file, or %lu MiB)\n",
+	     DEF_BULK_LEN >> 20);
+}
+
+static int parse_opt(int argc, char *argv[])
+{
+	int op;
+
+	while ((op = getopt(argc, argv, "a:m:s:w:n:b:c:ixSC:B:R:f:l:r:T:h")) != -1) {
+		switch (op) {
+		case 'a':
+			server = optarg;
+			break;
+		case 'm':
+			if (!strcmp(optarg, "pingpong")) {
+				mode = CM_MODE_ECHO;
+			} else if (!strcmp(optarg, "uni")) {
+				mode = CM_MODE_SINK;
+			} else if (!strcmp(optarg, "bi")) {
+				mode = CM_MODE_BIDIR;
+			} else if (!strcmp(optarg, "write")) {
+				mode = CM_MODE_BULK_WRITE;
+			} else if (!strcmp(optarg, "writeimm")) {
+				mode = CM_MODE_BULK_WRITE_IMM;
+			} else if (!strcmp(optarg, "read")) {
+				mode = CM_MODE_BULK_READ;
+			} else if (!strcmp(optarg, "sendcopy")) {
+				mode = CM_MODE_BULK_SEND;
+			} else {
+				usage(argv[0]);
+				return -EINVAL;
+			}
+			break;
+		case 's':
+			msg_size = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'n':
+			iters = strtoull(optarg, NULL, 0);
+			break;
+		case 'b':
+			pcfg.batch = atoi(optarg);
+			break;
+		case 'c':
+			pcfg.sig_every = atoi(optarg);
+			break;
+		case 'i':
+			pcfg.inl = true;
+			break;
+		case 'x':
+			pcfg.wr_api = true;
+			break;
+		case 'S':
+			sweep = true;
+			mode = CM_MODE_SINK;
+			break;
+		case 'C':
+			comp_mode = comp_mode_parse(optarg);
+			if (comp_mode < 0) {
+				usage(argv[0]);
+				return -EINVAL;
+			}
+			break;
+		case 'B':
+			comp_budget_ns = strtoull(optarg, NULL, 0) * 1000;
+			break;
+		case 'R':
+			rate = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			rcache_file = optarg;
+			break;
+		case 'T':
+			rcache_ttl = atoi(optarg);
+			break;
+		case 'f':
+			bulk_file = optarg;
+			break;
+		case 'l':
+			bulk_len = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+
+	rcache_init(&rcache, rcache_ttl, rcache_file);
+	if (mode == CM_MODE_PRINT)
+		return 0;
+
+	if (!window)
+		window = mode == CM_MODE_ECHO ? 1 : DEF_STREAM_WINDOW;
+	if (!msg_size)
+		msg_size = !is_bulk() ? DEF_MSG_SIZE :
+			   mode == CM_MODE_BULK_SEND ? BUFSIZE : DEF_BULK_CHUNK;
+	if (is_bulk()) {
+		if ((mode == CM_MODE_BULK_SEND && msg_size > BUFSIZE) || window > CM_MAX_WINDOW) {
+			usage(argv[0]);
+			return -EINVAL;
+		}
+		if (map_bulk_src())
+			return -1;
+
+		/* Receives for the server's SENDs, and the ring of sendcopy */
+		slot_size = msg_size < BUFSIZE ? msg_size : BUFSIZE;
+		bench_len = (size_t)window * 2 * slot_size;
+		bench_buf = calloc(window * 2, slot_size);
+		if (!bench_buf) {
+			ERR("Failed to allocate %u slots", window * 2);
+			return -ENOMEM;
+		}
+		return 0;
+	}
+
+	if (msg_size > BUFSIZE || window > CM_MAX_WINDOW || !iters ||
+	    !pcfg.batch || pcfg.batch > MAX_BATCH || !pcfg.sig_every) {
+		usage(argv[0]);
+		return -EINVAL;
+	}
+
+	/*
+	 * A stream waits for a signaled send to free its window; Unsignaled
+	 * sends of a ping-pong pile up in the send queue, of 2 * 32 at least
+	 */
+	if (pcfg.batch > window)
+		pcfg.batch = window;
+	if (mode != CM_MODE_ECHO && pcfg.sig_every > window)
+		pcfg.sig_every = window;
+	if (pcfg.sig_every > 32 && pcfg.sig_every > window)
+		pcfg.sig_every = 32;
+
+	slot_size = msg_size;
+	bench_len = (size_t)(window + 1) * msg_size;
+	bench_buf = calloc(window + 1, msg_size);
+	if (!bench_buf) {
+		ERR("Failed to allocate %u messages", window + 1);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
+	struct bench_res res;
 	int ret;
+
+	ret = parse_opt(argc, argv);
+	if (ret)
+		return ret;
+
 	ret = start_cm_client();
 	if (ret)
 		return ret;
 
-	send_data();
+	if (pcfg.inl && msg_size > max_inline) {
+		dump("%u bytes don't fit the %u bytes of inline data, sent from the sge\n",
+		     msg_size, max_inline);
+		pcfg.inl = false;
+	}
+
+	if (mode == CM_MODE_PRINT)
+		send_data();
+	else if (is_bulk())
+		ret = run_bulk();
+	else if (sweep)
+		ret = run_sweep();
+	else
+		ret = run_bench(&pcfg, &res);
 
 	rdma_disconnect(cm_id);
 	rdma_destroy_qp(cm_id);
-	ibv_destroy_cq(cq);
+	comp_destroy(&comp);
 	ibv_dereg_mr(mr);
+	if (bulk_mr)
+		ibv_dereg_mr(bulk_mr);
 	ibv_dealloc_pd(pd);
 	rdma_destroy_id(cm_id);
+	free(bench_buf);
+	if (bulk_src)
+		munmap(bulk_src, bulk_len);
 
-	return 0;
+	return ret;
 }
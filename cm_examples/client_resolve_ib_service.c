@@ -10,6 +10,7 @@
 
 #include "helper.h"
 #include "params.h"
+#include "rcache.h"
 
 #define CLIENT_RESOLVE_IB_SERVICE_VERSION "0.1"
 
@@ -21,6 +22,10 @@ static struct ibv_cq *cq;
 static struct ibv_mr *mr;
 static char buf[BUFSIZE];
 
+/* The service resolved by an earlier run, see -r */
+static struct rcache rcache;
+static const char *rcache_file;
+
 static int setup_qp_client(void)
 {
 	int ret;
@@ -71,8 +76,11 @@ static int start_cm_client(void)
 	struct rdma_conn_param param = {};
 	struct sockaddr_ib sib = {};
         struct rdma_cm_event *e;
+	struct rcache_entry ce;
+	char key[RCACHE_KEY_LEN];
 	struct in6_addr a6;
 	int err, n = 0;
+	bool hit;
 
 	INFO("Start client with IB resolve_addrinfo..");
 	ech = rdma_create_event_channel();
@@ -127,6 +135,32 @@ static int start_cm_client(void)
 	//rdma_freeaddrinfo(rai);
 	//rai = NULL;
 
+	/* Cached, no service record query */
+	snprintf(key, sizeof(key), "sid %s", CM_EXAMPLE_IB_SERVICE_ID);
+	hit = !rcache_lookup(&rcache, key, &ce);
+	if (hit) {
+		err = rcache_resolve_addr(cm_id, &ce, 2000);
+		if (err) {
+			perror("rdma_resolve_addr");
+			return err;
+		}
+
+		err = rdma_get_cm_event(ech, &e);
+		if (err || (e->event != RDMA_CM_EVENT_ADDR_RESOLVED)) {
+			ERR("Expects RDMA_CM_EVENT_ADDR_RESOLVED get %d(%s) status %d, err %d",
+			    e->event, rdma_event_str(e->event), e->status, err);
+			rcache_invalidate(&rcache, key);
+			return -1;
+		}
+		err = rdma_ack_cm_event(e);
+		if (err) {
+			perror("rdma_ack_cm_event");
+			return err;
+		}
+		INFO("rdma_resolve_addr done, from the cache");
+		goto route;
+	}
+
 	hints.ai_flags = RAI_SA;
 	err = rdma_resolve_addrinfo(cm_id, NULL, CM_EXAMPLE_IB_SERVICE_ID, &hints);
 	//err = rdma_resolve_addrinfo(cm_id, NULL, CM_EXAMPLE_IB_SERVICE_NAME, &hints);
@@ -162,7 +196,8 @@ static int start_cm_client(void)
 
 	rdma_freeaddrinfo(rai);
 
-	err = rdma_resolve_route(cm_id, 5000);
+route:
+	err = rcache_resolve_route(cm_id, hit ? &ce : NULL, 5000);
 	if (err) {
 		perror("rdma_resolve_route");
 		return err;
@@ -172,6 +207,7 @@ static int start_cm_client(void)
 	if (err || (e->event != RDMA_CM_EVENT_ROUTE_RESOLVED)) {
 		ERR("Expects RDMA_CM_EVENT_ROUTE_RESOLVED get %d(%s) status %d, err %d",
 		    e->event, rdma_event_str(e->event), e->status, err);
+		rcache_invalidate(&rcache, key);
 		return -1;
 	}
 	err = rdma_ack_cm_event(e);
@@ -181,6 +217,9 @@ static int start_cm_client(void)
 	}
 	INFO("rdma_resolve_route done");
 
+	if (!hit)
+		rcache_store(&rcache, key, cm_id);
+
 	err = setup_qp_client();
 	if (err)
 		return err;
@@ -260,10 +299,19 @@ static void send_data(void)
 
 int main(int argc, char *argv[])
 {
-	int ret;
+	int ret, op;
 
 	INFO("version %s", CLIENT_RESOLVE_IB_SERVICE_VERSION);
 
+	while ((op = getopt(argc, argv, "r:")) != -1) {
+		if (op != 'r') {
+			dump("Usage: %s [-r <resolution cache>]\n", argv[0]);
+			return -EINVAL;
+		}
+		rcache_file = optarg;
+	}
+	rcache_init(&rcache, 0, rcache_file);
+
 	ret = start_cm_client();
 	if (ret)
 		return ret;
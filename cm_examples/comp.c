@@ -0,0 +1,235 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "bench.h"
+#include "comp.h"
+#include "helper.h"
+
+#define COMP_ACK_BATCH 64		/* CQ events acked at once */
+
+static const char *const mode_str[COMP_MODE_NUM] = {
+	[COMP_POLL] = "poll",
+	[COMP_EVENT] = "event",
+	[COMP_HYBRID] = "hybrid",
+};
+
+int comp_mode_parse(const char *s)
+{
+	int i;
+
+	for (i = 0; i < COMP_MODE_NUM; i++)
+		if (!strcasecmp(s, mode_str[i]))
+			return i;
+	return -1;
+}
+
+const char *comp_mode_str(int mode)
+{
+	return mode >= 0 && mode < COMP_MODE_NUM ? mode_str[mode] : "unknown";
+}
+
+int comp_init(struct comp *c, struct ibv_context *verbs, int cqe, void *cq_context,
+	      int mode, unsigned int batch, uint64_t budget_ns)
+{
+	int flags;
+
+	memset(c, 0, sizeof(*c));
+	c->mode = mode;
+	c->batch = batch > COMP_MAX_BATCH ? COMP_MAX_BATCH : batch ? batch : 1;
+	c->budget_ns = budget_ns;
+	c->epfd = -1;
+	c->timerfd = -1;
+
+	if (mode != COMP_POLL) {
+		c->ch = ibv_create_comp_channel(verbs);
+		if (!c->ch) {
+			perror("ibv_create_comp_channel");
+			return -1;
+		}
+
+		flags = fcntl(c->ch->fd, F_GETFL);
+		if (fcntl(c->ch->fd, F_SETFL, flags | O_NONBLOCK)) {
+			perror("fcntl");
+			goto fail;
+		}
+	}
+
+	c->cq = ibv_create_cq(verbs, cqe, cq_context, c->ch, 0);
+	if (!c->cq) {
+		perror("ibv_create_cq");
+		goto fail;
+	}
+	return 0;
+
+fail:
+	if (c->ch)
+		ibv_destroy_comp_channel(c->ch);
+	c->ch = NULL;
+	return -1;
+}
+
+/* An epoll on the channel and a timer for the deadline */
+int comp_wait_init(struct comp *c)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	if (c->mode == COMP_POLL)
+		return 0;
+
+	c->epfd = epoll_create1(0);
+	c->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (c->epfd < 0 || c->timerfd < 0) {
+		perror("epoll_create1/timerfd_create");
+		return -1;
+	}
+
+	ev.data.u32 = 0;
+	if (epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->ch->fd, &ev)) {
+		perror("epoll_ctl");
+		return -1;
+	}
+	ev.data.u32 = 1;
+	if (epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->timerfd, &ev)) {
+		perror("epoll_ctl");
+		return -1;
+	}
+	return 0;
+}
+
+void comp_destroy(struct comp *c)
+{
+	if (c->epfd >= 0)
+		close(c->epfd);
+	if (c->timerfd >= 0)
+		close(c->timerfd);
+	if (c->cq) {
+		if (c->unacked)
+			ibv_ack_cq_events(c->cq, c->unacked);
+		ibv_destroy_cq(c->cq);
+	}
+	if (c->ch)
+		ibv_destroy_comp_channel(c->ch);
+	memset(c, 0, sizeof(*c));
+	c->epfd = -1;
+	c->timerfd = -1;
+}
+
+int comp_poll(struct comp *c, struct ibv_wc *wc)
+{
+	int ne;
+
+	ne = ibv_poll_cq(c->cq, c->batch, wc);
+	c->polls++;
+	if (ne > 0)
+		c->cqes += ne;
+	else if (!ne)
+		c->empty_polls++;
+	else
+		ERR("ibv_poll_cq failed %d", ne);
+	return ne;
+}
+
+/* Poll again after arming, for what completed before */
+int comp_arm(struct comp *c)
+{
+	if (c->armed)
+		return 0;
+
+	if (ibv_req_notify_cq(c->cq, 0)) {
+		perror("ibv_req_notify_cq");
+		return -1;
+	}
+	c->armed = true;
+	return 0;
+}
+
+/* Consumes the notification of an armed CQ, -1 if there is none yet */
+int comp_get_event(struct comp *c)
+{
+	struct ibv_cq *cq;
+	void *ctx;
+
+	if (ibv_get_cq_event(c->ch, &cq, &ctx))
+		return -1;
+
+	c->armed = false;
+	c->events++;
+	if (++c->unacked == COMP_ACK_BATCH) {
+		ibv_ack_cq_events(c->cq, c->unacked);
+		c->unacked = 0;
+	}
+	return 0;
+}
+
+static int comp_sleep(struct comp *c, uint64_t deadline_ns)
+{
+	struct itimerspec its = {};
+	struct epoll_event evs[2];
+	uint64_t expirations;
+	int n, i;
+
+	if (deadline_ns != COMP_FOREVER) {
+		its.it_value.tv_sec = deadline_ns / 1000000000ULL;
+		its.it_value.tv_nsec = deadline_ns % 1000000000ULL;
+	}
+	if (timerfd_settime(c->timerfd, TFD_TIMER_ABSTIME, &its, NULL)) {
+		perror("timerfd_settime");
+		return -1;
+	}
+
+	n = epoll_wait(c->epfd, evs, 2, -1);
+	if (n < 0) {
+		if (errno == EINTR)
+			return 0;
+		perror("epoll_wait");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!evs[i].data.u32)
+			comp_get_event(c);
+		else if (read(c->timerfd, &expirations, sizeof(expirations)) < 0 &&
+			 errno != EAGAIN)
+			perror("read timerfd");
+	}
+	return 0;
+}
+
+int comp_wait(struct comp *c, struct ibv_wc *wc, uint64_t deadline_ns)
+{
+	uint64_t spin_end;
+	int ne;
+
+	ne = comp_poll(c, wc);
+	if (ne || !deadline_ns)
+		return ne;
+
+	if (c->mode != COMP_EVENT) {
+		spin_end = deadline_ns;
+		if (c->mode == COMP_HYBRID && get_time_ns() + c->budget_ns < deadline_ns)
+			spin_end = get_time_ns() + c->budget_ns;
+
+		do {
+			ne = comp_poll(c, wc);
+		} while (!ne && get_time_ns() < spin_end);
+
+		if (ne || spin_end == deadline_ns)
+			return ne;
+	}
+
+	if (comp_arm(c))
+		return -1;
+	ne = comp_poll(c, wc);
+	if (ne)
+		return ne;
+
+	if (comp_sleep(c, deadline_ns))
+		return -1;
+	return comp_poll(c, wc);
+}
@@ -0,0 +1,65 @@
+#ifndef CM_EXAMPLES_COMP_H
+#define CM_EXAMPLES_COMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <infiniband/verbs.h>
+
+/*
+ * Completion engine of a CQ, shared by client.c and server.c:
+ *   poll:   Busy-polls, up to batch CQEs a call; Lowest latency, a core
+ *           burnt even when idle
+ *   event:  Arms the CQ and sleeps in epoll on its completion channel
+ *           whenever it's empty
+ *   hybrid: Busy-polls for budget_ns, then arms and sleeps
+ */
+enum {
+	COMP_POLL,
+	COMP_EVENT,
+	COMP_HYBRID,
+	COMP_MODE_NUM,
+};
+
+#define COMP_DEF_BATCH 16
+#define COMP_MAX_BATCH 64
+#define COMP_DEF_BUDGET_NS 20000ULL
+#define COMP_FOREVER UINT64_MAX
+
+struct comp {
+	int mode;
+	unsigned int batch;
+	uint64_t budget_ns;
+
+	struct ibv_cq *cq;
+	struct ibv_comp_channel *ch;	/* Not with COMP_POLL */
+	bool armed;
+	unsigned int unacked;
+
+	/* comp_wait() only */
+	int epfd;
+	int timerfd;
+
+	uint64_t polls, empty_polls, events, cqes;
+};
+
+int comp_mode_parse(const char *s);
+const char *comp_mode_str(int mode);
+
+int comp_init(struct comp *c, struct ibv_context *verbs, int cqe, void *cq_context,
+	      int mode, unsigned int batch, uint64_t budget_ns);
+int comp_wait_init(struct comp *c);
+void comp_destroy(struct comp *c);
+
+int comp_poll(struct comp *c, struct ibv_wc *wc);
+int comp_arm(struct comp *c);
+int comp_get_event(struct comp *c);
+
+/*
+ * Up to batch completions in @wc, waiting as the mode says until
+ * @deadline_ns (get_time_ns()), 0 to poll once or COMP_FOREVER; Returns
+ * 0 on timeout or a signal, < 0 on error
+ */
+int comp_wait(struct comp *c, struct ibv_wc *wc, uint64_t deadline_ns);
+
+#endif
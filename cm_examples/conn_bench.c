@@ -0,0 +1,818 @@
+/*
+ * Connection establishment rate: The client keeps up to M connects in
+ * flight on one event channel, driven by epoll on its fd, until N
+ * connections are established, then disconnects them all the same way.
+ * Each connection has its own RC QP on a shared PD and CQ, as a service
+ * reconnecting its clients after a failover would.
+ *
+ * With -k, every established connection then sends K messages to the
+ * server and waits for each to be echoed, M connections at a time, to
+ * measure the service throughput of server.c under thousands of clients.
+ *
+ * With -c, the resolutions go through the cache of rcache.c: Every
+ * connection resolves its address, from the cached source to the server,
+ * but only the first ones query the path, the others set the cached one,
+ * as a client reconnecting to the same server would. Compare the route
+ * phase with and without.
+ *
+ * The server (-s) accepts any number of connections and prints the
+ * accept rate every second.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <rdma/rdma_cma.h>
+
+#include "bench.h"
+#include "helper.h"
+#include "params.h"
+#include "proto.h"
+#include "rcache.h"
+
+#define DEF_CONNS 1000
+#define DEF_INFLIGHT 64
+#define DEF_MSG_SIZE 64
+#define MAX_DEVS 8
+#define MAX_SAMPLES (1 << 20)
+#define WRID_RECV (1ULL << 63)
+
+enum {
+	PH_ADDR,
+	PH_ROUTE,
+	PH_CONNECT,		/* rdma_connect() to ESTABLISHED */
+	PH_SETUP,		/* All the above, the (re)connect latency */
+	PH_DISCONNECT,		/* rdma_disconnect() to DISCONNECTED */
+	PH_NUM,
+};
+
+static const char *const phase_str[PH_NUM] = {
+	"addr resolve", "route resolve", "connect->established", "resolve+connect",
+	"disconnect",
+};
+
+enum {
+	BC_IDLE,
+	BC_CONNECTING,
+	BC_ESTABLISHED,
+	BC_DISCONNECTING,
+	BC_DONE,
+	BC_FAILED,
+};
+
+struct bconn {
+	struct rdma_cm_id *id;
+	int state;
+	uint64_t ts;		/* Start of the current phase or message */
+	uint64_t start;
+	unsigned long left;	/* Messages to echo */
+	bool cached;
+};
+
+/* PD, CQ and message buffers shared by the QPs of a device */
+struct dev_res {
+	struct ibv_context *verbs;
+	struct ibv_pd *pd;
+	struct ibv_cq *cq;
+	struct ibv_mr *mr;
+};
+
+static struct rdma_event_channel *ech;
+static int epfd = -1;
+
+static const char *server = CM_EXAMPLE_SERVER_IP;
+static int port = CM_EXAMPLE_SERVER_PORT;
+static int is_server;
+static unsigned long num_conns = DEF_CONNS;
+static unsigned int inflight = DEF_INFLIGHT;
+static unsigned long msgs_per_conn;
+static unsigned int msg_size = DEF_MSG_SIZE;
+static char *msg_buf;		/* Send and receive buffer of every connection */
+
+static struct dev_res devs[MAX_DEVS];
+static int num_devs;
+
+static bool use_rcache;
+static struct rcache rcache;
+static char rcache_key[RCACHE_KEY_LEN];
+static struct rcache_entry cached;	/* Of the one server */
+
+static struct bconn *bconns;
+static uint64_t *lat[PH_NUM];
+static unsigned long nlat[PH_NUM];
+static unsigned long established, disconnected, failed;
+static unsigned long echoing;	/* Connections with messages left to echo */
+
+static struct dev_res *get_dev_res(struct ibv_context *verbs)
+{
+	struct dev_res *d;
+	int i;
+
+	for (i = 0; i < num_devs; i++)
+		if (devs[i].verbs == verbs)
+			return &devs[i];
+
+	if (num_devs == MAX_DEVS) {
+		ERR("Too many devices");
+		return NULL;
+	}
+
+	d = &devs[num_devs];
+	d->pd = ibv_alloc_pd(verbs);
+	if (!d->pd) {
+		perror("ibv_alloc_pd");
+		return NULL;
+	}
+
+	/* Up to two sends and a receive of each connection echoing */
+	d->cq = ibv_create_cq(verbs, inflight * 3 + 64 > 1024 ? inflight * 3 + 64 : 1024,
+			      NULL, NULL, 0);
+	if (!d->cq) {
+		perror("ibv_create_cq");
+		ibv_dealloc_pd(d->pd);
+		return NULL;
+	}
+
+	if (msg_buf) {
+		d->mr = ibv_reg_mr(d->pd, msg_buf, num_conns * 2 * msg_size,
+				   IBV_ACCESS_LOCAL_WRITE);
+		if (!d->mr) {
+			perror("ibv_reg_mr");
+			ibv_destroy_cq(d->cq);
+			ibv_dealloc_pd(d->pd);
+			return NULL;
+		}
+	}
+
+	d->verbs = verbs;
+	num_devs++;
+	return d;
+}
+
+static void put_dev_res(void)
+{
+	int i;
+
+	for (i = 0; i < num_devs; i++) {
+		if (devs[i].mr)
+			ibv_dereg_mr(devs[i].mr);
+		ibv_destroy_cq(devs[i].cq);
+		ibv_dealloc_pd(devs[i].pd);
+	}
+	num_devs = 0;
+}
+
+static int create_qp(struct rdma_cm_id *id)
+{
+	struct ibv_qp_init_attr init_attr = {
+		.cap = {
+			.max_send_wr = 4,
+			.max_recv_wr = 4,
+			.max_send_sge = 1,
+			.max_recv_sge = 1,
+		},
+		.qp_type = IBV_QPT_RC,
+	};
+	struct dev_res *d;
+	int ret;
+
+	d = get_dev_res(id->verbs);
+	if (!d)
+		return -1;
+
+	init_attr.send_cq = d->cq;
+	init_attr.recv_cq = d->cq;
+	ret = rdma_create_qp(id, d->pd, &init_attr);
+	if (ret)
+		perror("rdma_create_qp");
+	return ret;
+}
+
+/* Make the event channel nonblocking and watch it with epoll */
+static int setup_event_channel(void)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	int flags;
+
+	ech = rdma_create_event_channel();
+	if (!ech) {
+		perror("rdma_create_event_channel");
+		return -1;
+	}
+
+	flags = fcntl(ech->fd, F_GETFL);
+	if (fcntl(ech->fd, F_SETFL, flags | O_NONBLOCK)) {
+		perror("fcntl");
+		return -1;
+	}
+
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return -1;
+	}
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, ech->fd, &ev)) {
+		perror("epoll_ctl");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void put_event_channel(void)
+{
+	if (epfd >= 0)
+		close(epfd);
+	if (ech)
+		rdma_destroy_event_channel(ech);
+}
+
+/* Wait up to @timeout_ms for the event channel, returns 0 on timeout */
+static int wait_events(int timeout_ms)
+{
+	struct epoll_event ev;
+	int n;
+
+	do {
+		n = epoll_wait(epfd, &ev, 1, timeout_ms);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		perror("epoll_wait");
+	return n;
+}
+
+static void record(struct bconn *c, int phase, uint64_t now)
+{
+	lat[phase][nlat[phase]++] = now - c->ts;
+	c->ts = now;
+}
+
+static int start_connect(struct bconn *c)
+{
+	struct sockaddr_in sin = {};
+	int ret;
+
+	ret = rdma_create_id(ech, &c->id, c, RDMA_PS_TCP);
+	if (ret) {
+		perror("rdma_create_id");
+		return ret;
+	}
+
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	inet_pton(AF_INET, server, &sin.sin_addr);
+
+	if (use_rcache) {
+		rcache_key_addr(rcache_key, (struct sockaddr *)&sin);
+		c->cached = !rcache_lookup(&rcache, rcache_key, &cached);
+	}
+
+	c->state = BC_CONNECTING;
+	c->ts = get_time_ns();
+	c->start = c->ts;
+	if (c->cached)
+		ret = rcache_resolve_addr(c->id, &cached, 2000);
+	else
+		ret = rdma_resolve_addr(c->id, NULL, (struct sockaddr *)&sin, 2000);
+	if (ret) {
+		perror("rdma_resolve_addr");
+		rdma_destroy_id(c->id);
+		c->id = NULL;
+		c->state = BC_FAILED;
+	}
+	return ret;
+}
+
+/* The rest of its messages are not echoed, the connection broke */
+static void stop_echo(struct bconn *c)
+{
+	if (!c->left)
+		return;
+	c->left = 0;
+	echoing--;
+}
+
+/* Called after the event is acked, the id can be destroyed */
+static void put_conn(struct bconn *c)
+{
+	if (c->id->qp)
+		rdma_destroy_qp(c->id);
+	rdma_destroy_id(c->id);
+	c->id = NULL;
+}
+
+static void client_event(struct rdma_cm_event *e, bool *put)
+{
+	struct bconn *c = e->id->context;
+	struct rdma_conn_param param = {};
+	struct cm_hello hello = {
+		.magic = htobe32(CM_HELLO_MAGIC),
+		.mode = CM_MODE_ECHO,
+		.msg_size = htobe32(msg_size),
+	};
+	uint64_t now = get_time_ns();
+	int ret = 0;
+
+	switch (e->event) {
+	case RDMA_CM_EVENT_ADDR_RESOLVED:
+		record(c, PH_ADDR, now);
+		ret = rcache_resolve_route(c->id, c->cached ? &cached : NULL, 2000);
+		if (ret)
+			perror("rdma_resolve_route");
+		break;
+
+	case RDMA_CM_EVENT_ROUTE_RESOLVED:
+		record(c, PH_ROUTE, now);
+		if (use_rcache && !c->cached)
+			rcache_store(&rcache, rcache_key, c->id);
+		ret = create_qp(c->id);
+		if (ret)
+			break;
+		param.rnr_retry_count = 7;
+		if (msgs_per_conn) {
+			param.private_data = &hello;
+			param.private_data_len = sizeof(hello);
+		}
+		ret = rdma_connect(c->id, &param);
+		if (ret)
+			perror("rdma_connect");
+		/* The QP creation is part of the connect phase */
+		break;
+
+	case RDMA_CM_EVENT_ESTABLISHED:
+		record(c, PH_CONNECT, now);
+		lat[PH_SETUP][nlat[PH_SETUP]++] = now - c->start;
+		c->state = BC_ESTABLISHED;
+		established++;
+		break;
+
+	case RDMA_CM_EVENT_DISCONNECTED:
+		if (c->state == BC_DISCONNECTING) {
+			record(c, PH_DISCONNECT, now);
+			disconnected++;
+		} else {
+			ERR("Connection %ld disconnected by the server", c - bconns);
+			if (c->state == BC_ESTABLISHED)
+				established--;
+			failed++;
+			stop_echo(c);
+		}
+		c->state = BC_DONE;
+		*put = true;
+		break;
+
+	case RDMA_CM_EVENT_ADDR_CHANGE:
+		rcache_event(&rcache, e);
+		break;
+
+	case RDMA_CM_EVENT_ADDR_ERROR:
+	case RDMA_CM_EVENT_ROUTE_ERROR:
+	case RDMA_CM_EVENT_CONNECT_ERROR:
+	case RDMA_CM_EVENT_UNREACHABLE:
+	case RDMA_CM_EVENT_REJECTED:
+		if (!failed)
+			ERR("Connection %ld: %s, status %d", c - bconns,
+			    rdma_event_str(e->event), e->status);
+		if (c->cached)
+			rcache_invalidate(&rcache, rcache_key);
+		ret = -1;
+		break;
+
+	default:
+		/* E.g. TIMEWAIT_EXIT, nothing to do */
+		break;
+	}
+
+	if (ret && c->state == BC_CONNECTING) {
+		c->state = BC_FAILED;
+		failed++;
+		*put = true;
+	}
+}
+
+static int handle_events(void (*handler)(struct rdma_cm_event *e, bool *put))
+{
+	struct rdma_cm_event *e;
+	struct rdma_cm_id *id;
+	bool put;
+
+	while (1) {
+		if (rdma_get_cm_event(ech, &e)) {
+			if (errno == EAGAIN)
+				return 0;
+			perror("rdma_get_cm_event");
+			return -1;
+		}
+
+		put = false;
+		id = e->id;
+		handler(e, &put);
+		if (rdma_ack_cm_event(e)) {
+			perror("rdma_ack_cm_event");
+			return -1;
+		}
+		if (put) {
+			if (is_server) {
+				if (id->qp)
+					rdma_destroy_qp(id);
+				rdma_destroy_id(id);
+			} else {
+				put_conn(id->context);
+			}
+		}
+	}
+}
+
+static int post_ping(struct bconn *c)
+{
+	struct dev_res *d = get_dev_res(c->id->verbs);
+	unsigned long idx = c - bconns;
+	char *p = msg_buf + idx * 2 * msg_size;
+	struct ibv_sge recv_sge = {
+		.addr   = (uintptr_t)p + msg_size,
+		.length = msg_size,
+		.lkey   = d->mr->lkey,
+	}, send_sge = {
+		.addr   = (uintptr_t)p,
+		.length = msg_size,
+		.lkey   = d->mr->lkey,
+	};
+	struct ibv_recv_wr rwr = {
+		.wr_id   = WRID_RECV | idx,
+		.sg_list = &recv_sge,
+		.num_sge = 1,
+	}, *bad_rwr;
+	struct ibv_send_wr swr = {
+		.wr_id      = idx,
+		.sg_list    = &send_sge,
+		.num_sge    = 1,
+		.opcode     = IBV_WR_SEND,
+		.send_flags = IBV_SEND_SIGNALED,
+	}, *bad_swr;
+
+	if (ibv_post_recv(c->id->qp, &rwr, &bad_rwr)) {
+		perror("ibv_post_recv");
+		return -1;
+	}
+
+	c->ts = get_time_ns();
+	if (ibv_post_send(c->id->qp, &swr, &bad_swr)) {
+		perror("ibv_post_send");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Each connection echoes msgs_per_conn messages, inflight connections at a
+ * time; A connection the server disconnects, or with a failed completion,
+ * stops echoing and the others go on
+ */
+static int run_echo(void)
+{
+	unsigned long total = established * msgs_per_conn, done = 0, next = 0;
+	unsigned long nsamples = 0, broken = 0, failed_before = failed;
+	struct ibv_wc wc[16];
+	struct bconn *c;
+	uint64_t *samples, start, wall, now;
+	int ret = -1, ne, nc, i, k;
+
+	samples = calloc(total < MAX_SAMPLES ? total : MAX_SAMPLES, sizeof(*samples));
+	if (!samples) {
+		ERR("Failed to allocate latency samples");
+		return -1;
+	}
+	memset(msg_buf, 0x5a, num_conns * 2 * msg_size);
+
+	start = get_time_ns();
+	echoing = 0;
+	while (next < num_conns || echoing) {
+		for (; next < num_conns && echoing < inflight; next++) {
+			c = &bconns[next];
+			if (c->state != BC_ESTABLISHED)
+				continue;
+			c->left = msgs_per_conn;
+			echoing++;
+			if (post_ping(c))
+				goto out;
+		}
+
+		nc = 0;
+		for (k = 0; k < num_devs; k++) {
+			ne = ibv_poll_cq(devs[k].cq, 16, wc);
+			if (ne < 0) {
+				ERR("ibv_poll_cq failed %d", ne);
+				goto out;
+			}
+
+			nc += ne;
+			for (i = 0; i < ne; i++) {
+				c = &bconns[wc[i].wr_id & ~WRID_RECV];
+				/* Flushed after the connection stopped echoing */
+				if (!c->left)
+					continue;
+				if (wc[i].status != IBV_WC_SUCCESS) {
+					if (!broken++)
+						ERR("Connection %ld: Failed status %s(%x) for wr_id 0x%lx",
+						    c - bconns, ibv_wc_status_str(wc[i].status),
+						    wc[i].status, wc[i].wr_id);
+					stop_echo(c);
+					continue;
+				}
+				if (!(wc[i].wr_id & WRID_RECV))
+					continue;
+
+				now = get_time_ns();
+				samples[nsamples++ % MAX_SAMPLES] = now - c->ts;
+				done++;
+				if (--c->left) {
+					if (post_ping(c))
+						goto out;
+				} else {
+					echoing--;
+				}
+			}
+		}
+
+		/* Disconnects by the server, seen once the CQs are idle */
+		if (!nc && wait_events(0) > 0 && handle_events(client_event))
+			goto out;
+	}
+	wall = get_time_ns() - start;
+
+	dump("Echo:       %lu messages of %u bytes over %lu connections in %.3f s, %.1f K messages/s\n",
+	     done, msg_size, established, wall / 1e9, done * 1e6 / wall);
+	if (done < total)
+		dump("            %lu messages not echoed, %lu connections failed, %lu disconnected\n",
+		     total - done, broken, failed - failed_before);
+	dump_lat("echo round trip", samples, nsamples < MAX_SAMPLES ? nsamples : MAX_SAMPLES);
+	ret = 0;
+
+out:
+	free(samples);
+	return ret;
+}
+
+static int run_client(void)
+{
+	unsigned long started = 0, issued = 0, i;
+	uint64_t start, wall;
+	int ret = -1, k;
+
+	bconns = calloc(num_conns, sizeof(*bconns));
+	if (!bconns)
+		goto fail_alloc;
+	for (k = 0; k < PH_NUM; k++) {
+		lat[k] = calloc(num_conns, sizeof(*lat[k]));
+		if (!lat[k])
+			goto fail_alloc;
+	}
+	if (msgs_per_conn) {
+		msg_buf = malloc(num_conns * 2 * msg_size);
+		if (!msg_buf)
+			goto fail_alloc;
+	}
+
+	INFO("Connecting %lu connections to %s:%d, %d in flight", num_conns, server, port, inflight);
+	start = get_time_ns();
+	while (established + failed < num_conns) {
+		while (started < num_conns && started - established - failed < inflight) {
+			if (start_connect(&bconns[started++]))
+				failed++;
+		}
+		if (wait_events(1000) > 0 && handle_events(client_event))
+			goto out;
+	}
+	wall = get_time_ns() - start;
+	dump("Connect:    %lu established, %lu failed in %.3f s, %.1f connections/s\n",
+	     established, failed, wall / 1e9, established * 1e9 / wall);
+
+	if (msgs_per_conn && established && run_echo())
+		goto out;
+
+	/* established drops if the server disconnects one meanwhile */
+	start = get_time_ns();
+	i = 0;
+	while (disconnected < established) {
+		for (; i < num_conns && issued - disconnected < inflight; i++) {
+			struct bconn *c = &bconns[i];
+
+			if (c->state != BC_ESTABLISHED)
+				continue;
+			c->state = BC_DISCONNECTING;
+			c->ts = get_time_ns();
+			if (rdma_disconnect(c->id)) {
+				perror("rdma_disconnect");
+				goto out;
+			}
+			issued++;
+		}
+		if (wait_events(1000) > 0 && handle_events(client_event))
+			goto out;
+	}
+	wall = get_time_ns() - start;
+	dump("Disconnect: %lu connections in %.3f s, %.1f disconnects/s\n",
+	     disconnected, wall / 1e9, disconnected * 1e9 / wall);
+
+	dump("Latency per phase%s:\n", use_rcache ? ", paths cached" : "");
+	for (k = 0; k < PH_NUM; k++)
+		dump_lat(phase_str[k], lat[k], nlat[k]);
+	if (use_rcache)
+		rcache_dump_stats(&rcache);
+	ret = failed ? -1 : 0;
+	goto out;
+
+fail_alloc:
+	ERR("Failed to allocate %lu connections", num_conns);
+out:
+	for (i = 0; bconns && i < num_conns; i++)
+		if (bconns[i].id)
+			put_conn(&bconns[i]);
+	for (k = 0; k < PH_NUM; k++)
+		free(lat[k]);
+	free(bconns);
+	return ret;
+}
+
+static void server_event(struct rdma_cm_event *e, bool *put)
+{
+	struct rdma_conn_param param = {};
+
+	switch (e->event) {
+	case RDMA_CM_EVENT_CONNECT_REQUEST:
+		if (create_qp(e->id)) {
+			rdma_reject(e->id, NULL, 0);
+			failed++;
+			*put = true;
+			break;
+		}
+		param.rnr_retry_count = 7;
+		if (rdma_accept(e->id, &param)) {
+			perror("rdma_accept");
+			rdma_reject(e->id, NULL, 0);
+			failed++;
+			*put = true;
+		}
+		break;
+
+	case RDMA_CM_EVENT_ESTABLISHED:
+		established++;
+		break;
+
+	case RDMA_CM_EVENT_DISCONNECTED:
+		disconnected++;
+		*put = true;
+		break;
+
+	case RDMA_CM_EVENT_CONNECT_ERROR:
+	case RDMA_CM_EVENT_UNREACHABLE:
+	case RDMA_CM_EVENT_REJECTED:
+		failed++;
+		*put = true;
+		break;
+
+	default:
+		INFO("Event %s ignored", rdma_event_str(e->event));
+		break;
+	}
+}
+
+static int run_server(void)
+{
+	unsigned long last_est = 0, last_disc = 0;
+	struct rdma_cm_id *listen_id;
+	struct sockaddr_in sin = {};
+	uint64_t last = get_time_ns(), now;
+	int ret;
+
+	ret = rdma_create_id(ech, &listen_id, NULL, RDMA_PS_TCP);
+	if (ret) {
+		perror("rdma_create_id");
+		return ret;
+	}
+
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	ret = rdma_bind_addr(listen_id, (struct sockaddr *)&sin);
+	if (ret) {
+		perror("rdma_bind_addr");
+		goto out;
+	}
+
+	ret = rdma_listen(listen_id, 1024);
+	if (ret) {
+		perror("rdma_listen");
+		goto out;
+	}
+
+	INFO("Accepting connections on port %d", port);
+	while (1) {
+		if (wait_events(1000) > 0) {
+			ret = handle_events(server_event);
+			if (ret)
+				break;
+		}
+
+		now = get_time_ns();
+		if (now - last < 1000000000ULL)
+			continue;
+		if (established != last_est || disconnected != last_disc)
+			dump("established %lu (%.1f/s), disconnected %lu (%.1f/s), active %lu, failed %lu\n",
+			     established, (established - last_est) * 1e9 / (now - last),
+			     disconnected, (disconnected - last_disc) * 1e9 / (now - last),
+			     established - disconnected, failed);
+		last_est = established;
+		last_disc = disconnected;
+		last = now;
+	}
+
+out:
+	rdma_destroy_id(listen_id);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	dump("Usage: %s [-s] [-a <server ip>] [-p <port>] [-n <connections>] [-m <in flight>] [-k <messages> [-z <size>]] [-c]\n", prog);
+	dump("  -s: Server, accepts any number of connections\n");
+	dump("  -a: Server IP (default %s), e.g. the IP of the rxe netdev for loopback\n",
+	     CM_EXAMPLE_SERVER_IP);
+	dump("  -n: Client, connections to establish (default %d)\n", DEF_CONNS);
+	dump("  -m: Client, connects/disconnects or echoing connections in flight (default %d)\n",
+	     DEF_INFLIGHT);
+	dump("  -k: Client, messages each connection has echoed by server.c before disconnecting\n");
+	dump("  -z: Client, message size (default %d)\n", DEF_MSG_SIZE);
+	dump("  -c: Client, path records resolved once and cached, for %d s; Addresses still resolved\n",
+	     RCACHE_DEF_TTL_S);
+}
+
+static int parse_opt(int argc, char *argv[])
+{
+	int op;
+
+	while ((op = getopt(argc, argv, "sa:p:n:m:k:z:ch")) != -1) {
+		switch (op) {
+		case 's':
+			is_server = 1;
+			break;
+		case 'a':
+			server = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			num_conns = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			inflight = atoi(optarg);
+			break;
+		case 'k':
+			msgs_per_conn = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			msg_size = atoi(optarg);
+			break;
+		case 'c':
+			use_rcache = true;
+			rcache_init(&rcache, 0, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+
+	if (!num_conns || !inflight || !msg_size || msg_size > BUFSIZE) {
+		usage(argv[0]);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	ret = parse_opt(argc, argv);
+	if (ret)
+		return ret;
+
+	ret = setup_event_channel();
+	if (!ret)
+		ret = is_server ? run_server() : run_client();
+
+	put_dev_res();
+	put_event_channel();
+	free(msg_buf);
+	return ret;
+}
@@ -0,0 +1,53 @@
+#ifndef CM_EXAMPLES_PROTO_H
+#define CM_EXAMPLES_PROTO_H
+
+#include <stdint.h>
+
+/*
+ * What a benchmark client wants from server.c, sent in the private data of
+ * its connect request, big-endian. client.c sends none, its messages are
+ * printed.
+ */
+#define CM_HELLO_MAGIC 0x636d6231	/* "cmb1" */
+
+#define CM_MAX_WINDOW 1024
+
+enum {
+	CM_MODE_PRINT,
+	CM_MODE_ECHO,		/* Every message is sent back, ping-pong */
+	CM_MODE_SINK,		/* Received only, unidirectional stream */
+	CM_MODE_BIDIR,		/* And as many sent to the client meanwhile */
+	CM_MODE_BULK_WRITE,	/* RDMA WRITEs to the region, then a SEND */
+	CM_MODE_BULK_WRITE_IMM,	/* RDMA WRITE_WITH_IMMs to the region, imm the length */
+	CM_MODE_BULK_READ,	/* The server RDMA READs the client's, then SENDs */
+	CM_MODE_BULK_SEND,	/* SENDs, copied into the region by the server */
+	CM_MODE_NUM,
+};
+
+/* Fields left 0, e.g. by older clients, take the server defaults */
+struct cm_hello {
+	uint32_t magic;
+	uint8_t mode;
+	uint8_t rsvd[3];
+	uint32_t msg_size;	/* Up to BUFSIZE, but for RDMA WRITE and READ */
+	uint32_t window;	/* Messages in flight each way */
+	uint64_t iters;		/* Messages the client sends */
+
+	/* CM_MODE_BULK_READ: What the server pulls, msg_size at a time */
+	uint64_t addr;
+	uint32_t rkey;
+	uint64_t len;
+} __attribute__((packed));
+
+/*
+ * The region of the bulk modes, in the private data of the accept; Data
+ * beyond its length wraps around to its start
+ */
+struct cm_region {
+	uint32_t magic;
+	uint32_t rkey;
+	uint64_t addr;
+	uint64_t len;
+} __attribute__((packed));
+
+#endif
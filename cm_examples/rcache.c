@@ -0,0 +1,295 @@
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <infiniband/ib.h>
+
+#include "helper.h"
+#include "rcache.h"
+
+#define RCACHE_MAGIC 0x72636131		/* "rca1" */
+
+struct rcache_file_hdr {
+	uint32_t magic;
+	uint32_t n;
+	uint32_t entry_size;
+};
+
+static uint64_t rcache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void rcache_load(struct rcache *rc)
+{
+	struct rcache_file_hdr hdr;
+	uint64_t now = rcache_now();
+	struct rcache_entry ce;
+	unsigned int i;
+	FILE *f;
+
+	f = fopen(rc->file, "r");
+	if (!f)
+		return;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != RCACHE_MAGIC ||
+	    hdr.entry_size != sizeof(ce)) {
+		ERR("Ignored %s, not a cache of this version", rc->file);
+		goto out;
+	}
+
+	for (i = 0; i < hdr.n && rc->n < RCACHE_MAX; i++) {
+		if (fread(&ce, sizeof(ce), 1, f) != 1)
+			break;
+		ce.key[RCACHE_KEY_LEN - 1] = '\0';
+		if (ce.expires > now)
+			rc->e[rc->n++] = ce;
+	}
+
+out:
+	fclose(f);
+}
+
+/* Written aside and renamed, a concurrent run sees the old or the new one */
+static void rcache_save(struct rcache *rc)
+{
+	struct rcache_file_hdr hdr = {
+		.magic = RCACHE_MAGIC,
+		.n = rc->n,
+		.entry_size = sizeof(struct rcache_entry),
+	};
+	char tmp[256];
+	FILE *f;
+
+	if (!rc->file)
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", rc->file);
+	f = fopen(tmp, "w");
+	if (!f) {
+		perror(tmp);
+		return;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    (rc->n && fwrite(rc->e, sizeof(rc->e[0]), rc->n, f) != rc->n)) {
+		perror("fwrite");
+		fclose(f);
+		remove(tmp);
+		return;
+	}
+	fclose(f);
+
+	if (rename(tmp, rc->file))
+		perror("rename");
+}
+
+void rcache_init(struct rcache *rc, unsigned int ttl_s, const char *file)
+{
+	memset(rc, 0, sizeof(*rc));
+	rc->ttl_s = ttl_s ? ttl_s : RCACHE_DEF_TTL_S;
+	rc->file = file;
+	if (file)
+		rcache_load(rc);
+}
+
+static struct rcache_entry *rcache_find(struct rcache *rc, const char *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < rc->n; i++)
+		if (!strcmp(rc->e[i].key, key))
+			return &rc->e[i];
+	return NULL;
+}
+
+static void rcache_remove(struct rcache *rc, struct rcache_entry *ce)
+{
+	*ce = rc->e[--rc->n];
+}
+
+int rcache_lookup(struct rcache *rc, const char *key, struct rcache_entry *out)
+{
+	struct rcache_entry *ce = rcache_find(rc, key);
+
+	if (ce && ce->expires <= rcache_now()) {
+		rcache_remove(rc, ce);
+		rc->expired++;
+		ce = NULL;
+	}
+	if (!ce) {
+		rc->misses++;
+		return -1;
+	}
+
+	*out = *ce;
+	rc->hits++;
+	return 0;
+}
+
+static void path_from_sa(struct ibv_path_data *pd, const struct ibv_sa_path_rec *p)
+{
+	struct ibv_path_record *r = &pd->path;
+
+	memset(pd, 0, sizeof(*pd));
+	pd->flags = IBV_PATH_FLAG_GMP | IBV_PATH_FLAG_PRIMARY | IBV_PATH_FLAG_BIDIRECTIONAL;
+	r->dgid = p->dgid;
+	r->sgid = p->sgid;
+	r->dlid = p->dlid;
+	r->slid = p->slid;
+	r->flowlabel_hoplimit = htobe32(be32toh(p->flow_label) << 8 | p->hop_limit);
+	r->tclass = p->traffic_class;
+	r->reversible_numpath = (p->reversible ? IBV_PATH_RECORD_REVERSIBLE : 0) |
+				(p->numb_path ? p->numb_path : 1);
+	r->pkey = p->pkey;
+	r->qosclass_sl = htobe16(p->sl & 0xf);
+	r->mtu = p->mtu_selector << 6 | p->mtu;
+	r->rate = p->rate_selector << 6 | p->rate;
+	r->packetlifetime = p->packet_life_time_selector << 6 | p->packet_life_time;
+	r->preference = p->preference;
+}
+
+static socklen_t addr_len(const struct sockaddr *sa)
+{
+	switch (sa->sa_family) {
+	case AF_INET:
+		return sizeof(struct sockaddr_in);
+	case AF_INET6:
+		return sizeof(struct sockaddr_in6);
+	case AF_IB:
+		return sizeof(struct sockaddr_ib);
+	default:
+		return 0;
+	}
+}
+
+static void clear_port(struct sockaddr_storage *ss)
+{
+	struct sockaddr_ib *sib = (struct sockaddr_ib *)ss;
+
+	switch (ss->ss_family) {
+	case AF_INET:
+		((struct sockaddr_in *)ss)->sin_port = 0;
+		break;
+	case AF_INET6:
+		((struct sockaddr_in6 *)ss)->sin6_port = 0;
+		break;
+	case AF_IB:
+		sib->sib_sid = 0;
+		sib->sib_sid_mask = 0;
+		break;
+	}
+}
+
+int rcache_store(struct rcache *rc, const char *key, struct rdma_cm_id *id)
+{
+	struct sockaddr *src = rdma_get_local_addr(id), *dst = rdma_get_peer_addr(id);
+	struct rcache_entry *ce;
+	unsigned int i;
+
+	if (!addr_len(src) || !addr_len(dst))
+		return -1;
+
+	ce = rcache_find(rc, key);
+	if (!ce && rc->n < RCACHE_MAX)
+		ce = &rc->e[rc->n++];
+
+	/* Full, replaces the one to expire first */
+	if (!ce) {
+		ce = &rc->e[0];
+		for (i = 1; i < rc->n; i++)
+			if (rc->e[i].expires < ce->expires)
+				ce = &rc->e[i];
+	}
+
+	memset(ce, 0, sizeof(*ce));
+	snprintf(ce->key, sizeof(ce->key), "%s", key);
+	memcpy(&ce->src, src, addr_len(src));
+	memcpy(&ce->dst, dst, addr_len(dst));
+	clear_port(&ce->src);		/* Still bound by @id, and the next of many */
+	if (id->route.num_paths > 0 && id->route.path_rec) {
+		path_from_sa(&ce->path, id->route.path_rec);
+		ce->has_path = true;
+	}
+	ce->expires = rcache_now() + rc->ttl_s * 1000000000ULL;
+
+	rcache_save(rc);
+	return 0;
+}
+
+void rcache_invalidate(struct rcache *rc, const char *key)
+{
+	struct rcache_entry *ce;
+
+	if (!key) {
+		rc->invalidated += rc->n;
+		rc->n = 0;
+	} else {
+		ce = rcache_find(rc, key);
+		if (!ce)
+			return;
+		rcache_remove(rc, ce);
+		rc->invalidated++;
+	}
+	rcache_save(rc);
+}
+
+void rcache_event(struct rcache *rc, struct rdma_cm_event *e)
+{
+	if (e->event != RDMA_CM_EVENT_ADDR_CHANGE)
+		return;
+
+	INFO("Address change, %u cached resolutions dropped", rc->n);
+	rcache_invalidate(rc, NULL);
+}
+
+int rcache_resolve_addr(struct rdma_cm_id *id, const struct rcache_entry *ce, int timeout_ms)
+{
+	return rdma_resolve_addr(id, (struct sockaddr *)&ce->src,
+				 (struct sockaddr *)&ce->dst, timeout_ms);
+}
+
+int rcache_resolve_route(struct rdma_cm_id *id, const struct rcache_entry *ce, int timeout_ms)
+{
+	if (ce && ce->has_path &&
+	    !rdma_set_option(id, RDMA_OPTION_IB, RDMA_OPTION_IB_PATH,
+			     (void *)&ce->path, sizeof(ce->path)))
+		return 0;
+
+	return rdma_resolve_route(id, timeout_ms);
+}
+
+void rcache_key_addr(char *key, const struct sockaddr *dst)
+{
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)dst;
+	const struct sockaddr_in *sin = (const struct sockaddr_in *)dst;
+	const struct sockaddr_ib *sib = (const struct sockaddr_ib *)dst;
+	char ip[INET6_ADDRSTRLEN] = "?";
+
+	switch (dst->sa_family) {
+	case AF_INET:
+		inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip));
+		snprintf(key, RCACHE_KEY_LEN, "%s:%u", ip, ntohs(sin->sin_port));
+		break;
+	case AF_INET6:
+		inet_ntop(AF_INET6, &sin6->sin6_addr, ip, sizeof(ip));
+		snprintf(key, RCACHE_KEY_LEN, "[%s]:%u", ip, ntohs(sin6->sin6_port));
+		break;
+	case AF_IB:
+		inet_ntop(AF_INET6, &sib->sib_addr, ip, sizeof(ip));
+		snprintf(key, RCACHE_KEY_LEN, "%s/0x%" PRIx64, ip, be64toh(sib->sib_sid));
+		break;
+	default:
+		snprintf(key, RCACHE_KEY_LEN, "family %u", dst->sa_family);
+	}
+}
+
+void rcache_dump_stats(const struct rcache *rc)
+{
+	printf("  resolution cache: %u entries, ttl %u s, %lu hits, %lu misses, %lu expired, %lu invalidated\n",
+	       rc->n, rc->ttl_s, rc->hits, rc->misses, rc->expired, rc->invalidated);
+}
@@ -0,0 +1,75 @@
+#ifndef CM_EXAMPLES_RCACHE_H
+#define CM_EXAMPLES_RCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <infiniband/sa.h>
+#include <rdma/rdma_cma.h>
+
+/*
+ * Resolution cache of the rdma_cm clients: The source and destination
+ * addresses and the path record a connect resolved, keyed by what it was
+ * resolved from, e.g. "192.168.1.1:7471" or an IB service ID. A reconnect
+ * within the TTL still resolves the address, from the cached source to the
+ * cached destination, but skips what led to them, e.g. the service record
+ * query, and sets the path with RDMA_OPTION_IB_PATH instead of the SA path
+ * query of rdma_resolve_route().
+ *
+ * Optionally kept in a file, so the next run of a client hits it too; An
+ * RDMA_CM_EVENT_ADDR_CHANGE drops everything, the addresses or ports of the
+ * host changed. Not thread-safe.
+ */
+#define RCACHE_MAX 64
+#define RCACHE_KEY_LEN 64
+#define RCACHE_DEF_TTL_S 60
+
+struct rcache_entry {
+	char key[RCACHE_KEY_LEN];
+	struct sockaddr_storage src;
+	struct sockaddr_storage dst;
+	bool has_path;
+	struct ibv_path_data path;
+	uint64_t expires;		/* CLOCK_REALTIME ns, valid across runs */
+};
+
+struct rcache {
+	unsigned int ttl_s;
+	const char *file;		/* NULL for memory only */
+	struct rcache_entry e[RCACHE_MAX];
+	unsigned int n;
+
+	unsigned long hits, misses, expired, invalidated;
+};
+
+void rcache_init(struct rcache *rc, unsigned int ttl_s, const char *file);
+
+/* A fresh entry of @key copied to @out, -1 if there is none */
+int rcache_lookup(struct rcache *rc, const char *key, struct rcache_entry *out);
+
+/* What @id resolved, once ROUTE_RESOLVED */
+int rcache_store(struct rcache *rc, const char *key, struct rdma_cm_id *id);
+
+/* @key, or everything if NULL */
+void rcache_invalidate(struct rcache *rc, const char *key);
+
+/* To see every event of the channel, e.g. RDMA_CM_EVENT_ADDR_CHANGE */
+void rcache_event(struct rcache *rc, struct rdma_cm_event *e);
+
+/*
+ * rdma_resolve_addr() from the cached source to the cached destination;
+ * Not skipped, the address is bound and its neighbour resolved as usual
+ */
+int rcache_resolve_addr(struct rdma_cm_id *id, const struct rcache_entry *ce, int timeout_ms);
+
+/*
+ * The cached path if any, else rdma_resolve_route(); Either way
+ * RDMA_CM_EVENT_ROUTE_RESOLVED follows
+ */
+int rcache_resolve_route(struct rdma_cm_id *id, const struct rcache_entry *ce, int timeout_ms);
+
+void rcache_key_addr(char *key, const struct sockaddr *dst);
+void rcache_dump_stats(const struct rcache *rc);
+
+#endif
@@ -0,0 +1,365 @@
+/*
+ * Name resolution rate: The names of a file, /etc/hosts by default, are
+ * resolved N times over, either asynchronously with rdma_resolve_addrinfo()
+ * on up to M ids sharing one event channel, or with rdma_getaddrinfo() from
+ * T threads, as resolve_dns.c and client.sync.c do one at a time.
+ *
+ * Each line of the file has names, after an address in the /etc/hosts
+ * format; '#' starts a comment. They resolve against whatever the resolver
+ * is set up with, e.g. /etc/hosts or a DNS stub on the host, so no network
+ * round trip is timed.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rdma/rdma_cma.h>
+
+#include "bench.h"
+#include "helper.h"
+#include "params.h"
+
+#define DEF_NAMES_FILE "/etc/hosts"
+#define DEF_RESOLVES 10000
+#define DEF_INFLIGHT 1000
+#define DEF_THREADS 8
+#define MAX_NAMES 65536
+
+enum {
+	RB_ASYNC = 1 << 0,
+	RB_SYNC = 1 << 1,
+};
+
+struct req {
+	struct rdma_cm_id *id;
+	uint64_t ts;
+};
+
+static const char *names_file = DEF_NAMES_FILE;
+static const char *service;
+static unsigned long num_resolves = DEF_RESOLVES;
+static unsigned int inflight = DEF_INFLIGHT;
+static unsigned int num_threads = DEF_THREADS;
+static int modes = RB_ASYNC | RB_SYNC;
+static int family;
+
+static char *names[MAX_NAMES];
+static unsigned int num_names;
+
+static uint64_t *lat;
+static unsigned long nlat, resolved, failed;
+
+/* The sync threads take the next resolution from here */
+static unsigned long next_resolve;
+
+static bool is_address(const char *s)
+{
+	struct in6_addr a;
+
+	return inet_pton(AF_INET, s, &a) == 1 || inet_pton(AF_INET6, s, &a) == 1;
+}
+
+static int load_names(void)
+{
+	char line[1024], *tok, *save;
+	FILE *f;
+
+	f = fopen(names_file, "r");
+	if (!f) {
+		perror(names_file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) && num_names < MAX_NAMES) {
+		tok = strchr(line, '#');
+		if (tok)
+			*tok = '\0';
+
+		for (tok = strtok_r(line, " \t\r\n", &save); tok && num_names < MAX_NAMES;
+		     tok = strtok_r(NULL, " \t\r\n", &save)) {
+			if (is_address(tok))
+				continue;
+			names[num_names] = strdup(tok);
+			if (!names[num_names])
+				break;
+			num_names++;
+		}
+	}
+	fclose(f);
+
+	if (!num_names) {
+		ERR("No names in %s", names_file);
+		return -1;
+	}
+	return 0;
+}
+
+static void fill_hints(struct rdma_addrinfo *hints)
+{
+	memset(hints, 0, sizeof(*hints));
+	hints->ai_family = family;
+	hints->ai_port_space = RDMA_PS_TCP;
+}
+
+static void report(const char *api, const char *how, uint64_t wall)
+{
+	dump("%s (%s): %lu resolved, %lu failed in %.3f s, %.1f resolutions/s\n",
+	     api, how, resolved, failed, wall / 1e9, (resolved + failed) * 1e9 / wall);
+	dump_lat("latency", lat, nlat);
+}
+
+static int start_resolve(struct rdma_event_channel *ech, struct req *r, unsigned long i)
+{
+	struct rdma_addrinfo hints;
+	int ret;
+
+	ret = rdma_create_id(ech, &r->id, r, RDMA_PS_TCP);
+	if (ret) {
+		perror("rdma_create_id");
+		return ret;
+	}
+
+	fill_hints(&hints);
+	r->ts = get_time_ns();
+	ret = rdma_resolve_addrinfo(r->id, names[i % num_names], service, &hints);
+	if (ret) {
+		if (!failed)
+			ERR("rdma_resolve_addrinfo(%s) failed", names[i % num_names]);
+		rdma_destroy_id(r->id);
+		r->id = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Up to inflight ids resolving at once; An id resolves once, so every
+ * resolution creates one, outside of the latency
+ */
+static int run_async(void)
+{
+	unsigned long started = 0, done = 0, i;
+	struct rdma_event_channel *ech;
+	struct rdma_cm_event *e;
+	struct rdma_cm_id *id;
+	struct req *reqs, *r;
+	uint64_t start, now;
+	int ret = -1;
+
+	reqs = calloc(inflight, sizeof(*reqs));
+	ech = rdma_create_event_channel();
+	if (!reqs || !ech) {
+		ERR("Failed to set up %u requests", inflight);
+		goto out;
+	}
+
+	resolved = failed = nlat = 0;
+	start = get_time_ns();
+
+	/* reqs[i] is free once its id is destroyed */
+	for (i = 0; i < inflight; i++) {
+		while (started < num_resolves && !reqs[i].id) {
+			if (start_resolve(ech, &reqs[i], started++)) {
+				failed++;
+				done++;
+			}
+		}
+	}
+
+	while (done < num_resolves) {
+		if (rdma_get_cm_event(ech, &e)) {
+			perror("rdma_get_cm_event");
+			goto out;
+		}
+
+		now = get_time_ns();
+		id = e->id;
+		r = id->context;
+		if (e->event == RDMA_CM_EVENT_ADDRINFO_RESOLVED) {
+			lat[nlat++] = now - r->ts;
+			resolved++;
+		} else {
+			if (!failed)
+				ERR("%s, status %d", rdma_event_str(e->event), e->status);
+			failed++;
+		}
+		done++;
+
+		rdma_ack_cm_event(e);
+		rdma_destroy_id(id);
+		r->id = NULL;
+
+		while (started < num_resolves && !r->id) {
+			if (start_resolve(ech, r, started++)) {
+				failed++;
+				done++;
+			}
+		}
+	}
+	report("rdma_resolve_addrinfo", "async, one event channel", get_time_ns() - start);
+	ret = 0;
+
+out:
+	for (i = 0; reqs && i < inflight; i++)
+		if (reqs[i].id)
+			rdma_destroy_id(reqs[i].id);
+	if (ech)
+		rdma_destroy_event_channel(ech);
+	free(reqs);
+	return ret;
+}
+
+static void *sync_thread(void *arg)
+{
+	struct rdma_addrinfo hints, *rai;
+	uint64_t ts;
+	unsigned long i;
+	int ret;
+
+	fill_hints(&hints);
+	while ((i = __atomic_fetch_add(&next_resolve, 1, __ATOMIC_RELAXED)) < num_resolves) {
+		ts = get_time_ns();
+		ret = rdma_getaddrinfo(names[i % num_names], service, &hints, &rai);
+		if (ret) {
+			if (!__atomic_fetch_add(&failed, 1, __ATOMIC_RELAXED))
+				ERR("rdma_getaddrinfo(%s) failed", names[i % num_names]);
+			continue;
+		}
+
+		/* nlat hands out the slots, one per resolution */
+		lat[__atomic_fetch_add(&nlat, 1, __ATOMIC_RELAXED)] = get_time_ns() - ts;
+		__atomic_add_fetch(&resolved, 1, __ATOMIC_RELAXED);
+		rdma_freeaddrinfo(rai);
+	}
+	return NULL;
+}
+
+static int run_sync(void)
+{
+	pthread_t *threads;
+	char how[64];
+	uint64_t start;
+	unsigned int i, n;
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!threads) {
+		ERR("Failed to allocate %u threads", num_threads);
+		return -1;
+	}
+
+	resolved = failed = nlat = next_resolve = 0;
+	start = get_time_ns();
+	for (n = 0; n < num_threads; n++)
+		if (pthread_create(&threads[n], NULL, sync_thread, NULL)) {
+			perror("pthread_create");
+			break;
+		}
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+
+	snprintf(how, sizeof(how), "sync, %u threads", n);
+	report("rdma_getaddrinfo", how, get_time_ns() - start);
+	free(threads);
+	return n ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+	dump("Usage: %s [-f <names file>] [-s <service>] [-n <resolutions>] [-m <in flight>] [-t <threads>]\n", prog);
+	dump("              [-a async|sync] [-4|-6]\n");
+	dump("  -f: Names to resolve, the /etc/hosts format works (default %s)\n", DEF_NAMES_FILE);
+	dump("  -s: Service, e.g. a port, resolved with every name\n");
+	dump("  -n: Resolutions, over the names again and again (default %d)\n", DEF_RESOLVES);
+	dump("  -m: Async, rdma_resolve_addrinfo() in flight on the event channel (default %d)\n",
+	     DEF_INFLIGHT);
+	dump("  -t: Sync, threads calling rdma_getaddrinfo() (default %d)\n", DEF_THREADS);
+	dump("  -a: Only the async or the sync API, both by default\n");
+}
+
+static int parse_opt(int argc, char *argv[])
+{
+	int op;
+
+	while ((op = getopt(argc, argv, "f:s:n:m:t:a:46h")) != -1) {
+		switch (op) {
+		case 'f':
+			names_file = optarg;
+			break;
+		case 's':
+			service = optarg;
+			break;
+		case 'n':
+			num_resolves = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			inflight = atoi(optarg);
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		case 'a':
+			if (!strcmp(optarg, "async")) {
+				modes = RB_ASYNC;
+			} else if (!strcmp(optarg, "sync")) {
+				modes = RB_SYNC;
+			} else {
+				usage(argv[0]);
+				return -EINVAL;
+			}
+			break;
+		case '4':
+			family = AF_INET;
+			break;
+		case '6':
+			family = AF_INET6;
+			break;
+		default:
+			usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+
+	if (!num_resolves || !inflight || !num_threads) {
+		usage(argv[0]);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	int ret;
+
+	ret = parse_opt(argc, argv);
+	if (ret)
+		return ret;
+
+	ret = load_names();
+	if (ret)
+		goto out;
+
+	lat = calloc(num_resolves, sizeof(*lat));
+	if (!lat) {
+		ERR("Failed to allocate %lu samples", num_resolves);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	dump("%u names from %s, %lu resolutions each way\n", num_names, names_file, num_resolves);
+	if (modes & RB_ASYNC)
+		ret = run_async();
+	if (!ret && (modes & RB_SYNC))
+		ret = run_sync();
+
+out:
+	free(lat);
+	for (i = 0; i < num_names; i++)
+		free(names[i]);
+	return ret;
+}
@@ -1,80 +1,1397 @@
+/*
+ * Event-driven server: The main thread runs an epoll loop on the CM event
+ * channel and accepts any number of connections. Each connection lives in
+ * an object of conn_slab, with its own completion channel, CQ, QP and
+ * receive buffers, and once established is handed to one of the pinned
+ * worker threads, whose epoll loop multiplexes the completion channels of
+ * all its connections.
+ *
+ * With -S, the connections of a device share one SRQ instead, fed from
+ * one registered pool of receive slots: A replenish thread, woken by the
+ * SRQ limit event at the low watermark, or the workers themselves (-I)
+ * post free slots back up to the high watermark. The connections of a
+ * worker on a device then share one CQ too, sized for the pool, and its
+ * completions are matched to their connection by QP number.
+ *
+ * The workers handle the CQs with the completion engine of comp.h (-C):
+ * Sleeping in epoll until a CQ event, busy-polling every connection, or
+ * busy-polling the connections that had one until they're idle for the
+ * budget (-B), then sleeping.
+ *
+ * Messages of client.c are printed; Clients that ask for it in the
+ * connect private data (see proto.h) get every message echoed, or just
+ * received, or received while the server streams as many back. Bulk
+ * clients get the address and rkey of a registered region, the file of -f
+ * mmap'ed, to RDMA WRITE into, or have the server RDMA READ theirs into it.
+ */
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+#include <sys/resource.h>
 
 #include <rdma/rdma_cma.h>
 
+#include "bench.h"
+#include "comp.h"
 #include "helper.h"
 #include "params.h"
+#include "proto.h"
 
-#define SERVER_VERSION "0.1"
+#define SERVER_VERSION "0.2"
 
-static struct rdma_event_channel *ech;
+#define MAX_DEVS 8
+#define MAX_WORKERS 64
+#define DEF_RECV_DEPTH 4
+#define POLL_BATCH 16
+#define SLAB_CHUNK (1 << 20)
+#define WRID_SEND (1ULL << 63)
+#define WRID_TX (1ULL << 62)		/* Streamed to the client */
+#define DEF_SRQ_SLOTS 8192
+#define DEF_BULK_LEN (256UL << 20)
+#define SRQ_POST_BATCH 32
+#define QP_HASH 1024		/* Buckets of the QP table of a worker */
+#define CQE_BYTES 64		/* Of mlx5, for the memory stats */
+
+/* Fixed-size objects carved from large chunks, recycled through a free list */
+struct slab {
+	size_t obj_size;
+	unsigned int per_chunk;
+	void *free;
+	void **chunks;
+	unsigned int nchunks;
+	unsigned long in_use;
+	pthread_mutex_t lock;
+};
+
+enum {
+	CMD_ADD = 1 << 0,
+	CMD_DEL = 1 << 1,
+};
+
+struct worker;
+struct conn;
+struct dev_res;
+
+/* A CQ of a worker: The own of a connection, or shared with an SRQ */
+struct wcq {
+	struct comp comp;
+	struct conn *c;		/* NULL if shared, see qp_lookup() */
+	struct worker *w;
+	struct dev_res *dev;
+	unsigned int tx_cqe;	/* Shared, for the streams and READs in flight */
+
+	LIST_ENTRY(wcq) hot_node;
+	bool hot;		/* Busy-polled by a hybrid worker */
+	uint64_t last_cqe;
+};
+
+/* Touched by the main thread until it's handed to its worker with CMD_ADD */
+struct conn {
+	struct rdma_cm_id *id;
+	struct worker *w;
+	struct wcq *cq;		/* own, or the one of the worker with an SRQ */
+	struct wcq own;
+	struct ibv_mr *mr;
+	unsigned int echoes;	/* Sends in flight, each holding a slot */
+	uint8_t mode;
+	bool added;		/* To the lists and epoll of its worker */
+	bool established;
+
+	LIST_ENTRY(conn) node;
+	struct conn *qp_next;	/* In the QP table of the worker, with an SRQ */
+
+	char *buf;		/* nslots slots of BUFSIZE, none with an SRQ */
+	unsigned int nslots;
+
+	/* Requested in the hello */
+	uint32_t msg_size;
+	uint32_t window;
+	uint64_t iters;
+
+	/* CM_MODE_BIDIR stream, every message sent from tx */
+	char *tx;
+	struct ibv_mr *tx_mr;
+	uint64_t tx_posted, tx_done;
+
+	/* Bulk modes, bytes of the transfer into the region */
+	uint64_t peer_addr;
+	uint32_t peer_rkey;
+	uint64_t bulk_total, bulk_posted, bulk_done;
+	uint64_t bulk_start;
+
+	int cmds;		/* CMD_*, under w->lock */
+	struct conn *next_cmd;
+
+	struct dev_res *dev;
+
+	char slots[];		/* recv_depth slots, buf unless the client wants more */
+};
+
+struct worker {
+	pthread_t thread;
+	int idx;
+	int epfd;
+	int evfd;		/* Commands are queued */
+	pthread_mutex_t lock;
+	struct conn *cmds;
 
-static struct rdma_cm_id *listen_id, *client_id;
-static struct ibv_pd *pd;
-static struct ibv_mr *mr;
-static struct ibv_cq *cq;
+	LIST_HEAD(, conn) conns;
+	LIST_HEAD(, wcq) hot;
+	uint64_t cpu_ns;	/* Of the thread, for the stats */
 
-static char buf[BUFSIZE];
+	unsigned long nconns;
+	unsigned long msgs;
+	uint64_t bytes;
+
+	/* SRQ mode: The CQs by device, created by the main thread, and the QPs under lock */
+	struct wcq *srq_cqs[MAX_DEVS];
+	struct conn *qps[QP_HASH];
+};
+
+struct dev_res {
+	struct ibv_context *verbs;
+	struct ibv_pd *pd;
+
+	/* SRQ mode */
+	struct ibv_srq *srq;
+	struct ibv_mr *pool_mr;
+	char *pool;		/* srq_slots slots of BUFSIZE */
+	uint32_t *free_slots;	/* Stack, under pool_lock */
+	unsigned int nfree;
+	unsigned int posted;	/* Receives on the SRQ */
+	unsigned long limit_events;
+	pthread_mutex_t pool_lock;
+	pthread_t replenisher;
+	bool has_replenisher;
+
+	struct ibv_mr *bulk_mr;	/* Registered on the first bulk client */
+};
+
+static struct rdma_event_channel *ech;
+static struct rdma_cm_id *listen_id;
+static int epfd = -1;
 
 static int server_port_space = RDMA_PS_TCP;
+static unsigned int num_workers;
+static unsigned int recv_depth = DEF_RECV_DEPTH;
+static int comp_mode = COMP_EVENT;
+static const char *bulk_file;
+static char *bulk_region;
+static size_t bulk_len = DEF_BULK_LEN;
+static uint64_t comp_budget_ns = COMP_DEF_BUDGET_NS;
+static unsigned int srq_slots;		/* SRQ mode if set */
+static unsigned int srq_low, srq_high;
+static bool inline_replenish;
+
+static struct dev_res devs[MAX_DEVS];
+static int num_devs;
+static struct worker workers[MAX_WORKERS];
+static unsigned int next_worker;
+static struct slab conn_slab;
+
+static unsigned long accepted, closed, rejected;
+static unsigned long extra_slots;	/* Of the bufs allocated past the slots */
+static unsigned long cq_entries;	/* Of all the CQs */
+
+static int slab_init(struct slab *s, size_t obj_size)
+{
+	memset(s, 0, sizeof(*s));
+	s->obj_size = (obj_size + 63) & ~63UL;
+	s->per_chunk = SLAB_CHUNK / s->obj_size ? SLAB_CHUNK / s->obj_size : 1;
+	return pthread_mutex_init(&s->lock, NULL);
+}
+
+static int slab_grow(struct slab *s)
+{
+	void **chunks;
+	char *p;
+	unsigned int i;
+
+	chunks = realloc(s->chunks, (s->nchunks + 1) * sizeof(*chunks));
+	if (!chunks)
+		return ENOMEM;
+	s->chunks = chunks;
+
+	p = aligned_alloc(4096, (size_t)s->per_chunk * s->obj_size);
+	if (!p)
+		return ENOMEM;
+	s->chunks[s->nchunks++] = p;
+
+	for (i = 0; i < s->per_chunk; i++) {
+		*(void **)(p + i * s->obj_size) = s->free;
+		s->free = p + i * s->obj_size;
+	}
+	return 0;
+}
+
+static void *slab_alloc(struct slab *s)
+{
+	void *obj = NULL;
+
+	pthread_mutex_lock(&s->lock);
+	if (s->free || !slab_grow(s)) {
+		obj = s->free;
+		s->free = *(void **)obj;
+		s->in_use++;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return obj;
+}
+
+static void slab_free(struct slab *s, void *obj)
+{
+	pthread_mutex_lock(&s->lock);
+	*(void **)obj = s->free;
+	s->free = obj;
+	s->in_use--;
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void slab_destroy(struct slab *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->nchunks; i++)
+		free(s->chunks[i]);
+	free(s->chunks);
+	pthread_mutex_destroy(&s->lock);
+}
+
+static int set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK)) {
+		perror("fcntl");
+		return -1;
+	}
+	return 0;
+}
+
+/* Posts free slots until srq_high are posted */
+static void rx_refill(struct dev_res *d)
+{
+	struct ibv_recv_wr wr[SRQ_POST_BATCH], *bad_wr;
+	struct ibv_sge sge[SRQ_POST_BATCH];
+	unsigned int n, posted;
+	uint32_t slot;
+
+	pthread_mutex_lock(&d->pool_lock);
+	while (d->nfree) {
+		posted = __atomic_load_n(&d->posted, __ATOMIC_RELAXED);
+		for (n = 0; n < SRQ_POST_BATCH && d->nfree && posted + n < srq_high; n++) {
+			slot = d->free_slots[--d->nfree];
+			sge[n].addr = (uintptr_t)d->pool + (size_t)slot * BUFSIZE;
+			sge[n].length = BUFSIZE;
+			sge[n].lkey = d->pool_mr->lkey;
+			wr[n].wr_id = slot;
+			wr[n].sg_list = &sge[n];
+			wr[n].num_sge = 1;
+			wr[n].next = &wr[n + 1];
+		}
+		if (!n)
+			break;
+		wr[n - 1].next = NULL;
+
+		/* Counted first, their completions may come right away */
+		__atomic_add_fetch(&d->posted, n, __ATOMIC_RELAXED);
+		if (ibv_post_srq_recv(d->srq, wr, &bad_wr)) {
+			perror("ibv_post_srq_recv");
+			__atomic_sub_fetch(&d->posted, n, __ATOMIC_RELAXED);
+			d->nfree += n;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&d->pool_lock);
+}
 
-static int setup_qp_server(struct rdma_cm_id *cid)
+static void rx_free(struct dev_res *d, uint32_t slot)
 {
+	unsigned int posted;
+
+	pthread_mutex_lock(&d->pool_lock);
+	d->free_slots[d->nfree++] = slot;
+	pthread_mutex_unlock(&d->pool_lock);
+
+	posted = __atomic_load_n(&d->posted, __ATOMIC_RELAXED);
+	if (inline_replenish && posted < srq_low)
+		rx_refill(d);
+}
+
+/* The limit event is one-shot, armed again after every refill */
+static void arm_srq_limit(struct dev_res *d)
+{
+	struct ibv_srq_attr attr = { .srq_limit = srq_low };
+
+	if (ibv_modify_srq(d->srq, &attr, IBV_SRQ_LIMIT))
+		perror("ibv_modify_srq");
+}
+
+static void *replenish_thread(void *arg)
+{
+	struct dev_res *d = arg;
+	struct pollfd pfd = { .fd = d->verbs->async_fd, .events = POLLIN };
+	struct ibv_async_event ev;
+	int n;
+
+	while (1) {
+		/*
+		 * Below the watermark with no free slot, e.g. all held by
+		 * echoes in flight: The event won't come again, check back soon
+		 */
+		n = poll(&pfd, 1, __atomic_load_n(&d->posted, __ATOMIC_RELAXED) < srq_low ? 1 : -1);
+		if (n < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+
+		while (n > 0 && !ibv_get_async_event(d->verbs, &ev)) {
+			if (ev.event_type == IBV_EVENT_SRQ_LIMIT_REACHED)
+				d->limit_events++;
+			else
+				INFO("Async event %s", ibv_event_type_str(ev.event_type));
+			ibv_ack_async_event(&ev);
+		}
+
+		rx_refill(d);
+		arm_srq_limit(d);
+	}
+
+	return NULL;
+}
+
+static int rx_pool_init(struct dev_res *d)
+{
+	struct ibv_srq_init_attr attr = {
+		.attr = {
+			.max_wr = srq_slots,
+			.max_sge = 1,
+		},
+	};
+	unsigned int i;
 	int ret;
 
-	pd = ibv_alloc_pd(cid->verbs);
-	if (!pd) {
-		perror("ibv_alloc_pd");
+	d->pool = aligned_alloc(4096, (size_t)srq_slots * BUFSIZE);
+	d->free_slots = calloc(srq_slots, sizeof(*d->free_slots));
+	if (!d->pool || !d->free_slots) {
+		ERR("Failed to allocate %u receive slots", srq_slots);
 		return -1;
 	}
+	pthread_mutex_init(&d->pool_lock, NULL);
+	for (i = 0; i < srq_slots; i++)
+		d->free_slots[i] = srq_slots - 1 - i;
+	d->nfree = srq_slots;
 
-	mr = ibv_reg_mr(pd, buf, BUFSIZE, IBV_ACCESS_LOCAL_WRITE);
-	if (!mr) {
+	d->pool_mr = ibv_reg_mr(d->pd, d->pool, (size_t)srq_slots * BUFSIZE,
+				IBV_ACCESS_LOCAL_WRITE);
+	if (!d->pool_mr) {
 		perror("ibv_reg_mr");
 		return -1;
 	}
 
-	cq = ibv_create_cq(cid->verbs, 32, NULL, NULL, 0);
+	d->srq = ibv_create_srq(d->pd, &attr);
+	if (!d->srq) {
+		perror("ibv_create_srq");
+		return -1;
+	}
+
+	rx_refill(d);
+	if (inline_replenish)
+		return 0;
+
+	if (set_nonblock(d->verbs->async_fd))
+		return -1;
+	arm_srq_limit(d);
+	ret = pthread_create(&d->replenisher, NULL, replenish_thread, d);
+	if (ret) {
+		ERR("pthread_create failed %d", ret);
+		return ret;
+	}
+	d->has_replenisher = true;
+	return 0;
+}
+
+static void rx_pool_destroy(struct dev_res *d)
+{
+	if (d->has_replenisher) {
+		pthread_cancel(d->replenisher);
+		pthread_join(d->replenisher, NULL);
+	}
+	if (d->srq)
+		ibv_destroy_srq(d->srq);
+	if (d->pool_mr)
+		ibv_dereg_mr(d->pool_mr);
+	free(d->pool);
+	free(d->free_slots);
+}
+
+static struct dev_res *get_dev(struct ibv_context *verbs)
+{
+	struct dev_res *d;
+	int i;
+
+	for (i = 0; i < num_devs; i++)
+		if (devs[i].verbs == verbs)
+			return &devs[i];
+
+	if (num_devs == MAX_DEVS) {
+		ERR("Too many devices");
+		return NULL;
+	}
+
+	d = &devs[num_devs];
+	d->pd = ibv_alloc_pd(verbs);
+	if (!d->pd) {
+		perror("ibv_alloc_pd");
+		return NULL;
+	}
+	d->verbs = verbs;
+	num_devs++;
+
+	if (srq_slots && rx_pool_init(d)) {
+		ERR("Failed to set up the SRQ");
+		return NULL;
+	}
+	return d;
+}
+
+static int post_recv(struct conn *c, unsigned int slot)
+{
+	struct ibv_sge sg_list = {
+		.addr   = (uintptr_t)c->buf + slot * BUFSIZE,
+		.length = BUFSIZE,
+		.lkey   = c->mr->lkey,
+	};
+	struct ibv_recv_wr wr = {
+		.wr_id   = slot,
+		.sg_list = &sg_list,
+		.num_sge = 1,
+	}, *bad_wr;
+	int ret;
+
+	ret = ibv_post_recv(c->id->qp, &wr, &bad_wr);
+	if (ret)
+		perror("ibv_post_recv");
+	return ret;
+}
+
+static char *slot_buf(struct conn *c, uint32_t slot)
+{
+	return (c->dev->srq ? c->dev->pool : c->buf) + (size_t)slot * BUFSIZE;
+}
+
+/* A slot is received into again once it's printed or echoed */
+static void rx_put(struct conn *c, uint32_t slot)
+{
+	if (c->dev->srq)
+		rx_free(c->dev, slot);
+	else
+		post_recv(c, slot);
+}
+
+static int post_echo(struct conn *c, unsigned int slot, uint32_t len)
+{
+	struct ibv_sge sg_list = {
+		.addr   = (uintptr_t)slot_buf(c, slot),
+		.length = len,
+		.lkey   = c->dev->srq ? c->dev->pool_mr->lkey : c->mr->lkey,
+	};
+	struct ibv_send_wr wr = {
+		.wr_id      = WRID_SEND | slot,
+		.sg_list    = &sg_list,
+		.num_sge    = 1,
+		.opcode     = IBV_WR_SEND,
+		.send_flags = IBV_SEND_SIGNALED,
+	}, *bad_wr;
+	int ret;
+
+	ret = ibv_post_send(c->id->qp, &wr, &bad_wr);
+	if (ret)
+		perror("ibv_post_send");
+	else
+		c->echoes++;
+	return ret;
+}
+
+static bool is_bulk(int mode)
+{
+	return mode >= CM_MODE_BULK_WRITE && mode <= CM_MODE_BULK_SEND;
+}
+
+/* The next chunk of the transfer can't cross the end of the region */
+static uint32_t bulk_chunk(struct conn *c, uint64_t off)
+{
+	uint64_t len = c->bulk_total - off;
+
+	if (len > c->msg_size)
+		len = c->msg_size;
+	if (len > bulk_len - off % bulk_len)
+		len = bulk_len - off % bulk_len;
+	return len;
+}
+
+/* A SEND of the transfer, wrapped at the end of the region as the chunks are */
+static void bulk_copy(struct conn *c, const char *p, uint32_t len)
+{
+	uint64_t off;
+	uint32_t n;
+
+	while (len) {
+		off = c->bulk_done % bulk_len;
+		n = len < bulk_len - off ? len : bulk_len - off;
+		memcpy(bulk_region + off, p, n);
+		c->bulk_done += n;
+		p += n;
+		len -= n;
+	}
+}
+
+/* Pulls the client's data with window RDMA READs in flight */
+static int post_pull(struct conn *c)
+{
+	struct ibv_sge sg_list = {
+		.lkey = c->dev->bulk_mr->lkey,
+	};
+	struct ibv_send_wr wr = {
+		.sg_list    = &sg_list,
+		.num_sge    = 1,
+		.opcode     = IBV_WR_RDMA_READ,
+		.send_flags = IBV_SEND_SIGNALED,
+		.wr.rdma.rkey = c->peer_rkey,
+	}, *bad_wr;
+	int ret;
+
+	while (c->bulk_posted < c->bulk_total && c->tx_posted - c->tx_done < c->window) {
+		sg_list.length = bulk_chunk(c, c->bulk_posted);
+		sg_list.addr = (uintptr_t)bulk_region + c->bulk_posted % bulk_len;
+		wr.wr_id = WRID_TX | sg_list.length;
+		wr.wr.rdma.remote_addr = c->peer_addr + c->bulk_posted;
+
+		ret = ibv_post_send(c->id->qp, &wr, &bad_wr);
+		if (ret) {
+			perror("ibv_post_send");
+			return ret;
+		}
+		c->bulk_posted += sg_list.length;
+		c->tx_posted++;
+	}
+	return 0;
+}
+
+/* All pulled, a zero-length SEND tells the client */
+static void bulk_read_done(struct conn *c)
+{
+	struct ibv_send_wr wr = {
+		.wr_id      = WRID_TX,
+		.opcode     = IBV_WR_SEND,
+		.send_flags = IBV_SEND_SIGNALED,
+	}, *bad_wr;
+	uint64_t ns = get_time_ns() - c->bulk_start;
+
+	dump("Pulled %lu bytes in %.3f s, %.3f GB/s\n", c->bulk_done, ns / 1e9,
+	     (double)c->bulk_done / ns);
+	c->tx_posted++;
+	if (ibv_post_send(c->id->qp, &wr, &bad_wr))
+		perror("ibv_post_send");
+}
+
+/* Keeps window messages in flight to the client until iters are sent */
+static int post_stream(struct conn *c)
+{
+	struct ibv_sge sg_list = {
+		.addr   = (uintptr_t)c->tx,
+		.length = c->msg_size,
+		.lkey   = c->tx_mr->lkey,
+	};
+	struct ibv_send_wr wr = {
+		.wr_id      = WRID_TX,
+		.sg_list    = &sg_list,
+		.num_sge    = 1,
+		.opcode     = IBV_WR_SEND,
+		.send_flags = IBV_SEND_SIGNALED,
+	}, *bad_wr;
+	int ret;
+
+	while (c->tx_posted < c->iters && c->tx_posted - c->tx_done < c->window) {
+		ret = ibv_post_send(c->id->qp, &wr, &bad_wr);
+		if (ret) {
+			perror("ibv_post_send");
+			return ret;
+		}
+		c->tx_posted++;
+	}
+	return 0;
+}
+
+/*
+ * The echo of a slot is sent before it's received again, so a slot has at
+ * most one completion in a CQ: The own of a connection is sized for its
+ * slots, a shared one for the pool
+ */
+static int wcq_init(struct wcq *cq, struct ibv_context *verbs, int cqe)
+{
+	if (comp_init(&cq->comp, verbs, cqe, cq, comp_mode, POLL_BATCH, comp_budget_ns))
+		return -1;
+	__atomic_add_fetch(&cq_entries, cq->comp.cq->cqe, __ATOMIC_RELAXED);
+	if (comp_mode != COMP_POLL && comp_arm(&cq->comp))
+		return -1;
+	return 0;
+}
+
+static void wcq_destroy(struct wcq *cq)
+{
+	if (!cq->comp.cq)
+		return;
+	__atomic_sub_fetch(&cq_entries, cq->comp.cq->cqe, __ATOMIC_RELAXED);
+	comp_destroy(&cq->comp);
+}
+
+/* The CQ of the worker for its connections of the device, made for the first */
+static struct wcq *srq_cq_get(struct conn *c)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct worker *w = c->w;
+	int d = c->dev - devs;
+	struct wcq *cq = w->srq_cqs[d];
+
+	if (cq)
+		return cq;
+
+	cq = calloc(1, sizeof(*cq));
 	if (!cq) {
-		perror("ibv_create_cq");
+		ERR("Failed to allocate a CQ");
+		return NULL;
+	}
+	cq->w = w;
+	cq->dev = c->dev;
+	if (wcq_init(cq, c->id->verbs, srq_slots))
+		goto fail;
+	ev.data.ptr = cq;
+	if (cq->comp.ch && epoll_ctl(w->epfd, EPOLL_CTL_ADD, cq->comp.ch->fd, &ev)) {
+		perror("epoll_ctl");
+		goto fail;
+	}
+
+	/* Busy-polled by the worker from now on */
+	__atomic_store_n(&w->srq_cqs[d], cq, __ATOMIC_RELEASE);
+	return cq;
+
+fail:
+	wcq_destroy(cq);
+	free(cq);
+	return NULL;
+}
+
+/*
+ * Room in a shared CQ for the stream or the READs of @c, made by the
+ * worker, that polls it, once the connection is handed over; They don't
+ * start before
+ */
+static int srq_cq_reserve(struct conn *c)
+{
+	struct wcq *cq = c->cq;
+	int cqe = cq->comp.cq->cqe, need = srq_slots + cq->tx_cqe + c->window;
+
+	if (cq->c || !c->window)
+		return 0;
+
+	if (need > cqe) {
+		if (ibv_resize_cq(cq->comp.cq, need)) {
+			perror("ibv_resize_cq");
+			c->window = 0;
+			return -1;
+		}
+		__atomic_add_fetch(&cq_entries, cq->comp.cq->cqe - cqe, __ATOMIC_RELAXED);
+	}
+	cq->tx_cqe += c->window;
+	return 0;
+}
+
+static void qp_add(struct conn *c)
+{
+	struct worker *w = c->w;
+	struct conn **head = &w->qps[c->id->qp->qp_num % QP_HASH];
+
+	pthread_mutex_lock(&w->lock);
+	c->qp_next = *head;
+	*head = c;
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void qp_del(struct conn *c)
+{
+	struct worker *w = c->w;
+	struct conn **p;
+
+	pthread_mutex_lock(&w->lock);
+	for (p = &w->qps[c->id->qp->qp_num % QP_HASH]; *p; p = &(*p)->qp_next) {
+		if (*p == c) {
+			*p = c->qp_next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* The connections of a batch of a shared CQ, NULL for a QP gone */
+static void qp_lookup(struct worker *w, struct ibv_wc *wc, struct conn **conns, int n)
+{
+	struct conn *c;
+	int i;
+
+	pthread_mutex_lock(&w->lock);
+	for (i = 0; i < n; i++) {
+		for (c = w->qps[wc[i].qp_num % QP_HASH]; c; c = c->qp_next)
+			if (c->id->qp->qp_num == wc[i].qp_num)
+				break;
+		conns[i] = c;
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+static int setup_qp_server(struct conn *c)
+{
+	struct rdma_cm_id *cid = c->id;
+	unsigned int i;
+	int ret;
+
+	c->dev = get_dev(cid->verbs);
+	if (!c->dev)
 		return -1;
+
+	if (!c->dev->srq) {
+		c->mr = ibv_reg_mr(c->dev->pd, c->buf, (size_t)c->nslots * BUFSIZE,
+				   IBV_ACCESS_LOCAL_WRITE);
+		if (!c->mr) {
+			perror("ibv_reg_mr");
+			return -1;
+		}
+	}
+
+	if (is_bulk(c->mode) && !c->dev->bulk_mr) {
+		c->dev->bulk_mr = ibv_reg_mr(c->dev->pd, bulk_region, bulk_len,
+					     IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+		if (!c->dev->bulk_mr) {
+			perror("ibv_reg_mr");
+			return -1;
+		}
+	}
+
+	if (c->mode == CM_MODE_BIDIR) {
+		c->tx = calloc(1, c->msg_size);
+		if (!c->tx) {
+			ERR("Failed to allocate the stream buffer");
+			return -1;
+		}
+		c->tx_mr = ibv_reg_mr(c->dev->pd, c->tx, c->msg_size, 0);
+		if (!c->tx_mr) {
+			perror("ibv_reg_mr");
+			return -1;
+		}
+	}
+
+	if (c->dev->srq) {
+		c->cq = srq_cq_get(c);
+		if (!c->cq)
+			return -1;
+	} else {
+		c->own.c = c;
+		c->own.w = c->w;
+		c->own.dev = c->dev;
+		c->cq = &c->own;
+		if (wcq_init(&c->own, cid->verbs, c->nslots * 2 + c->window))
+			return -1;
 	}
 
 	struct ibv_qp_init_attr init_attr = {
 		.cap = {
-			.max_send_wr = 32,
-			.max_recv_wr = 32,
+			.max_send_wr = c->nslots + c->window,
+			.max_recv_wr = c->nslots,
 			.max_send_sge = 1,
 			.max_recv_sge = 1,
 			.max_inline_data = 64,
 		},
 		.qp_type = IBV_QPT_RC,
-		.send_cq = cq,
-		.recv_cq = cq,
+		.send_cq = c->cq->comp.cq,
+		.recv_cq = c->cq->comp.cq,
+		.srq = c->dev->srq,
 	};
 
-	ret = rdma_create_qp(cid, pd, &init_attr);
+	if (c->dev->srq) {
+		init_attr.cap.max_recv_wr = 0;
+		init_attr.cap.max_recv_sge = 0;
+	}
+
+	ret = rdma_create_qp(cid, c->dev->pd, &init_attr);
 	if (ret) {
 		perror("rdma_create_qp");
 		return -1;
 	}
+	if (c->dev->srq)
+		qp_add(c);
+
+	for (i = 0; !c->dev->srq && i < c->nslots; i++) {
+		ret = post_recv(c, i);
+		if (ret)
+			return ret;
+	}
 
 	return 0;
 }
 
-static int server_init(void)
+static int wcq_poll(struct wcq *cq);
+
+/*
+ * With an SRQ, the receives the QP took and its echoes in flight hold pool
+ * slots: The QP is flushed and the shared CQ polled dry before it goes,
+ * destroying it would drop their completions
+ */
+static void conn_drain(struct conn *c)
+{
+	struct ibv_qp_attr attr = { .qp_state = IBV_QPS_ERR };
+	uint64_t end = get_time_ns() + 100000000ULL;
+	int n;
+
+	if (ibv_modify_qp(c->id->qp, &attr, IBV_QP_STATE))
+		perror("ibv_modify_qp");
+	do {
+		n = wcq_poll(c->cq);
+	} while ((n || c->echoes || c->tx_posted != c->tx_done) && get_time_ns() < end);
+	if (c->echoes)
+		ERR("%u receive slots lost", c->echoes);
+}
+
+/* By the main thread before the hand-off, or by the worker after it */
+static void conn_destroy(struct conn *c)
+{
+	if (c->added) {
+		if (c->own.comp.ch)
+			epoll_ctl(c->w->epfd, EPOLL_CTL_DEL, c->own.comp.ch->fd, NULL);
+		LIST_REMOVE(c, node);
+		if (c->own.hot)
+			LIST_REMOVE(&c->own, hot_node);
+		if (c->cq != &c->own)
+			c->cq->tx_cqe -= c->window;
+	}
+	if (c->id->qp && c->dev->srq) {
+		conn_drain(c);
+		qp_del(c);
+	}
+	if (c->id->qp)
+		rdma_destroy_qp(c->id);
+	wcq_destroy(&c->own);
+	if (c->mr)
+		ibv_dereg_mr(c->mr);
+	if (c->tx_mr)
+		ibv_dereg_mr(c->tx_mr);
+	free(c->tx);
+	if (c->buf != c->slots) {
+		free(c->buf);
+		__atomic_sub_fetch(&extra_slots, c->nslots, __ATOMIC_RELAXED);
+	}
+	rdma_destroy_id(c->id);
+	slab_free(&conn_slab, c);
+}
+
+static void worker_queue(struct conn *c, int cmd)
+{
+	struct worker *w = c->w;
+	uint64_t one = 1;
+	bool kick;
+
+	pthread_mutex_lock(&w->lock);
+	kick = !w->cmds;
+	if (!c->cmds) {
+		c->next_cmd = w->cmds;
+		w->cmds = c;
+	}
+	c->cmds |= cmd;
+	pthread_mutex_unlock(&w->lock);
+
+	if (kick && write(w->evfd, &one, sizeof(one)) != sizeof(one))
+		perror("write eventfd");
+}
+
+static void worker_cmds(struct worker *w)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct conn *c, *next;
+	uint64_t n;
+	int cmds;
+
+	if (read(w->evfd, &n, sizeof(n)) != sizeof(n) && errno != EAGAIN)
+		perror("read eventfd");
+
+	pthread_mutex_lock(&w->lock);
+	c = w->cmds;
+	w->cmds = NULL;
+	pthread_mutex_unlock(&w->lock);
+
+	for (; c; c = next) {
+		pthread_mutex_lock(&w->lock);
+		next = c->next_cmd;
+		cmds = c->cmds;
+		c->cmds = 0;
+		pthread_mutex_unlock(&w->lock);
+
+		if ((cmds & CMD_ADD) && !(cmds & CMD_DEL)) {
+			ev.data.ptr = &c->own;
+			if (c->own.comp.ch &&
+			    epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->own.comp.ch->fd, &ev))
+				perror("epoll_ctl");
+			LIST_INSERT_HEAD(&w->conns, c, node);
+			c->added = true;
+			w->nconns++;
+			if (srq_cq_reserve(c))
+				rdma_disconnect(c->id);
+			else if (c->mode == CM_MODE_BIDIR)
+				post_stream(c);
+			else if (c->mode == CM_MODE_BULK_READ) {
+				c->bulk_start = get_time_ns();
+				post_pull(c);
+			}
+		}
+		if (cmds & CMD_DEL) {
+			if (c->established && !(cmds & CMD_ADD))
+				w->nconns--;
+			conn_destroy(c);
+		}
+	}
+}
+
+static void conn_wc(struct conn *c, struct ibv_wc *wc)
+{
+	struct worker *w = c->w;
+	unsigned int slot = wc->wr_id & ~WRID_SEND;
+	char *p;
+
+	if (wc->wr_id & WRID_TX) {
+		c->tx_done++;
+		if (wc->status != IBV_WC_SUCCESS) {
+			if (wc->status != IBV_WC_WR_FLUSH_ERR)
+				ERR("Failed status %s(%x) for the stream",
+				    ibv_wc_status_str(wc->status), wc->status);
+			return;
+		}
+
+		if (c->mode == CM_MODE_BIDIR) {
+			post_stream(c);
+		} else if (c->mode == CM_MODE_BULK_READ && (uint32_t)wc->wr_id) {
+			c->bulk_done += (uint32_t)wc->wr_id;
+			__atomic_add_fetch(&w->bytes, (uint32_t)wc->wr_id, __ATOMIC_RELAXED);
+			if (c->bulk_done == c->bulk_total)
+				bulk_read_done(c);
+			else
+				post_pull(c);
+		}
+		return;
+	}
+
+	if (wc->wr_id & WRID_SEND)
+		c->echoes--;
+	else if (c->dev->srq)
+		__atomic_sub_fetch(&c->dev->posted, 1, __ATOMIC_RELAXED);
+
+	if (wc->status != IBV_WC_SUCCESS) {
+		/* Flushed once the peer disconnected */
+		if (wc->status != IBV_WC_WR_FLUSH_ERR)
+			ERR("Failed status %s(%x) for wr_id 0x%lx",
+			    ibv_wc_status_str(wc->status), wc->status, wc->wr_id);
+		/* The pool outlives the connection */
+		if (c->dev->srq)
+			rx_free(c->dev, slot);
+		return;
+	}
+
+	if (wc->wr_id & WRID_SEND) {
+		rx_put(c, slot);
+		return;
+	}
+
+	__atomic_add_fetch(&w->msgs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&w->bytes, wc->byte_len, __ATOMIC_RELAXED);
+	if (wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+		/* No data in the slot, it's in the region */
+		__atomic_add_fetch(&w->bytes, be32toh(wc->imm_data), __ATOMIC_RELAXED);
+		rx_put(c, slot);
+		return;
+	}
+	if (c->mode == CM_MODE_BULK_SEND) {
+		bulk_copy(c, slot_buf(c, slot), wc->byte_len);
+		rx_put(c, slot);
+		return;
+	}
+	if (c->mode == CM_MODE_ECHO) {
+		/* A client past its nslots with an SRQ fills the SQ, not echoed */
+		if (post_echo(c, slot, wc->byte_len))
+			rx_put(c, slot);
+		return;
+	}
+	if (c->mode != CM_MODE_PRINT) {
+		rx_put(c, slot);
+		return;
+	}
+
+	p = slot_buf(c, slot);
+	p[wc->byte_len < BUFSIZE ? wc->byte_len : BUFSIZE - 1] = '\0';
+	INFO("String received: `%s'", p);
+	rx_put(c, slot);
+}
+
+/* Of a QP no longer in the table, the slot goes back to the pool */
+static void orphan_wc(struct dev_res *d, struct ibv_wc *wc)
+{
+	if (wc->wr_id & WRID_TX)
+		return;
+	if (!(wc->wr_id & WRID_SEND))
+		__atomic_sub_fetch(&d->posted, 1, __ATOMIC_RELAXED);
+	rx_free(d, wc->wr_id & ~WRID_SEND);
+}
+
+/* Handles all the CQ has, returns how many */
+static int wcq_poll(struct wcq *cq)
+{
+	struct conn *conns[POLL_BATCH];
+	struct ibv_wc wc[POLL_BATCH];
+	int ne, i, n = 0;
+
+	do {
+		ne = comp_poll(&cq->comp, wc);
+		if (ne > 0 && !cq->c)
+			qp_lookup(cq->w, wc, conns, ne);
+		for (i = 0; i < ne; i++) {
+			if (cq->c)
+				conn_wc(cq->c, &wc[i]);
+			else if (conns[i])
+				conn_wc(conns[i], &wc[i]);
+			else
+				orphan_wc(cq->dev, &wc[i]);
+		}
+		if (ne > 0)
+			n += ne;
+	} while (ne == POLL_BATCH);
+	return n;
+}
+
+/* A hybrid worker busy-polls it instead until it's idle for the budget */
+static void wcq_event(struct wcq *cq)
+{
+	struct worker *w = cq->w;
+
+	if (comp_get_event(&cq->comp))
+		return;
+
+	if (comp_mode == COMP_HYBRID) {
+		if (!cq->hot) {
+			LIST_INSERT_HEAD(&w->hot, cq, hot_node);
+			cq->hot = true;
+		}
+		cq->last_cqe = get_time_ns();
+	} else {
+		comp_arm(&cq->comp);
+	}
+	wcq_poll(cq);
+}
+
+static void poll_hot(struct worker *w)
+{
+	uint64_t now = get_time_ns();
+	struct wcq *cq, *next;
+
+	for (cq = LIST_FIRST(&w->hot); cq; cq = next) {
+		next = LIST_NEXT(cq, hot_node);
+		if (wcq_poll(cq)) {
+			cq->last_cqe = now;
+		} else if (now - cq->last_cqe > comp_budget_ns) {
+			LIST_REMOVE(cq, hot_node);
+			cq->hot = false;
+			comp_arm(&cq->comp);
+			wcq_poll(cq);
+		}
+	}
+}
+
+/* COMP_POLL: Every connection, or the shared CQs */
+static void poll_all(struct worker *w)
+{
+	struct conn *c;
+	struct wcq *cq;
+	int i;
+
+	if (!srq_slots) {
+		LIST_FOREACH(c, &w->conns, node)
+			wcq_poll(&c->own);
+		return;
+	}
+
+	for (i = 0; i < MAX_DEVS; i++) {
+		cq = __atomic_load_n(&w->srq_cqs[i], __ATOMIC_ACQUIRE);
+		if (cq)
+			wcq_poll(cq);
+	}
+}
+
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *worker_thread(void *arg)
+{
+	struct epoll_event evs[POLL_BATCH];
+	struct worker *w = arg;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t cpus;
+	bool busy;
+	int n, i;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(w->idx % (ncpus > 0 ? ncpus : 1), &cpus);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+		ERR("Failed to pin worker %d", w->idx);
+
+	LIST_INIT(&w->conns);
+	LIST_INIT(&w->hot);
+	while (1) {
+		busy = comp_mode == COMP_POLL || !LIST_EMPTY(&w->hot);
+		n = epoll_wait(w->epfd, evs, POLL_BATCH, busy ? 0 : 1000);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (evs[i].data.ptr)
+				wcq_event(evs[i].data.ptr);
+			else
+				worker_cmds(w);
+		}
+
+		if (comp_mode == COMP_POLL)
+			poll_all(w);
+		else if (comp_mode == COMP_HYBRID)
+			poll_hot(w);
+
+		__atomic_store_n(&w->cpu_ns, thread_cpu_ns(), __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static int start_workers(void)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	struct worker *w;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < num_workers; i++) {
+		w = &workers[i];
+		w->idx = i;
+		pthread_mutex_init(&w->lock, NULL);
+		w->epfd = epoll_create1(0);
+		w->evfd = eventfd(0, EFD_NONBLOCK);
+		if (w->epfd < 0 || w->evfd < 0) {
+			perror("epoll_create1/eventfd");
+			return -1;
+		}
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->evfd, &ev)) {
+			perror("epoll_ctl");
+			return -1;
+		}
+
+		ret = pthread_create(&w->thread, NULL, worker_thread, w);
+		if (ret) {
+			ERR("pthread_create failed %d", ret);
+			return ret;
+		}
+	}
+
+	INFO("%d workers started", num_workers);
+	return 0;
+}
+
+static int parse_hello(struct conn *c, struct rdma_cm_event *e)
+{
+	const struct cm_hello *h = e->param.conn.private_data;
+
+	c->mode = CM_MODE_PRINT;
+	c->buf = c->slots;
+	c->nslots = recv_depth;
+	if (!h || e->param.conn.private_data_len < sizeof(*h) ||
+	    be32toh(h->magic) != CM_HELLO_MAGIC)
+		return 0;
+
+	c->mode = h->mode;
+	c->msg_size = be32toh(h->msg_size);
+	c->window = be32toh(h->window);
+	c->iters = be64toh(h->iters);
+	c->peer_addr = be64toh(h->addr);
+	c->peer_rkey = be32toh(h->rkey);
+	c->bulk_total = be64toh(h->len);
+	if (c->mode >= CM_MODE_NUM || c->window > CM_MAX_WINDOW ||
+	    (c->msg_size > BUFSIZE && c->mode != CM_MODE_BULK_WRITE &&
+	     c->mode != CM_MODE_BULK_WRITE_IMM && c->mode != CM_MODE_BULK_READ)) {
+		ERR("Bad hello: mode %d, msg size %u, window %u", c->mode, c->msg_size, c->window);
+		return -1;
+	}
+	if (!c->msg_size)
+		c->msg_size = BUFSIZE;
+	if (!c->window)
+		c->window = 1;
+	if (c->mode != CM_MODE_BIDIR && c->mode != CM_MODE_BULK_READ)
+		c->window = 0;		/* Of the stream or the READs */
+
+	/* Enough receives, or CQ entries with an SRQ, for what's in flight */
+	if (be32toh(h->window) <= recv_depth)
+		return 0;
+	c->nslots = be32toh(h->window);
+	if (!srq_slots) {
+		c->buf = aligned_alloc(4096, (size_t)c->nslots * BUFSIZE);
+		if (!c->buf) {
+			c->buf = c->slots;
+			ERR("Failed to allocate %u receive slots", c->nslots);
+			return -1;
+		}
+		__atomic_add_fetch(&extra_slots, c->nslots, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+/*
+ * Returns the connection to destroy once the event is acked, if any; With
+ * no memory for one, the id is left in *drop
+ */
+static struct conn *server_accept(struct rdma_cm_event *e, struct rdma_cm_id **drop)
 {
-	//struct rdma_addrinfo hints = {}, *rai = NULL;
 	struct rdma_conn_param param = {};
+	struct cm_region region;
+	struct conn *c;
+
+	c = slab_alloc(&conn_slab);
+	if (!c) {
+		ERR("No memory for a new connection");
+		rdma_reject(e->id, NULL, 0);
+		*drop = e->id;
+		rejected++;
+		return NULL;
+	}
+
+	memset(c, 0, sizeof(*c));
+	c->id = e->id;
+	c->id->context = c;
+	c->w = &workers[next_worker++ % num_workers];
+
+	if (parse_hello(c, e) || setup_qp_server(c))
+		goto fail;
+
+	param.rnr_retry_count = 7;
+	if (is_bulk(c->mode)) {
+		region.magic = htobe32(CM_HELLO_MAGIC);
+		region.rkey = htobe32(c->dev->bulk_mr->rkey);
+		region.addr = htobe64((uintptr_t)bulk_region);
+		region.len = htobe64(bulk_len);
+		param.private_data = &region;
+		param.private_data_len = sizeof(region);
+
+		/* As many READs in flight as both sides allow */
+		param.initiator_depth = RDMA_MAX_INIT_DEPTH;
+		param.responder_resources = RDMA_MAX_RESP_RES;
+	}
+	if (rdma_accept(c->id, &param)) {
+		perror("rdma_accept");
+		goto fail;
+	}
+	return NULL;
+
+fail:
+	rdma_reject(c->id, NULL, 0);
+	rejected++;
+	return c;
+}
+
+static int handle_cm_events(void)
+{
+	struct rdma_cm_event *e;
+	struct rdma_cm_id *drop;
+	struct conn *c, *put;
+
+	while (1) {
+		if (rdma_get_cm_event(ech, &e)) {
+			if (errno == EAGAIN)
+				return 0;
+			perror("rdma_get_cm_event");
+			return -1;
+		}
+
+		c = e->id->context;
+		put = NULL;
+		drop = NULL;
+		switch (e->event) {
+		case RDMA_CM_EVENT_CONNECT_REQUEST:
+			put = server_accept(e, &drop);
+			break;
+
+		case RDMA_CM_EVENT_ESTABLISHED:
+			c->established = true;
+			accepted++;
+			worker_queue(c, CMD_ADD);
+			break;
+
+		case RDMA_CM_EVENT_DISCONNECTED:
+			closed++;
+			/* fall through */
+		case RDMA_CM_EVENT_CONNECT_ERROR:
+		case RDMA_CM_EVENT_UNREACHABLE:
+		case RDMA_CM_EVENT_REJECTED:
+			put = c;
+			break;
+
+		default:
+			INFO("Event %s ignored", rdma_event_str(e->event));
+			break;
+		}
+
+		if (rdma_ack_cm_event(e)) {
+			perror("rdma_ack_cm_event");
+			return -1;
+		}
+
+		/* With an SRQ, only the worker may poll the CQ it shares */
+		if (put && (put->established || srq_slots))
+			worker_queue(put, CMD_DEL);
+		else if (put)
+			conn_destroy(put);
+		if (drop)
+			rdma_destroy_id(drop);
+	}
+}
+
+static int server_init(void)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
 	struct sockaddr_in sin = {};
 	struct sockaddr_ib sib = {};
 	struct sockaddr *sa;
-	struct rdma_cm_event *e;
 	char *endptr = NULL;
 	uint64_t service_id;
 	int err;
@@ -82,26 +1399,12 @@ static int server_init(void)
 	service_id = strtol(CM_EXAMPLE_IB_SERVICE_ID, &endptr, 0);
 
 	if (server_port_space == RDMA_PS_IB) {
-#if 0
-		hints.ai_flags = RAI_NUMERICHOST | RAI_FAMILY | RAI_PASSIVE;
-		hints.ai_family = AF_IB;
-		hints.ai_port_space = RDMA_PS_IB;
-		err = rdma_getaddrinfo(NULL, CM_EXAMPLE_SERVER_PORT_STR, &hints, &rai);
-		if (err) {
-			perror("rdma_getaddrinfo");
-			return err;
-		}
-		saddr = *rai->ai_src_addr;
-		sa = &saddr;
-		dump_sockaddr_ib("src_addr", (struct sockaddr_ib *)rai->ai_src_addr);
-#endif
 		sib.sib_family = AF_IB;
 		sib.sib_pkey = 0xffff;
 		sib.sib_sid = htobe64(service_id);
 		sib.sib_sid_mask = (__be64)-1;
 		dump_sockaddr_ib("src_addr", (struct sockaddr_ib *)&sib);
 		sa = (struct sockaddr *)&sib;
-		//r = rdma_getaddrinfo(NULL, "7471", &hints, &rai);
 	} else if (server_port_space == RDMA_PS_TCP) {
 		sin.sin_family = AF_INET;
 		sin.sin_port = htons(CM_EXAMPLE_SERVER_PORT);
@@ -117,6 +1420,18 @@ static int server_init(void)
 		perror("rdma_create_event_channel");
 		return errno;
 	}
+	if (set_nonblock(ech->fd))
+		return -1;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return errno;
+	}
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, ech->fd, &ev)) {
+		perror("epoll_ctl");
+		return errno;
+	}
 
 	err = rdma_create_id(ech, &listen_id, NULL, server_port_space);
 	if (err) {
@@ -125,167 +1440,195 @@ static int server_init(void)
 	}
 
 	err = rdma_bind_addr(listen_id, sa);
-        if (err) {
+	if (err) {
 		perror("rdma_bind_addr");
 		return err;
 	}
 	INFO("bound done, port space 0x%x port %d",
 	     SERVER_ID_to_PORT_SPACE(service_id), SERVER_ID_to_PORT(service_id));
 
-	//if (rai) rdma_freeaddrinfo(rai);
-
-	err = rdma_listen(listen_id, 10);
-        if (err) {
+	err = rdma_listen(listen_id, 1024);
+	if (err) {
 		perror("rdma_listen");
 		return err;
 	}
 
-	err = rdma_get_cm_event(ech, &e);
-	if (err || (e->event != RDMA_CM_EVENT_CONNECT_REQUEST)) {
-		ERR("Expects RDMA_CM_EVENT_CONNECT_REQUEST get %d(%s): %d",
-		    e->event, rdma_event_str(e->event), err);
-		return -1;
-	}
-	client_id = e->id;
+	return 0;
+}
 
-	err = rdma_ack_cm_event(e);
-	if (err) {
-		perror("rdma_ack_cm_event");
-		return err;
-	}
-	INFO("Get an incoming request");
+static unsigned long rss_kb(void)
+{
+	unsigned long size, rss = 0;
+	FILE *f;
 
-	err = setup_qp_server(client_id);
-	if (err)
-		return err;
-	INFO("setup_qp_server done");
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%lu %lu", &size, &rss) != 2)
+		rss = 0;
+	fclose(f);
+	return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
 
-	err = rdma_accept(client_id, &param);
-	if (err) {
-		perror("rdma_accept");
-		return err;
-	}
-	err = rdma_get_cm_event(ech, &e);
-	if (err || (e->event != RDMA_CM_EVENT_ESTABLISHED)) {
-		ERR("Expects RDMA_CM_EVENT_ESTABLISHED get %d(%s): %d",
-		    e->event, rdma_event_str(e->event), err);
-		return -1;
-	}
-	err = rdma_ack_cm_event(e);
-	if (err) {
-		perror("rdma_ack_cm_event");
-		return err;
+/* Receive buffers and resident memory, in total and per connection */
+static void dump_mem(unsigned long conns, unsigned long base_rss)
+{
+	unsigned long rx = 0, rss = rss_kb();
+	unsigned long cq = __atomic_load_n(&cq_entries, __ATOMIC_RELAXED) * CQE_BYTES / 1024;
+	int i;
+
+	if (srq_slots) {
+		for (i = 0; i < num_devs; i++)
+			rx += (unsigned long)srq_slots * BUFSIZE / 1024;
+	} else {
+		rx = (conns * recv_depth +
+		      __atomic_load_n(&extra_slots, __ATOMIC_RELAXED)) * BUFSIZE / 1024;
 	}
+	rss = rss > base_rss ? rss - base_rss : 0;
 
-	INFO("Server connection established");
-	return 0;
+	dump("  memory: rx buffers %lu KB (%.1f KB/conn), cqs %lu KB (%.1f KB/conn), rss +%lu KB (%.1f KB/conn)",
+	     rx, conns ? (double)rx / conns : 0, cq, conns ? (double)cq / conns : 0,
+	     rss, conns ? (double)rss / conns : 0);
+	for (i = 0; i < num_devs && srq_slots; i++)
+		dump(", srq %d: %u posted, %lu limit events", i,
+		     __atomic_load_n(&devs[i].posted, __ATOMIC_RELAXED), devs[i].limit_events);
+	dump("\n");
 }
 
-#if 0
-#define DATA_PER_LINE 16
-static char dbuf[256] = {};
-static void print_line(int line_id, const char *addr, int len, int unit)
+/* Accept rate, connections and message rate every second */
+static void server_stats(uint64_t *last_ns, unsigned long *last_acc, unsigned long *last_msgs,
+			 unsigned long base_rss)
 {
-	int i;
+	static uint64_t last_cpu;
+	uint64_t now = get_time_ns(), bytes = 0, cpu = 0;
+	unsigned long msgs = 0;
+	unsigned int i;
+	double s;
+
+	if (now - *last_ns < 1000000000ULL)
+		return;
+
+	for (i = 0; i < num_workers; i++) {
+		msgs += __atomic_load_n(&workers[i].msgs, __ATOMIC_RELAXED);
+		bytes += __atomic_load_n(&workers[i].bytes, __ATOMIC_RELAXED);
+		cpu += __atomic_load_n(&workers[i].cpu_ns, __ATOMIC_RELAXED);
+	}
 
-	sprintf(dbuf, "%04x:", line_id * DATA_PER_LINE);
-	for (i = 0; i < len; i++)
-		sprintf(dbuf + strlen(dbuf), " %02x", addr[i]);
+	/* Idle connections too, to see what the completion mode costs */
+	s = (now - *last_ns) / 1e9;
+	if (accepted != *last_acc || msgs != *last_msgs || accepted != closed) {
+		dump("conns %lu (accepted %.1f/s, closed %lu, rejected %lu, %lu objects), msgs %.1f K/s, total %lu msgs %lu bytes\n",
+		     accepted - closed, (accepted - *last_acc) / s, closed, rejected,
+		     conn_slab.in_use, (msgs - *last_msgs) / s / 1000, msgs, bytes);
+		dump("  workers: %s completions, cpu %.1f%% of %u cores\n",
+		     comp_mode_str(comp_mode), (cpu - last_cpu) / 1e7 / s, num_workers);
+		dump_mem(accepted - closed, base_rss);
+	}
+	last_cpu = cpu;
 
-	sprintf(dbuf + strlen(dbuf), "\n");
-	printf("%s", dbuf);
+	*last_ns = now;
+	*last_acc = accepted;
+	*last_msgs = msgs;
 }
 
-static void DUMP(const char *info, const char *addr, int len)
+static int server_run(void)
 {
-	int pos = 0, left = len, line_id = 0;
-	int unit = 1;
+	unsigned long last_acc = 0, last_msgs = 0, base_rss = rss_kb();
+	uint64_t last_ns = get_time_ns();
+	struct epoll_event ev;
+	int n;
 
-	if (info)
-		printf("====> %s\n", info);
+	if (srq_slots)
+		INFO("Server ready, SRQ of %u slots of %d bytes per device, watermarks %u/%u, %s replenish",
+		     srq_slots, BUFSIZE, srq_low, srq_high, inline_replenish ? "inline" : "thread");
 	else
-		printf("====>\n");
-	do {
-		if (left >= DATA_PER_LINE) {
-			print_line(line_id, addr + pos, DATA_PER_LINE, unit);
-			line_id++;
-			pos += DATA_PER_LINE;
-			left -= DATA_PER_LINE;
-		} else {
-			print_line(line_id, addr + pos, left, unit);
-			break;
+		INFO("Server ready, %d receives of %d bytes per connection", recv_depth, BUFSIZE);
+	while (1) {
+		n = epoll_wait(epfd, &ev, 1, 1000);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			return -1;
 		}
-	} while (left);
-	printf("<====\n");
+		if (n > 0 && handle_cm_events())
+			return -1;
+
+		server_stats(&last_ns, &last_acc, &last_msgs, base_rss);
+	}
 }
-#endif
 
-static void recv_data(struct rdma_cm_id *cid)
+static void server_uninit(void)
 {
-	struct ibv_sge sg_list = {
-		.addr   = (uintptr_t)buf,
-		.length = BUFSIZE,
-		.lkey   = mr->lkey,
-	};
-	struct ibv_recv_wr wr = {
-		.wr_id   = 12345,
-		.next    = NULL,
-		.sg_list = &sg_list,
-		.num_sge = 1,
-	}, *bad_wr;
-	struct ibv_wc wc;
-        int num_comp, ret;
-
-	ret = ibv_post_recv(cid->qp, &wr, &bad_wr);
-	if (ret) {
-		perror("ibv_post_recv");
-		return;
-	}
+	int i;
 
-	/*
-	static struct ibv_port_attr port_attr = {};
-	ret = ibv_query_port(cid->verbs, cid->port_num, &port_attr);
-	if (ret) {
-		ERR("ibv_query_port failed");
-		return;
+	if (listen_id)
+		rdma_destroy_id(listen_id);
+	for (i = 0; i < num_devs; i++) {
+		if (srq_slots)
+			rx_pool_destroy(&devs[i]);
+		if (devs[i].bulk_mr)
+			ibv_dereg_mr(devs[i].bulk_mr);
+		ibv_dealloc_pd(devs[i].pd);
 	}
-	*/
+	if (bulk_region)
+		munmap(bulk_region, bulk_len);
+	if (epfd >= 0)
+		close(epfd);
+	if (ech)
+		rdma_destroy_event_channel(ech);
+}
 
-	INFO("Now waiting for dataexpecting wr_id = %ld...", wr.wr_id);
-	do {
-		num_comp = ibv_poll_cq(cq, 1, &wc);
-		//num_comp = ibv_exp_poll_cq(cq, 1, &wc, sizeof(wc));
-	} while (num_comp == 0);
+/* The file of -f if any, grown to bulk_len, or anonymous memory */
+static int map_bulk_region(void)
+{
+	int fd = -1, flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	struct stat st;
 
-	if (num_comp < 0) {
-		perror("ibv_poll_cq");
-		return;
+	if (bulk_file) {
+		fd = open(bulk_file, O_RDWR | O_CREAT, 0644);
+		if (fd < 0 || fstat(fd, &st)) {
+			perror(bulk_file);
+			goto fail;
+		}
+		if (st.st_size < (off_t)bulk_len && ftruncate(fd, bulk_len)) {
+			perror("ftruncate");
+			goto fail;
+		}
+		flags = MAP_SHARED;
 	}
-	INFO("ibv_poll_cq() returns %d wr_id %d\n", num_comp, (int)wr.wr_id);
-	if (wc.status != IBV_WC_SUCCESS) {
-		ERR("Failed status %s(%x) for wr_id %d\n",
-		    ibv_wc_status_str(wc.status), wc.status, (int)wc.wr_id);
-		return;
+
+	bulk_region = mmap(NULL, bulk_len, PROT_READ | PROT_WRITE, flags, fd, 0);
+	if (bulk_region == MAP_FAILED) {
+		perror("mmap");
+		bulk_region = NULL;
+		goto fail;
 	}
-	INFO("String received: `%s'", buf);
+	if (fd >= 0)
+		close(fd);
+	return 0;
+
+fail:
+	if (fd >= 0)
+		close(fd);
+	return -1;
 }
 
-static void server_uninit(void)
+/* A completion channel per connection */
+static void raise_fd_limit(void)
 {
-	rdma_disconnect(client_id);
-	rdma_destroy_qp(client_id);
-	ibv_destroy_cq(cq);
-	ibv_dereg_mr(mr);
-	ibv_dealloc_pd(pd);
-	rdma_destroy_id(client_id);
-	rdma_destroy_id(listen_id);
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl))
+		return;
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl))
+		perror("setrlimit");
 }
 
 static int parse_opt(int argc, char *argv[])
 {
 	int op;
 
-	while ((op = getopt(argc, argv, "P:")) != -1) {
+	while ((op = getopt(argc, argv, "P:w:r:S:l:H:IC:B:f:L:")) != -1) {
 		switch (op) {
 		case 'P':
 			if (!strncasecmp("ib", optarg, 2)) {
@@ -296,13 +1639,77 @@ static int parse_opt(int argc, char *argv[])
 				return -EINVAL;
 			}
 			break;
+		case 'w':
+			num_workers = atoi(optarg);
+			break;
+		case 'r':
+			recv_depth = atoi(optarg);
+			break;
+		case 'S':
+			srq_slots = atoi(optarg);
+			break;
+		case 'l':
+			srq_low = atoi(optarg);
+			break;
+		case 'H':
+			srq_high = atoi(optarg);
+			break;
+		case 'I':
+			inline_replenish = true;
+			break;
+		case 'C':
+			comp_mode = comp_mode_parse(optarg);
+			if (comp_mode < 0) {
+				fprintf(stderr, "Unknown completion mode: %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'B':
+			comp_budget_ns = strtoull(optarg, NULL, 0) * 1000;
+			break;
+		case 'f':
+			bulk_file = optarg;
+			break;
+		case 'L':
+			bulk_len = strtoull(optarg, NULL, 0);
+			break;
 		default:
-			dump("Usage: server [-P <port_space>]\n");
+			dump("Usage: server [-P <port_space>] [-w <workers>] [-r <receives per connection>]\n");
+			dump("              [-S <SRQ slots> [-l <low watermark>] [-H <high watermark>] [-I]]\n");
+			dump("              [-C poll|event|hybrid [-B <budget us>]] [-f <file>] [-L <bytes>]\n");
+			dump("  -r: Receives posted per connection, or messages in flight with an SRQ (default %d)\n",
+			     DEF_RECV_DEPTH);
+			dump("  -S: Share an SRQ and a pool of receive slots, e.g. %d, among the connections\n",
+			     DEF_SRQ_SLOTS);
+			dump("  -l/-H: Slots posted when the SRQ is refilled, and up to (default 1/4, all)\n");
+			dump("  -I: Refilled by the workers instead of a thread woken by the SRQ limit event\n");
+			dump("  -C: Completions: poll, event (default) or hybrid, busy-polling for -B <us> (default %llu)\n",
+			     COMP_DEF_BUDGET_NS / 1000);
+			dump("  -f/-L: Region of the bulk clients, the file mapped or anonymous, of -L bytes (default %lu MiB)\n",
+			     DEF_BULK_LEN >> 20);
 			dump("Examples: server -P ib\n");
+			dump("          server -S %d -w 8\n", DEF_SRQ_SLOTS);
 			return -EINVAL;
 		}
 	}
 
+	if (!num_workers) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+		num_workers = n > 0 ? n : 1;
+	}
+	if (num_workers > MAX_WORKERS)
+		num_workers = MAX_WORKERS;
+	if (!recv_depth)
+		recv_depth = 1;
+	if (!bulk_len)
+		bulk_len = DEF_BULK_LEN;
+	if (srq_slots) {
+		if (!srq_high || srq_high > srq_slots)
+			srq_high = srq_slots;
+		if (!srq_low || srq_low >= srq_high)
+			srq_low = srq_high / 4 ? srq_high / 4 : 1;
+	}
 	return 0;
 }
 
@@ -315,13 +1722,25 @@ int main(int argc, char *argv[])
 	if (ret)
 		return ret;
 
-	ret = server_init();
+	raise_fd_limit();
+	ret = map_bulk_region();
 	if (ret)
 		return ret;
 
-	recv_data(client_id);
+	ret = slab_init(&conn_slab, sizeof(struct conn) +
+			(srq_slots ? 0 : (size_t)recv_depth * BUFSIZE));
+	if (ret)
+		return ret;
+
+	ret = start_workers();
+	if (ret)
+		return ret;
+
+	ret = server_init();
+	if (!ret)
+		ret = server_run();
 
-	sleep(1);
 	server_uninit();
-	return 0;
+	slab_destroy(&conn_slab);
+	return ret;
 }
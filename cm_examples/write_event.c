@@ -1,18 +1,77 @@
+/*
+ * Injects an RDMA_CM_EVENT_USER with rdma_write_cm_event() and reads it
+ * back. With any option, it's a benchmark of the cm event path instead:
+ * P producer threads inject events as fast as they can, round-robin over C
+ * event channels of I ids each, and a consumer thread per channel gets
+ * them with a blocking rdma_get_cm_event() or from epoll on its
+ * nonblocking fd. The injection time is the arg of each event, so the
+ * consumer sees how long delivery took. At most Q events are queued per
+ * channel, or the kernel queues grow without bound.
+ */
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 
 #include <infiniband/ib.h>
 #include <rdma/rdma_cma.h>
 
+#include "bench.h"
 #include "helper.h"
 #include "params.h"
 
+#define DEF_EVENTS 1000000
+#define DEF_IDS 16
+#define DEF_QUEUE 1024
+#define MAX_CHANNELS 64
+#define MAX_SAMPLES (1 << 20)
+
 static struct rdma_event_channel *ech;
 static struct rdma_cm_id *cm_id;
+
+/* A channel, its ids and its consumer */
+struct chan {
+	struct rdma_event_channel *ech;
+	struct rdma_cm_id **ids;
+	pthread_t consumer;
+	int epfd;
+
+	unsigned long expected;
+	unsigned long sent;		/* By all the producers */
+	unsigned long received;
+	uint64_t *lat;
+	unsigned long nlat;
+	int err;
+};
+
+struct producer {
+	pthread_t thread;
+	unsigned int idx;
+	int err;
+};
+
+static bool bench;
+static unsigned int num_producers = 1;
+static unsigned int num_chans = 1;
+static unsigned int ids_per_chan = DEF_IDS;
+static unsigned long events_per_producer = DEF_EVENTS;
+static unsigned long queue_depth = DEF_QUEUE;
+static bool use_epoll;
+static bool sweep;
+
+static struct chan chans[MAX_CHANNELS];
+static struct producer *producers;
+static unsigned int nchans;		/* Of the current run */
+static volatile bool go;
+static volatile bool stop;	/* Not all the threads started, no events */
 void do_write_event_test(void)
 {
 	uint64_t arg = 0x55667788aabbccdd;
@@ -58,8 +117,357 @@ out_create_id:
 	return;
 }
 
-int main(int argc, char *argv[])
+static void *producer_thread(void *arg)
+{
+	struct producer *p = arg;
+	struct chan *c;
+	unsigned long i;
+	int ret;
+
+	while (!go)
+		sched_yield();
+	if (stop)
+		return NULL;
+
+	for (i = 0; i < events_per_producer; i++) {
+		c = &chans[(p->idx + i) % nchans];
+		while (__atomic_load_n(&c->sent, __ATOMIC_RELAXED) -
+		       __atomic_load_n(&c->received, __ATOMIC_ACQUIRE) >= queue_depth)
+			sched_yield();
+
+		/* The status says who, the arg when */
+		__atomic_add_fetch(&c->sent, 1, __ATOMIC_RELAXED);
+		ret = rdma_write_cm_event(c->ids[(i / nchans) % ids_per_chan], RDMA_CM_EVENT_USER,
+					  p->idx, get_time_ns());
+		if (ret) {
+			perror("rdma_write_cm_event");
+			p->err = ret;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* One event, or -1 with errno EAGAIN if the nonblocking channel has none */
+static int consume_one(struct chan *c)
+{
+	struct rdma_cm_event *e;
+	uint64_t now;
+
+	if (rdma_get_cm_event(c->ech, &e))
+		return -1;
+
+	now = get_time_ns();
+	if (e->event == RDMA_CM_EVENT_USER)
+		c->lat[c->nlat++ % MAX_SAMPLES] = now - e->param.arg;
+	else
+		ERR("Unexpected %s", rdma_event_str(e->event));
+	rdma_ack_cm_event(e);
+	__atomic_add_fetch(&c->received, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void *consumer_thread(void *arg)
+{
+	struct chan *c = arg;
+	struct epoll_event ev;
+	int n;
+
+	while (c->received < c->expected) {
+		if (!use_epoll) {
+			if (consume_one(c)) {
+				perror("rdma_get_cm_event");
+				c->err = -1;
+				break;
+			}
+			continue;
+		}
+
+		n = epoll_wait(c->epfd, &ev, 1, 1000);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			c->err = -1;
+			break;
+		}
+		while (c->received < c->expected && !consume_one(c))
+			;
+		if (errno != EAGAIN && c->received < c->expected) {
+			perror("rdma_get_cm_event");
+			c->err = -1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void put_chans(void)
+{
+	unsigned int i, k;
+
+	for (i = 0; i < MAX_CHANNELS; i++) {
+		struct chan *c = &chans[i];
+
+		for (k = 0; c->ids && k < ids_per_chan; k++)
+			if (c->ids[k])
+				rdma_destroy_id(c->ids[k]);
+		free(c->ids);
+		if (c->epfd > 0)
+			close(c->epfd);
+		if (c->ech)
+			rdma_destroy_event_channel(c->ech);
+		free(c->lat);
+		memset(c, 0, sizeof(*c));
+	}
+}
+
+static int setup_chan(struct chan *c)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	unsigned int k;
+	int flags;
+
+	c->ech = rdma_create_event_channel();
+	c->ids = calloc(ids_per_chan, sizeof(*c->ids));
+	c->lat = calloc(MAX_SAMPLES, sizeof(*c->lat));
+	if (!c->ech || !c->ids || !c->lat) {
+		ERR("Failed to set up an event channel");
+		return -1;
+	}
+
+	for (k = 0; k < ids_per_chan; k++)
+		if (rdma_create_id(c->ech, &c->ids[k], c, RDMA_PS_TCP)) {
+			perror("rdma_create_id");
+			return -1;
+		}
+
+	if (!use_epoll)
+		return 0;
+
+	flags = fcntl(c->ech->fd, F_GETFL);
+	if (fcntl(c->ech->fd, F_SETFL, flags | O_NONBLOCK)) {
+		perror("fcntl");
+		return -1;
+	}
+	c->epfd = epoll_create1(0);
+	if (c->epfd < 0 || epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->ech->fd, &ev)) {
+		perror("epoll");
+		return -1;
+	}
+	return 0;
+}
+
+/* Producer k sends its i-th event to channel (k + i) % n */
+static unsigned long expected_events(unsigned int chan, unsigned int n)
+{
+	unsigned long total = 0;
+	unsigned int k;
+
+	for (k = 0; k < num_producers; k++)
+		total += events_per_producer / n +
+			 ((chan + n - k % n) % n < events_per_producer % n);
+	return total;
+}
+
+static int run_bench(unsigned int n, double *rate, uint64_t *p50, uint64_t *p99)
+{
+	unsigned long total = 0, nlat = 0;
+	unsigned int i, started_p = 0, started_c = 0;
+	uint64_t start, wall, *lat = NULL;
+	int ret = -1;
+
+	nchans = n;
+	for (i = 0; i < n; i++) {
+		if (setup_chan(&chans[i]))
+			goto out;
+		chans[i].expected = expected_events(i, n);
+	}
+
+	go = false;
+	stop = false;
+	for (; started_c < n; started_c++)
+		if (pthread_create(&chans[started_c].consumer, NULL, consumer_thread,
+				   &chans[started_c])) {
+			perror("pthread_create");
+			goto join;
+		}
+	for (; started_p < num_producers; started_p++) {
+		producers[started_p].idx = started_p;
+		producers[started_p].err = 0;
+		if (pthread_create(&producers[started_p].thread, NULL, producer_thread,
+				   &producers[started_p])) {
+			perror("pthread_create");
+			goto join;
+		}
+	}
+
+	start = get_time_ns();
+	go = true;
+	for (i = 0; i < started_p; i++)
+		pthread_join(producers[i].thread, NULL);
+	for (i = 0; i < started_c; i++)
+		pthread_join(chans[i].consumer, NULL);
+	wall = get_time_ns() - start;
+
+	for (i = 0; i < n; i++) {
+		total += chans[i].received;
+		nlat += chans[i].nlat < MAX_SAMPLES ? chans[i].nlat : MAX_SAMPLES;
+		if (chans[i].err)
+			goto out;
+	}
+	for (i = 0; i < num_producers; i++)
+		if (producers[i].err)
+			goto out;
+
+	lat = malloc(nlat * sizeof(*lat));
+	if (!lat) {
+		ERR("Failed to allocate %lu samples", nlat);
+		goto out;
+	}
+	for (i = 0, nlat = 0; i < n; i++) {
+		unsigned long m = chans[i].nlat < MAX_SAMPLES ? chans[i].nlat : MAX_SAMPLES;
+
+		memcpy(lat + nlat, chans[i].lat, m * sizeof(*lat));
+		nlat += m;
+	}
+
+	*rate = total * 1e9 / wall;
+	if (sweep) {
+		qsort(lat, nlat, sizeof(*lat), cmp_u64);
+		*p50 = nlat ? lat[nlat / 2] : 0;
+		*p99 = nlat ? lat[nlat * 99 / 100] : 0;
+	} else {
+		dump("%lu events, %u producers, %u channels of %u ids, %s consumers, queue %lu, in %.3f s\n",
+		     total, num_producers, n, ids_per_chan, use_epoll ? "epoll" : "blocking",
+		     queue_depth, wall / 1e9);
+		dump("  %.1f K events/s\n", *rate / 1000);
+		dump_lat("inject->delivery", lat, nlat);
+	}
+	ret = 0;
+	goto out;
+
+join:
+	/*
+	 * The producers that started send nothing, and an event of the
+	 * channel wakes its consumer to see it expects none
+	 */
+	ERR("Failed to start the threads");
+	stop = true;
+	go = true;
+	for (i = 0; i < started_p; i++)
+		pthread_join(producers[i].thread, NULL);
+	for (i = 0; i < started_c; i++) {
+		__atomic_store_n(&chans[i].expected, 0, __ATOMIC_RELEASE);
+		if (rdma_write_cm_event(chans[i].ids[0], RDMA_CM_EVENT_USER, 0, 0)) {
+			perror("rdma_write_cm_event");
+			pthread_cancel(chans[i].consumer);
+		}
+		pthread_join(chans[i].consumer, NULL);
+	}
+out:
+	free(lat);
+	put_chans();
+	return ret;
+}
+
+/* Throughput as the channels, and so the consumers, double */
+static int run_sweep(void)
+{
+	uint64_t p50, p99;
+	unsigned int n;
+	double rate;
+	int ret;
+
+	dump("%u producers, %u ids per channel, %s consumers, queue %lu, %lu events per producer\n",
+	     num_producers, ids_per_chan, use_epoll ? "epoll" : "blocking", queue_depth,
+	     events_per_producer);
+	dump("%9s %14s %10s %10s\n", "channels", "K events/s", "p50 us", "p99 us");
+	for (n = 1; n <= num_chans; n *= 2) {
+		ret = run_bench(n, &rate, &p50, &p99);
+		if (ret)
+			return ret;
+		dump("%9u %14.1f %10.2f %10.2f\n", n, rate / 1000, p50 / 1000.0, p99 / 1000.0);
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	dump("Usage: %s [-p <producers>] [-c <channels>] [-i <ids per channel>] [-n <events per producer>]\n", prog);
+	dump("              [-q <queued per channel>] [-e] [-S]\n");
+	dump("  Without options, one event is injected and checked\n");
+	dump("  -p: Producer threads (default 1)\n");
+	dump("  -c: Event channels, a consumer thread each (default 1, up to %d)\n", MAX_CHANNELS);
+	dump("  -i: Ids per channel the events are spread over (default %d)\n", DEF_IDS);
+	dump("  -n: Events each producer injects (default %d)\n", DEF_EVENTS);
+	dump("  -q: Events queued per channel at most (default %d)\n", DEF_QUEUE);
+	dump("  -e: Consumers wait in epoll on the nonblocking fd, instead of blocking in rdma_get_cm_event()\n");
+	dump("  -S: Sweep 1, 2, 4.. up to -c channels\n");
+}
+
+static int parse_opt(int argc, char *argv[])
 {
-	do_write_event_test();
+	int op;
+
+	while ((op = getopt(argc, argv, "p:c:i:n:q:eSh")) != -1) {
+		bench = true;
+		switch (op) {
+		case 'p':
+			num_producers = atoi(optarg);
+			break;
+		case 'c':
+			num_chans = atoi(optarg);
+			break;
+		case 'i':
+			ids_per_chan = atoi(optarg);
+			break;
+		case 'n':
+			events_per_producer = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			queue_depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			use_epoll = true;
+			break;
+		case 'S':
+			sweep = true;
+			break;
+		default:
+			usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+
+	if (!num_producers || !num_chans || num_chans > MAX_CHANNELS || !ids_per_chan ||
+	    !events_per_producer || !queue_depth) {
+		usage(argv[0]);
+		return -EINVAL;
+	}
 	return 0;
 }
+
+int main(int argc, char *argv[])
+{
+	uint64_t p50, p99;
+	double rate;
+	int ret;
+
+	ret = parse_opt(argc, argv);
+	if (ret)
+		return ret;
+
+	if (!bench) {
+		do_write_event_test();
+		return 0;
+	}
+
+	producers = calloc(num_producers, sizeof(*producers));
+	if (!producers) {
+		ERR("Failed to allocate %u producers", num_producers);
+		return -ENOMEM;
+	}
+
+	ret = sweep ? run_sweep() : run_bench(num_chans, &rate, &p50, &p99);
+	free(producers);
+	return ret;
+}
@@ -0,0 +1,370 @@
+/* SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause) */
+/*
+ * CRC-T10DIF with carry-less multiply folding.
+ *
+ * The data is seen as a polynomial, 16 bytes at a time as a big-endian
+ * 128-bit value X. Moving X forward by D bits is done by
+ *   X * x^D = Xhi * x^(D+64) + Xlo * x^D
+ *          == Xhi * (x^(D+64) mod P) + Xlo * (x^D mod P)
+ * i.e. two 64x16 bits carry-less multiplies, after which the next chunk is
+ * xor'ed in. The last 128-bit value is reduced to the 16-bit CRC with Barrett
+ * reduction, bytes left over are done with the tables.
+ * All constants are computed at startup from the polynomial.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "crc_t10dif.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC_HAVE_CLMUL
+#endif
+
+#define CRC_POLY 0x18bb7	/* x^16 + x^15 + x^11 + x^9 + x^8 + x^7 + x^5 + x^4 + x^2 + x + 1 */
+
+static uint16_t crc_tables[8][256];
+
+/* Fold constants, low qword x^D mod P and high qword x^(D+64) mod P */
+static uint64_t fold_16b[2];	/* D = 128, one chunk */
+static uint64_t fold_48b[2];
+static uint64_t fold_32b[2];
+static uint64_t fold_64b[2];	/* D = 512, 4 chunks */
+static uint64_t fold_256b[2];	/* D = 2048, 4 zmm */
+static uint64_t fold_192b[2];
+static uint64_t fold_128b[2];
+static uint64_t x80_mod_p, x64_mod_p, barrett_mu;
+
+static enum crc_t10dif_impl crc_impl = CRC_T10DIF_IMPL_MAX;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static const char *const impl_names[CRC_T10DIF_IMPL_MAX] = {
+	[CRC_T10DIF_TABLE] = "table",
+	[CRC_T10DIF_SLICE8] = "slice-by-8",
+	[CRC_T10DIF_PCLMUL] = "pclmulqdq",
+	[CRC_T10DIF_VPCLMUL] = "vpclmulqdq",
+};
+
+/* x^n mod P */
+static uint64_t xpow_mod(unsigned int n)
+{
+	uint32_t r = 1;
+
+	while (n--) {
+		r <<= 1;
+		if (r & 0x10000)
+			r ^= CRC_POLY;
+	}
+	return r;
+}
+
+static void init_tables(void)
+{
+	unsigned int i, k;
+
+	for (i = 0; i < 256; i++) {
+		uint16_t crc = i << 8;
+
+		for (k = 0; k < 8; k++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ (CRC_POLY & 0xffff) : crc << 1;
+		crc_tables[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (k = 1; k < 8; k++)
+			crc_tables[k][i] = (crc_tables[k - 1][i] << 8) ^
+				crc_tables[0][crc_tables[k - 1][i] >> 8];
+}
+
+static void init_fold(uint64_t *k, unsigned int d)
+{
+	k[0] = xpow_mod(d);
+	k[1] = xpow_mod(d + 64);
+}
+
+static void init_consts(void)
+{
+	unsigned __int128 r = (unsigned __int128)1 << 64;
+	uint64_t q = 0;
+	int i;
+
+	init_tables();
+
+	init_fold(fold_16b, 128);
+	init_fold(fold_32b, 256);
+	init_fold(fold_48b, 384);
+	init_fold(fold_64b, 512);
+	init_fold(fold_128b, 1024);
+	init_fold(fold_192b, 1536);
+	init_fold(fold_256b, 2048);
+	x80_mod_p = xpow_mod(80);
+	x64_mod_p = xpow_mod(64);
+
+	/* mu = floor(x^64 / P), degree 48 */
+	for (i = 48; i >= 0; i--) {
+		if (r & ((unsigned __int128)1 << (i + 16))) {
+			q |= 1ull << i;
+			r ^= (unsigned __int128)CRC_POLY << i;
+		}
+	}
+	barrett_mu = q;
+
+#ifdef CRC_HAVE_CLMUL
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+	    __builtin_cpu_supports("vpclmulqdq") && __builtin_cpu_supports("pclmul"))
+		crc_impl = CRC_T10DIF_VPCLMUL;
+	else if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"))
+		crc_impl = CRC_T10DIF_PCLMUL;
+	else
+#endif
+		crc_impl = CRC_T10DIF_SLICE8;
+}
+
+static uint16_t crc_table(uint16_t crc, const uint8_t *p, size_t len)
+{
+	while (len--)
+		crc = (crc << 8) ^ crc_tables[0][((crc >> 8) ^ *p++) & 0xff];
+	return crc;
+}
+
+static uint16_t crc_slice8(uint16_t crc, const uint8_t *p, size_t len)
+{
+	while (len >= 8) {
+		crc = crc_tables[7][(p[0] ^ (crc >> 8)) & 0xff] ^
+			crc_tables[6][(p[1] ^ crc) & 0xff] ^
+			crc_tables[5][p[2]] ^ crc_tables[4][p[3]] ^
+			crc_tables[3][p[4]] ^ crc_tables[2][p[5]] ^
+			crc_tables[1][p[6]] ^ crc_tables[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+	return crc_table(crc, p, len);
+}
+
+#ifdef CRC_HAVE_CLMUL
+
+#define CRC_TARGET __attribute__((target("pclmul,ssse3,sse4.1")))
+#define CRC_TARGET_512 __attribute__((target("pclmul,ssse3,sse4.1,avx512f,avx512bw,vpclmulqdq")))
+
+static CRC_TARGET inline __m128i load_be128(const uint8_t *p)
+{
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+					   8, 9, 10, 11, 12, 13, 14, 15);
+
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap);
+}
+
+static CRC_TARGET inline __m128i fold128(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+			     _mm_clmulepi64_si128(x, k, 0x00));
+}
+
+static CRC_TARGET inline __m128i load_k(const uint64_t *k)
+{
+	return _mm_loadu_si128((const __m128i *)k);
+}
+
+/* (X * x^16) mod P of a 128-bit X, the CRC state after X */
+static CRC_TARGET uint16_t reduce128(__m128i x)
+{
+	__m128i y, z, t, k;
+
+	/* Y = Xhi * (x^80 mod P) + Xlo * x^16, at most 80 bits */
+	k = _mm_set_epi64x(0, x80_mod_p);
+	y = _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x01),
+			  _mm_slli_si128(_mm_move_epi64(x), 2));
+
+	/* Z = Yhi * (x^64 mod P) + Ylo, 64 bits */
+	k = _mm_set_epi64x(0, x64_mod_p);
+	z = _mm_xor_si128(_mm_clmulepi64_si128(y, k, 0x01), _mm_move_epi64(y));
+
+	/* Barrett: q = ((Z / x^16) * mu) / x^48, crc = Z + q * P */
+	k = _mm_set_epi64x(CRC_POLY, barrett_mu);
+	t = _mm_clmulepi64_si128(_mm_srli_epi64(z, 16), k, 0x00);
+	t = _mm_srli_si128(t, 6);
+	t = _mm_clmulepi64_si128(t, k, 0x10);
+	return _mm_cvtsi128_si32(_mm_xor_si128(z, t)) & 0xffff;
+}
+
+/* Fold 16-byte chunks into @x, starting at @p, returns bytes consumed */
+static CRC_TARGET size_t fold_chunks(__m128i *x, const uint8_t *p, size_t len)
+{
+	__m128i k = load_k(fold_16b), acc = *x;
+	size_t done = 0;
+
+	while (len - done >= 16) {
+		acc = _mm_xor_si128(fold128(acc, k), load_be128(p + done));
+		done += 16;
+	}
+	*x = acc;
+	return done;
+}
+
+/* Fold four parallel 16-byte lanes into one */
+static CRC_TARGET __m128i fold4(__m128i x0, __m128i x1, __m128i x2, __m128i x3)
+{
+	__m128i x;
+
+	x = _mm_xor_si128(fold128(x0, load_k(fold_48b)), fold128(x1, load_k(fold_32b)));
+	x = _mm_xor_si128(x, fold128(x2, load_k(fold_16b)));
+	return _mm_xor_si128(x, x3);
+}
+
+static CRC_TARGET uint16_t crc_pclmul(uint16_t crc, const uint8_t *p, size_t len)
+{
+	__m128i x0, x1, x2, x3, k;
+	size_t done;
+
+	if (len < 64)
+		return crc_slice8(crc, p, len);
+
+	x0 = _mm_xor_si128(load_be128(p), _mm_slli_si128(_mm_cvtsi32_si128(crc), 14));
+	x1 = load_be128(p + 16);
+	x2 = load_be128(p + 32);
+	x3 = load_be128(p + 48);
+
+	k = load_k(fold_64b);
+	for (done = 64; len - done >= 64; done += 64) {
+		x0 = _mm_xor_si128(fold128(x0, k), load_be128(p + done));
+		x1 = _mm_xor_si128(fold128(x1, k), load_be128(p + done + 16));
+		x2 = _mm_xor_si128(fold128(x2, k), load_be128(p + done + 32));
+		x3 = _mm_xor_si128(fold128(x3, k), load_be128(p + done + 48));
+	}
+
+	x0 = fold4(x0, x1, x2, x3);
+	done += fold_chunks(&x0, p + done, len - done);
+	return crc_slice8(reduce128(x0), p + done, len - done);
+}
+
+static CRC_TARGET_512 inline __m512i load_be512(const uint8_t *p)
+{
+	const __m512i bswap = _mm512_broadcast_i32x4(
+		_mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+	return _mm512_shuffle_epi8(_mm512_loadu_si512(p), bswap);
+}
+
+static CRC_TARGET_512 inline __m512i fold512(__m512i x, const uint64_t *k)
+{
+	__m512i kk = _mm512_broadcast_i32x4(load_k(k));
+
+	return _mm512_xor_si512(_mm512_clmulepi64_epi128(x, kk, 0x11),
+				_mm512_clmulepi64_epi128(x, kk, 0x00));
+}
+
+static CRC_TARGET_512 uint16_t crc_vpclmul(uint16_t crc, const uint8_t *p, size_t len)
+{
+	__m512i x0, x1, x2, x3;
+	size_t done;
+
+	if (len < 256)
+		return crc_pclmul(crc, p, len);
+
+	/* Each zmm holds four consecutive chunks, lane 0 being the first */
+	x0 = _mm512_xor_si512(load_be512(p),
+			      _mm512_zextsi128_si512(_mm_slli_si128(_mm_cvtsi32_si128(crc), 14)));
+	x1 = load_be512(p + 64);
+	x2 = load_be512(p + 128);
+	x3 = load_be512(p + 192);
+
+	for (done = 256; len - done >= 256; done += 256) {
+		x0 = _mm512_xor_si512(fold512(x0, fold_256b), load_be512(p + done));
+		x1 = _mm512_xor_si512(fold512(x1, fold_256b), load_be512(p + done + 64));
+		x2 = _mm512_xor_si512(fold512(x2, fold_256b), load_be512(p + done + 128));
+		x3 = _mm512_xor_si512(fold512(x3, fold_256b), load_be512(p + done + 192));
+	}
+
+	x0 = _mm512_xor_si512(fold512(x0, fold_192b), fold512(x1, fold_128b));
+	x0 = _mm512_xor_si512(x0, fold512(x2, fold_64b));
+	x0 = _mm512_xor_si512(x0, x3);
+
+	for (; len - done >= 64; done += 64)
+		x0 = _mm512_xor_si512(fold512(x0, fold_64b), load_be512(p + done));
+
+	{
+		__m128i x = fold4(_mm512_extracti32x4_epi32(x0, 0),
+				  _mm512_extracti32x4_epi32(x0, 1),
+				  _mm512_extracti32x4_epi32(x0, 2),
+				  _mm512_extracti32x4_epi32(x0, 3));
+
+		done += fold_chunks(&x, p + done, len - done);
+		return crc_slice8(reduce128(x), p + done, len - done);
+	}
+}
+
+#endif /* CRC_HAVE_CLMUL */
+
+static uint16_t crc_impl_update(enum crc_t10dif_impl impl, uint16_t crc,
+				const void *buf, size_t len)
+{
+	switch (impl) {
+#ifdef CRC_HAVE_CLMUL
+	case CRC_T10DIF_VPCLMUL:
+		return crc_vpclmul(crc, buf, len);
+	case CRC_T10DIF_PCLMUL:
+		return crc_pclmul(crc, buf, len);
+#endif
+	case CRC_T10DIF_SLICE8:
+		return crc_slice8(crc, buf, len);
+	default:
+		return crc_table(crc, buf, len);
+	}
+}
+
+uint16_t crc_t10dif_update(uint16_t crc, const void *buf, size_t len)
+{
+	pthread_once(&crc_once, init_consts);
+	return crc_impl_update(crc_impl, crc, buf, len);
+}
+
+void crc_t10dif_blocks(const void *buf, size_t block_size, size_t stride,
+		       unsigned int nblocks, uint16_t *guards)
+{
+	const uint8_t *p = buf;
+	unsigned int i;
+
+	pthread_once(&crc_once, init_consts);
+	for (i = 0; i < nblocks; i++, p += stride)
+		guards[i] = crc_impl_update(crc_impl, 0, p, block_size);
+}
+
+int crc_t10dif_set_impl(enum crc_t10dif_impl impl)
+{
+	pthread_once(&crc_once, init_consts);
+
+	switch (impl) {
+	case CRC_T10DIF_TABLE:
+	case CRC_T10DIF_SLICE8:
+		break;
+#ifdef CRC_HAVE_CLMUL
+	case CRC_T10DIF_VPCLMUL:
+		if (!__builtin_cpu_supports("avx512f") ||
+		    !__builtin_cpu_supports("avx512bw") ||
+		    !__builtin_cpu_supports("vpclmulqdq"))
+			return ENOTSUP;
+		/* fallthrough */
+	case CRC_T10DIF_PCLMUL:
+		if (!__builtin_cpu_supports("pclmul") || !__builtin_cpu_supports("ssse3"))
+			return ENOTSUP;
+		break;
+#endif
+	default:
+		return ENOTSUP;
+	}
+
+	crc_impl = impl;
+	return 0;
+}
+
+enum crc_t10dif_impl crc_t10dif_get_impl(void)
+{
+	pthread_once(&crc_once, init_consts);
+	return crc_impl;
+}
+
+const char *crc_t10dif_impl_name(enum crc_t10dif_impl impl)
+{
+	return impl < CRC_T10DIF_IMPL_MAX ? impl_names[impl] : "unknown";
+}
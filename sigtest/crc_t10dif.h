@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause) */
+/*
+ * CRC-T10DIF (poly 0x8bb7, init 0, MSB first), the T10 PI guard.
+ * The implementation is chosen at runtime by CPUID: VPCLMULQDQ (AVX-512),
+ * PCLMULQDQ folding, or a slice-by-8 table.
+ */
+#ifndef __CRC_T10DIF_H__
+#define __CRC_T10DIF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum crc_t10dif_impl {
+	CRC_T10DIF_TABLE,	/* One byte per step, same as readme.crc-t10dif.c */
+	CRC_T10DIF_SLICE8,
+	CRC_T10DIF_PCLMUL,
+	CRC_T10DIF_VPCLMUL,
+	CRC_T10DIF_IMPL_MAX,
+};
+
+/* Continue a CRC over @len bytes; Start with @crc 0 */
+uint16_t crc_t10dif_update(uint16_t crc, const void *buf, size_t len);
+
+static inline uint16_t crc_t10dif(const void *buf, size_t len)
+{
+	return crc_t10dif_update(0, buf, len);
+}
+
+/*
+ * Guards of @nblocks blocks of @block_size bytes, @stride bytes apart
+ * (e.g. block_size + 8 for PI interleaved with the data).
+ */
+void crc_t10dif_blocks(const void *buf, size_t block_size, size_t stride,
+		       unsigned int nblocks, uint16_t *guards);
+
+/* Returns 0 or ENOTSUP if the CPU doesn't support @impl */
+int crc_t10dif_set_impl(enum crc_t10dif_impl impl);
+enum crc_t10dif_impl crc_t10dif_get_impl(void);
+const char *crc_t10dif_impl_name(enum crc_t10dif_impl impl);
+
+#endif
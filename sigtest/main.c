@@ -2,8 +2,11 @@
 /*
  * Copyright (c) 2023 NVIDIA CORPORATION. All rights reserved
  */
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -17,6 +20,7 @@
 #include <rdma/rdma_cma.h>
 #include <infiniband/mlx5dv.h>
 
+#include "pi.h"
 #include "sig_test.h"
 
 enum {
@@ -28,45 +32,88 @@ enum {
 #define SERVER_PORT  6006
 
 struct sig_param param;
+static struct sig_stream_opts stream_opts;
 
 static int my_role = ROLE_NONE;
 static struct sockaddr server;
 
 static struct rdma_event_channel *ech;
 static struct rdma_cm_id *cmid;
-struct ibv_pd *pd;
-struct ibv_cq *cq;
-struct ibv_qp *qp;
 
-static struct rdma_cm_id *client_id; /* Used by server */
+/* One per connection, each driven by its own pinned thread if there are several */
+struct conn {
+	struct rdma_cm_id *id;
+	struct ibv_pd *pd;
+	struct ibv_cq *cq;
+	struct ibv_qp *qp;
+	struct ibv_comp_channel *channel;
+	struct sig_param param;
+	struct sig_stream_conn stream;
+	pthread_t thread;
+	int ret;
+};
+
+static struct conn *conns;
+static unsigned int num_conns = 1;
 
-static int create_self_qp(struct rdma_cm_id *id)
+#define DEF_STREAM_WINDOW 16
+#define DEF_STREAM_ITERS 100000
+#define DEF_INJECT_RATE 100
+
+/* Room for the receives the stream server keeps posted, plus mkey configures */
+static unsigned int get_queue_depth(void)
+{
+	unsigned int qd = 32;
+
+	if (stream_opts.stream && stream_opts.window * 2 + 32 > qd)
+		qd = stream_opts.window * 2 + 32;
+	/* mkey configure, RDMA and response per block target request */
+	if (stream_opts.target && stream_opts.window * 3 + 32 > qd)
+		qd = stream_opts.window * 3 + 32;
+	return qd;
+}
+
+static int create_self_qp(struct conn *c)
 {
 	struct mlx5dv_qp_init_attr mlx5_qp_attr = {};
         struct ibv_qp_init_attr_ex qp_attr = {};
 
 	qp_attr.qp_type = IBV_QPT_RC;
 	qp_attr.sq_sig_all = 0;
-	qp_attr.send_cq = cq;
-	qp_attr.recv_cq = cq;
-	qp_attr.cap.max_send_wr = 32;
-	qp_attr.cap.max_recv_wr = 32;
+	qp_attr.send_cq = c->cq;
+	qp_attr.recv_cq = c->cq;
+	qp_attr.cap.max_send_wr = get_queue_depth();
+	qp_attr.cap.max_recv_wr = get_queue_depth();
 	qp_attr.cap.max_send_sge = 1;
 	qp_attr.cap.max_recv_sge = 1;
 	qp_attr.cap.max_inline_data = 64;
 
-	qp_attr.pd = pd;
+	qp_attr.pd = c->pd;
 	qp_attr.comp_mask = IBV_QP_INIT_ATTR_PD;
 	qp_attr.comp_mask |= IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
 	qp_attr.send_ops_flags = IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_SEND |
 		IBV_QP_EX_WITH_RDMA_READ | IBV_QP_EX_WITH_LOCAL_INV;
 
+	/* No signature offload (e.g. rxe): A plain QP, PI by the CPU */
+	if (!c->param.sw_sig && is_sig_supported(c->id->verbs, &c->param)) {
+		info("Falling back to software signature\n");
+		c->param.sw_sig = true;
+	}
+	if (c->param.sw_sig) {
+		c->qp = ibv_create_qp_ex(c->id->verbs, &qp_attr);
+		if (!c->qp) {
+			err("ibv_create_qp_ex: %s\n", strerror(errno));
+			return errno;
+		}
+		return 0;
+	}
+
 	/* Signature attributes */
 	mlx5_qp_attr.comp_mask = MLX5DV_QP_INIT_ATTR_MASK_SEND_OPS_FLAGS;
 	mlx5_qp_attr.send_ops_flags = MLX5DV_QP_EX_WITH_MKEY_CONFIGURE;
 
-	qp = mlx5dv_create_qp(id->verbs, &qp_attr, &mlx5_qp_attr);
-	if (!qp) {
+	c->qp = mlx5dv_create_qp(c->id->verbs, &qp_attr, &mlx5_qp_attr);
+	if (!c->qp) {
 		err("mlx5dv_create_qp: %s\n", strerror(errno));
 		return errno;
 	}
@@ -105,48 +152,104 @@ static int modify_qp(struct rdma_cm_id *id, struct ibv_qp *qp)
 	return ibv_modify_qp(qp, &qp_attr, qp_attr_mask);
 }
 
-static int create_res(struct rdma_cm_id *id)
+static int create_res(struct conn *c)
 {
 	int err;
 
-	pd = ibv_alloc_pd(id->verbs);
-	if (!pd) {
+	c->pd = ibv_alloc_pd(c->id->verbs);
+	if (!c->pd) {
 		perror("ibv_alloc_pd");
 		return errno;
 	}
 
-	cq = ibv_create_cq(id->verbs, 32, NULL, NULL, 0);
-	if (!cq) {
+	/* The WRITE/READ stream server sleeps on it until the client is done */
+	if (my_role == ROLE_SERVER && stream_opts.stream && stream_opts.op != SIG_OP_SEND) {
+		c->channel = ibv_create_comp_channel(c->id->verbs);
+		if (!c->channel) {
+			perror("ibv_create_comp_channel");
+			goto fail_create_channel;
+		}
+	}
+
+	c->cq = ibv_create_cq(c->id->verbs, get_queue_depth() * 2, NULL, c->channel, 0);
+	if (!c->cq) {
 		perror("ibv_create_cq");
 		goto fail_create_cq;
 	}
 
-	err = create_self_qp(id);
+	err = create_self_qp(c);
 	if (err)
 		goto fail_create_qp;
 
+	c->stream.pd = c->pd;
+	c->stream.cq = c->cq;
+	c->stream.qp = c->qp;
+	c->stream.channel = c->channel;
 	return 0;
 
 fail_create_qp:
-	ibv_destroy_cq(cq);
+	ibv_destroy_cq(c->cq);
 fail_create_cq:
-	ibv_dealloc_pd(pd);
+	if (c->channel)
+		ibv_destroy_comp_channel(c->channel);
+	c->channel = NULL;
+fail_create_channel:
+	ibv_dealloc_pd(c->pd);
 	return -1;
 }
 
-static void destroy_qp(struct rdma_cm_id *id)
+static void destroy_qp(struct conn *c)
 {
-	ibv_destroy_qp(qp);
-	ibv_destroy_cq(cq);
-	ibv_dealloc_pd(pd);
+	if (!c->qp)
+		return;
+	ibv_destroy_qp(c->qp);
+	ibv_destroy_cq(c->cq);
+	if (c->channel)
+		ibv_destroy_comp_channel(c->channel);
+	ibv_dealloc_pd(c->pd);
+	c->qp = NULL;
+	c->channel = NULL;
+}
+
+static int alloc_conns(void)
+{
+	unsigned int i;
+
+	conns = calloc(num_conns, sizeof(*conns));
+	if (!conns) {
+		err("Failed to allocate %d connections\n", num_conns);
+		return ENOMEM;
+	}
+
+	for (i = 0; i < num_conns; i++) {
+		conns[i].param = param;
+		conns[i].stream.param = &conns[i].param;
+		conns[i].stream.opts = &stream_opts;
+		conns[i].stream.num_qps = num_conns;
+		conns[i].stream.qp_idx = i;
+	}
+	return 0;
+}
+
+/* Let the client have as many RDMA READs in flight as the device allows */
+static void set_rd_atomic(struct ibv_context *ctx, struct rdma_conn_param *conn_param)
+{
+	struct ibv_device_attr attr;
+
+	if (ibv_query_device(ctx, &attr))
+		return;
+	conn_param->initiator_depth = attr.max_qp_init_rd_atom;
+	conn_param->responder_resources = attr.max_qp_rd_atom;
 }
 
 static int setup_connection_server(void)
 {
-	struct rdma_conn_param param = {}, *cparam;
+	struct rdma_conn_param conn_param, *cparam;
+	unsigned int nreq = 0, nest = 0;
+	struct sig_remote_buf rb;
 	struct rdma_cm_event *e;
 	struct sockaddr_in sin;
-	bool done;
+	struct conn *c = NULL;
 	int err;
 
 	sin.sin_family = AF_INET;
@@ -158,14 +261,13 @@ static int setup_connection_server(void)
 		return errno;
 	}
 
-	err = rdma_listen(cmid, 5);
+	err = rdma_listen(cmid, num_conns > 5 ? num_conns : 5);
 	if (err) {
 		perror("rdma_listen");
 		return errno;
 	}
 
-	done = false;
-	while (!done) {
+	while (nest < num_conns) {
 		err = rdma_get_cm_event(ech, &e);
 		if (err) {
 			perror("rdma_get_cm_event");
@@ -174,23 +276,41 @@ static int setup_connection_server(void)
 
 		switch (e->event) {
 		case RDMA_CM_EVENT_CONNECT_REQUEST:
+			if (nreq == num_conns) {
+				err("Unexpected connect request, rejected\n");
+				rdma_reject(e->id, NULL, 0);
+				break;
+			}
+
 			cparam = &e->param.conn;
-			client_id = e->id;
-			err = create_res(client_id);
+			c = &conns[nreq++];
+			c->id = e->id;
+			err = create_res(c);
 			if (err)
 				return err;
 
 			info("Connect request comes; Created lqpn %d, rqpn %d\n",
-			     qp->qp_num, cparam->qp_num);
+			     c->qp->qp_num, cparam->qp_num);
 
-			err = modify_qp(client_id, qp);
+			err = modify_qp(c->id, c->qp);
 			if (err) {
 				perror("modify_qp");
 				goto fail;
 			}
 
-			param.qp_num = qp->qp_num;
-			err = rdma_accept(client_id, &param);
+			memset(&conn_param, 0, sizeof(conn_param));
+			if (stream_opts.stream && stream_opts.op != SIG_OP_SEND) {
+				err = sig_stream_expose(&c->stream, &rb);
+				if (err)
+					goto fail;
+				conn_param.private_data = &rb;
+				conn_param.private_data_len = sizeof(rb);
+			}
+
+			conn_param.qp_num = c->qp->qp_num;
+			conn_param.rnr_retry_count = 7;
+			set_rd_atomic(c->id->verbs, &conn_param);
+			err = rdma_accept(c->id, &conn_param);
 			if (err) {
 				perror("rdma_accept");
 				goto fail;
@@ -198,8 +318,8 @@ static int setup_connection_server(void)
 			break;
 
 		case RDMA_CM_EVENT_ESTABLISHED:
-			info("Connection established.\n");
-			done = true;
+			nest++;
+			info("Connection established (%d/%d).\n", nest, num_conns);
 			break;
 
 		default:
@@ -217,7 +337,7 @@ static int setup_connection_server(void)
 	return 0;
 
 fail:
-	destroy_qp(client_id);
+	destroy_qp(c);
 	return err;
 }
 
@@ -230,8 +350,111 @@ static inline char *type2str(enum mlx5dv_sig_type type)
 	else
 		return "UNKNOWN";
 }
+
+static int run_conn(struct conn *c)
+{
+	if (stream_opts.target)
+		return (my_role == ROLE_SERVER) ?
+			start_sig_target_server(&c->stream) :
+			start_sig_target_client(&c->stream);
+
+	if (my_role == ROLE_SERVER) {
+		if (stream_opts.stream)
+			return start_sig_stream_server(&c->stream);
+		return start_sig_test_server(c->pd, c->qp, c->cq, &c->param);
+	}
+
+	if (stream_opts.stream)
+		return start_sig_stream_client(&c->stream);
+	return start_sig_test_client(c->pd, c->qp, c->cq, &c->param);
+}
+
+static void *conn_thread(void *arg)
+{
+	struct conn *c = arg;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t cpus;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(c->stream.qp_idx % (ncpus > 0 ? ncpus : 1), &cpus);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+		err("Failed to pin the thread of QP %d\n", c->stream.qp_idx);
+
+	c->ret = run_conn(c);
+	return NULL;
+}
+
+/*
+ * Aggregate over all QPs, from the first start to the last end of a phase,
+ * and the spread of the per-QP rates.
+ */
+static void print_aggregate(void)
+{
+	static const char *const phase_name[] = { "PI off", "PI on" };
+	unsigned int i, k;
+
+	for (k = 0; k < 2; k++) {
+		uint64_t start = ~0ULL, end = 0, bytes = 0, msgs = 0;
+		double min = 0, max = 0;
+
+		for (i = 0; i < num_conns; i++) {
+			const struct sig_stream_result *r = &conns[i].stream.result[k];
+			double rate;
+
+			if (!r->msgs || r->end_ns <= r->start_ns)
+				continue;
+			rate = (double)r->bytes / (r->end_ns - r->start_ns);
+			if (!msgs || rate < min)
+				min = rate;
+			if (!msgs || rate > max)
+				max = rate;
+			if (r->start_ns < start)
+				start = r->start_ns;
+			if (r->end_ns > end)
+				end = r->end_ns;
+			bytes += r->bytes;
+			msgs += r->msgs;
+		}
+		if (!msgs)
+			continue;
+
+		info("Aggregate %-6s over %d QPs: %.3f GB/s, %.3f Mmsgs/s; per QP %.3f - %.3f GB/s\n",
+		     phase_name[k], num_conns, (double)bytes / (end - start),
+		     msgs * 1000.0 / (end - start), min, max);
+	}
+}
+
+static int run_conns(void)
+{
+	unsigned int i, started;
+	int ret = 0;
+
+	if (num_conns == 1)
+		return run_conn(&conns[0]);
+
+	for (started = 0; started < num_conns; started++) {
+		ret = pthread_create(&conns[started].thread, NULL, conn_thread,
+				     &conns[started]);
+		if (ret) {
+			err("pthread_create failed %d\n", ret);
+			break;
+		}
+	}
+
+	for (i = 0; i < started; i++) {
+		pthread_join(conns[i].thread, NULL);
+		if (conns[i].ret && !ret)
+			ret = conns[i].ret;
+	}
+
+	if (!ret)
+		print_aggregate();
+	return ret;
+}
+
 static int run_server(void)
 {
+	unsigned int i;
 	int ret;
 
 	if (param.sig_type == MLX5DV_SIG_TYPE_NVMEDIF)
@@ -243,35 +466,52 @@ static int run_server(void)
 	if (ret)
 		return ret;
 
-	ret = start_sig_test_server(pd, qp, cq, &param);
+	ret = run_conns();
 
-	destroy_qp(client_id);
+	for (i = 0; i < num_conns; i++)
+		destroy_qp(&conns[i]);
 	return ret;
 }
 
 static int setup_connection_client(void)
 {
-	struct rdma_conn_param param = {}, *cparam;
+	struct rdma_conn_param conn_param, *cparam;
+	unsigned int i, nest = 0;
 	struct rdma_cm_event *e;
-	int ret, done;
+	struct conn *c = NULL;
+	int ret;
 
-	ret = rdma_resolve_addr(cmid, NULL, &server, 1000);
-	if (ret) {
-		perror("rdma_resolve_addr");
-		return ret;
+	for (i = 0; i < num_conns; i++) {
+		c = &conns[i];
+		if (i == 0) {
+			c->id = cmid;
+			cmid->context = c;
+		} else {
+			ret = rdma_create_id(ech, &c->id, c, RDMA_PS_TCP);
+			if (ret) {
+				perror("rdma_create_id");
+				return errno;
+			}
+		}
+
+		ret = rdma_resolve_addr(c->id, NULL, &server, 1000);
+		if (ret) {
+			perror("rdma_resolve_addr");
+			return ret;
+		}
 	}
 
-	done = false;
-	while (!done) {
+	while (nest < num_conns) {
 		ret = rdma_get_cm_event(ech, &e);
 		if (ret) {
 			perror("rdma_get_cm_event");
 			return errno;
 		}
 
+		c = e->id->context;
 		switch (e->event) {
 		case RDMA_CM_EVENT_ADDR_RESOLVED:
-			ret = rdma_resolve_route(cmid, 2000);
+			ret = rdma_resolve_route(c->id, 2000);
 			if (ret) {
 				perror("rdma_resolve_route");
 				return errno;
@@ -279,12 +519,15 @@ static int setup_connection_client(void)
 			break;
 
 		case RDMA_CM_EVENT_ROUTE_RESOLVED:
-			ret = create_res(cmid);
+			ret = create_res(c);
 			if (ret)
 				return ret;
 
-			param.qp_num = qp->qp_num;
-			ret = rdma_connect(cmid, &param);
+			memset(&conn_param, 0, sizeof(conn_param));
+			conn_param.qp_num = c->qp->qp_num;
+			conn_param.rnr_retry_count = 7;
+			set_rd_atomic(c->id->verbs, &conn_param);
+			ret = rdma_connect(c->id, &conn_param);
 			if (ret) {
 				perror("rdma_connect");
 				goto fail;
@@ -294,22 +537,31 @@ static int setup_connection_client(void)
 		case RDMA_CM_EVENT_CONNECT_RESPONSE:
 		/* case RDMA_CM_EVENT_ESTABLISHED: */
 			cparam = &e->param.conn;
-			ret = modify_qp(cmid, qp);
+			if (stream_opts.stream && stream_opts.op != SIG_OP_SEND) {
+				if (cparam->private_data_len < sizeof(c->stream.remote)) {
+					err("No remote buffer in the connect response\n");
+					ret = -1;
+					goto fail;
+				}
+				memcpy(&c->stream.remote, cparam->private_data,
+				       sizeof(c->stream.remote));
+			}
+
+			ret = modify_qp(c->id, c->qp);
 			if (ret) {
 				perror("modify_qp");
 				goto fail;
 			}
 
-			ret = rdma_establish(cmid);
+			ret = rdma_establish(c->id);
 			if (ret) {
 				perror("rdma_establish");
 				goto fail;
 			}
 
-			info("Connection established, lqpn %d, rqpn %d\n",
-			     qp->qp_num, cparam->qp_num);
-
-			done = true;
+			nest++;
+			info("Connection established (%d/%d), lqpn %d, rqpn %d\n",
+			     nest, num_conns, c->qp->qp_num, cparam->qp_num);
 			break;
 
 		default:
@@ -328,7 +580,7 @@ static int setup_connection_client(void)
 	return 0;
 
 fail:
-	destroy_qp(cmid);
+	destroy_qp(c);
 	return -1;
 }
 
@@ -336,6 +588,7 @@ static int run_client(void)
 {
 	const char *p = NULL;
 	char ipstr[64] = {};
+	unsigned int i;
 	int ret;
 
 	switch(server.sa_family) {
@@ -366,12 +619,16 @@ static int run_client(void)
 
 	ret = setup_connection_client();
 	if (ret)
-		return ret;
-
+		goto out;
 
-	ret = start_sig_test_client(pd, qp, cq, &param);
+	ret = run_conns();
 
-	destroy_qp(cmid);
+out:
+	for (i = 0; i < num_conns; i++) {
+		destroy_qp(&conns[i]);
+		if (i && conns[i].id)
+			rdma_destroy_id(conns[i].id);
+	}
 	return ret;
 }
 
@@ -383,6 +640,19 @@ static void show_usage(char *program)
 	printf("  [-n, --block-num] - Number of blocks (1 by default), must be same in server and client side\n");
 	printf("  [-m, --enable-check-copy-en-mask] - Enable the check-copy-en-mask flag\n");
 	printf("  [-t, --sig-type]  - Signature type; 0 - T10DIF (default), 2 - NVMEDIF\n");
+	printf("  [-b, --stream]    - Streaming benchmark, with PI off then on\n");
+	printf("  [-w, --window]    - Outstanding messages in streaming mode (%d by default)\n", DEF_STREAM_WINDOW);
+	printf("  [-I, --iters]     - Messages per streaming phase (%d by default)\n", DEF_STREAM_ITERS);
+	printf("  [-o, --op]        - Streaming data path: send (default), write or read, must be same in server and client side\n");
+	printf("  [-D, --domain]    - Signature domains for write/read: wire (default), mem or both\n");
+	printf("  [-q, --qps]       - Streaming over <k> connections, each with its own QP, CQ, mkeys and pinned thread (1 by default), must be same in server and client side\n");
+	printf("  [-E, --entries]   - Streaming with the data also in 1, 2, 4 ... <n> fragments, mkeys with up to <n> entries, must be same in server and client side\n");
+	printf("  [-j, --inject]    - Streaming with guard, app, ref, storage or all (default) errors injected by the client\n");
+	printf("  [-r, --inject-rate] - Corrupt one message in <n> (%d by default)\n", DEF_INJECT_RATE);
+	printf("  [-P, --pool]      - Streaming with up to <n> mkeys reconfigured per message, must be same in server and client side\n");
+	printf("  [-C, --cpu-sig]   - Insert/verify PI by the CPU instead of mlx5 signature offload (the default if the device has none)\n");
+	printf("  [-T, --target]    - Server: serve protected block I/O from file <file>, data and PI interleaved\n");
+	printf("  [-B, --blk-io]    - Client: random block WRITEs and READs to a -T server, -w requests of -n blocks outstanding (queue depth, must be same in server and client side)\n");
 	printf("  [-h, --help]      - Show help\n");
 	printf("  For nvmedif only:\n");
 	printf("    [-F, --nvmedif-format]: 0 - FORMAT_16 (default), 1 - FORMAT_32, 2 - FORMAT64\n");
@@ -396,6 +666,18 @@ static void show_usage(char *program)
 	printf("  Server: %s -m -t 2 -F 1 -S 24 -s\n", program);
 	printf("  Client: %s -m -t 2 -F 1 -S 24 -c 192.168.0.64\n", program);
 	printf("\n");
+	printf("Example 3 (streaming, 8 blocks per message, window 64):\n");
+	printf("  Server: %s -b -n 8 -w 64 -s\n", program);
+	printf("  Client: %s -b -n 8 -w 64 -c 192.168.0.64\n", program);
+	printf("\n");
+	printf("Example 4 (RDMA READ, both domains, 1 to 32 blocks):\n");
+	printf("  Server: %s -o read -n 32 -s\n", program);
+	printf("  Client: %s -o read -D both -n 32 -c 192.168.0.64\n", program);
+	printf("\n");
+	printf("Example 5 (block target, queue depth 32):\n");
+	printf("  Server: %s -T /dev/shm/sig_target.img -w 32 -s\n", program);
+	printf("  Client: %s -B -w 32 -c 192.168.0.64\n", program);
+	printf("\n");
 }
 
 static int get_addr(char *ip, struct sockaddr *addr)
@@ -449,11 +731,24 @@ static int parse_opt(int argc, char *argv[])
 		{"nvmedif-format", 0, NULL, 'F'},
 		{"nvmedif-sts", 0, NULL, 'S'},
 		{"enable-check-copy-en-mask", 0, NULL, 'm'},
+		{"stream", 0, NULL, 'b'},
+		{"window", 1, NULL, 'w'},
+		{"iters", 1, NULL, 'I'},
+		{"pool", 1, NULL, 'P'},
+		{"qps", 1, NULL, 'q'},
+		{"entries", 1, NULL, 'E'},
+		{"inject", 1, NULL, 'j'},
+		{"inject-rate", 1, NULL, 'r'},
+		{"op", 1, NULL, 'o'},
+		{"domain", 1, NULL, 'D'},
+		{"cpu-sig", 0, NULL, 'C'},
+		{"target", 1, NULL, 'T'},
+		{"blk-io", 0, NULL, 'B'},
 		{},
 	};
 	int op, err;
 
-	while ((op = getopt_long(argc, argv, "hvcsn:mt:S:F:", long_opts, NULL)) != -1) {
+	while ((op = getopt_long(argc, argv, "hvcsn:mt:S:F:bw:I:P:o:D:q:E:j:r:CT:B", long_opts, NULL)) != -1) {
                 switch (op) {
 		case 'v':
 			//printf("%s %s\n", PROJECT_NAME, PROJECT_VERSION);
@@ -501,6 +796,97 @@ static int parse_opt(int argc, char *argv[])
 			param.sts = atoi(optarg);
 			break;
 
+		case 'b':
+			stream_opts.stream = true;
+			break;
+
+		case 'C':
+			param.sw_sig = true;
+			break;
+
+		case 'T':
+			stream_opts.target = true;
+			stream_opts.target_file = optarg;
+			break;
+
+		case 'B':
+			stream_opts.target = true;
+			break;
+
+		case 'w':
+			stream_opts.window = atoi(optarg);
+			break;
+
+		case 'I':
+			stream_opts.iters = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'P':
+			stream_opts.pool_size = atoi(optarg);
+			break;
+
+		case 'j':
+			if (!strcmp(optarg, "guard")) {
+				stream_opts.inject_field = PI_CHECK_GUARD;
+			} else if (!strcmp(optarg, "app")) {
+				stream_opts.inject_field = PI_CHECK_APP;
+			} else if (!strcmp(optarg, "ref")) {
+				stream_opts.inject_field = PI_CHECK_REF;
+			} else if (!strcmp(optarg, "storage")) {
+				stream_opts.inject_field = PI_CHECK_STORAGE;
+			} else if (!strcmp(optarg, "all")) {
+				stream_opts.inject_field = 0;
+			} else {
+				err("Unknown PI field %s\n", optarg);
+				return -1;
+			}
+			if (!stream_opts.inject_rate)
+				stream_opts.inject_rate = DEF_INJECT_RATE;
+			break;
+
+		case 'r':
+			stream_opts.inject_rate = atoi(optarg);
+			break;
+
+		case 'E':
+			stream_opts.max_entries = atoi(optarg);
+			break;
+
+		case 'q':
+			num_conns = atoi(optarg);
+			if (!num_conns) {
+				err("Invalid number of connections %s\n", optarg);
+				return -1;
+			}
+			break;
+
+		case 'o':
+			if (!strcmp(optarg, "send")) {
+				stream_opts.op = SIG_OP_SEND;
+			} else if (!strcmp(optarg, "write")) {
+				stream_opts.op = SIG_OP_WRITE;
+			} else if (!strcmp(optarg, "read")) {
+				stream_opts.op = SIG_OP_READ;
+			} else {
+				err("Unknown op %s\n", optarg);
+				return -1;
+			}
+			stream_opts.stream = true;
+			break;
+
+		case 'D':
+			if (!strcmp(optarg, "wire")) {
+				stream_opts.domains = SIG_FLAG_WIRE;
+			} else if (!strcmp(optarg, "mem")) {
+				stream_opts.domains = SIG_FLAG_MEM;
+			} else if (!strcmp(optarg, "both")) {
+				stream_opts.domains = SIG_FLAG_WIRE | SIG_FLAG_MEM;
+			} else {
+				err("Unknown domain %s\n", optarg);
+				return -1;
+			}
+			break;
+
 		default:
 			err("Unknown option %c\n", op);
 			show_usage(argv[0]);
@@ -546,6 +932,49 @@ static int parse_opt(int argc, char *argv[])
 		param.block_size = 4096;
 	}
 
+	if (stream_opts.pool_size || stream_opts.max_entries > 1 || stream_opts.inject_rate)
+		stream_opts.stream = true;
+
+	if (stream_opts.target) {
+		if (stream_opts.stream) {
+			err("The block target doesn't stream\n");
+			return -1;
+		}
+		if (my_role == ROLE_SERVER && !stream_opts.target_file) {
+			err("The block target needs a backing file (-T)\n");
+			return -1;
+		}
+		if (!param.block_num)
+			param.block_num = 1;
+		if (!stream_opts.window)
+			stream_opts.window = DEF_STREAM_WINDOW;
+		if (!stream_opts.iters)
+			stream_opts.iters = DEF_STREAM_ITERS;
+	}
+
+	/* sig_test.c keeps its buffers and mkey in globals */
+	if (num_conns > 1 && !stream_opts.stream) {
+		err("Multiple connections are supported in streaming mode only\n");
+		return -1;
+	}
+
+	if (stream_opts.stream) {
+		if (!param.block_num)
+			param.block_num = 1;
+		if (!param.block_size)
+			param.block_size = 512;
+		if (!stream_opts.window)
+			stream_opts.window = DEF_STREAM_WINDOW;
+		if (!stream_opts.iters)
+			stream_opts.iters = DEF_STREAM_ITERS;
+		if (!stream_opts.domains)
+			stream_opts.domains = SIG_FLAG_WIRE;
+		if (stream_opts.op == SIG_OP_SEND && stream_opts.domains != SIG_FLAG_WIRE) {
+			err("SEND streaming supports the wire domain only\n");
+			return -1;
+		}
+	}
+
 	param.pi_size = get_pi_size(&param);
 	return 0;
 }
@@ -558,6 +987,9 @@ int main(int argc, char *argv[])
 	if (ret)
 		return ret;
 
+	ret = alloc_conns();
+	if (ret)
+		return ret;
 
 	ech = rdma_create_event_channel();
 	if (!ech) {
@@ -581,5 +1013,6 @@ int main(int argc, char *argv[])
 
 fail:
 	rdma_destroy_event_channel(ech);
+	free(conns);
 	return ret;
 }
@@ -0,0 +1,303 @@
+/* SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause) */
+/*
+ * Software PI engine. The guards of a batch of blocks are computed first
+ * with the PCLMULQDQ CRCs (crc_t10dif.c, pi_crc.c), then the tuples are
+ * built or checked.
+ */
+#include <errno.h>
+#include <string.h>
+
+#include "crc_t10dif.h"
+#include "pi.h"
+#include "pi_crc.h"
+
+#define PI_BATCH 64
+
+struct pi_tuple {
+	uint64_t guard;
+	uint16_t app;
+	uint64_t ref;
+	uint64_t storage;
+};
+
+static unsigned int guard_bytes(enum pi_format fmt)
+{
+	switch (fmt) {
+	case PI_FMT_NVME_32:
+		return 4;
+	case PI_FMT_NVME_64:
+		return 8;
+	default:
+		return 2;
+	}
+}
+
+/* Size of the storage+ref tag field in bits */
+static unsigned int sr_bits(enum pi_format fmt)
+{
+	switch (fmt) {
+	case PI_FMT_NVME_32:
+		return 80;
+	case PI_FMT_NVME_64:
+		return 48;
+	default:
+		return 32;
+	}
+}
+
+static unsigned int sts_bits(const struct pi_domain *d)
+{
+	return d->format == PI_FMT_T10DIF ? 0 : d->sts;
+}
+
+static uint64_t mask_bits(unsigned int bits)
+{
+	return bits >= 64 ? ~0ull : (1ull << bits) - 1;
+}
+
+unsigned int pi_size(const struct pi_domain *d)
+{
+	return guard_bytes(d->format) + 2 + sr_bits(d->format) / 8;
+}
+
+int pi_check_domain(const struct pi_domain *d)
+{
+	unsigned int ref_bits = sr_bits(d->format) - sts_bits(d);
+
+	if (sts_bits(d) > 64 || sts_bits(d) > sr_bits(d->format) || ref_bits > 64)
+		return EINVAL;
+	if (!d->block_size)
+		return EINVAL;
+	return 0;
+}
+
+static uint16_t ip_csum(uint16_t seed, const uint8_t *p, size_t len)
+{
+	uint64_t sum = seed;
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (p[i] << 8) | p[i + 1];
+	if (len & 1)
+		sum += p[len - 1] << 8;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static void compute_guards(const struct pi_domain *d, const uint8_t *data,
+			   size_t stride, unsigned int n, uint64_t *guards)
+{
+	uint16_t g16[PI_BATCH];
+	unsigned int i;
+
+	switch (d->format) {
+	case PI_FMT_T10DIF:
+	case PI_FMT_NVME_16:
+		if (d->format == PI_FMT_T10DIF && d->bg_type == PI_T10DIF_CSUM) {
+			for (i = 0; i < n; i++)
+				guards[i] = ip_csum(d->seed, data + i * stride, d->block_size);
+		} else if (!(uint16_t)d->seed) {
+			crc_t10dif_blocks(data, d->block_size, stride, n, g16);
+			for (i = 0; i < n; i++)
+				guards[i] = g16[i];
+		} else {
+			for (i = 0; i < n; i++)
+				guards[i] = crc_t10dif_update(d->seed, data + i * stride,
+							      d->block_size);
+		}
+		break;
+	case PI_FMT_NVME_32:
+		for (i = 0; i < n; i++)
+			guards[i] = (uint32_t)~crc32c_update(d->seed, data + i * stride,
+							     d->block_size);
+		break;
+	case PI_FMT_NVME_64:
+		for (i = 0; i < n; i++)
+			guards[i] = ~crc64_nvme_update(d->seed, data + i * stride,
+						       d->block_size);
+		break;
+	}
+}
+
+static void put_be(uint8_t *p, unsigned __int128 v, unsigned int bytes)
+{
+	while (bytes--) {
+		p[bytes] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+static unsigned __int128 get_be(const uint8_t *p, unsigned int bytes)
+{
+	unsigned __int128 v = 0;
+
+	while (bytes--)
+		v = (v << 8) | *p++;
+	return v;
+}
+
+static void pack_tuple(const struct pi_domain *d, const struct pi_tuple *t, uint8_t *pi)
+{
+	unsigned int gb = guard_bytes(d->format), ref_bits;
+	unsigned __int128 sr;
+
+	ref_bits = sr_bits(d->format) - sts_bits(d);
+	sr = ((unsigned __int128)t->storage << ref_bits) | t->ref;
+
+	put_be(pi, t->guard, gb);
+	put_be(pi + gb, t->app, 2);
+	put_be(pi + gb + 2, sr, sr_bits(d->format) / 8);
+}
+
+static void unpack_tuple(const struct pi_domain *d, const uint8_t *pi, struct pi_tuple *t)
+{
+	unsigned int gb = guard_bytes(d->format), ref_bits;
+	unsigned __int128 sr;
+
+	ref_bits = sr_bits(d->format) - sts_bits(d);
+	sr = get_be(pi + gb + 2, sr_bits(d->format) / 8);
+
+	t->guard = get_be(pi, gb);
+	t->app = get_be(pi + gb, 2);
+	t->ref = sr & mask_bits(ref_bits);
+	t->storage = (sr >> ref_bits) & mask_bits(sts_bits(d));
+}
+
+static uint64_t block_ref_tag(const struct pi_domain *d, unsigned int block)
+{
+	uint64_t ref = d->ref_tag;
+
+	if (d->flags & PI_FLAG_REF_REMAP)
+		ref += block;
+	return ref & mask_bits(sr_bits(d->format) - sts_bits(d));
+}
+
+void pi_generate(const struct pi_domain *d, const void *data, size_t data_stride,
+		 void *pi, size_t pi_stride, unsigned int nblocks)
+{
+	const uint8_t *dp = data;
+	uint64_t guards[PI_BATCH];
+	uint8_t *pp = pi;
+	struct pi_tuple t;
+	unsigned int i, n;
+
+	t.app = d->app_tag;
+	t.storage = d->storage_tag & mask_bits(sts_bits(d));
+
+	for (i = 0; i < nblocks; i += n) {
+		unsigned int k;
+
+		n = nblocks - i < PI_BATCH ? nblocks - i : PI_BATCH;
+		compute_guards(d, dp + i * data_stride, data_stride, n, guards);
+		for (k = 0; k < n; k++) {
+			t.guard = guards[k];
+			t.ref = block_ref_tag(d, i + k);
+			pack_tuple(d, &t, pp + (i + k) * pi_stride);
+		}
+	}
+}
+
+static int is_escaped(const struct pi_domain *d, const struct pi_tuple *t)
+{
+	uint64_t ref_ones = mask_bits(sr_bits(d->format) - sts_bits(d));
+	uint64_t st_ones = mask_bits(sts_bits(d));
+
+	if (t->app != 0xffff)
+		return 0;
+	if (d->flags & PI_FLAG_APP_ESCAPE)
+		return 1;
+	if ((d->flags & PI_FLAG_APP_REF_ESCAPE) && t->ref == ref_ones)
+		return 1;
+	if ((d->flags & PI_FLAG_APP_REF_STORAGE_ESCAPE) && t->ref == ref_ones &&
+	    t->storage == st_ones)
+		return 1;
+	return 0;
+}
+
+static uint32_t check_tuple(const struct pi_domain *d, const struct pi_tuple *t,
+			    uint64_t guard, unsigned int block,
+			    uint64_t *expected, uint64_t *actual)
+{
+	uint64_t v;
+
+	if ((d->check & PI_CHECK_GUARD) && t->guard != guard) {
+		*expected = guard;
+		*actual = t->guard;
+		return PI_CHECK_GUARD;
+	}
+	if ((d->check & PI_CHECK_APP) && ((t->app ^ d->app_tag) & d->app_tag_mask)) {
+		*expected = d->app_tag;
+		*actual = t->app;
+		return PI_CHECK_APP;
+	}
+	v = block_ref_tag(d, block);
+	if ((d->check & PI_CHECK_REF) && t->ref != v) {
+		*expected = v;
+		*actual = t->ref;
+		return PI_CHECK_REF;
+	}
+	v = d->storage_tag & mask_bits(sts_bits(d));
+	if ((d->check & PI_CHECK_STORAGE) && ((t->storage ^ v) & d->storage_tag_mask)) {
+		*expected = v;
+		*actual = t->storage;
+		return PI_CHECK_STORAGE;
+	}
+	return 0;
+}
+
+unsigned int pi_verify(const struct pi_domain *d, const void *data, size_t data_stride,
+		       const void *pi, size_t pi_stride, unsigned int nblocks,
+		       struct pi_error *err)
+{
+	const uint8_t *dp = data, *pp = pi;
+	uint64_t guards[PI_BATCH] = {};
+	unsigned int i, n, bad = 0;
+
+	for (i = 0; i < nblocks; i += n) {
+		unsigned int k;
+
+		n = nblocks - i < PI_BATCH ? nblocks - i : PI_BATCH;
+		if (d->check & PI_CHECK_GUARD)
+			compute_guards(d, dp + i * data_stride, data_stride, n, guards);
+		for (k = 0; k < n; k++) {
+			uint64_t expected, actual;
+			struct pi_tuple t;
+			uint32_t type;
+
+			unpack_tuple(d, pp + (i + k) * pi_stride, &t);
+			if (is_escaped(d, &t))
+				continue;
+
+			type = check_tuple(d, &t, guards[k], i + k, &expected, &actual);
+			if (!type)
+				continue;
+
+			if (!bad++ && err) {
+				err->block = i + k;
+				err->type = type;
+				err->expected = expected;
+				err->actual = actual;
+				err->offset = (uint64_t)(i + k) * d->block_size;
+			}
+		}
+	}
+
+	return bad;
+}
+
+const char *pi_check_str(uint32_t type)
+{
+	switch (type) {
+	case PI_CHECK_GUARD:
+		return "GUARD";
+	case PI_CHECK_APP:
+		return "APP_TAG";
+	case PI_CHECK_REF:
+		return "REF_TAG";
+	case PI_CHECK_STORAGE:
+		return "STORAGE_TAG";
+	default:
+		return "NONE";
+	}
+}
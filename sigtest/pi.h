@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause) */
+/*
+ * Software protection information (PI) generate/verify, the CPU reference
+ * of the mlx5 T10DIF and NVMe DIF signature offload. Same fields, tag
+ * escapes and ref tag remapping as mlx5dv_sig_t10dif/mlx5dv_sig_nvmedif,
+ * but no dependency on mlx5dv, so that it runs without hardware.
+ *
+ * PI layouts (big-endian):
+ *   T10DIF, NVMe 16b guard: guard(2) app(2) storage+ref(4)
+ *   NVMe 32b guard:         guard(4) app(2) storage+ref(10)
+ *   NVMe 64b guard:         guard(8) app(2) storage+ref(6)
+ * The storage tag takes the upper "sts" bits of storage+ref.
+ */
+#ifndef __PI_H__
+#define __PI_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum pi_format {
+	PI_FMT_T10DIF,
+	PI_FMT_NVME_16,		/* CRC16-T10DIF guard */
+	PI_FMT_NVME_32,		/* CRC32C guard */
+	PI_FMT_NVME_64,		/* CRC64-NVMe guard */
+};
+
+enum pi_t10dif_guard {
+	PI_T10DIF_CRC,
+	PI_T10DIF_CSUM,		/* IP checksum */
+};
+
+enum {
+	PI_FLAG_REF_REMAP = 1 << 0,	/* Ref tag increments per block */
+	PI_FLAG_APP_ESCAPE = 1 << 1,	/* Skip checks if app tag is all 1s */
+	PI_FLAG_APP_REF_ESCAPE = 1 << 2,	/* ... app and ref tags are all 1s */
+	PI_FLAG_APP_REF_STORAGE_ESCAPE = 1 << 3,	/* ... app, ref and storage tags */
+};
+
+enum {
+	PI_CHECK_GUARD = 1 << 0,
+	PI_CHECK_APP = 1 << 1,
+	PI_CHECK_REF = 1 << 2,
+	PI_CHECK_STORAGE = 1 << 3,
+};
+
+struct pi_domain {
+	enum pi_format format;
+	enum pi_t10dif_guard bg_type;	/* T10DIF only */
+	uint32_t flags;			/* PI_FLAG_* */
+	uint32_t check;			/* PI_CHECK_*, for verify */
+	unsigned int block_size;
+	uint64_t seed;			/* Initial guard CRC register (or csum) */
+	uint16_t app_tag;
+	uint16_t app_tag_mask;		/* App tag bits to check */
+	uint64_t ref_tag;		/* Of the first block */
+	uint64_t storage_tag;
+	uint64_t storage_tag_mask;	/* Storage tag bits to check */
+	unsigned int sts;		/* Storage tag size in bits, NVMe only */
+};
+
+struct pi_error {
+	unsigned int block;
+	uint32_t type;			/* PI_CHECK_GUARD/APP/REF/STORAGE */
+	uint64_t expected;
+	uint64_t actual;
+	uint64_t offset;		/* Data offset of the block */
+};
+
+unsigned int pi_size(const struct pi_domain *d);
+
+/* Returns 0, or EINVAL if the tag sizes of @d are invalid for its format */
+int pi_check_domain(const struct pi_domain *d);
+
+/*
+ * Block i is at data + i * data_stride and its PI at pi + i * pi_stride;
+ * For PI interleaved with the data use pi = data + block_size and
+ * data_stride = pi_stride = block_size + pi_size().
+ */
+void pi_generate(const struct pi_domain *d, const void *data, size_t data_stride,
+		 void *pi, size_t pi_stride, unsigned int nblocks);
+
+/* Returns the number of bad blocks, the first one is reported in @err */
+unsigned int pi_verify(const struct pi_domain *d, const void *data, size_t data_stride,
+		       const void *pi, size_t pi_stride, unsigned int nblocks,
+		       struct pi_error *err);
+
+const char *pi_check_str(uint32_t type);
+
+#endif
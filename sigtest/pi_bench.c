@@ -0,0 +1,298 @@
+/* SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause) */
+/*
+ * Self-test and throughput of the software PI engine (pi.c) for T10DIF and
+ * the NVMe 16b/32b/64b guard formats. No device is needed.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc_t10dif.h"
+#include "pi.h"
+#include "pi_crc.h"
+
+#define err(args...) fprintf(stderr, ##args)
+#define info(args...) fprintf(stdout, ##args)
+
+struct pi_test_fmt {
+	const char *name;
+	struct pi_domain d;
+};
+
+#define PI_CHECK_ALL (PI_CHECK_GUARD | PI_CHECK_APP | PI_CHECK_REF | PI_CHECK_STORAGE)
+
+/* Tags as set_sig_domain_t10dif()/set_sig_domain_nvmedif() in sig_test.c */
+static struct pi_test_fmt fmts[] = {
+	{ "t10dif-crc", { .format = PI_FMT_T10DIF, .bg_type = PI_T10DIF_CRC,
+			  .flags = PI_FLAG_REF_REMAP | PI_FLAG_APP_ESCAPE,
+			  .app_tag = 0x5678, .ref_tag = 0xabcdef90 } },
+	{ "t10dif-csum", { .format = PI_FMT_T10DIF, .bg_type = PI_T10DIF_CSUM,
+			   .flags = PI_FLAG_REF_REMAP | PI_FLAG_APP_ESCAPE,
+			   .app_tag = 0x5678, .ref_tag = 0xabcdef90 } },
+	{ "nvme-16b", { .format = PI_FMT_NVME_16, .sts = 20,
+			.flags = PI_FLAG_REF_REMAP | PI_FLAG_APP_REF_ESCAPE,
+			.app_tag = 0xabcd, .ref_tag = 0x55667788beef9900,
+			.storage_tag = 0x11223344dead5566 } },
+	{ "nvme-32b", { .format = PI_FMT_NVME_32, .sts = 24, .seed = ~0ull,
+			.flags = PI_FLAG_REF_REMAP | PI_FLAG_APP_REF_ESCAPE,
+			.app_tag = 0xabcd, .ref_tag = 0x55667788beef9900,
+			.storage_tag = 0x11223344dead5566 } },
+	{ "nvme-64b", { .format = PI_FMT_NVME_64, .sts = 20, .seed = ~0ull,
+			.flags = PI_FLAG_REF_REMAP | PI_FLAG_APP_REF_ESCAPE,
+			.app_tag = 0xabcd, .ref_tag = 0x55667788beef9900,
+			.storage_tag = 0x11223344dead5566 } },
+};
+
+#define NUM_FMTS (sizeof(fmts) / sizeof(fmts[0]))
+
+static size_t data_size = 4 << 20;
+static unsigned int duration_ms = 500;
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void init_domain(struct pi_domain *d, unsigned int block_size)
+{
+	d->block_size = block_size;
+	d->check = PI_CHECK_ALL;
+	d->app_tag_mask = 0xffff;
+	d->storage_tag_mask = ~0ull;
+}
+
+static int expect_error(const struct pi_test_fmt *f, const struct pi_domain *d,
+			const unsigned char *buf, unsigned int nblocks,
+			unsigned int block, uint32_t type)
+{
+	size_t stride = d->block_size + pi_size(d);
+	struct pi_error e = {};
+	unsigned int bad;
+
+	bad = pi_verify(d, buf, stride, buf + d->block_size, stride, nblocks, &e);
+	if (bad != (type ? 1 : 0) || (type && (e.block != block || e.type != type))) {
+		err("%s: expected %s at block %u, got %u bad, first %s at block %u\n",
+		    f->name, pi_check_str(type), block, bad, pi_check_str(e.type), e.block);
+		return EINVAL;
+	}
+	return 0;
+}
+
+/* Corrupt each PI field in turn and check that exactly that error is found */
+static int self_test_fmt(const struct pi_test_fmt *f, unsigned char *buf)
+{
+	const unsigned int nblocks = 70, block_size = 512;
+	enum crc_t10dif_impl impl = crc_t10dif_get_impl();
+	struct pi_domain d = f->d, esc;
+	unsigned int psz, gb;
+	unsigned char *pi;
+	size_t stride;
+	int ret;
+
+	init_domain(&d, block_size);
+	psz = pi_size(&d);
+	stride = block_size + psz;
+	gb = psz == 8 ? 2 : (d.format == PI_FMT_NVME_32 ? 4 : 8);
+
+	/* Generate with the table CRCs, verify with the fastest ones */
+	crc_t10dif_set_impl(CRC_T10DIF_TABLE);
+	pi_crc_disable_clmul(1);
+	pi_generate(&d, buf, stride, buf + block_size, stride, nblocks);
+	crc_t10dif_set_impl(impl);
+	pi_crc_disable_clmul(0);
+	ret = expect_error(f, &d, buf, nblocks, 0, 0);
+	if (ret)
+		return ret;
+
+	buf[3 * stride + 100] ^= 0x10;
+	ret = expect_error(f, &d, buf, nblocks, 3, PI_CHECK_GUARD);
+	buf[3 * stride + 100] ^= 0x10;
+	if (ret)
+		return ret;
+
+	pi = buf + 65 * stride + block_size;
+	pi[gb + 1] ^= 0x01;
+	ret = expect_error(f, &d, buf, nblocks, 65, PI_CHECK_APP);
+	pi[gb + 1] ^= 0x01;
+	if (ret)
+		return ret;
+
+	pi[psz - 1] ^= 0x01;	/* LSB of the ref tag */
+	ret = expect_error(f, &d, buf, nblocks, 65, PI_CHECK_REF);
+	pi[psz - 1] ^= 0x01;
+	if (ret)
+		return ret;
+
+	if (d.format != PI_FMT_T10DIF) {
+		pi[gb + 2] ^= 0x80;	/* MSB of the storage tag */
+		ret = expect_error(f, &d, buf, nblocks, 65, PI_CHECK_STORAGE);
+		pi[gb + 2] ^= 0x80;
+		if (ret)
+			return ret;
+	}
+
+	/* Escaped blocks are not checked at all, even with a bad guard */
+	esc = d;
+	esc.app_tag = 0xffff;
+	esc.ref_tag = ~0ull;
+	esc.flags &= ~PI_FLAG_REF_REMAP;
+	pi_generate(&esc, buf + 65 * stride, stride, pi, stride, 1);
+	pi[0] ^= 0xff;
+	ret = expect_error(f, &d, buf, nblocks, 0, 0);
+	pi_generate(&d, buf, stride, buf + block_size, stride, nblocks);
+	return ret;
+}
+
+static int self_test(unsigned char *buf)
+{
+	unsigned int i;
+	int ret;
+
+	if (~crc32c_update(~0u, "123456789", 9) != 0xe3069283 ||
+	    ~crc64_nvme_update(~0ull, "123456789", 9) != 0xae8b14860a799888ull) {
+		err("CRC32C/CRC64-NVMe check values mismatch\n");
+		return EINVAL;
+	}
+
+	for (i = 0; i < NUM_FMTS; i++) {
+		ret = self_test_fmt(&fmts[i], buf);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static double bench(const struct pi_domain *d, unsigned char *buf, int interleaved, int verify)
+{
+	unsigned int psz = pi_size(d), nblocks = data_size / d->block_size;
+	size_t dstride, pstride;
+	uint64_t start, now, end, bytes = 0;
+	unsigned char *pi;
+
+	if (interleaved) {
+		dstride = pstride = d->block_size + psz;
+		pi = buf + d->block_size;
+	} else {
+		dstride = d->block_size;
+		pstride = psz;
+		pi = buf + (size_t)nblocks * d->block_size;
+	}
+
+	pi_generate(d, buf, dstride, pi, pstride, nblocks);
+	start = get_time_ns();
+	end = start + duration_ms * 1000000ull;
+	do {
+		if (verify) {
+			if (pi_verify(d, buf, dstride, pi, pstride, nblocks, NULL)) {
+				err("Unexpected PI error\n");
+				return 0;
+			}
+		} else {
+			pi_generate(d, buf, dstride, pi, pstride, nblocks);
+		}
+		bytes += (uint64_t)nblocks * d->block_size;
+		now = get_time_ns();
+	} while (now < end);
+
+	return (double)bytes / (now - start);
+}
+
+static void show_usage(char *program)
+{
+	printf("Usage: %s [OPTIONS]\n", program);
+	printf("  -s, --size <bytes>  Data size per pass (default %zu)\n", data_size);
+	printf("  -t, --time <ms>     Duration of each measurement (default %u)\n", duration_ms);
+	printf("  -T, --test-only     Only run the self-test\n");
+	printf("  -h, --help          Show this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int block_sizes[] = { 512, 4096 };
+	int test_only = 0, ret;
+	unsigned char *buf;
+	unsigned int i, k;
+	size_t len, n;
+
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{ .name = "size",      .has_arg = 1, .val = 's' },
+			{ .name = "time",      .has_arg = 1, .val = 't' },
+			{ .name = "test-only", .has_arg = 0, .val = 'T' },
+			{ .name = "help",      .has_arg = 0, .val = 'h' },
+			{}
+		};
+
+		c = getopt_long(argc, argv, "s:t:Th", long_options, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 's':
+			data_size = strtoul(optarg, NULL, 0);
+			if (data_size < 4096) {
+				err("Data size must be at least 4096\n");
+				return EINVAL;
+			}
+			break;
+		case 't':
+			duration_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			test_only = 1;
+			break;
+		case 'h':
+			show_usage(argv[0]);
+			return 0;
+		default:
+			show_usage(argv[0]);
+			return EINVAL;
+		}
+	}
+
+	/* Data plus up to 16 bytes of PI per 512-byte block */
+	len = data_size + data_size / 32 + 65536;
+	buf = malloc(len);
+	if (!buf) {
+		err("Failed to allocate %zu bytes\n", len);
+		return ENOMEM;
+	}
+	srand(1);
+	for (n = 0; n < len; n++)
+		buf[n] = rand();
+
+	ret = self_test(buf);
+	if (ret)
+		goto out;
+	info("Self-test passed (crc16 %s, crc32c/crc64 %s)\n",
+	     crc_t10dif_impl_name(crc_t10dif_get_impl()),
+	     pi_crc_has_clmul() ? "pclmulqdq" : "slice-by-8");
+	if (test_only)
+		goto out;
+
+	info("%-12s %6s %12s %12s %12s %12s\n", "format", "block",
+	     "gen GB/s", "verify GB/s", "gen(sep)", "verify(sep)");
+	for (i = 0; i < NUM_FMTS; i++) {
+		for (k = 0; k < sizeof(block_sizes) / sizeof(block_sizes[0]); k++) {
+			struct pi_domain d = fmts[i].d;
+
+			init_domain(&d, block_sizes[k]);
+			info("%-12s %6u %12.2f %12.2f %12.2f %12.2f\n", fmts[i].name,
+			     block_sizes[k], bench(&d, buf, 1, 0), bench(&d, buf, 1, 1),
+			     bench(&d, buf, 0, 0), bench(&d, buf, 0, 1));
+		}
+	}
+
+out:
+	free(buf);
+	return ret;
+}
@@ -0,0 +1,209 @@
+/* SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause) */
+/*
+ * Reflected CRC folding, the bit-reflected counterpart of crc_t10dif.c.
+ *
+ * A 16-byte chunk loaded little-endian is the polynomial X = Lo * x^64 + Hi,
+ * bit 0 of Lo being the highest degree. Folding by D bits uses
+ *   X * x^D == Lo * (x^(D+64) mod P) + Hi * (x^D mod P)
+ * A carry-less multiply of two reflected values yields the product times x,
+ * so the constants are x^(D+63) and x^(D-1) mod P, reflected.
+ * The last 128-bit value is fed to the table code as 16 message bytes, which
+ * gives the same register as the prefix it is congruent to.
+ */
+#include <endian.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "pi_crc.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC_HAVE_CLMUL
+#endif
+
+struct crc_refl {
+	unsigned int width;
+	uint64_t poly;		/* Reflected, without the x^width term */
+	uint64_t table[8][256];
+	uint64_t fold_16b[2];	/* x^(D+63), x^(D-1) mod P for D = 128 */
+	uint64_t fold_32b[2];
+	uint64_t fold_48b[2];
+	uint64_t fold_64b[2];
+};
+
+static struct crc_refl crc32c = { .width = 32, .poly = 0x82f63b78 };
+static struct crc_refl crc64_nvme = { .width = 64, .poly = 0x9a6c9329ac4bc9b5ull };
+
+static int use_clmul;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint64_t bitrev64(uint64_t v)
+{
+	uint64_t r = 0;
+	int i;
+
+	for (i = 0; i < 64; i++, v >>= 1)
+		r = (r << 1) | (v & 1);
+	return r;
+}
+
+/* x^n mod P, reflected in 64 bits (coefficient of x^j at bit 63 - j) */
+static uint64_t xpow_mod_refl(const struct crc_refl *c, unsigned int n)
+{
+	uint64_t poly = bitrev64(c->poly) >> (64 - c->width);
+	uint64_t top = 1ull << (c->width - 1), r = 1;
+
+	while (n--) {
+		if (r & top)
+			r = ((r << 1) ^ poly) & (top | (top - 1));
+		else
+			r <<= 1;
+	}
+	return bitrev64(r);
+}
+
+static void init_fold(const struct crc_refl *c, uint64_t *k, unsigned int d)
+{
+	k[0] = xpow_mod_refl(c, d + 63);
+	k[1] = xpow_mod_refl(c, d - 1);
+}
+
+static void init_crc(struct crc_refl *c)
+{
+	unsigned int i, k;
+
+	for (i = 0; i < 256; i++) {
+		uint64_t r = i;
+
+		for (k = 0; k < 8; k++)
+			r = (r & 1) ? (r >> 1) ^ c->poly : r >> 1;
+		c->table[0][i] = r;
+	}
+	for (i = 0; i < 256; i++)
+		for (k = 1; k < 8; k++)
+			c->table[k][i] = (c->table[k - 1][i] >> 8) ^
+				c->table[0][c->table[k - 1][i] & 0xff];
+
+	init_fold(c, c->fold_16b, 128);
+	init_fold(c, c->fold_32b, 256);
+	init_fold(c, c->fold_48b, 384);
+	init_fold(c, c->fold_64b, 512);
+}
+
+static void init_consts(void)
+{
+	init_crc(&crc32c);
+	init_crc(&crc64_nvme);
+
+#ifdef CRC_HAVE_CLMUL
+	__builtin_cpu_init();
+	use_clmul = __builtin_cpu_supports("pclmul");
+#endif
+}
+
+static uint64_t crc_slice8(const struct crc_refl *c, uint64_t reg,
+			   const uint8_t *p, size_t len)
+{
+	uint64_t v;
+
+	while (len >= 8) {
+		memcpy(&v, p, 8);
+		v = le64toh(v) ^ reg;
+		reg = c->table[7][v & 0xff] ^ c->table[6][(v >> 8) & 0xff] ^
+			c->table[5][(v >> 16) & 0xff] ^ c->table[4][(v >> 24) & 0xff] ^
+			c->table[3][(v >> 32) & 0xff] ^ c->table[2][(v >> 40) & 0xff] ^
+			c->table[1][(v >> 48) & 0xff] ^ c->table[0][v >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		reg = c->table[0][(reg ^ *p++) & 0xff] ^ (reg >> 8);
+	return reg;
+}
+
+#ifdef CRC_HAVE_CLMUL
+
+#define CRC_TARGET __attribute__((target("pclmul,sse2")))
+
+static CRC_TARGET inline __m128i fold128(__m128i x, const uint64_t *k)
+{
+	__m128i kk = _mm_loadu_si128((const __m128i *)k);
+
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, kk, 0x00),
+			     _mm_clmulepi64_si128(x, kk, 0x11));
+}
+
+static CRC_TARGET inline __m128i load128(const uint8_t *p)
+{
+	return _mm_loadu_si128((const __m128i *)p);
+}
+
+static CRC_TARGET uint64_t crc_clmul(const struct crc_refl *c, uint64_t reg,
+				     const uint8_t *p, size_t len)
+{
+	__m128i x0, x1, x2, x3;
+	uint8_t tail[16];
+	size_t done;
+
+	if (len < 64)
+		return crc_slice8(c, reg, p, len);
+
+	x0 = _mm_xor_si128(load128(p), _mm_cvtsi64_si128(reg));
+	x1 = load128(p + 16);
+	x2 = load128(p + 32);
+	x3 = load128(p + 48);
+
+	for (done = 64; len - done >= 64; done += 64) {
+		x0 = _mm_xor_si128(fold128(x0, c->fold_64b), load128(p + done));
+		x1 = _mm_xor_si128(fold128(x1, c->fold_64b), load128(p + done + 16));
+		x2 = _mm_xor_si128(fold128(x2, c->fold_64b), load128(p + done + 32));
+		x3 = _mm_xor_si128(fold128(x3, c->fold_64b), load128(p + done + 48));
+	}
+
+	x0 = _mm_xor_si128(fold128(x0, c->fold_48b), fold128(x1, c->fold_32b));
+	x0 = _mm_xor_si128(x0, fold128(x2, c->fold_16b));
+	x0 = _mm_xor_si128(x0, x3);
+	for (; len - done >= 16; done += 16)
+		x0 = _mm_xor_si128(fold128(x0, c->fold_16b), load128(p + done));
+
+	_mm_storeu_si128((__m128i *)tail, x0);
+	reg = crc_slice8(c, 0, tail, sizeof(tail));
+	return crc_slice8(c, reg, p + done, len - done);
+}
+
+#endif /* CRC_HAVE_CLMUL */
+
+static uint64_t crc_update(const struct crc_refl *c, uint64_t reg,
+			   const void *buf, size_t len)
+{
+	pthread_once(&crc_once, init_consts);
+#ifdef CRC_HAVE_CLMUL
+	if (use_clmul)
+		return crc_clmul(c, reg, buf, len);
+#endif
+	return crc_slice8(c, reg, buf, len);
+}
+
+uint32_t crc32c_update(uint32_t reg, const void *buf, size_t len)
+{
+	return crc_update(&crc32c, reg, buf, len);
+}
+
+uint64_t crc64_nvme_update(uint64_t reg, const void *buf, size_t len)
+{
+	return crc_update(&crc64_nvme, reg, buf, len);
+}
+
+void pi_crc_disable_clmul(int disable)
+{
+	pthread_once(&crc_once, init_consts);
+#ifdef CRC_HAVE_CLMUL
+	use_clmul = !disable && __builtin_cpu_supports("pclmul");
+#endif
+}
+
+int pi_crc_has_clmul(void)
+{
+	pthread_once(&crc_once, init_consts);
+	return use_clmul;
+}
@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause) */
+/*
+ * Reflected CRCs used by the NVMe PI guards: CRC32C (32b guard) and
+ * CRC64-NVMe (64b guard). PCLMULQDQ folding when the CPU has it, otherwise
+ * slice-by-8 tables.
+ *
+ * These work on the raw CRC register, without the initial/final inversion,
+ * e.g. the standard CRC32C of a buffer is ~crc32c_update(~0, buf, len).
+ */
+#ifndef __PI_CRC_H__
+#define __PI_CRC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c_update(uint32_t reg, const void *buf, size_t len);
+uint64_t crc64_nvme_update(uint64_t reg, const void *buf, size_t len);
+
+/* Don't use PCLMULQDQ even if the CPU supports it, for comparison */
+void pi_crc_disable_clmul(int disable);
+int pi_crc_has_clmul(void);
+
+#endif
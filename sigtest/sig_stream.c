@@ -0,0 +1,1673 @@
+/* SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause) */
+/*
+ * Streaming benchmark: The client keeps a window of SENDs of block_num blocks
+ * outstanding and the server keeps twice as many receives posted, both
+ * busy-poll completions in batches. Each phase moves "iters" messages, first
+ * without PI, then through signature mkeys with the wire domain only, i.e.
+ * the client inserts PI and the server verifies and strips it.
+ * Every message slot has its own mkey, configured once before the phase.
+ *
+ * With a pool (-P) the client then reconfigures an mkey of the pool for
+ * every message, posting the configure unsignaled in the same ibv_wr_start
+ * batch as the fenced SEND that uses it. The configure rate alone and the
+ * message rate are reported as the pool size and queue depth grow.
+ *
+ * With -o write/read the server only exposes a buffer of "window" slots,
+ * advertised in the rdma_cm private data (sig_stream_expose()), and the
+ * client moves the data with RDMA WRITE/READ through its local sig mkeys,
+ * with the wire domain, the memory domain or both (-D). Block sizes 512 and
+ * 4096 and block counts 1, 2, 4 ... block_num are swept. A READ phase first
+ * WRITEs every remote slot, so that there is valid PI to read back.
+ *
+ * With -E the client's message data is also split in 1, 2, 4 ... fragments
+ * and sent either through an mkey with that many list entries, through an
+ * interleaved layout of the fragments plus a separate PI buffer, or after
+ * a copy to one contiguous bounce buffer.
+ *
+ * With -r the client sends PI generated by pi.c as plain data, so that its
+ * guard, app, ref or storage tag can be corrupted at a given rate, and the
+ * server checks the mkey of every received message, reconfiguring the
+ * ones that failed before reusing them.
+ *
+ * With the software signature backend (-C, or a device without signature
+ * offload) the PI phase of SEND streaming has no mkeys: The client copies
+ * each message to a slot of data and PI generated by pi.c, and the server
+ * verifies and strips it, so the CPU cost of the same workload shows.
+ */
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <infiniband/mlx5dv.h>
+
+#include "pi.h"
+#include "sig_test.h"
+
+#define STREAM_POLL_BATCH 16
+#define STREAM_POST_BATCH 32
+#define STREAM_CONF_BATCH 16
+
+enum {
+	STREAM_PI_OFF,
+	STREAM_PI_ON,
+	STREAM_PI_RAW,		/* PI generated in software, sent as data */
+};
+
+#define STREAM_WRID_CONF (1ULL << 63)
+
+enum {
+	LAYOUT_LIST,		/* Data fragments, wire domain */
+	LAYOUT_INTERLEAVED,	/* Data fragments and separate PI, both domains */
+};
+
+/*
+ * Fragmented slot buffers: the data of each slot is in "entries" fragments,
+ * in reverse order and with gaps so that none are adjacent, then its PI.
+ * A list fragment is a piece of the message; An interleaved fragment holds
+ * its 1/entries share of every block.
+ */
+struct stream_layout {
+	int type;
+	unsigned int entries;	/* Data fragments */
+	size_t frag_len;	/* Of all but the last list fragment */
+	size_t frag_stride;
+	size_t slot_len;
+	size_t pi_len;
+	unsigned char *buf;
+	struct ibv_mr *mr;
+	struct ibv_sge *sge;
+	struct mlx5dv_mr_interleaved *il;
+};
+
+/* Slots of data and PI as sent with STREAM_PI_RAW, with the injected errors */
+struct stream_inject {
+	uint32_t fields[4];	/* PI_CHECK_* that can be corrupted */
+	unsigned int nfields;
+	unsigned int rate;	/* One message in rate is corrupted, 0 - none */
+	unsigned int seed;
+	unsigned long injected;
+
+	size_t slot_len;
+	unsigned char *buf;
+	struct ibv_mr *mr;
+	long *off;		/* Corrupted byte per slot, -1 if none */
+	unsigned char *mask;
+};
+
+struct stream_ctx {
+	struct ibv_pd *pd;
+	struct ibv_qp *qp;
+	struct ibv_cq *cq;
+	struct sig_stream_conn *conn;
+	const struct sig_stream_opts *opts;
+	struct sig_param *param;	/* Of the current point of a sweep */
+	unsigned long iters;		/* Messages of the current phase */
+
+	enum ibv_wr_opcode opcode;
+	int mode;		/* SIG_FLAG_WIRE/SIG_FLAG_MEM */
+	unsigned int nslots;
+	size_t slot_len;	/* Buffer stride of the slots */
+	size_t data_len;	/* Per message, without PI */
+	size_t mem_len;		/* In memory, with PI if mode has SIG_FLAG_MEM */
+	size_t wire_len;	/* On the wire, with PI if mode has SIG_FLAG_WIRE */
+	unsigned char *buf;
+	struct ibv_mr *mr;
+	struct mlx5dv_mkey **mkeys;
+	struct stream_layout *layout;	/* Used by the mkey configures if set */
+	struct stream_layout *gather;	/* Copied to the slot before sending if set */
+	struct stream_inject *inject;	/* Buffers of STREAM_PI_RAW */
+	struct pi_domain sw_dom;	/* Of the software signature backend */
+	unsigned long sw_bad;		/* Blocks that failed its checks */
+
+	/* Remote buffer for WRITE/READ, host order */
+	uint64_t raddr;
+	uint32_t rkey;
+	uint32_t rslot_len;
+	uint32_t rnslots;
+};
+
+struct stream_stats {
+	uint64_t start_ns, end_ns;
+	struct rusage ru_start, ru_end;
+	unsigned long msgs;
+	uint64_t bytes;
+};
+
+static uint64_t tv_ns(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000000ull + tv->tv_usec * 1000ull;
+}
+
+static void stats_start(struct stream_stats *st)
+{
+	memset(st, 0, sizeof(*st));
+	getrusage(RUSAGE_THREAD, &st->ru_start);
+	st->start_ns = get_time_ns();
+}
+
+static void stats_end(struct stream_stats *st)
+{
+	st->end_ns = get_time_ns();
+	getrusage(RUSAGE_THREAD, &st->ru_end);
+}
+
+/* CPU is that of the calling thread, there is one thread per QP */
+static void stats_print(struct stream_ctx *ctx, const char *name,
+			const struct stream_stats *st)
+{
+	char qp[16] = "";
+	uint64_t wall = st->end_ns - st->start_ns;
+	uint64_t usr, sys;
+
+	if (!wall)
+		wall = 1;
+	usr = tv_ns(&st->ru_end.ru_utime) - tv_ns(&st->ru_start.ru_utime);
+	sys = tv_ns(&st->ru_end.ru_stime) - tv_ns(&st->ru_start.ru_stime);
+
+	if (ctx->conn->num_qps > 1)
+		snprintf(qp, sizeof(qp), "[qp %u] ", ctx->conn->qp_idx);
+	info("%s%-16s: %lu msgs in %.3f s, %.3f GB/s, %.3f Mmsgs/s, CPU %.1f%% (usr %.1f%%, sys %.1f%%)\n",
+	     qp, name, st->msgs, wall / 1e9, (double)st->bytes / wall,
+	     st->msgs * 1000.0 / wall, (usr + sys) * 100.0 / wall,
+	     usr * 100.0 / wall, sys * 100.0 / wall);
+}
+
+static void stats_record(struct stream_ctx *ctx, int pi, const struct stream_stats *st)
+{
+	struct sig_stream_result *res = &ctx->conn->result[pi];
+
+	res->msgs = st->msgs;
+	res->bytes = st->bytes;
+	res->start_ns = st->start_ns;
+	res->end_ns = st->end_ns;
+}
+
+/* Per-message lengths for the block size and count of @param */
+static void stream_set_len(struct stream_ctx *ctx, struct sig_param *param)
+{
+	size_t pi_len = (size_t)param->pi_size * param->block_num;
+
+	ctx->param = param;
+	ctx->data_len = (size_t)param->block_size * param->block_num;
+	ctx->mem_len = ctx->data_len + ((ctx->mode & SIG_FLAG_MEM) ? pi_len : 0);
+	ctx->wire_len = ctx->data_len + ((ctx->mode & SIG_FLAG_WIRE) ? pi_len : 0);
+}
+
+/* Largest message of the block size sweep, data and PI */
+static size_t max_msg_len(struct sig_param *param)
+{
+	return (size_t)(4096 + param->pi_size) * param->block_num;
+}
+
+static int stream_init(struct stream_ctx *ctx, struct sig_stream_conn *sc,
+		       unsigned int nslots, int mode, size_t slot_len)
+{
+	int flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+		IBV_ACCESS_REMOTE_WRITE;
+	const struct sig_stream_opts *opts = sc->opts;
+	struct sig_param *param = sc->param;
+	struct ibv_pd *pd = sc->pd;
+	unsigned int i;
+	size_t len;
+	int ret;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->pd = pd;
+	ctx->qp = sc->qp;
+	ctx->cq = sc->cq;
+	ctx->conn = sc;
+	ctx->opts = opts;
+	ctx->iters = opts->iters;
+	ctx->opcode = IBV_WR_SEND;
+	ctx->mode = mode;
+	ctx->nslots = nslots;
+	ctx->slot_len = slot_len;
+	stream_set_len(ctx, param);
+
+	len = slot_len * nslots;
+	ctx->buf = malloc(len);
+	if (!ctx->buf) {
+		perror("malloc");
+		return errno;
+	}
+	for (i = 0; i < len; i++)
+		ctx->buf[i] = i / param->block_size;
+
+	ctx->mr = ibv_reg_mr(pd, ctx->buf, len, flags);
+	if (!ctx->mr) {
+		perror("ibv_reg_mr");
+		ret = errno;
+		goto fail_reg_mr;
+	}
+
+	if (param->sw_sig)
+		return 0;
+
+	ctx->mkeys = calloc(nslots, sizeof(*ctx->mkeys));
+	if (!ctx->mkeys) {
+		ret = ENOMEM;
+		goto fail_alloc_mkeys;
+	}
+
+	for (i = 0; i < nslots; i++) {
+		ctx->mkeys[i] = create_sig_mkey(pd, opts->max_entries ? opts->max_entries : 1);
+		if (!ctx->mkeys[i]) {
+			ret = errno;
+			goto fail_create_mkey;
+		}
+	}
+
+	return 0;
+
+fail_create_mkey:
+	while (i--)
+		mlx5dv_destroy_mkey(ctx->mkeys[i]);
+	free(ctx->mkeys);
+fail_alloc_mkeys:
+	ibv_dereg_mr(ctx->mr);
+fail_reg_mr:
+	free(ctx->buf);
+	return ret;
+}
+
+static void stream_destroy(struct stream_ctx *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; ctx->mkeys && i < ctx->nslots; i++)
+		mlx5dv_destroy_mkey(ctx->mkeys[i]);
+	free(ctx->mkeys);
+	ibv_dereg_mr(ctx->mr);
+	free(ctx->buf);
+}
+
+/* Busy-poll up to @max completions, returns the number or -1 on error */
+static int stream_poll(struct stream_ctx *ctx, struct ibv_wc *wc, int max)
+{
+	int ne, i;
+
+	ne = ibv_poll_cq(ctx->cq, max, wc);
+	if (ne < 0) {
+		err("ibv_poll_cq failed %d\n", ne);
+		return -1;
+	}
+
+	for (i = 0; i < ne; i++) {
+		if (wc[i].status != IBV_WC_SUCCESS) {
+			err("CQE status %d(%s), opcode %d(%s), wr_id 0x%lx\n",
+			    wc[i].status, ibv_wc_status_str(wc[i].status),
+			    wc[i].opcode, wc_opcode_str(wc[i].opcode), wc[i].wr_id);
+			return -1;
+		}
+	}
+
+	return ne;
+}
+
+static int layout_init(struct stream_layout *l, struct stream_ctx *ctx,
+		       unsigned int max_entries)
+{
+	int flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+		IBV_ACCESS_REMOTE_WRITE;
+	size_t len, i;
+
+	memset(l, 0, sizeof(*l));
+	l->pi_len = (size_t)ctx->param->pi_size * ctx->param->block_num;
+	l->slot_len = ctx->data_len + max_entries * 128 + l->pi_len;
+
+	len = l->slot_len * ctx->nslots;
+	l->buf = malloc(len);
+	l->sge = calloc(max_entries + 1, sizeof(*l->sge));
+	l->il = calloc(max_entries + 1, sizeof(*l->il));
+	if (!l->buf || !l->sge || !l->il) {
+		err("Failed to allocate the fragment buffers\n");
+		goto fail;
+	}
+	for (i = 0; i < len; i++)
+		l->buf[i] = i / 64;
+
+	l->mr = ibv_reg_mr(ctx->pd, l->buf, len, flags);
+	if (!l->mr) {
+		perror("ibv_reg_mr");
+		goto fail;
+	}
+	return 0;
+
+fail:
+	free(l->il);
+	free(l->sge);
+	free(l->buf);
+	return -1;
+}
+
+static void layout_destroy(struct stream_layout *l)
+{
+	ibv_dereg_mr(l->mr);
+	free(l->il);
+	free(l->sge);
+	free(l->buf);
+}
+
+static void layout_set(struct stream_layout *l, struct stream_ctx *ctx,
+		       int type, unsigned int entries)
+{
+	l->type = type;
+	l->entries = entries;
+	if (type == LAYOUT_LIST)
+		l->frag_len = (ctx->data_len + entries - 1) / entries;
+	else
+		l->frag_len = ctx->data_len / entries;
+	l->frag_stride = ((l->frag_len + 63) & ~63UL) + 64;
+}
+
+static unsigned char *frag_addr(struct stream_layout *l, unsigned int slot, unsigned int f)
+{
+	return l->buf + slot * l->slot_len + (l->entries - 1 - f) * l->frag_stride;
+}
+
+static unsigned char *frag_pi_addr(struct stream_layout *l, unsigned int slot)
+{
+	return l->buf + (slot + 1) * l->slot_len - l->pi_len;
+}
+
+static size_t list_frag_len(struct stream_layout *l, struct stream_ctx *ctx, unsigned int f)
+{
+	return f < l->entries - 1 ? l->frag_len : ctx->data_len - f * l->frag_len;
+}
+
+/* Whether a layout with @entries data fragments fits the message and the mkeys */
+static bool layout_ok(struct stream_ctx *ctx, int type, unsigned int entries)
+{
+	unsigned int max_entries = ctx->opts->max_entries;
+	struct sig_param *param = ctx->param;
+	size_t data_len = (size_t)param->block_size * param->block_num;
+	size_t frag_len = (data_len + entries - 1) / entries;
+
+	if (type == LAYOUT_LIST)
+		return entries <= max_entries && data_len / entries >= 64 &&
+			frag_len * (entries - 1) < data_len;
+	return entries + 1 <= max_entries && !(param->block_size % entries);
+}
+
+/* The PI of the blocks spread over the interleaved fragments */
+static int layout_gen_pi(struct stream_layout *l, struct stream_ctx *ctx)
+{
+	unsigned int bs = ctx->param->block_size, piece = bs / l->entries;
+	unsigned int slot, b, f;
+	struct pi_domain d;
+	unsigned char *tmp;
+
+	tmp = malloc(ctx->data_len);
+	if (!tmp)
+		return ENOMEM;
+
+	get_pi_domain(ctx->param, &d);
+	for (slot = 0; slot < ctx->nslots; slot++) {
+		for (b = 0; b < ctx->param->block_num; b++)
+			for (f = 0; f < l->entries; f++)
+				memcpy(tmp + b * bs + f * piece,
+				       frag_addr(l, slot, f) + b * piece, piece);
+		pi_generate(&d, tmp, bs, frag_pi_addr(l, slot), ctx->param->pi_size,
+			    ctx->param->block_num);
+	}
+
+	free(tmp);
+	return 0;
+}
+
+static void wr_set_layout(struct stream_layout *l, struct stream_ctx *ctx,
+			  struct mlx5dv_qp_ex *dv_qp, unsigned int slot)
+{
+	unsigned int f;
+
+	if (l->type == LAYOUT_LIST) {
+		for (f = 0; f < l->entries; f++) {
+			l->sge[f].addr = (uint64_t)frag_addr(l, slot, f);
+			l->sge[f].length = list_frag_len(l, ctx, f);
+			l->sge[f].lkey = l->mr->lkey;
+		}
+		mlx5dv_wr_set_mkey_layout_list(dv_qp, l->entries, l->sge);
+		return;
+	}
+
+	for (f = 0; f < l->entries; f++) {
+		l->il[f].addr = (uint64_t)frag_addr(l, slot, f);
+		l->il[f].bytes_count = ctx->param->block_size / l->entries;
+		l->il[f].bytes_skip = 0;
+		l->il[f].lkey = l->mr->lkey;
+	}
+	l->il[f].addr = (uint64_t)frag_pi_addr(l, slot);
+	l->il[f].bytes_count = ctx->param->pi_size;
+	l->il[f].bytes_skip = 0;
+	l->il[f].lkey = l->mr->lkey;
+	mlx5dv_wr_set_mkey_layout_interleaved(dv_qp, ctx->param->block_num,
+					      l->entries + 1, l->il);
+}
+
+/* Copy the list fragments of the slot to its contiguous buffer */
+static void layout_gather(struct stream_layout *l, struct stream_ctx *ctx, unsigned int slot)
+{
+	unsigned char *p = ctx->buf + slot * ctx->slot_len;
+	unsigned int f;
+
+	for (f = 0; f < l->entries; f++) {
+		memcpy(p, frag_addr(l, slot, f), list_frag_len(l, ctx, f));
+		p += l->frag_len;
+	}
+}
+
+/*
+ * Add a configure of the slot mkey, with the domains of ctx->mode, over the
+ * slot buffer or ctx->layout to the current ibv_wr_start batch. wr_id and
+ * wr_flags are the caller's.
+ */
+static void wr_slot_mkey_configure(struct stream_ctx *ctx, struct mlx5dv_qp_ex *dv_qp,
+				   unsigned int slot, struct sig_attr *sa)
+{
+	uint32_t access_flags = IBV_ACCESS_LOCAL_WRITE |
+		IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+	struct mlx5dv_mkey_conf_attr conf_attr = {};
+	struct ibv_sge sge;
+
+	sge.addr = (uint64_t)ctx->buf + slot * ctx->slot_len;
+	sge.length = ctx->mem_len;
+	sge.lkey = ctx->mr->lkey;
+
+	mlx5dv_wr_mkey_configure(dv_qp, ctx->mkeys[slot], 3, &conf_attr);
+	mlx5dv_wr_set_mkey_access_flags(dv_qp, access_flags);
+	if (ctx->layout)
+		wr_set_layout(ctx->layout, ctx, dv_qp, slot);
+	else
+		mlx5dv_wr_set_mkey_layout_list(dv_qp, 1, &sge);
+	mlx5dv_wr_set_mkey_sig_block(dv_qp, &sa->attr);
+}
+
+/*
+ * Configure the mkeys of slots first..first+n-1 (modulo @pool) in one batch,
+ * only the last one signaled. Its wr_id is the number of configures covered.
+ */
+static int post_mkey_configures(struct stream_ctx *ctx, struct sig_attr *sa,
+				unsigned long first, unsigned int n, unsigned int pool)
+{
+	struct ibv_qp_ex *qpx = ibv_qp_to_qp_ex(ctx->qp);
+	struct mlx5dv_qp_ex *dv_qp = mlx5dv_qp_ex_from_ibv_qp_ex(qpx);
+	unsigned int i;
+	int ret;
+
+	ibv_wr_start(qpx);
+	for (i = 0; i < n; i++) {
+		qpx->wr_id = n;
+		qpx->wr_flags = IBV_SEND_INLINE;
+		if (i == n - 1)
+			qpx->wr_flags |= IBV_SEND_SIGNALED;
+		wr_slot_mkey_configure(ctx, dv_qp, (first + i) % pool, sa);
+	}
+	ret = ibv_wr_complete(qpx);
+	if (ret)
+		err("ibv_wr_complete failed %d, errno %d\n", ret, errno);
+	return ret;
+}
+
+/* Configure the mkey of every slot and wait for it */
+static int stream_config_mkeys(struct stream_ctx *ctx)
+{
+	struct ibv_wc wc[STREAM_POLL_BATCH];
+	struct sig_attr sa;
+	unsigned int i, n;
+	int ret;
+
+	init_sig_attr(ctx->param, ctx->mode, &sa);
+
+	for (i = 0; i < ctx->nslots; i += n) {
+		n = ctx->nslots - i < STREAM_CONF_BATCH ? ctx->nslots - i : STREAM_CONF_BATCH;
+		ret = post_mkey_configures(ctx, &sa, i, n, ctx->nslots);
+		if (ret)
+			return ret;
+
+		do {
+			ret = stream_poll(ctx, wc, 1);
+		} while (ret == 0);
+		if (ret < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Configure rate alone: @iters configures over @pool mkeys, @qd of them in flight */
+static int stream_conf_rate(struct stream_ctx *ctx, unsigned int pool, unsigned int qd,
+			    struct stream_stats *st)
+{
+	unsigned long iters = ctx->iters, posted = 0, completed = 0;
+	struct ibv_wc wc[STREAM_POLL_BATCH];
+	struct sig_attr sa;
+	int ne, i;
+
+	init_sig_attr(ctx->param, ctx->mode, &sa);
+
+	stats_start(st);
+	while (completed < iters) {
+		while (posted < iters && posted - completed < qd) {
+			unsigned long n = qd - (posted - completed);
+
+			if (n > iters - posted)
+				n = iters - posted;
+			if (n > STREAM_CONF_BATCH)
+				n = STREAM_CONF_BATCH;
+			if (post_mkey_configures(ctx, &sa, posted, n, pool))
+				return -1;
+			posted += n;
+		}
+
+		ne = stream_poll(ctx, wc, STREAM_POLL_BATCH);
+		if (ne < 0)
+			return -1;
+		for (i = 0; i < ne; i++)
+			completed += wc[i].wr_id;
+	}
+	stats_end(st);
+
+	st->msgs = completed;
+	return 0;
+}
+
+/* Count the slot mkeys that saw a signature error */
+static unsigned int stream_check_mkeys(struct stream_ctx *ctx)
+{
+	struct mlx5dv_mkey_err err_info;
+	unsigned int i, bad = 0;
+
+	if (ctx->param->sw_sig)
+		return ctx->sw_bad;
+
+	for (i = 0; i < ctx->nslots; i++) {
+		if (mlx5dv_mkey_check(ctx->mkeys[i], &err_info)) {
+			err("mlx5dv_mkey_check failed, errno %d\n", errno);
+			bad++;
+			continue;
+		}
+		if (err_info.err_type != MLX5DV_MKEY_NO_ERR) {
+			if (!bad)
+				err("SIG ERROR on slot %d: type %d, expected 0x%lx, actual 0x%lx, offset %lu\n",
+				    i, err_info.err_type, err_info.err.sig.expected_value,
+				    err_info.err.sig.actual_value, err_info.err.sig.offset);
+			bad++;
+		}
+	}
+
+	return bad;
+}
+
+static unsigned int pi_guard_bytes(struct sig_param *param)
+{
+	if (param->sig_type != MLX5DV_SIG_TYPE_NVMEDIF ||
+	    param->nvme_fmt == MLX5DV_SIG_NVMEDIF_FORMAT_16)
+		return 2;
+	return param->nvme_fmt == MLX5DV_SIG_NVMEDIF_FORMAT_32 ? 4 : 8;
+}
+
+static int inject_init(struct stream_inject *in, struct stream_ctx *ctx)
+{
+	int flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+		IBV_ACCESS_REMOTE_WRITE;
+	struct sig_param *param = ctx->param;
+	size_t stride = param->block_size + param->pi_size, len, i;
+	uint32_t want = ctx->opts->inject_field;
+	struct pi_domain d;
+
+	memset(in, 0, sizeof(*in));
+	if (!want || want == PI_CHECK_GUARD)
+		in->fields[in->nfields++] = PI_CHECK_GUARD;
+	if (!want || want == PI_CHECK_APP)
+		in->fields[in->nfields++] = PI_CHECK_APP;
+	if ((!want || want == PI_CHECK_REF) && get_pi_ref_bits(param))
+		in->fields[in->nfields++] = PI_CHECK_REF;
+	if ((!want || want == PI_CHECK_STORAGE) &&
+	    param->sig_type == MLX5DV_SIG_TYPE_NVMEDIF && param->sts)
+		in->fields[in->nfields++] = PI_CHECK_STORAGE;
+	if (!in->nfields) {
+		err("Cannot inject %s errors with this signature format\n",
+		    pi_check_str(want));
+		return EINVAL;
+	}
+
+	in->seed = ctx->conn->qp_idx + 1;
+	in->slot_len = stride * param->block_num;
+	len = in->slot_len * ctx->nslots;
+	in->buf = malloc(len);
+	in->off = malloc(ctx->nslots * sizeof(*in->off));
+	in->mask = calloc(ctx->nslots, 1);
+	if (!in->buf || !in->off || !in->mask) {
+		err("Failed to allocate the injection buffers\n");
+		goto fail;
+	}
+	for (i = 0; i < ctx->nslots; i++)
+		in->off[i] = -1;
+
+	for (i = 0; i < len; i++)
+		in->buf[i] = i / param->block_size;
+	get_pi_domain(param, &d);
+	for (i = 0; i < ctx->nslots; i++)
+		pi_generate(&d, in->buf + i * in->slot_len, stride,
+			    in->buf + i * in->slot_len + param->block_size, stride,
+			    param->block_num);
+
+	in->mr = ibv_reg_mr(ctx->pd, in->buf, len, flags);
+	if (!in->mr) {
+		perror("ibv_reg_mr");
+		goto fail;
+	}
+	return 0;
+
+fail:
+	free(in->mask);
+	free(in->off);
+	free(in->buf);
+	return -1;
+}
+
+static void inject_destroy(struct stream_inject *in)
+{
+	ibv_dereg_mr(in->mr);
+	free(in->mask);
+	free(in->off);
+	free(in->buf);
+}
+
+/* Undo the error of the last message of the slot, then maybe inject one */
+static void inject_prepare(struct stream_ctx *ctx, unsigned int slot)
+{
+	struct stream_inject *in = ctx->inject;
+	struct sig_param *param = ctx->param;
+	unsigned char *p = in->buf + slot * in->slot_len;
+	unsigned int gb = pi_guard_bytes(param), block;
+	long off;
+
+	if (in->off[slot] >= 0) {
+		p[in->off[slot]] ^= in->mask[slot];
+		in->off[slot] = -1;
+	}
+
+	if (!in->rate || rand_r(&in->seed) % in->rate)
+		return;
+
+	block = rand_r(&in->seed) % param->block_num;
+	off = (long)block * (param->block_size + param->pi_size) + param->block_size;
+	switch (in->fields[in->injected % in->nfields]) {
+	case PI_CHECK_GUARD:
+		in->mask[slot] = 0x01;
+		break;
+	case PI_CHECK_APP:
+		off += gb + 1;
+		in->mask[slot] = 0x01;
+		break;
+	case PI_CHECK_REF:		/* LSB of storage+ref */
+		off += param->pi_size - 1;
+		in->mask[slot] = 0x01;
+		break;
+	default:			/* MSB of storage+ref */
+		off += gb + 2;
+		in->mask[slot] = 0x80;
+		break;
+	}
+
+	p[off] ^= in->mask[slot];
+	in->off[slot] = off;
+	in->injected++;
+}
+
+/* Software signature: The data of the slot with its PI, as the wire mkey sends it */
+static void sw_insert_pi(struct stream_ctx *ctx, unsigned int slot)
+{
+	struct sig_param *param = ctx->param;
+	size_t stride = param->block_size + param->pi_size;
+	unsigned char *src = ctx->buf + slot * ctx->slot_len;
+	unsigned char *dst = ctx->inject->buf + slot * ctx->inject->slot_len;
+	unsigned int i;
+
+	for (i = 0; i < param->block_num; i++)
+		memcpy(dst + i * stride, src + (size_t)i * param->block_size, param->block_size);
+	pi_generate(&ctx->sw_dom, dst, stride, dst + param->block_size, stride,
+		    param->block_num);
+}
+
+/* Software signature: Verify the PI of a received slot and strip it to ctx->buf */
+static void sw_strip_pi(struct stream_ctx *ctx, unsigned int slot)
+{
+	struct sig_param *param = ctx->param;
+	size_t stride = param->block_size + param->pi_size;
+	unsigned char *src = ctx->inject->buf + slot * ctx->inject->slot_len;
+	unsigned char *dst = ctx->buf + slot * ctx->slot_len;
+	struct pi_error e;
+	unsigned int i, bad;
+
+	bad = pi_verify(&ctx->sw_dom, src, stride, src + param->block_size, stride,
+			param->block_num, &e);
+	if (bad) {
+		if (!ctx->sw_bad)
+			err("SIG ERROR on slot %d: %s, expected 0x%lx, actual 0x%lx, offset %lu\n",
+			    slot, pi_check_str(e.type), e.expected, e.actual, e.offset);
+		ctx->sw_bad += bad;
+	}
+
+	for (i = 0; i < param->block_num; i++)
+		memcpy(dst + (size_t)i * param->block_size, src + i * stride, param->block_size);
+}
+
+static void fill_sge(struct stream_ctx *ctx, int pi, unsigned int slot, struct ibv_sge *sge)
+{
+	if (pi == STREAM_PI_RAW) {
+		sge->addr = (uint64_t)ctx->inject->buf + slot * ctx->inject->slot_len;
+		sge->length = ctx->wire_len;
+		sge->lkey = ctx->inject->mr->lkey;
+	} else if (pi == STREAM_PI_ON) {
+		sge->addr = 0;
+		sge->length = ctx->wire_len;
+		sge->lkey = ctx->mkeys[slot]->lkey;
+	} else {
+		sge->addr = (uint64_t)ctx->buf + slot * ctx->slot_len;
+		sge->length = ctx->data_len;
+		sge->lkey = ctx->mr->lkey;
+	}
+}
+
+/* SENDs, or RDMA WRITE/READs to the same slot of the remote buffer */
+static int post_ops(struct stream_ctx *ctx, int pi, unsigned long first, unsigned int n)
+{
+	struct ibv_send_wr wr[STREAM_POST_BATCH], *bad_wr = NULL;
+	struct ibv_sge sge[STREAM_POST_BATCH];
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < n; i++) {
+		unsigned int slot = (first + i) % ctx->nslots;
+
+		if (ctx->gather)
+			layout_gather(ctx->gather, ctx, slot);
+		if (pi == STREAM_PI_RAW && ctx->param->sw_sig)
+			sw_insert_pi(ctx, slot);
+		else if (pi == STREAM_PI_RAW)
+			inject_prepare(ctx, slot);
+		fill_sge(ctx, pi, slot, &sge[i]);
+		memset(&wr[i], 0, sizeof(wr[i]));
+		wr[i].wr_id = slot;
+		wr[i].sg_list = &sge[i];
+		wr[i].num_sge = 1;
+		wr[i].opcode = ctx->opcode;
+		wr[i].send_flags = IBV_SEND_SIGNALED;
+		if (ctx->opcode != IBV_WR_SEND) {
+			wr[i].wr.rdma.remote_addr = ctx->raddr +
+				(uint64_t)(slot % ctx->rnslots) * ctx->rslot_len;
+			wr[i].wr.rdma.rkey = ctx->rkey;
+		}
+		wr[i].next = (i + 1 < n) ? &wr[i + 1] : NULL;
+	}
+
+	ret = ibv_post_send(ctx->qp, wr, &bad_wr);
+	if (ret)
+		err("ibv_post_send failed %d\n", ret);
+	return ret;
+}
+
+static int post_recv(struct stream_ctx *ctx, int pi, unsigned int slot)
+{
+	struct ibv_recv_wr wr = {}, *bad_wr = NULL;
+	struct ibv_sge sge;
+	int ret;
+
+	fill_sge(ctx, pi, slot, &sge);
+	wr.wr_id = slot;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+
+	ret = ibv_post_recv(ctx->qp, &wr, &bad_wr);
+	if (ret)
+		err("ibv_post_recv failed %d\n", ret);
+	return ret;
+}
+
+static int stream_client_phase(struct stream_ctx *ctx, int pi, struct stream_stats *st)
+{
+	unsigned long iters = ctx->iters, posted = 0, completed = 0;
+	unsigned int window = ctx->opts->window;
+	struct ibv_wc wc[STREAM_POLL_BATCH];
+	int ne;
+
+	stats_start(st);
+	while (completed < iters) {
+		while (posted < iters && posted - completed < window) {
+			unsigned long n = window - (posted - completed);
+
+			if (n > iters - posted)
+				n = iters - posted;
+			if (n > STREAM_POST_BATCH)
+				n = STREAM_POST_BATCH;
+			if (post_ops(ctx, pi, posted, n))
+				return -1;
+			posted += n;
+		}
+
+		ne = stream_poll(ctx, wc, STREAM_POLL_BATCH);
+		if (ne < 0)
+			return -1;
+		completed += ne;
+	}
+	stats_end(st);
+
+	st->msgs = completed;
+	st->bytes = completed * ctx->data_len;
+	return 0;
+}
+
+/*
+ * Each message reconfigures mkey (msg % pool) in the same batch as its SEND;
+ * The SEND is fenced so that it starts after the configure is done.
+ * At most @qd <= @pool messages are in flight, so a pool mkey is only
+ * reconfigured after the SEND that used it completed.
+ */
+static int stream_client_pool_phase(struct stream_ctx *ctx, unsigned int pool,
+				    unsigned int qd, struct stream_stats *st)
+{
+	unsigned long iters = ctx->iters, posted = 0, completed = 0;
+	struct ibv_qp_ex *qpx = ibv_qp_to_qp_ex(ctx->qp);
+	struct mlx5dv_qp_ex *dv_qp = mlx5dv_qp_ex_from_ibv_qp_ex(qpx);
+	struct ibv_wc wc[STREAM_POLL_BATCH];
+	struct sig_attr sa;
+	int ne, ret;
+
+	init_sig_attr(ctx->param, ctx->mode, &sa);
+
+	stats_start(st);
+	while (completed < iters) {
+		if (posted < iters && posted - completed < qd) {
+			unsigned long n = qd - (posted - completed), i;
+
+			if (n > iters - posted)
+				n = iters - posted;
+			if (n > STREAM_CONF_BATCH)
+				n = STREAM_CONF_BATCH;
+
+			ibv_wr_start(qpx);
+			for (i = 0; i < n; i++) {
+				unsigned int slot = (posted + i) % pool;
+
+				qpx->wr_id = slot;
+				qpx->wr_flags = IBV_SEND_INLINE;
+				wr_slot_mkey_configure(ctx, dv_qp, slot, &sa);
+
+				qpx->wr_id = slot;
+				qpx->wr_flags = IBV_SEND_SIGNALED | IBV_SEND_FENCE;
+				ibv_wr_send(qpx);
+				ibv_wr_set_sge(qpx, ctx->mkeys[slot]->lkey, 0, ctx->wire_len);
+			}
+			ret = ibv_wr_complete(qpx);
+			if (ret) {
+				err("ibv_wr_complete failed %d, errno %d\n", ret, errno);
+				return ret;
+			}
+			posted += n;
+		}
+
+		ne = stream_poll(ctx, wc, STREAM_POLL_BATCH);
+		if (ne < 0)
+			return -1;
+		completed += ne;
+	}
+	stats_end(st);
+
+	st->msgs = completed;
+	st->bytes = completed * ctx->data_len;
+	return 0;
+}
+
+struct stream_check_stats {
+	unsigned long errors[MLX5DV_MKEY_SIG_BLOCK_BAD_STORAGETAG + 1];
+	uint64_t check_ns;		/* In mlx5dv_mkey_check() */
+	unsigned long recovered;
+	uint64_t recover_ns, recover_max_ns;	/* From detection to reconfigured */
+};
+
+static int post_recover(struct stream_ctx *ctx, struct sig_attr *sa, unsigned int slot)
+{
+	struct ibv_qp_ex *qpx = ibv_qp_to_qp_ex(ctx->qp);
+	struct mlx5dv_qp_ex *dv_qp = mlx5dv_qp_ex_from_ibv_qp_ex(qpx);
+	int ret;
+
+	ibv_wr_start(qpx);
+	qpx->wr_id = STREAM_WRID_CONF | slot;
+	qpx->wr_flags = IBV_SEND_SIGNALED | IBV_SEND_INLINE;
+	wr_slot_mkey_configure(ctx, dv_qp, slot, sa);
+	ret = ibv_wr_complete(qpx);
+	if (ret)
+		err("ibv_wr_complete failed %d, errno %d\n", ret, errno);
+	return ret;
+}
+
+/*
+ * Like stream_server_phase() with PI, but the mkey of every message is
+ * checked. A failed mkey is reconfigured, and its receive reposted once
+ * the configure completed.
+ */
+static int stream_server_check_phase(struct stream_ctx *ctx, struct stream_stats *st,
+				     struct stream_check_stats *cs)
+{
+	unsigned long iters = ctx->iters, posted = 0, received = 0, pending = 0;
+	struct ibv_wc wc[STREAM_POLL_BATCH];
+	struct mlx5dv_mkey_err err_info;
+	uint64_t *detect_ns, t;
+	bool started = false;
+	struct sig_attr sa;
+	int ne, i, ret = -1;
+
+	memset(cs, 0, sizeof(*cs));
+	memset(st, 0, sizeof(*st));
+	init_sig_attr(ctx->param, ctx->mode, &sa);
+	detect_ns = calloc(ctx->nslots, sizeof(*detect_ns));
+	if (!detect_ns)
+		return ENOMEM;
+
+	while (posted < iters && posted < ctx->nslots) {
+		if (post_recv(ctx, STREAM_PI_ON, posted))
+			goto out;
+		posted++;
+	}
+
+	while (received < iters || pending) {
+		ne = stream_poll(ctx, wc, STREAM_POLL_BATCH);
+		if (ne < 0)
+			goto out;
+		if (ne && !started) {
+			stats_start(st);
+			started = true;
+		}
+
+		for (i = 0; i < ne; i++) {
+			unsigned int slot = wc[i].wr_id & ~STREAM_WRID_CONF;
+
+			if (wc[i].wr_id & STREAM_WRID_CONF) {
+				t = get_time_ns() - detect_ns[slot];
+				cs->recover_ns += t;
+				if (t > cs->recover_max_ns)
+					cs->recover_max_ns = t;
+				cs->recovered++;
+				pending--;
+			} else {
+				received++;
+				st->bytes += wc[i].byte_len;
+
+				t = get_time_ns();
+				ret = mlx5dv_mkey_check(ctx->mkeys[slot], &err_info);
+				detect_ns[slot] = get_time_ns();
+				cs->check_ns += detect_ns[slot] - t;
+				if (ret) {
+					err("mlx5dv_mkey_check failed %d, errno %d\n", ret, errno);
+					goto out;
+				}
+				ret = -1;
+
+				if (err_info.err_type != MLX5DV_MKEY_NO_ERR) {
+					if (err_info.err_type <= MLX5DV_MKEY_SIG_BLOCK_BAD_STORAGETAG)
+						cs->errors[err_info.err_type]++;
+					if (post_recover(ctx, &sa, slot))
+						goto out;
+					pending++;
+					continue;
+				}
+			}
+
+			if (posted < iters) {
+				if (post_recv(ctx, STREAM_PI_ON, slot))
+					goto out;
+				posted++;
+			}
+		}
+	}
+	stats_end(st);
+	st->msgs = received;
+	ret = 0;
+
+out:
+	free(detect_ns);
+	return ret;
+}
+
+static int stream_server_phase(struct stream_ctx *ctx, int pi, struct stream_stats *st)
+{
+	unsigned long iters = ctx->iters, posted = 0, received = 0;
+	struct ibv_wc wc[STREAM_POLL_BATCH];
+	int ne, i;
+
+	while (posted < iters && posted < ctx->nslots) {
+		if (post_recv(ctx, pi, posted))
+			return -1;
+		posted++;
+	}
+
+	/* Start the clock on the first message */
+	do {
+		ne = stream_poll(ctx, wc, STREAM_POLL_BATCH);
+	} while (ne == 0);
+	stats_start(st);
+
+	while (1) {
+		if (ne < 0)
+			return -1;
+
+		for (i = 0; i < ne; i++) {
+			received++;
+			st->bytes += wc[i].byte_len;
+			if (pi == STREAM_PI_RAW && ctx->param->sw_sig)
+				sw_strip_pi(ctx, wc[i].wr_id);
+			if (posted < iters) {
+				if (post_recv(ctx, pi, wc[i].wr_id))
+					return -1;
+				posted++;
+			}
+		}
+		if (received >= iters)
+			break;
+
+		ne = stream_poll(ctx, wc, STREAM_POLL_BATCH);
+	}
+	stats_end(st);
+
+	st->msgs = received;
+	return 0;
+}
+
+static unsigned int next_step(unsigned int v, unsigned int max)
+{
+	return (v < max && v * 2 > max) ? max : v * 2;
+}
+
+/*
+ * Configure rate per pool size and queue depth on the client, then the
+ * message rate per pool size, with the queue depth capped by the window.
+ * The server receives into its statically configured mkeys meanwhile.
+ */
+static int stream_pool_sweep(struct stream_ctx *ctx, bool server)
+{
+	unsigned int pool_size = ctx->opts->pool_size;
+	unsigned int window = ctx->opts->window;
+	struct stream_stats st;
+	unsigned int pool, qd;
+	char name[32];
+	int ret;
+
+	if (!server) {
+		info("mkey configure rate:\n");
+		for (pool = 1; pool <= pool_size; pool = next_step(pool, pool_size)) {
+			for (qd = 1; qd <= pool && qd <= window; qd = next_step(qd, window)) {
+				ret = stream_conf_rate(ctx, pool, qd, &st);
+				if (ret)
+					return ret;
+				info("  pool %4u qd %4u: %.3f M configures/s\n", pool, qd,
+				     st.msgs * 1000.0 / (st.end_ns - st.start_ns));
+			}
+		}
+	}
+
+	info("Pipelined configure + SEND:\n");
+	for (pool = 1; pool <= pool_size; pool = next_step(pool, pool_size)) {
+		qd = pool < window ? pool : window;
+		if (server)
+			ret = stream_server_phase(ctx, STREAM_PI_ON, &st);
+		else
+			ret = stream_client_pool_phase(ctx, pool, qd, &st);
+		if (ret)
+			return ret;
+
+		snprintf(name, sizeof(name), "pool %u qd %u", pool, qd);
+		stats_print(ctx, name, &st);
+	}
+
+	return 0;
+}
+
+int sig_stream_expose(struct sig_stream_conn *sc, struct sig_remote_buf *rb)
+{
+	int flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+		IBV_ACCESS_REMOTE_WRITE;
+	struct ibv_recv_wr wr = {}, *bad_wr = NULL;
+	size_t slot_len = max_msg_len(sc->param);
+	size_t len = slot_len * sc->opts->window;
+	int ret;
+
+	sc->expose_buf = calloc(1, len);
+	if (!sc->expose_buf) {
+		perror("calloc");
+		return errno;
+	}
+
+	sc->expose_mr = ibv_reg_mr(sc->pd, sc->expose_buf, len, flags);
+	if (!sc->expose_mr) {
+		perror("ibv_reg_mr");
+		ret = errno;
+		goto fail_reg_mr;
+	}
+
+	/* For the zero-length SEND of the client once it is done */
+	ret = ibv_post_recv(sc->qp, &wr, &bad_wr);
+	if (ret) {
+		err("ibv_post_recv failed %d\n", ret);
+		goto fail_post_recv;
+	}
+
+	rb->addr = htobe64((uint64_t)sc->expose_buf);
+	rb->rkey = htobe32(sc->expose_mr->rkey);
+	rb->slot_len = htobe32(slot_len);
+	rb->nslots = htobe32(sc->opts->window);
+
+	info("Exposing %d slots of %zu bytes, rkey 0x%x\n",
+	     sc->opts->window, slot_len, sc->expose_mr->rkey);
+	return 0;
+
+fail_post_recv:
+	ibv_dereg_mr(sc->expose_mr);
+fail_reg_mr:
+	free(sc->expose_buf);
+	sc->expose_buf = NULL;
+	return ret;
+}
+
+/*
+ * The client does all the work, sleep on the completion channel until it
+ * says it is done
+ */
+static int stream_server_wait(struct sig_stream_conn *sc)
+{
+	struct ibv_cq *ev_cq;
+	struct ibv_wc wc;
+	void *ev_ctx;
+	int ne;
+
+	if (!sc->expose_buf || !sc->channel) {
+		err("No buffer exposed to the client\n");
+		return -EINVAL;
+	}
+
+	while (1) {
+		/* Armed before polling, so a completion in between raises an event */
+		if (ibv_req_notify_cq(sc->cq, 0)) {
+			err("ibv_req_notify_cq failed\n");
+			ne = -1;
+			break;
+		}
+
+		ne = ibv_poll_cq(sc->cq, 1, &wc);
+		if (ne)
+			break;
+
+		if (ibv_get_cq_event(sc->channel, &ev_cq, &ev_ctx)) {
+			perror("ibv_get_cq_event");
+			ne = -1;
+			break;
+		}
+		ibv_ack_cq_events(ev_cq, 1);
+	}
+
+	if (ne < 0 || wc.status != IBV_WC_SUCCESS) {
+		err("Waiting for the client failed: ne %d status %d\n", ne, wc.status);
+		ne = -1;
+	} else {
+		info("Client done\n");
+		ne = 0;
+	}
+
+	ibv_dereg_mr(sc->expose_mr);
+	free(sc->expose_buf);
+	sc->expose_buf = NULL;
+	return ne;
+}
+
+static int stream_send_done(struct stream_ctx *ctx)
+{
+	struct ibv_send_wr wr = {}, *bad_wr = NULL;
+	struct ibv_wc wc;
+	int ret;
+
+	wr.opcode = IBV_WR_SEND;
+	wr.send_flags = IBV_SEND_SIGNALED;
+	ret = ibv_post_send(ctx->qp, &wr, &bad_wr);
+	if (ret) {
+		err("ibv_post_send failed %d\n", ret);
+		return ret;
+	}
+
+	do {
+		ret = stream_poll(ctx, &wc, 1);
+	} while (ret == 0);
+	return ret < 0 ? -1 : 0;
+}
+
+/* Valid PI in every slot buffer, for the memory domain */
+static void stream_generate_pi(struct stream_ctx *ctx)
+{
+	size_t stride = ctx->param->block_size + ctx->param->pi_size;
+	struct pi_domain d;
+	unsigned int i;
+
+	get_pi_domain(ctx->param, &d);
+	for (i = 0; i < ctx->nslots; i++) {
+		unsigned char *p = ctx->buf + i * ctx->slot_len;
+
+		pi_generate(&d, p, stride, p + ctx->param->block_size, stride,
+			    ctx->param->block_num);
+	}
+}
+
+/* WRITE every slot through its mkey, so that the READs find valid PI */
+static int stream_prime_remote(struct stream_ctx *ctx)
+{
+	unsigned long iters = ctx->iters;
+	enum ibv_wr_opcode opcode = ctx->opcode;
+	struct stream_stats st;
+	int ret;
+
+	ctx->opcode = IBV_WR_RDMA_WRITE;
+	ctx->iters = ctx->nslots;
+	ret = stream_client_phase(ctx, STREAM_PI_ON, &st);
+	ctx->iters = iters;
+	ctx->opcode = opcode;
+	return ret;
+}
+
+static const char *domain_str(int mode)
+{
+	switch (mode) {
+	case SIG_FLAG_WIRE:
+		return "wire";
+	case SIG_FLAG_MEM:
+		return "memory";
+	default:
+		return "wire+memory";
+	}
+}
+
+/* WRITE/READ throughput per block size and block count, PI off then on */
+static int stream_rdma_sweep(struct stream_ctx *ctx)
+{
+	static const unsigned int block_sizes[] = { 512, 4096 };
+	struct sig_param *param = ctx->param, pt = *param;
+	unsigned int block_num = param->block_num;
+	struct stream_stats st;
+	unsigned int i, n;
+	char name[32];
+	int ret = 0;
+
+	info("RDMA %s, %s domain, window %d, %lu ops per point\n",
+	     ctx->opcode == IBV_WR_RDMA_WRITE ? "WRITE" : "READ",
+	     domain_str(ctx->mode), ctx->opts->window, ctx->iters);
+
+	for (i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+		for (n = 1; n <= block_num; n = next_step(n, block_num)) {
+			pt.block_size = block_sizes[i];
+			pt.block_num = n;
+			stream_set_len(ctx, &pt);
+
+			ret = stream_client_phase(ctx, STREAM_PI_OFF, &st);
+			if (ret)
+				goto out;
+			snprintf(name, sizeof(name), "%ux%u PI off", block_sizes[i], n);
+			stats_print(ctx, name, &st);
+			stats_record(ctx, STREAM_PI_OFF, &st);
+
+			if (ctx->mode & SIG_FLAG_MEM)
+				stream_generate_pi(ctx);
+			ret = stream_config_mkeys(ctx);
+			if (!ret && ctx->opcode == IBV_WR_RDMA_READ)
+				ret = stream_prime_remote(ctx);
+			if (!ret)
+				ret = stream_client_phase(ctx, STREAM_PI_ON, &st);
+			if (ret)
+				goto out;
+			snprintf(name, sizeof(name), "%ux%u PI on", block_sizes[i], n);
+			stats_print(ctx, name, &st);
+			stats_record(ctx, STREAM_PI_ON, &st);
+
+			if (stream_check_mkeys(ctx)) {
+				err("Signature errors detected\n");
+				ret = -EIO;
+				goto out;
+			}
+		}
+	}
+
+out:
+	stream_set_len(ctx, param);
+	if (stream_send_done(ctx) && !ret)
+		ret = -1;
+	return ret;
+}
+
+/* Average latency of one signaled configure, with ctx->layout */
+static double stream_conf_latency(struct stream_ctx *ctx, unsigned int reps)
+{
+	struct ibv_wc wc;
+	struct sig_attr sa;
+	uint64_t start;
+	unsigned int i;
+	int ret;
+
+	init_sig_attr(ctx->param, ctx->mode, &sa);
+
+	start = get_time_ns();
+	for (i = 0; i < reps; i++) {
+		if (post_mkey_configures(ctx, &sa, i, 1, ctx->nslots))
+			return -1;
+		do {
+			ret = stream_poll(ctx, &wc, 1);
+		} while (ret == 0);
+		if (ret < 0)
+			return -1;
+	}
+
+	return (get_time_ns() - start) / 1000.0 / reps;
+}
+
+/* Client side of a fragmented point: configure latency, then the message rate */
+static int stream_layout_point(struct stream_ctx *ctx, struct stream_layout *l,
+			       const char *name)
+{
+	unsigned int reps = ctx->iters < 1000 ? ctx->iters : 1000;
+	unsigned int qd = ctx->opts->window < ctx->nslots ? ctx->opts->window : ctx->nslots;
+	struct stream_stats st;
+	double lat;
+	int ret;
+
+	ctx->layout = l;
+	lat = stream_conf_latency(ctx, reps);
+	ret = lat < 0 ? -1 : stream_client_pool_phase(ctx, ctx->nslots, qd, &st);
+	ctx->layout = NULL;
+	if (ret)
+		return ret;
+
+	info("%s: configure latency %.2f us\n", name, lat);
+	stats_print(ctx, name, &st);
+	return 0;
+}
+
+/*
+ * Per number of fragments: bounce through the slot buffer, list layout, and
+ * interleaved layout with a separate PI buffer. The server receives the
+ * same number of messages per point into its static mkeys.
+ */
+static int stream_layout_sweep(struct stream_ctx *ctx, bool server)
+{
+	unsigned int max = ctx->opts->max_entries, e;
+	struct stream_layout l;
+	struct stream_stats st;
+	char name[32];
+	int ret = 0;
+
+	if (!server && layout_init(&l, ctx, max))
+		return -1;
+
+	info("Fragmented buffers, up to %d mkey entries:\n", max);
+	for (e = 1; e <= max; e = next_step(e, max)) {
+		if (!layout_ok(ctx, LAYOUT_LIST, e))
+			continue;
+
+		snprintf(name, sizeof(name), "bounce %u", e);
+		if (server) {
+			ret = stream_server_phase(ctx, STREAM_PI_ON, &st);
+		} else {
+			layout_set(&l, ctx, LAYOUT_LIST, e);
+			ret = stream_config_mkeys(ctx);
+			ctx->gather = &l;
+			if (!ret)
+				ret = stream_client_phase(ctx, STREAM_PI_ON, &st);
+			ctx->gather = NULL;
+		}
+		if (ret)
+			goto out;
+		stats_print(ctx, name, &st);
+
+		snprintf(name, sizeof(name), "list %u", e);
+		if (server) {
+			ret = stream_server_phase(ctx, STREAM_PI_ON, &st);
+			if (!ret)
+				stats_print(ctx, name, &st);
+		} else {
+			ret = stream_layout_point(ctx, &l, name);
+		}
+		if (ret)
+			goto out;
+	}
+
+	for (e = 1; e < max; e = next_step(e, max - 1)) {
+		if (!layout_ok(ctx, LAYOUT_INTERLEAVED, e))
+			continue;
+
+		snprintf(name, sizeof(name), "interleaved %u+1", e);
+		if (server) {
+			ret = stream_server_phase(ctx, STREAM_PI_ON, &st);
+			if (!ret)
+				stats_print(ctx, name, &st);
+		} else {
+			layout_set(&l, ctx, LAYOUT_INTERLEAVED, e);
+			ret = layout_gen_pi(&l, ctx);
+			ctx->mode = SIG_FLAG_WIRE | SIG_FLAG_MEM;
+			if (!ret)
+				ret = stream_layout_point(ctx, &l, name);
+			ctx->mode = SIG_FLAG_WIRE;
+		}
+		if (ret)
+			goto out;
+	}
+
+out:
+	if (!server)
+		layout_destroy(&l);
+	return ret;
+}
+
+/*
+ * Software PI sent as data, checked by the server for every message: First
+ * without errors, for the cost of the checks, then with errors injected.
+ */
+static int stream_inject_sweep(struct stream_ctx *ctx, bool server)
+{
+	static const char *const phase_name[] = { "check", "inject" };
+	struct stream_check_stats cs;
+	struct stream_inject in;
+	struct stream_stats st;
+	unsigned long n;
+	int phase, ret = 0;
+
+	if (!server) {
+		ret = inject_init(&in, ctx);
+		if (ret)
+			return ret;
+		ctx->inject = &in;
+	}
+
+	info("Checking every message, injecting %s errors in one message of %d:\n",
+	     ctx->opts->inject_field ? pi_check_str(ctx->opts->inject_field) : "all",
+	     ctx->opts->inject_rate);
+
+	for (phase = 0; phase < 2; phase++) {
+		if (server) {
+			ret = stream_server_check_phase(ctx, &st, &cs);
+			if (ret)
+				break;
+			stats_print(ctx, phase_name[phase], &st);
+
+			n = cs.errors[MLX5DV_MKEY_SIG_BLOCK_BAD_GUARD] +
+				cs.errors[MLX5DV_MKEY_SIG_BLOCK_BAD_APPTAG] +
+				cs.errors[MLX5DV_MKEY_SIG_BLOCK_BAD_REFTAG] +
+				cs.errors[MLX5DV_MKEY_SIG_BLOCK_BAD_STORAGETAG];
+			info("  mkey_check %.1f ns per message; %lu errors: guard %lu, app %lu, ref %lu, storage %lu\n",
+			     st.msgs ? (double)cs.check_ns / st.msgs : 0, n,
+			     cs.errors[MLX5DV_MKEY_SIG_BLOCK_BAD_GUARD],
+			     cs.errors[MLX5DV_MKEY_SIG_BLOCK_BAD_APPTAG],
+			     cs.errors[MLX5DV_MKEY_SIG_BLOCK_BAD_REFTAG],
+			     cs.errors[MLX5DV_MKEY_SIG_BLOCK_BAD_STORAGETAG]);
+			if (cs.recovered)
+				info("  reconfigure after error: avg %.2f us, max %.2f us\n",
+				     cs.recover_ns / 1000.0 / cs.recovered,
+				     cs.recover_max_ns / 1000.0);
+		} else {
+			in.rate = phase ? ctx->opts->inject_rate : 0;
+			in.injected = 0;
+			ret = stream_client_phase(ctx, STREAM_PI_RAW, &st);
+			if (ret)
+				break;
+			stats_print(ctx, phase_name[phase], &st);
+			info("  %lu messages corrupted\n", in.injected);
+		}
+	}
+
+	if (!server) {
+		ctx->inject = NULL;
+		inject_destroy(&in);
+	}
+	return ret;
+}
+
+static int start_sig_stream(struct sig_stream_conn *sc, bool server)
+{
+	static const char *const phase_name[] = { "PI off", "PI on" };
+	const struct sig_stream_opts *opts = sc->opts;
+	struct sig_param *param = sc->param;
+	struct stream_inject sw_in;
+	struct stream_stats st;
+	struct stream_ctx ctx;
+	unsigned int nslots;
+	int pi, phase_pi, ret;
+
+	if (param->sw_sig) {
+		if (opts->op != SIG_OP_SEND || opts->pool_size ||
+		    opts->max_entries > 1 || opts->inject_rate) {
+			err("Software signature supports SEND streaming only, without -P, -E or -r\n");
+			return -EOPNOTSUPP;
+		}
+	} else {
+		ret = is_sig_supported(sc->pd->context, param);
+		if (ret)
+			return ret;
+	}
+
+	if (opts->op != SIG_OP_SEND) {
+		if (server)
+			return stream_server_wait(sc);
+
+		ret = stream_init(&ctx, sc, opts->window, opts->domains, max_msg_len(param));
+		if (ret)
+			return ret;
+
+		ctx.opcode = (opts->op == SIG_OP_WRITE) ?
+			IBV_WR_RDMA_WRITE : IBV_WR_RDMA_READ;
+		ctx.raddr = be64toh(sc->remote.addr);
+		ctx.rkey = be32toh(sc->remote.rkey);
+		ctx.rslot_len = be32toh(sc->remote.slot_len);
+		ctx.rnslots = be32toh(sc->remote.nslots);
+		if (!ctx.rnslots || ctx.rslot_len < max_msg_len(param)) {
+			err("Remote buffer of %u slots of %u bytes is too small\n",
+			    ctx.rnslots, ctx.rslot_len);
+			ret = -EINVAL;
+		} else {
+			ret = stream_rdma_sweep(&ctx);
+		}
+		stream_destroy(&ctx);
+		return ret;
+	}
+
+	/* The server keeps twice the window of receives posted */
+	if (server)
+		nslots = opts->window * 2;
+	else
+		nslots = opts->window > opts->pool_size ? opts->window : opts->pool_size;
+	ret = stream_init(&ctx, sc, nslots, SIG_FLAG_WIRE,
+			  (size_t)param->block_size * param->block_num);
+	if (ret)
+		return ret;
+
+	info("Streaming %lu messages of %d x %d-byte blocks per phase, window %d%s\n",
+	     opts->iters, param->block_num, param->block_size, opts->window,
+	     param->sw_sig ? ", software signature" : "");
+
+	if (param->sw_sig) {
+		get_pi_domain(param, &ctx.sw_dom);
+		if (pi_size(&ctx.sw_dom) != param->pi_size || pi_check_domain(&ctx.sw_dom)) {
+			err("Software signature: pi size %d, expected %d\n",
+			    param->pi_size, pi_size(&ctx.sw_dom));
+			ret = -EINVAL;
+			goto out;
+		}
+		ret = inject_init(&sw_in, &ctx);
+		if (ret)
+			goto out;
+		ctx.inject = &sw_in;
+	}
+
+	for (pi = STREAM_PI_OFF; pi <= STREAM_PI_ON; pi++) {
+		if (pi == STREAM_PI_ON && !param->sw_sig) {
+			ret = stream_config_mkeys(&ctx);
+			if (ret)
+				goto out;
+		}
+
+		/* The software backend sends/receives data and PI as STREAM_PI_RAW */
+		phase_pi = (pi == STREAM_PI_ON && param->sw_sig) ? STREAM_PI_RAW : pi;
+		if (server)
+			ret = stream_server_phase(&ctx, phase_pi, &st);
+		else
+			ret = stream_client_phase(&ctx, phase_pi, &st);
+		if (ret)
+			goto out;
+
+		stats_print(&ctx, phase_name[pi], &st);
+		stats_record(&ctx, pi, &st);
+	}
+
+	if (opts->inject_rate) {
+		ret = stream_inject_sweep(&ctx, server);
+		if (ret)
+			goto out;
+	}
+
+	if (opts->pool_size) {
+		ret = stream_pool_sweep(&ctx, server);
+		if (ret)
+			goto out;
+	}
+
+	if (opts->max_entries > 1) {
+		ret = stream_layout_sweep(&ctx, server);
+		if (ret)
+			goto out;
+	}
+
+	if (stream_check_mkeys(&ctx)) {
+		err("Signature errors detected\n");
+		ret = -EIO;
+	} else {
+		info("SIG status: OK\n");
+	}
+
+out:
+	if (ctx.inject) {
+		ctx.inject = NULL;
+		inject_destroy(&sw_in);
+	}
+	stream_destroy(&ctx);
+	return ret;
+}
+
+int start_sig_stream_server(struct sig_stream_conn *sc)
+{
+	return start_sig_stream(sc, true);
+}
+
+int start_sig_stream_client(struct sig_stream_conn *sc)
+{
+	return start_sig_stream(sc, false);
+}
@@ -0,0 +1,814 @@
+/* SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause) */
+/*
+ * Protected block target: The server (-T <file>) serves block READ/WRITE
+ * requests from an mmap'ed file that keeps every block followed by its PI,
+ * the layout dump_data_buf_with_pi() shows. The client (-B) has no PI; For
+ * each request the target configures a sig mkey with the memory domain over
+ * the blocks in the file, then RDMA READs the client's data into it (WRITE,
+ * the PI is generated) or RDMA WRITEs from it (READ, the PI is verified and
+ * stripped), and answers with a SEND.
+ *
+ * The ref tag of a block is its LBA. A FORMAT request re-lays the file for
+ * a block size and generates the PI of all blocks with pi.c.
+ *
+ * The client keeps "window" requests of block_num blocks at random LBAs
+ * outstanding, and reports IOPS and latency percentiles of WRITEs, then
+ * READs, for 512 and 4096-byte blocks.
+ */
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <infiniband/mlx5dv.h>
+
+#include "pi.h"
+#include "sig_test.h"
+
+#define TARGET_POLL_BATCH 16
+#define TARGET_DEF_SIZE (64UL << 20)	/* Of a new or empty backing file */
+#define TARGET_WRID_RECV (1ULL << 63)
+#define TARGET_WRID_RSP (1ULL << 62)
+#define TARGET_RSP_SIGNAL 16		/* Within the 32 spare WRs of the SQ */
+
+enum {
+	BLK_OP_READ,
+	BLK_OP_WRITE,
+	BLK_OP_FORMAT,		/* lba is the block size */
+	BLK_OP_DONE,
+};
+
+enum {
+	BLK_STS_OK,
+	BLK_STS_PI_ERR,		/* The stored PI of a READ is bad */
+	BLK_STS_RANGE,
+	BLK_STS_BUSY,		/* More requests than the target queue depth */
+	BLK_STS_IO,
+};
+
+/* Requests and responses, big-endian */
+struct blk_req {
+	uint8_t opcode;
+	uint8_t rsvd;
+	uint16_t tag;
+	uint32_t nblocks;
+	uint64_t lba;
+	uint64_t addr;		/* Client buffer of the data, without PI */
+	uint32_t rkey;
+} __attribute__((packed));
+
+struct blk_rsp {
+	uint16_t tag;
+	uint16_t status;
+	uint32_t rsvd;
+	uint64_t capacity;	/* In blocks, for FORMAT */
+} __attribute__((packed));
+
+struct target_io {
+	struct blk_req req;	/* Host order */
+	uint64_t start_ns;
+};
+
+struct target {
+	struct ibv_pd *pd;
+	struct ibv_qp *qp;
+	struct ibv_cq *cq;
+	struct sig_param param;	/* block_size is the formatted one */
+
+	int fd;
+	bool copy;		/* The file can't be pinned, serving a copy */
+	unsigned char *store;
+	size_t store_len;
+	struct ibv_mr *store_mr;
+	unsigned int stride;	/* Block and PI */
+	uint64_t capacity;	/* In blocks */
+
+	unsigned int qd;
+	struct blk_req *reqs;	/* Receive buffers */
+	struct ibv_mr *reqs_mr;
+	struct target_io *ios;
+	struct mlx5dv_mkey **mkeys;
+	unsigned int *free_ios;
+	unsigned int nfree;
+	unsigned int unsignaled;	/* Responses since the last signaled one */
+	struct sig_attr sa;
+	uint64_t ref_mask;
+
+	unsigned long reads, writes, pi_errors;
+	uint64_t busy_ns;	/* Request received to response posted */
+};
+
+static const char *blk_op_str(unsigned int op)
+{
+	return op == BLK_OP_READ ? "READ" : "WRITE";
+}
+
+/*
+ * Pages of a shared file mapping can't be pinned on every filesystem (only
+ * tmpfs, e.g. /dev/shm, on recent kernels); Then a copy is served and
+ * written back to the file at exit.
+ */
+static int store_open(struct target *t, const char *path)
+{
+	int flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+		IBV_ACCESS_REMOTE_WRITE;
+	struct stat st;
+	ssize_t n;
+	int ret;
+
+	t->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (t->fd < 0) {
+		perror("open");
+		return errno;
+	}
+
+	if (fstat(t->fd, &st)) {
+		perror("fstat");
+		ret = errno;
+		goto fail_close;
+	}
+	if (!st.st_size) {
+		if (ftruncate(t->fd, TARGET_DEF_SIZE)) {
+			perror("ftruncate");
+			ret = errno;
+			goto fail_close;
+		}
+		st.st_size = TARGET_DEF_SIZE;
+	}
+	t->store_len = st.st_size;
+
+	t->store = mmap(NULL, t->store_len, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0);
+	if (t->store == MAP_FAILED) {
+		perror("mmap");
+		ret = errno;
+		goto fail_close;
+	}
+
+	t->store_mr = ibv_reg_mr(t->pd, t->store, t->store_len, flags);
+	if (t->store_mr) {
+		info("Backing store %s: %lu bytes, mmap'ed\n", path, t->store_len);
+		return 0;
+	}
+
+	info("Can't register the mapping of %s (%s), serving a copy\n", path, strerror(errno));
+	munmap(t->store, t->store_len);
+	t->copy = true;
+	t->store = malloc(t->store_len);
+	if (!t->store) {
+		perror("malloc store");
+		ret = errno;
+		goto fail_close;
+	}
+
+	n = pread(t->fd, t->store, t->store_len, 0);
+	if (n != t->store_len) {
+		err("Failed to read %s\n", path);
+		ret = EIO;
+		goto fail_free;
+	}
+
+	t->store_mr = ibv_reg_mr(t->pd, t->store, t->store_len, flags);
+	if (!t->store_mr) {
+		perror("ibv_reg_mr store");
+		ret = errno;
+		goto fail_free;
+	}
+
+	info("Backing store %s: %lu bytes, in memory\n", path, t->store_len);
+	return 0;
+
+fail_free:
+	free(t->store);
+fail_close:
+	close(t->fd);
+	return ret;
+}
+
+static void store_close(struct target *t)
+{
+	ibv_dereg_mr(t->store_mr);
+	if (t->copy) {
+		if (pwrite(t->fd, t->store, t->store_len, 0) != t->store_len)
+			err("Failed to write the backing store back\n");
+		free(t->store);
+	} else {
+		msync(t->store, t->store_len, MS_SYNC);
+		munmap(t->store, t->store_len);
+	}
+	close(t->fd);
+}
+
+/* Lay the store out for @block_size and generate the PI of every block */
+static int target_format(struct target *t, unsigned int block_size)
+{
+	struct pi_domain dom;
+	uint64_t start;
+
+	if (block_size != 512 && block_size != 4096)
+		return EINVAL;
+
+	t->param.block_size = block_size;
+	get_pi_domain(&t->param, &dom);
+	if (pi_size(&dom) != t->param.pi_size || pi_check_domain(&dom)) {
+		err("Target: pi size %d, expected %d\n", t->param.pi_size, pi_size(&dom));
+		return EINVAL;
+	}
+
+	t->stride = block_size + t->param.pi_size;
+	t->capacity = t->store_len / t->stride;
+	dom.ref_tag = 0;
+
+	start = get_time_ns();
+	pi_generate(&dom, t->store, t->stride, t->store + block_size, t->stride, t->capacity);
+	info("Target formatted: %lu blocks of %d + %d bytes in %.1f ms\n",
+	     t->capacity, block_size, t->param.pi_size, (get_time_ns() - start) / 1e6);
+
+	init_sig_attr(&t->param, SIG_FLAG_MEM, &t->sa);
+	return 0;
+}
+
+static int target_post_recv(struct target *t, unsigned int i)
+{
+	struct ibv_recv_wr wr = {}, *bad_wr = NULL;
+	struct ibv_sge sge;
+	int ret;
+
+	sge.addr = (uint64_t)&t->reqs[i];
+	sge.length = sizeof(t->reqs[i]);
+	sge.lkey = t->reqs_mr->lkey;
+	wr.wr_id = TARGET_WRID_RECV | i;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+
+	ret = ibv_post_recv(t->qp, &wr, &bad_wr);
+	if (ret)
+		err("ibv_post_recv failed %d\n", ret);
+	return ret;
+}
+
+/*
+ * Inline, and mostly retired by the signaled RDMA operations; But FORMAT,
+ * DONE and error responses may come with no I/O outstanding, so every
+ * TARGET_RSP_SIGNAL-th response, and any while the target is idle, is
+ * signaled too.
+ */
+static int target_respond(struct target *t, uint16_t tag, uint16_t status, uint64_t capacity)
+{
+	struct ibv_send_wr wr = {}, *bad_wr = NULL;
+	struct blk_rsp rsp = {};
+	struct ibv_sge sge;
+	int ret;
+
+	rsp.tag = htobe16(tag);
+	rsp.status = htobe16(status);
+	rsp.capacity = htobe64(capacity);
+	sge.addr = (uint64_t)&rsp;
+	sge.length = sizeof(rsp);
+	sge.lkey = 0;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+	wr.wr_id = TARGET_WRID_RSP;
+	wr.opcode = IBV_WR_SEND;
+	wr.send_flags = IBV_SEND_INLINE;
+	if (++t->unsignaled >= TARGET_RSP_SIGNAL || t->nfree == t->qd) {
+		wr.send_flags |= IBV_SEND_SIGNALED;
+		t->unsignaled = 0;
+	}
+
+	ret = ibv_post_send(t->qp, &wr, &bad_wr);
+	if (ret)
+		err("ibv_post_send failed %d\n", ret);
+	return ret;
+}
+
+/*
+ * Configure the mkey of @s over the blocks of the request, then move the
+ * data through it; The RDMA operation is fenced behind the configure.
+ */
+static int target_post_io(struct target *t, unsigned int s)
+{
+	struct ibv_qp_ex *qpx = ibv_qp_to_qp_ex(t->qp);
+	struct mlx5dv_qp_ex *dv_qp = mlx5dv_qp_ex_from_ibv_qp_ex(qpx);
+	struct mlx5dv_mkey_conf_attr conf_attr = {};
+	struct blk_req *req = &t->ios[s].req;
+	uint64_t ref = req->lba & t->ref_mask;
+	struct ibv_sge sge;
+	int ret;
+
+	if (t->param.sig_type == MLX5DV_SIG_TYPE_T10DIF)
+		t->sa.mem_sig.t10dif.ref_tag = ref;
+	else
+		t->sa.mem_sig.nvmedif.ref_tag = ref;
+
+	sge.addr = (uint64_t)t->store + req->lba * t->stride;
+	sge.length = req->nblocks * t->stride;
+	sge.lkey = t->store_mr->lkey;
+
+	ibv_wr_start(qpx);
+	qpx->wr_id = s;
+	qpx->wr_flags = IBV_SEND_INLINE;
+	mlx5dv_wr_mkey_configure(dv_qp, t->mkeys[s], 3, &conf_attr);
+	mlx5dv_wr_set_mkey_access_flags(dv_qp, IBV_ACCESS_LOCAL_WRITE |
+					IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE);
+	mlx5dv_wr_set_mkey_layout_list(dv_qp, 1, &sge);
+	mlx5dv_wr_set_mkey_sig_block(dv_qp, &t->sa.attr);
+
+	qpx->wr_id = s;
+	qpx->wr_flags = IBV_SEND_SIGNALED | IBV_SEND_FENCE;
+	if (req->opcode == BLK_OP_WRITE)
+		ibv_wr_rdma_read(qpx, req->rkey, req->addr);
+	else
+		ibv_wr_rdma_write(qpx, req->rkey, req->addr);
+	ibv_wr_set_sge(qpx, t->mkeys[s]->lkey, 0, req->nblocks * t->param.block_size);
+
+	ret = ibv_wr_complete(qpx);
+	if (ret)
+		err("ibv_wr_complete failed %d, errno %d\n", ret, errno);
+	return ret;
+}
+
+/* Of the requests since the last FORMAT */
+static void target_stats(struct target *t)
+{
+	unsigned long n = t->reads + t->writes;
+
+	info("Target, %d-byte blocks: %lu reads, %lu writes, %lu PI errors, %.2f us per request\n",
+	     t->param.block_size, t->reads, t->writes, t->pi_errors,
+	     n ? t->busy_ns / 1000.0 / n : 0);
+	t->reads = t->writes = t->pi_errors = t->busy_ns = 0;
+}
+
+/* A received request; Returns 1 after DONE */
+static int target_request(struct target *t, unsigned int i)
+{
+	struct blk_req *r = &t->reqs[i];
+	struct target_io *io;
+	uint16_t tag = be16toh(r->tag);
+	uint64_t lba = be64toh(r->lba);
+	uint32_t nblocks = be32toh(r->nblocks);
+	unsigned int s;
+	uint8_t op = r->opcode;
+	int ret;
+
+	switch (op) {
+	case BLK_OP_FORMAT:
+		if (t->nfree != t->qd)
+			return target_respond(t, tag, BLK_STS_BUSY, 0);
+		if (t->capacity)
+			target_stats(t);
+		ret = target_format(t, lba);
+		if (ret)
+			return target_respond(t, tag, BLK_STS_IO, 0);
+		return target_respond(t, tag, BLK_STS_OK, t->capacity);
+
+	case BLK_OP_DONE:
+		target_stats(t);
+		ret = target_respond(t, tag, BLK_STS_OK, 0);
+		return ret ? ret : 1;
+
+	case BLK_OP_READ:
+	case BLK_OP_WRITE:
+		/* Within the store MR, and the 32-bit SGE of the mkey */
+		if (!t->capacity || !nblocks || lba >= t->capacity ||
+		    nblocks > t->capacity - lba ||
+		    (uint64_t)nblocks * t->stride > UINT32_MAX)
+			return target_respond(t, tag, BLK_STS_RANGE, 0);
+		if (!t->nfree)
+			return target_respond(t, tag, BLK_STS_BUSY, 0);
+
+		s = t->free_ios[--t->nfree];
+		io = &t->ios[s];
+		io->start_ns = get_time_ns();
+		io->req.opcode = op;
+		io->req.tag = tag;
+		io->req.nblocks = nblocks;
+		io->req.lba = lba;
+		io->req.addr = be64toh(r->addr);
+		io->req.rkey = be32toh(r->rkey);
+		return target_post_io(t, s);
+
+	default:
+		err("Target: unknown request opcode %d\n", op);
+		return target_respond(t, tag, BLK_STS_IO, 0);
+	}
+}
+
+/* The data of the request in slot @s moved; A READ checks the stored PI */
+static int target_complete(struct target *t, unsigned int s)
+{
+	struct target_io *io = &t->ios[s];
+	struct mlx5dv_mkey_err err_info;
+	uint16_t status = BLK_STS_OK;
+	int ret;
+
+	ret = mlx5dv_mkey_check(t->mkeys[s], &err_info);
+	if (ret) {
+		err("mlx5dv_mkey_check failed %d, errno %d\n", ret, errno);
+		status = BLK_STS_IO;
+	} else if (err_info.err_type != MLX5DV_MKEY_NO_ERR) {
+		if (!t->pi_errors)
+			err("SIG ERROR: %s of lba %lu: type %d, expected 0x%lx, actual 0x%lx, offset %lu\n",
+			    blk_op_str(io->req.opcode), io->req.lba, err_info.err_type,
+			    err_info.err.sig.expected_value, err_info.err.sig.actual_value,
+			    err_info.err.sig.offset);
+		t->pi_errors++;
+		status = BLK_STS_PI_ERR;
+	}
+
+	if (io->req.opcode == BLK_OP_READ)
+		t->reads++;
+	else
+		t->writes++;
+
+	t->free_ios[t->nfree++] = s;
+	ret = target_respond(t, io->req.tag, status, 0);
+	t->busy_ns += get_time_ns() - io->start_ns;
+	return ret;
+}
+
+static int target_run(struct target *t)
+{
+	struct ibv_wc wc[TARGET_POLL_BATCH];
+	unsigned int i;
+	int ne, k, ret;
+
+	for (i = 0; i < t->qd; i++) {
+		ret = target_post_recv(t, i);
+		if (ret)
+			return ret;
+	}
+
+	info("Target ready, queue depth %d\n", t->qd);
+	while (1) {
+		ne = ibv_poll_cq(t->cq, TARGET_POLL_BATCH, wc);
+		if (ne < 0) {
+			err("ibv_poll_cq failed %d\n", ne);
+			return -1;
+		}
+
+		for (k = 0; k < ne; k++) {
+			if (wc[k].status != IBV_WC_SUCCESS) {
+				err("CQE status %d(%s), opcode %d(%s), wr_id 0x%lx\n",
+				    wc[k].status, ibv_wc_status_str(wc[k].status),
+				    wc[k].opcode, wc_opcode_str(wc[k].opcode), wc[k].wr_id);
+				return -1;
+			}
+
+			if (wc[k].wr_id == TARGET_WRID_RSP)
+				continue;
+
+			if (!(wc[k].wr_id & TARGET_WRID_RECV)) {
+				ret = target_complete(t, wc[k].wr_id);
+				if (ret)
+					return ret;
+				continue;
+			}
+
+			i = wc[k].wr_id & ~TARGET_WRID_RECV;
+			ret = target_request(t, i);
+			if (ret)
+				return ret > 0 ? 0 : ret;
+			ret = target_post_recv(t, i);
+			if (ret)
+				return ret;
+		}
+	}
+}
+
+int start_sig_target_server(struct sig_stream_conn *sc)
+{
+	struct sig_param *param = sc->param;
+	struct ibv_pd *pd = sc->pd;
+	struct target t = {};
+	unsigned int i;
+	int ret;
+
+	if (param->sw_sig) {
+		err("The block target needs signature offload\n");
+		return -EOPNOTSUPP;
+	}
+	ret = is_sig_supported(pd->context, param);
+	if (ret)
+		return ret;
+
+	t.pd = pd;
+	t.qp = sc->qp;
+	t.cq = sc->cq;
+	t.param = *param;
+	t.qd = sc->opts->window;
+	t.ref_mask = get_pi_ref_mask(param);
+
+	ret = store_open(&t, sc->opts->target_file);
+	if (ret)
+		return ret;
+
+	t.reqs = calloc(t.qd, sizeof(*t.reqs));
+	t.ios = calloc(t.qd, sizeof(*t.ios));
+	t.mkeys = calloc(t.qd, sizeof(*t.mkeys));
+	t.free_ios = calloc(t.qd, sizeof(*t.free_ios));
+	if (!t.reqs || !t.ios || !t.mkeys || !t.free_ios) {
+		err("Failed to allocate %d request slots\n", t.qd);
+		ret = ENOMEM;
+		goto out;
+	}
+
+	t.reqs_mr = ibv_reg_mr(pd, t.reqs, t.qd * sizeof(*t.reqs), IBV_ACCESS_LOCAL_WRITE);
+	if (!t.reqs_mr) {
+		perror("ibv_reg_mr");
+		ret = errno;
+		goto out;
+	}
+
+	for (i = 0; i < t.qd; i++) {
+		t.mkeys[i] = create_sig_mkey(pd, 1);
+		if (!t.mkeys[i]) {
+			ret = errno;
+			goto out;
+		}
+		t.free_ios[t.nfree++] = i;
+	}
+
+	ret = target_run(&t);
+
+out:
+	for (i = 0; t.mkeys && i < t.qd; i++)
+		if (t.mkeys[i])
+			mlx5dv_destroy_mkey(t.mkeys[i]);
+	if (t.reqs_mr)
+		ibv_dereg_mr(t.reqs_mr);
+	free(t.free_ios);
+	free(t.mkeys);
+	free(t.ios);
+	free(t.reqs);
+	store_close(&t);
+	return ret;
+}
+
+struct initiator {
+	struct ibv_qp *qp;
+	struct ibv_cq *cq;
+	struct sig_param *param;
+	unsigned long iters;	/* Per point */
+
+	unsigned int qd;
+	unsigned char *buf;	/* One I/O per tag */
+	size_t io_len;
+	struct ibv_mr *mr;
+	struct blk_rsp *rsps;	/* Receive buffers */
+	struct ibv_mr *rsps_mr;
+	uint64_t *submit_ns;	/* Per tag */
+	uint16_t *free_tags;
+	unsigned int nfree;
+	unsigned int seed;
+	uint64_t *lat;
+};
+
+static int ini_post_recv(struct initiator *ini, unsigned int i)
+{
+	struct ibv_recv_wr wr = {}, *bad_wr = NULL;
+	struct ibv_sge sge;
+	int ret;
+
+	sge.addr = (uint64_t)&ini->rsps[i];
+	sge.length = sizeof(ini->rsps[i]);
+	sge.lkey = ini->rsps_mr->lkey;
+	wr.wr_id = TARGET_WRID_RECV | i;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+
+	ret = ibv_post_recv(ini->qp, &wr, &bad_wr);
+	if (ret)
+		err("ibv_post_recv failed %d\n", ret);
+	return ret;
+}
+
+static int ini_send(struct initiator *ini, uint8_t op, uint16_t tag,
+		    uint64_t lba, uint32_t nblocks)
+{
+	struct ibv_send_wr wr = {}, *bad_wr = NULL;
+	struct blk_req req = {};
+	struct ibv_sge sge;
+	int ret;
+
+	req.opcode = op;
+	req.tag = htobe16(tag);
+	req.nblocks = htobe32(nblocks);
+	req.lba = htobe64(lba);
+	req.addr = htobe64((uint64_t)ini->buf + tag * ini->io_len);
+	req.rkey = htobe32(ini->mr->rkey);
+	sge.addr = (uint64_t)&req;
+	sge.length = sizeof(req);
+	sge.lkey = 0;
+	wr.wr_id = tag;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+	wr.opcode = IBV_WR_SEND;
+	wr.send_flags = IBV_SEND_INLINE | IBV_SEND_SIGNALED;
+
+	ret = ibv_post_send(ini->qp, &wr, &bad_wr);
+	if (ret)
+		err("ibv_post_send failed %d\n", ret);
+	return ret;
+}
+
+/* Busy-poll the next response, skipping send completions */
+static int ini_wait_rsp(struct initiator *ini, struct blk_rsp *rsp)
+{
+	struct ibv_wc wc;
+	unsigned int i;
+	int ne;
+
+	while (1) {
+		ne = ibv_poll_cq(ini->cq, 1, &wc);
+		if (ne < 0) {
+			err("ibv_poll_cq failed %d\n", ne);
+			return -1;
+		}
+		if (!ne)
+			continue;
+		if (wc.status != IBV_WC_SUCCESS) {
+			err("CQE status %d(%s), opcode %d(%s)\n",
+			    wc.status, ibv_wc_status_str(wc.status),
+			    wc.opcode, wc_opcode_str(wc.opcode));
+			return -1;
+		}
+		if (!(wc.wr_id & TARGET_WRID_RECV))
+			continue;
+
+		i = wc.wr_id & ~TARGET_WRID_RECV;
+		rsp->tag = be16toh(ini->rsps[i].tag);
+		rsp->status = be16toh(ini->rsps[i].status);
+		rsp->capacity = be64toh(ini->rsps[i].capacity);
+		return ini_post_recv(ini, i);
+	}
+}
+
+/* FORMAT or DONE, with nothing else outstanding */
+static int ini_admin(struct initiator *ini, uint8_t op, uint64_t arg, uint64_t *capacity)
+{
+	struct blk_rsp rsp;
+	int ret;
+
+	ret = ini_send(ini, op, 0, arg, 0);
+	if (ret)
+		return ret;
+	ret = ini_wait_rsp(ini, &rsp);
+	if (ret)
+		return ret;
+	if (rsp.status != BLK_STS_OK) {
+		err("Target failed request %d, status %d\n", op, rsp.status);
+		return -EIO;
+	}
+	if (capacity)
+		*capacity = rsp.capacity;
+	return 0;
+}
+
+/* ini->iters requests of @op at random LBAs, "window" of them outstanding */
+static int ini_run(struct initiator *ini, uint8_t op, unsigned int block_size,
+		   uint64_t capacity)
+{
+	unsigned long iters = ini->iters, submitted = 0, completed = 0, errors = 0;
+	uint32_t nblocks = ini->param->block_num;
+	uint64_t slots = capacity / nblocks, start, wall, total = 0;
+	struct blk_rsp rsp;
+	uint16_t tag;
+	int ret;
+
+	if (!slots) {
+		err("Target capacity %lu is less than %d blocks\n", capacity, nblocks);
+		return -EINVAL;
+	}
+
+	start = get_time_ns();
+	while (completed < iters) {
+		while (submitted < iters && ini->nfree) {
+			tag = ini->free_tags[--ini->nfree];
+			ini->submit_ns[tag] = get_time_ns();
+			ret = ini_send(ini, op, tag, (rand_r(&ini->seed) % slots) * nblocks, nblocks);
+			if (ret)
+				return ret;
+			submitted++;
+		}
+
+		ret = ini_wait_rsp(ini, &rsp);
+		if (ret)
+			return ret;
+		if (rsp.tag >= ini->qd) {
+			err("Response with unknown tag %d\n", rsp.tag);
+			return -EIO;
+		}
+		if (rsp.status != BLK_STS_OK) {
+			if (!errors)
+				err("%s failed, status %d\n", blk_op_str(op), rsp.status);
+			errors++;
+		}
+		ini->lat[completed] = get_time_ns() - ini->submit_ns[rsp.tag];
+		total += ini->lat[completed];
+		completed++;
+		ini->free_tags[ini->nfree++] = rsp.tag;
+	}
+	wall = get_time_ns() - start;
+
+	qsort(ini->lat, iters, sizeof(*ini->lat), cmp_u64);
+	info("%-5s %4d B x %d: %lu IOs, %.1f KIOPS, %.3f GB/s, lat avg %.2f us, p50 %.2f us, p99 %.2f us, p99.9 %.2f us; %lu errors\n",
+	     blk_op_str(op), block_size, nblocks, iters, iters * 1e6 / wall,
+	     (double)iters * nblocks * block_size / wall, total / 1000.0 / iters,
+	     ini->lat[iters / 2] / 1000.0, ini->lat[(uint64_t)iters * 99 / 100] / 1000.0,
+	     ini->lat[(uint64_t)iters * 999 / 1000] / 1000.0, errors);
+	return errors ? -EIO : 0;
+}
+
+int start_sig_target_client(struct sig_stream_conn *sc)
+{
+	struct sig_param *param = sc->param;
+	struct ibv_pd *pd = sc->pd;
+	static const unsigned int block_sizes[] = { 512, 4096 };
+	struct initiator ini = {};
+	uint64_t capacity;
+	unsigned int i;
+	size_t len;
+	int ret = 0;
+
+	ini.qp = sc->qp;
+	ini.cq = sc->cq;
+	ini.param = param;
+	ini.iters = sc->opts->iters;
+	ini.qd = sc->opts->window;
+	ini.seed = sc->qp_idx + 1;
+	ini.io_len = (size_t)4096 * param->block_num;
+
+	len = ini.io_len * ini.qd;
+	ini.buf = malloc(len);
+	ini.rsps = calloc(ini.qd, sizeof(*ini.rsps));
+	ini.submit_ns = calloc(ini.qd, sizeof(*ini.submit_ns));
+	ini.free_tags = calloc(ini.qd, sizeof(*ini.free_tags));
+	ini.lat = calloc(ini.iters, sizeof(*ini.lat));
+	if (!ini.buf || !ini.rsps || !ini.submit_ns || !ini.free_tags || !ini.lat) {
+		err("Failed to allocate %d I/O slots\n", ini.qd);
+		ret = ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < len; i++)
+		ini.buf[i] = i / 512;
+	for (i = 0; i < ini.qd; i++)
+		ini.free_tags[ini.nfree++] = i;
+
+	ini.mr = ibv_reg_mr(pd, ini.buf, len, IBV_ACCESS_LOCAL_WRITE |
+			    IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE);
+	ini.rsps_mr = ibv_reg_mr(pd, ini.rsps, ini.qd * sizeof(*ini.rsps),
+				 IBV_ACCESS_LOCAL_WRITE);
+	if (!ini.mr || !ini.rsps_mr) {
+		perror("ibv_reg_mr");
+		ret = errno;
+		goto out;
+	}
+
+	for (i = 0; i < ini.qd; i++) {
+		ret = ini_post_recv(&ini, i);
+		if (ret)
+			goto out;
+	}
+
+	info("Block I/O, %lu requests of %d blocks per point, queue depth %d\n",
+	     ini.iters, param->block_num, ini.qd);
+	for (i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+		/* nvmedif is set up for 4096-byte blocks only */
+		if (param->block_size && param->block_size != block_sizes[i])
+			continue;
+
+		ret = ini_admin(&ini, BLK_OP_FORMAT, block_sizes[i], &capacity);
+		if (ret)
+			goto out;
+
+		/* Written first, so that the READs return the client's data */
+		ret = ini_run(&ini, BLK_OP_WRITE, block_sizes[i], capacity);
+		if (ret)
+			goto out;
+		ret = ini_run(&ini, BLK_OP_READ, block_sizes[i], capacity);
+		if (ret)
+			goto out;
+	}
+
+	ret = ini_admin(&ini, BLK_OP_DONE, 0, NULL);
+
+out:
+	if (ini.rsps_mr)
+		ibv_dereg_mr(ini.rsps_mr);
+	if (ini.mr)
+		ibv_dereg_mr(ini.mr);
+	free(ini.lat);
+	free(ini.free_tags);
+	free(ini.submit_ns);
+	free(ini.rsps);
+	free(ini.buf);
+	return ret;
+}
@@ -4,17 +4,14 @@
  */
 
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <infiniband/mlx5dv.h>
 
+#include "pi.h"
 #include "sig_test.h"
 
-enum {
-	SIG_FLAG_WIRE = 1 << 0,
-	SIG_FLAG_MEM = 1 << 1,
-};
-
 static unsigned int sig_block_size = 512;
 static unsigned int sig_pi_size = 8;	/* For t10dif */
 static unsigned int sig_num_blocks = 1;
@@ -24,6 +21,16 @@ static unsigned char *data_buf, *pi_buf;
 
 static struct mlx5dv_mkey *sig_mkey;
 
+/*
+ * Software backend, when the device has no signature offload (e.g. rxe) or
+ * with -C: The CPU inserts the PI into sw_buf on send, and verifies and strips
+ * it from sw_buf on receive, as sig_mkey would.
+ */
+static struct ibv_mr *sw_mr;
+static unsigned char *sw_buf;
+static unsigned int sw_bad;	/* Bad blocks since the last check_sig() */
+static struct pi_error sw_err;
+
 static void dump_data_buf(void)
 {
 	unsigned char *p = data_buf;
@@ -81,7 +88,7 @@ static void dump_pi(void)
 	}
 }
 
-static int is_sig_supported(struct ibv_context *ctx, struct sig_param *param)
+int is_sig_supported(struct ibv_context *ctx, struct sig_param *param)
 {
 	struct mlx5dv_context dv_ctx = {
 		.comp_mask = MLX5DV_CONTEXT_MASK_SIGNATURE_OFFLOAD,
@@ -106,11 +113,22 @@ static int is_sig_supported(struct ibv_context *ctx, struct sig_param *param)
 	     !!(prot & MLX5DV_SIG_PROT_CAP_CRC),
 	     !!(prot & MLX5DV_SIG_PROT_CAP_NVMEDIF));
 
+	if ((param->sig_type == MLX5DV_SIG_TYPE_T10DIF && !(prot & MLX5DV_SIG_PROT_CAP_T10DIF)) ||
+	    (param->sig_type == MLX5DV_SIG_TYPE_NVMEDIF && !(prot & MLX5DV_SIG_PROT_CAP_NVMEDIF))) {
+		err("Device %s doesn't support signature type %d\n",
+		    ibv_get_device_name(ctx->device), param->sig_type);
+		return -EOPNOTSUPP;
+	}
+
 	if (param->check_copy_en_mask && !(prot & MLX5DV_SIG_PROT_CAP_NVMEDIF))
 		err("check_copy_en_mask is not supported!!!\n");
 	return 0;
 }
 
+/*
+ * Busy-polls: One operation is outstanding at a time, and a sleep between
+ * polls only adds to its latency
+ */
 static int poll_completion(struct ibv_cq *cq, enum ibv_wc_opcode expected)
 {
 	struct ibv_wc wc = {};
@@ -118,9 +136,13 @@ static int poll_completion(struct ibv_cq *cq, enum ibv_wc_opcode expected)
 
 	do {
 		ret = ibv_poll_cq(cq, 1, &wc);
-		usleep(1000 * 100);
 	} while (ret == 0);
 
+	if (ret < 0) {
+		err("ibv_poll_cq failed %d\n", ret);
+		return -1;
+	}
+
 	if (wc.status != IBV_WC_SUCCESS) {
 		err("CQE status %d(%s), opcode %d(%s), expected %s\n",
 		    wc.status, ibv_wc_status_str(wc.status),
@@ -139,13 +161,13 @@ static int poll_completion(struct ibv_cq *cq, enum ibv_wc_opcode expected)
 	return 0;
 }
 
-static struct mlx5dv_mkey *create_sig_mkey(struct ibv_pd *pd)
+struct mlx5dv_mkey *create_sig_mkey(struct ibv_pd *pd, unsigned int max_entries)
 {
 	struct mlx5dv_mkey_init_attr mkey_attr = {};
 	struct mlx5dv_mkey *mkey;
 
 	mkey_attr.pd = pd;
-	mkey_attr.max_entries = 1;
+	mkey_attr.max_entries = max_entries;
 	mkey_attr.create_flags = MLX5DV_MKEY_INIT_ATTR_FLAGS_INDIRECT |
 		MLX5DV_MKEY_INIT_ATTR_FLAGS_BLOCK_SIGNATURE;
 
@@ -157,7 +179,8 @@ static struct mlx5dv_mkey *create_sig_mkey(struct ibv_pd *pd)
 }
 
 static void set_sig_domain_t10dif(struct mlx5dv_sig_block_domain *domain,
-				  struct mlx5dv_sig_t10dif *dif)
+				  struct mlx5dv_sig_t10dif *dif,
+				  unsigned int block_size)
 {
 	memset(dif, 0, sizeof(*dif));
 	dif->bg_type = MLX5DV_SIG_T10DIF_CRC;
@@ -169,7 +192,7 @@ static void set_sig_domain_t10dif(struct mlx5dv_sig_block_domain *domain,
 	memset(domain, 0, sizeof(*domain));
 	domain->sig.dif = dif;
 	domain->sig_type = MLX5DV_SIG_TYPE_T10DIF;
-	domain->block_size = (sig_block_size == 512) ?
+	domain->block_size = (block_size == 512) ?
 		MLX5DV_BLOCK_SIZE_512 : MLX5DV_BLOCK_SIZE_4096;
 }
 
@@ -188,7 +211,7 @@ static void set_sig_domain_nvmedif(struct sig_param *param,
 
 	domain->sig_type = MLX5DV_SIG_TYPE_NVMEDIF;
 	domain->sig.nvmedif = dif;
-	domain->block_size = (sig_block_size == 512) ?
+	domain->block_size = (param->block_size == 512) ?
 		MLX5DV_BLOCK_SIZE_512 : MLX5DV_BLOCK_SIZE_4096;
 
 	dif->format = param->nvme_fmt;
@@ -204,6 +227,215 @@ static void set_sig_domain_nvmedif(struct sig_param *param,
 	dif->storage_tag_check = dif->sts;
 }
 
+/*
+ * Signature attributes of the SIG_FLAG_WIRE/SIG_FLAG_MEM domains in @mode,
+ * the same as reg_sig_mkey_t10dif()/reg_sig_mkey_nvmedif() configure
+ */
+void init_sig_attr(struct sig_param *param, int mode, struct sig_attr *a)
+{
+	memset(a, 0, sizeof(*a));
+
+	if (param->sig_type == MLX5DV_SIG_TYPE_T10DIF) {
+		if (mode & SIG_FLAG_MEM) {
+			set_sig_domain_t10dif(&a->mem, &a->mem_sig.t10dif, param->block_size);
+			a->attr.mem = &a->mem;
+		}
+		if (mode & SIG_FLAG_WIRE) {
+			set_sig_domain_t10dif(&a->wire, &a->wire_sig.t10dif, param->block_size);
+			a->attr.wire = &a->wire;
+		}
+		if (param->check_copy_en_mask)
+			a->attr.comp_mask = MLX5DV_SIG_BLOCK_COMP_MASK_CHECK_COPY_EN;
+		else
+			a->attr.check_mask = MLX5DV_SIG_MASK_T10DIF_GUARD |
+				MLX5DV_SIG_MASK_T10DIF_APPTAG | MLX5DV_SIG_MASK_T10DIF_REFTAG;
+		return;
+	}
+
+	a->attr.comp_mask = MLX5DV_SIG_BLOCK_COMP_MASK_CHECK_COPY_EN;
+	a->attr.check_copy_en.guard_check_en = 1;
+	a->attr.check_copy_en.ref_tag_check_en = 1;
+	a->attr.check_copy_en.app_tag_check_en = 1;
+	a->attr.check_copy_en.storage_tag_check_en = 1;
+	if (mode & SIG_FLAG_MEM) {
+		set_sig_domain_nvmedif(param, &a->mem, &a->mem_sig.nvmedif);
+		a->attr.mem = &a->mem;
+	}
+	if (mode & SIG_FLAG_WIRE) {
+		set_sig_domain_nvmedif(param, &a->wire, &a->wire_sig.nvmedif);
+		a->attr.wire = &a->wire;
+	}
+	if ((mode & SIG_FLAG_MEM) && (mode & SIG_FLAG_WIRE))
+		a->attr.check_copy_en.storage_tag_copy_en = 0xff;
+}
+
+/*
+ * The PI generated by an mkey of reg_sig_mkey_t10dif()/reg_sig_mkey_nvmedif();
+ * All fields are verified, whatever the mkey checks itself.
+ */
+void get_pi_domain(struct sig_param *param, struct pi_domain *pi)
+{
+	unsigned int block_size = param->block_size ? param->block_size : sig_block_size;
+	struct mlx5dv_sig_block_domain domain = {};
+	struct mlx5dv_sig_nvmedif nvmedif = {};
+	struct mlx5dv_sig_t10dif t10dif;
+
+	memset(pi, 0, sizeof(*pi));
+	pi->block_size = block_size;
+	pi->check = PI_CHECK_GUARD | PI_CHECK_APP | PI_CHECK_REF | PI_CHECK_STORAGE;
+	pi->app_tag_mask = 0xffff;
+	pi->storage_tag_mask = ~0ULL;
+
+	if (param->sig_type == MLX5DV_SIG_TYPE_T10DIF) {
+		set_sig_domain_t10dif(&domain, &t10dif, block_size);
+		pi->format = PI_FMT_T10DIF;
+		pi->bg_type = (t10dif.bg_type == MLX5DV_SIG_T10DIF_CSUM) ?
+			PI_T10DIF_CSUM : PI_T10DIF_CRC;
+		pi->seed = t10dif.bg;
+		pi->app_tag = t10dif.app_tag;
+		pi->ref_tag = t10dif.ref_tag;
+		if (t10dif.flags & MLX5DV_SIG_T10DIF_FLAG_REF_REMAP)
+			pi->flags |= PI_FLAG_REF_REMAP;
+		if (t10dif.flags & MLX5DV_SIG_T10DIF_FLAG_APP_ESCAPE)
+			pi->flags |= PI_FLAG_APP_ESCAPE;
+		if (t10dif.flags & MLX5DV_SIG_T10DIF_FLAG_APP_REF_ESCAPE)
+			pi->flags |= PI_FLAG_APP_REF_ESCAPE;
+		return;
+	}
+
+	set_sig_domain_nvmedif(param, &domain, &nvmedif);
+	if (nvmedif.format == MLX5DV_SIG_NVMEDIF_FORMAT_16)
+		pi->format = PI_FMT_NVME_16;
+	else if (nvmedif.format == MLX5DV_SIG_NVMEDIF_FORMAT_32)
+		pi->format = PI_FMT_NVME_32;
+	else
+		pi->format = PI_FMT_NVME_64;
+	pi->seed = nvmedif.seed;
+	pi->app_tag = nvmedif.app_tag;
+	pi->ref_tag = nvmedif.ref_tag;
+	pi->storage_tag = nvmedif.storage_tag;
+	pi->sts = nvmedif.sts;
+	/* No remap flag for nvmedif, the ref tag increments per block as Type 1 */
+	pi->flags = PI_FLAG_REF_REMAP;
+	if (nvmedif.flags & MLX5DV_SIG_NVMEDIF_FLAG_APP_ESCAPE)
+		pi->flags |= PI_FLAG_APP_ESCAPE;
+	if (nvmedif.flags & MLX5DV_SIG_NVMEDIF_FLAG_APP_REF_ESCAPE)
+		pi->flags |= PI_FLAG_APP_REF_ESCAPE;
+	if (nvmedif.flags & MLX5DV_SIG_NVMEDIF_FLAG_APP_REF_STORAGE_ESCAPE)
+		pi->flags |= PI_FLAG_APP_REF_STORAGE_ESCAPE;
+}
+
+/* Size in bits of the ref tag, i.e. storage+ref without the storage tag */
+unsigned int get_pi_ref_bits(struct sig_param *param)
+{
+	if (param->sig_type != MLX5DV_SIG_TYPE_NVMEDIF)
+		return 32;
+	if (param->nvme_fmt == MLX5DV_SIG_NVMEDIF_FORMAT_16)
+		return 32 - param->sts;
+	return (param->nvme_fmt == MLX5DV_SIG_NVMEDIF_FORMAT_32 ? 80 : 48) - param->sts;
+}
+
+/* Of the ref tag the mkeys and pi.c increment per block */
+uint64_t get_pi_ref_mask(struct sig_param *param)
+{
+	unsigned int bits = get_pi_ref_bits(param);
+
+	return bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+}
+
+uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Verify the PI of all received blocks in software */
+static int sw_verify_pi(struct sig_param *param, const unsigned char *data,
+			size_t data_stride, const unsigned char *pi, size_t pi_stride)
+{
+	struct pi_domain dom;
+	struct pi_error e = {};
+	unsigned int bad;
+
+	get_pi_domain(param, &dom);
+	if (pi_size(&dom) != sig_pi_size || pi_check_domain(&dom)) {
+		err("SW PI verify skipped: pi size %d, expected %d\n", sig_pi_size, pi_size(&dom));
+		return 0;
+	}
+
+	bad = pi_verify(&dom, data, data_stride, pi, pi_stride, sig_num_blocks, &e);
+	if (!bad) {
+		info("SW PI verify: %d blocks OK\n", sig_num_blocks);
+		return 0;
+	}
+
+	err("SW PI verify: %d of %d blocks bad, first block %d: %s expected 0x%lx, actual 0x%lx, offset %lu\n",
+	    bad, sig_num_blocks, e.block, pi_check_str(e.type),
+	    e.expected, e.actual, e.offset);
+	return -EIO;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Send side of a WIRE mkey: The blocks of data_buf with their PI appended, into sw_buf */
+static void sw_insert_pi(struct sig_param *param)
+{
+	unsigned int stride = sig_block_size + sig_pi_size;
+	struct pi_domain dom;
+	uint64_t start;
+	int i;
+
+	get_pi_domain(param, &dom);
+	start = now_ns();
+	for (i = 0; i < sig_num_blocks; i++)
+		memcpy(sw_buf + stride * i, data_buf + sig_block_size * i, sig_block_size);
+	pi_generate(&dom, sw_buf, stride, sw_buf + sig_block_size, stride, sig_num_blocks);
+	info("SW PI insert: %d blocks, %lu ns\n", sig_num_blocks, now_ns() - start);
+}
+
+/*
+ * Receive side of a MEM|WIRE mkey: Check the PI in sw_buf, then split it to
+ * data_buf and pi_buf; Errors are kept for check_sig() as the mkey keeps them.
+ */
+static void sw_strip_pi(struct sig_param *param)
+{
+	unsigned int stride = sig_block_size + sig_pi_size;
+	struct pi_domain dom;
+	struct pi_error e = {};
+	unsigned int bad;
+	uint64_t start;
+	int i;
+
+	get_pi_domain(param, &dom);
+	start = now_ns();
+	bad = pi_verify(&dom, sw_buf, stride, sw_buf + sig_block_size, stride,
+			sig_num_blocks, &e);
+	for (i = 0; i < sig_num_blocks; i++) {
+		memcpy(data_buf + sig_block_size * i, sw_buf + stride * i, sig_block_size);
+		memcpy(pi_buf + sig_pi_size * i, sw_buf + stride * i + sig_block_size, sig_pi_size);
+	}
+	info("SW PI verify and strip: %d blocks, %lu ns\n", sig_num_blocks, now_ns() - start);
+
+	if (bad && !sw_bad)
+		sw_err = e;
+	sw_bad += bad;
+}
+
 static int config_sig_mkey(struct ibv_qp *qp, struct mlx5dv_mkey *mkey,
 			   struct mlx5dv_sig_block_attr *sig_attr, int mode)
 {
@@ -268,12 +500,12 @@ static int reg_sig_mkey_t10dif(struct ibv_qp *qp, struct ibv_cq *cq,
 
 	if (mode & SIG_FLAG_MEM) {
 		sig_attr.mem = &dmem;
-		set_sig_domain_t10dif(&dmem, &mem_t10dif);
+		set_sig_domain_t10dif(&dmem, &mem_t10dif, sig_block_size);
 		info("t10dif/mem: ref_tag 0x%x, app_tag 0x%x\n", mem_t10dif.ref_tag, mem_t10dif.app_tag);
 	}
 	if (mode & SIG_FLAG_WIRE) {
 		sig_attr.wire = &dwire;
-		set_sig_domain_t10dif(&dwire, &wire_t10dif);
+		set_sig_domain_t10dif(&dwire, &wire_t10dif, sig_block_size);
 		info("t10dif/wire: ref_tag 0x%x, app_tag 0x%x\n", wire_t10dif.ref_tag, wire_t10dif.app_tag);
 	}
 
@@ -345,6 +577,23 @@ static int reg_sig_mkey_nvmedif(struct ibv_qp *qp, struct ibv_cq *cq,
 	return 0;
 }
 
+/* Make sig_mkey, or the software backend, insert/check the PI of the @mode domains */
+static int reg_sig(struct ibv_qp *qp, struct ibv_cq *cq, int mode,
+		   struct sig_param *param)
+{
+	if (sw_buf) {
+		info("Software signature, PI is handled by the CPU\n");
+		return 0;
+	}
+
+	if (param->sig_type == MLX5DV_SIG_TYPE_T10DIF)
+		return reg_sig_mkey_t10dif(qp, cq, sig_mkey, mode, param);
+	else if (param->sig_type == MLX5DV_SIG_TYPE_NVMEDIF)
+		return reg_sig_mkey_nvmedif(qp, cq, sig_mkey, mode, param);
+
+	return -EOPNOTSUPP;
+}
+
 #if 0
 static int inv_sig_mkey(struct ibv_qp *qp, struct ibv_cq *cq,
 			struct mlx5dv_mkey *mkey)
@@ -435,7 +684,36 @@ static void dealloc_mr(void)
 	}
 }
 
-static int create_sig_res(struct ibv_pd *pd)
+static int create_sw_res(struct ibv_pd *pd, struct sig_param *param)
+{
+	ssize_t len = (sig_block_size + sig_pi_size) * sig_num_blocks;
+	struct pi_domain dom;
+
+	get_pi_domain(param, &dom);
+	if (pi_size(&dom) != sig_pi_size || pi_check_domain(&dom)) {
+		err("Software signature: pi size %d, expected %d\n", sig_pi_size, pi_size(&dom));
+		return EINVAL;
+	}
+
+	sw_buf = malloc(len);
+	if (!sw_buf) {
+		perror("malloc sw");
+		return errno;
+	}
+
+	sw_mr = ibv_reg_mr(pd, sw_buf, len, IBV_ACCESS_LOCAL_WRITE);
+	if (!sw_mr) {
+		perror("ibv_reg_mr sw");
+		free(sw_buf);
+		sw_buf = NULL;
+		return errno;
+	}
+
+	sw_bad = 0;
+	return 0;
+}
+
+static int create_sig_res(struct ibv_pd *pd, struct sig_param *param)
 {
 	int ret;
 
@@ -443,7 +721,16 @@ static int create_sig_res(struct ibv_pd *pd)
 	if (ret)
 		return ret;
 
-	sig_mkey = create_sig_mkey(pd);
+	if (param->sw_sig) {
+		ret = create_sw_res(pd, param);
+		if (ret)
+			goto fail_create_sig_mkey;
+		info("Sig res created (software).\n\n");
+		return 0;
+	}
+
+	/* One SGE, or data and PI interleaved */
+	sig_mkey = create_sig_mkey(pd, 2);
 	if (!sig_mkey) {
 		ret = errno;
 		goto fail_create_sig_mkey;
@@ -460,12 +747,22 @@ fail_create_sig_mkey:
 
 static void destroy_sig_res(void)
 {
-	mlx5dv_destroy_mkey(sig_mkey);
+	if (sig_mkey) {
+		mlx5dv_destroy_mkey(sig_mkey);
+		sig_mkey = NULL;
+	}
+	if (sw_mr) {
+		ibv_dereg_mr(sw_mr);
+		free(sw_buf);
+		sw_mr = NULL;
+		sw_buf = NULL;
+	}
 	dealloc_mr();
 }
 
+/* Into @sig_mkey, or @mr if it's NULL */
 static int do_recv(struct ibv_qp *qp, struct ibv_cq *cq,
-		   struct mlx5dv_mkey *sig_mkey)
+		   struct mlx5dv_mkey *sig_mkey, struct ibv_mr *mr)
 {
 	struct ibv_recv_wr wr = {}, *bad_wr = NULL;
 	struct ibv_sge sge = {};
@@ -477,9 +774,9 @@ static int do_recv(struct ibv_qp *qp, struct ibv_cq *cq,
 		sge.length = (sig_block_size + sig_pi_size) * sig_num_blocks;
 		sge.lkey = sig_mkey->lkey;
 	} else {
-		sge.addr = (uint64_t)data_buf;
-		sge.length = data_mr->length;
-		sge.lkey = data_mr->lkey;
+		sge.addr = (uint64_t)mr->addr;
+		sge.length = mr->length;
+		sge.lkey = mr->lkey;
 	}
 
 	wr.wr_id = wr_id++;
@@ -555,15 +852,57 @@ static int check_sig_mkey(struct mlx5dv_mkey *mkey)
 	return 0;
 }
 
+/* Same report as check_sig_mkey(), for the errors found by sw_strip_pi() */
+static int check_sw_sig(void)
+{
+	const char *sig_err_str;
+
+	if (!sw_bad) {
+		info("SIG status: OK\n");
+		return 0;
+	}
+
+	switch (sw_err.type) {
+	case PI_CHECK_REF:
+		sig_err_str = "REF_TAG";
+		break;
+	case PI_CHECK_APP:
+		sig_err_str = "APP_TAG";
+		break;
+	case PI_CHECK_GUARD:
+		sig_err_str = "BLOCK_GUARD";
+		break;
+	default:
+		sig_err_str = "STORAGE_TAG";
+		break;
+	}
+
+	err("SIG ERROR: %s: expected 0x%lx, actual 0x%lx, offset %lu\n",
+	    sig_err_str, sw_err.expected, sw_err.actual, sw_err.offset);
+	sw_bad = 0;
+	return 0;
+}
+
+static int check_sig(void)
+{
+	if (sw_buf)
+		return check_sw_sig();
+	if (sig_mkey)
+		return check_sig_mkey(sig_mkey);
+	return 0;
+}
+
 int start_sig_test_server(struct ibv_pd *pd, struct ibv_qp *qp,
 			  struct ibv_cq *cq, struct sig_param *param)
 {
 	ssize_t recv_len;
-	int ret;
+	int ret, pi_ret = 0;
 
-	ret = is_sig_supported(pd->context, param);
-	if (ret)
-		return ret;
+	if (!param->sw_sig) {
+		ret = is_sig_supported(pd->context, param);
+		if (ret)
+			return ret;
+	}
 
 	if (param->block_num)
 		sig_num_blocks = param->block_num;
@@ -576,14 +915,14 @@ int start_sig_test_server(struct ibv_pd *pd, struct ibv_qp *qp,
 
 	recv_len = (sig_block_size + sig_pi_size) * sig_num_blocks;
 
-	ret = create_sig_res(pd);
+	ret = create_sig_res(pd, param);
 	if (ret)
 		return ret;
 
 	init_buf(data_buf, recv_len, 0);
 	init_buf(pi_buf, sig_pi_size * sig_num_blocks, 0);
 	info("Receving data without mkey...\n");
-	ret = do_recv(qp, cq, NULL);
+	ret = do_recv(qp, cq, NULL, data_mr);
 	if (ret)
 		goto out;
 	dump_data_buf();
@@ -591,39 +930,42 @@ int start_sig_test_server(struct ibv_pd *pd, struct ibv_qp *qp,
 
 	init_buf(data_buf, recv_len, 0);
 	info("Receving data (sent with mkey enabled)...\n");
-	ret = do_recv(qp, cq, NULL);
+	ret = do_recv(qp, cq, NULL, data_mr);
 	if (ret)
 		goto out;
 	dump_data_buf_with_pi();
+	pi_ret = sw_verify_pi(param, data_buf, sig_block_size + sig_pi_size,
+			      data_buf + sig_block_size, sig_block_size + sig_pi_size);
 	info("Done\n\n");
 
 	info("Register sig mkey...\n");
-	if (param->sig_type == MLX5DV_SIG_TYPE_T10DIF)
-		ret = reg_sig_mkey_t10dif(qp, cq, sig_mkey,
-					  SIG_FLAG_MEM | SIG_FLAG_WIRE, param);
-	else if (param->sig_type == MLX5DV_SIG_TYPE_NVMEDIF)
-		ret = reg_sig_mkey_nvmedif(qp, cq, sig_mkey,
-					   SIG_FLAG_MEM | SIG_FLAG_WIRE, param);
-	else
-		ret = -EOPNOTSUPP;
+	ret = reg_sig(qp, cq, SIG_FLAG_MEM | SIG_FLAG_WIRE, param);
 	if (ret)
 		goto out;
 
 	init_buf(data_buf, recv_len, 0);
 	info("Receving data 2nd time (sent with mkey enabled)...\n");
-	ret = do_recv(qp, cq, sig_mkey);
-	if (ret)
-		goto out;
+	if (sw_buf) {
+		ret = do_recv(qp, cq, NULL, sw_mr);
+		if (ret)
+			goto out;
+		sw_strip_pi(param);
+	} else {
+		ret = do_recv(qp, cq, sig_mkey, NULL);
+		if (ret)
+			goto out;
+	}
 
 	dump_data_buf();
 	dump_pi();
+	if (sw_verify_pi(param, data_buf, sig_block_size, pi_buf, sig_pi_size))
+		pi_ret = -EIO;
 	info("Done\n\n");
 
 out:
-	if (sig_mkey)
-		check_sig_mkey(sig_mkey);
+	check_sig();
 	destroy_sig_res();
-	return ret;
+	return ret ? ret : pi_ret;
 }
 
 /* Client sends the same data with mkey twice; In the server side:
@@ -631,7 +973,7 @@ out:
  * - Second time: Receives clear data (with mkey configured and pi striped)
  */
 static int do_send(struct ibv_qp *qp, struct ibv_cq *cq, ssize_t data_len,
-		   struct mlx5dv_mkey *sig_mkey)
+		   struct mlx5dv_mkey *sig_mkey, struct ibv_mr *mr)
 {
 	struct ibv_send_wr wr = {}, *bad_wr = NULL;
 	struct ibv_sge sge = {};
@@ -643,9 +985,9 @@ static int do_send(struct ibv_qp *qp, struct ibv_cq *cq, ssize_t data_len,
 		sge.length = data_len + sig_pi_size * sig_num_blocks;
 		sge.lkey = sig_mkey->lkey;
 	} else {
-		sge.addr = (uint64_t)data_buf;
+		sge.addr = (uint64_t)mr->addr;
 		sge.length = data_len;
-		sge.lkey = data_mr->lkey;
+		sge.lkey = mr->lkey;
 	}
 
 	wr.wr_id = wr_id++;
@@ -665,15 +1007,28 @@ static int do_send(struct ibv_qp *qp, struct ibv_cq *cq, ssize_t data_len,
 	return ret;
 }
 
+/* @data_len bytes of data_buf with the PI inserted by sig_mkey, or by the CPU */
+static int send_with_pi(struct ibv_qp *qp, struct ibv_cq *cq, ssize_t data_len,
+			struct sig_param *param)
+{
+	if (!sw_buf)
+		return do_send(qp, cq, data_len, sig_mkey, NULL);
+
+	sw_insert_pi(param);
+	return do_send(qp, cq, data_len + sig_pi_size * sig_num_blocks, NULL, sw_mr);
+}
+
 int start_sig_test_client(struct ibv_pd *pd, struct ibv_qp *qp,
 			  struct ibv_cq *cq, struct sig_param *param)
 {
 	ssize_t send_len;
 	int ret;
 
-	ret = is_sig_supported(pd->context, param);
-	if (ret)
-		return ret;
+	if (!param->sw_sig) {
+		ret = is_sig_supported(pd->context, param);
+		if (ret)
+			return ret;
+	}
 
 	if (param->block_num)
 		sig_num_blocks = param->block_num;
@@ -686,7 +1041,7 @@ int start_sig_test_client(struct ibv_pd *pd, struct ibv_qp *qp,
 
 	send_len = sig_block_size * sig_num_blocks;
 
-	ret = create_sig_res(pd);
+	ret = create_sig_res(pd, param);
 	if (ret)
 		return ret;
 
@@ -694,25 +1049,20 @@ int start_sig_test_client(struct ibv_pd *pd, struct ibv_qp *qp,
 
 	usleep(1000*500);
 	info("Send data (%ld bytes) without mkey...\n", send_len);
-	ret = do_send(qp, cq, send_len, NULL);
+	ret = do_send(qp, cq, send_len, NULL, data_mr);
 	if (ret)
 		goto out;
 	info ("Done\n\n");
 
 	info("Register sig mkey (WIRE)...\n");
-	if (param->sig_type == MLX5DV_SIG_TYPE_T10DIF)
-		ret = reg_sig_mkey_t10dif(qp, cq, sig_mkey, SIG_FLAG_WIRE, param);
-	else if (param->sig_type == MLX5DV_SIG_TYPE_NVMEDIF)
-		ret = reg_sig_mkey_nvmedif(qp, cq, sig_mkey, SIG_FLAG_WIRE, param);
-	else
-		ret = -EOPNOTSUPP;
+	ret = reg_sig(qp, cq, SIG_FLAG_WIRE, param);
 	if (ret)
 		goto out;
 	info("Done\n\n");
 
 	usleep(1000 * 500);
 	info("Send data (%ld bytes) with mkey (server receives without mkey)...\n", send_len);
-	ret = do_send(qp, cq, send_len, sig_mkey);
+	ret = send_with_pi(qp, cq, send_len, param);
 	if (ret)
 		goto out;
 #if 0
@@ -722,7 +1072,7 @@ int start_sig_test_client(struct ibv_pd *pd, struct ibv_qp *qp,
 #endif
 	info ("Done\n\n");
 
-	ret = check_sig_mkey(sig_mkey);
+	ret = check_sig();
 	if (ret < 0)
 		goto out;
 
@@ -730,14 +1080,13 @@ int start_sig_test_client(struct ibv_pd *pd, struct ibv_qp *qp,
 
 	usleep(1000 * 500);
 	info("Send data (%ld bytes) with mkey (server receives *with* mkey)...\n", send_len);
-	ret = do_send(qp, cq, send_len, sig_mkey);
+	ret = send_with_pi(qp, cq, send_len, param);
 	if (ret)
 		goto out;
 	info ("Done\n\n");
 
 out:
-	if (sig_mkey)
-		check_sig_mkey(sig_mkey);
+	check_sig();
 
 	destroy_sig_res();
 	return ret;
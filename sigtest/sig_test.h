@@ -7,6 +7,32 @@
 #define info(args...) fprintf(stdout, ##args)
 #define dbg(args...) fprintf(stdout, ##args)
 
+enum {
+	SIG_FLAG_WIRE = 1 << 0,
+	SIG_FLAG_MEM = 1 << 1,
+};
+
+enum sig_op {
+	SIG_OP_SEND,
+	SIG_OP_WRITE,
+	SIG_OP_READ,
+};
+
+/* Advertised by the server in the rdma_cm private data, big-endian */
+struct sig_remote_buf {
+	uint64_t addr;
+	uint32_t rkey;
+	uint32_t slot_len;
+	uint32_t nslots;
+} __attribute__((packed));
+
+/* Totals of a streaming phase, for the multi-QP summary */
+struct sig_stream_result {
+	uint64_t msgs;
+	uint64_t bytes;
+	uint64_t start_ns, end_ns;
+};
+
 struct sig_param {
 	enum mlx5dv_sig_type sig_type;
 
@@ -17,6 +43,49 @@ struct sig_param {
 
 	enum mlx5dv_sig_nvmedif_format nvme_fmt;
 	unsigned int sts;	/* Storage tag size, for nvmedif only */
+	bool sw_sig;		/* PI by the CPU (pi.c) instead of sig mkeys */
+};
+
+/* Options of the streaming benchmark (sig_stream.c) and the block target (sig_target.c) */
+struct sig_stream_opts {
+	bool stream;
+	unsigned int window;	/* Outstanding messages */
+	unsigned long iters;	/* Messages per phase */
+	unsigned int pool_size;	/* mkeys reconfigured per message, 0 - off */
+	unsigned int max_entries;	/* Of the mkeys, > 1 for the fragment sweep */
+	unsigned int inject_rate;	/* Corrupt one message in n, 0 - off */
+	uint32_t inject_field;		/* PI_CHECK_* to corrupt, 0 - all */
+	enum sig_op op;
+	int domains;		/* SIG_FLAG_*, for WRITE/READ */
+
+	bool target;
+	const char *target_file;	/* Server only */
+};
+
+/* One per connection, set up by main.c, the state of a streaming or target run */
+struct sig_stream_conn {
+	struct ibv_pd *pd;
+	struct ibv_qp *qp;
+	struct ibv_cq *cq;
+	struct ibv_comp_channel *channel;	/* Of @cq, server of WRITE/READ only */
+	struct sig_param *param;
+	const struct sig_stream_opts *opts;
+
+	unsigned int num_qps;
+	unsigned int qp_idx;
+	struct sig_remote_buf remote;		/* Client of WRITE/READ */
+	struct sig_stream_result result[2];	/* PI off, PI on */
+	unsigned char *expose_buf;		/* Server of WRITE/READ */
+	struct ibv_mr *expose_mr;
+};
+
+struct sig_attr {
+	struct mlx5dv_sig_block_attr attr;
+	struct mlx5dv_sig_block_domain wire, mem;
+	union {
+		struct mlx5dv_sig_t10dif t10dif;
+		struct mlx5dv_sig_nvmedif nvmedif;
+	} wire_sig, mem_sig;
 };
 
 static inline const char *wc_opcode_str(enum ibv_wc_opcode opcode)
@@ -54,6 +123,21 @@ int start_sig_test_server(struct ibv_pd *pd, struct ibv_qp *qp,
 			  struct ibv_cq *cq, struct sig_param *param);
 int start_sig_test_client(struct ibv_pd *pd, struct ibv_qp *qp,
 			  struct ibv_cq *cq, struct sig_param *param);
+int start_sig_stream_server(struct sig_stream_conn *sc);
+int start_sig_stream_client(struct sig_stream_conn *sc);
+int start_sig_target_server(struct sig_stream_conn *sc);
+int start_sig_target_client(struct sig_stream_conn *sc);
+
+int is_sig_supported(struct ibv_context *ctx, struct sig_param *param);
+struct mlx5dv_mkey *create_sig_mkey(struct ibv_pd *pd, unsigned int max_entries);
+void init_sig_attr(struct sig_param *param, int mode, struct sig_attr *a);
+struct pi_domain;
+void get_pi_domain(struct sig_param *param, struct pi_domain *pi);
+unsigned int get_pi_ref_bits(struct sig_param *param);
+uint64_t get_pi_ref_mask(struct sig_param *param);
+uint64_t get_time_ns(void);
+int cmp_u64(const void *a, const void *b);
+int sig_stream_expose(struct sig_stream_conn *sc, struct sig_remote_buf *rb);
 
 
 int verify_sts(enum mlx5dv_sig_nvmedif_format nvme_fmt, unsigned int sts);